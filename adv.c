@@ -0,0 +1,1709 @@
+/**
+  * @brief advertisement of inbound preferences to RDE controllers
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adv.h"
+#include "arena.h"
+#include "pace.h"
+#include "proto.h"
+#include "revdns.h"
+#include "uring.h"
+
+/* states of a connection to a controller */
+#define DOWN 0
+#define CONNECTING 1
+#define UP 2
+
+/* lists a peer may be on, see peer_settle() */
+#define NOLIST 0
+#define IDLELIST 1
+#define BACKOFFLIST 2
+
+/* bounds of the delay (in us) before reconnecting to a failed controller */
+#define BACKOFF_MIN 250000l
+#define BACKOFF_MAX 32000000l
+
+/* max number of queued messages written to a connection at once */
+#define MAXIOV 16
+
+/* advertisements to several controllers race connections to up to RACEMAX
+ * of them, starting the next attempt every RACEDELAY us (RFC 8305) or as
+ * soon as the previous attempt fails */
+#define RACEMAX 3
+#define RACEDELAY 250000l
+
+/* max number of controllers looked at in a list of candidates */
+#define MAXCAND 8
+
+/* max size of a message advertisements get merged into, when connections
+ * are not pooled */
+#define JOINMAX 65536
+
+/* connection attempts are paced per controller: the window of every
+ * controller starts at CTLWINDOW attempts at once, and peers that have to
+ * wait for it try again every PACEDELAY us. the windows of CTLSLOTS
+ * controllers are remembered. */
+#define CTLWINDOW 4
+#define PACEDELAY 5000l
+#define CTLSLOTS 1024
+
+/* number of lists of controllers whose fastest member is remembered */
+#define PREFSLOTS 1024
+
+/* size of the io_uring submission queue, if any */
+#define RINGENTRIES 256
+
+struct advreq {
+  struct advreq *prev;   /* advertisements in progress are kept in a list, */
+  struct advreq *next;   /* sorted by deadline (oldest first)              */
+  struct advreq *qnext;  /* next advertisement queued on the same peer, or merged into the same one */
+  struct advreq *riders; /* advertisements merged into this one, see req_join() */
+  struct advpeer *peer;  /* the connection the advertisement goes through */
+  rppadv_cb cb;
+  void *priv;
+  long start;            /* time (us) of submission, then latency once done */
+  long deadline;         /* time (us) after which the advertisement fails */
+  struct rppmsg *msg;    /* the message to send */
+  int status;            /* if non-zero, the advertisement failed already */
+  int err;
+  struct advreq *rprev;  /* advertisements racing controllers are kept in a */
+  struct advreq *rnext;  /* list, sorted by time of their next attempt     */
+  long racenext;         /* time (us) of the next connection attempt */
+  unsigned long prefhash; /* hash of the list of controllers */
+  int ncand;             /* how many controllers may be raced */
+  int nrace;             /* how many of them were tried so far */
+  int rstatus;           /* status and errno of the last failed attempt */
+  int rerr;
+  struct sockaddr_storage cand[RACEMAX];  /* controllers, the preferred first */
+  struct advpeer *race[RACEMAX];     /* attempts in progress, NULL once over */
+};
+
+struct advpeer {
+  struct advpeer *prev;  /* idle or backoff list */
+  struct advpeer *next;
+  struct advpeer *hnext; /* hash chain of pooled connections */
+  struct sockaddr_storage addr; /* IPv4 or IPv6 address of the controller */
+  int sock;
+  int state;             /* DOWN, CONNECTING or UP */
+  int list;              /* NOLIST, IDLELIST or BACKOFFLIST */
+  unsigned int events;   /* epoll events the socket is watched for */
+  long idle;             /* time (us) the peer went idle */
+  long retry;            /* time (us) of the next connection attempt */
+  long backoff;          /* current reconnection delay (us), 0 after a success */
+  int status;            /* status and errno of the last failure, if any */
+  int err;
+  struct advreq *qhead;  /* advertisements queued on the connection, the */
+  struct advreq *qtail;  /* head one being sent                          */
+  int sent;              /* how much of the head message has been sent already */
+  int racers;            /* how many racing advertisements wait for the connection */
+  struct advop *op;      /* connection attempt or write in flight through io_uring, if any */
+  struct advctl *ctl;    /* the window the connection attempt counts in, if any */
+  long connstart;        /* time (us) the connection attempt started */
+  int paced;             /* set while waiting in the backoff list for a window or a token */
+};
+
+/* an operation in flight through io_uring: a connection attempt along with
+ * its linked timeout, or a write. it holds the messages it writes, which
+ * may outlive their advertisements, and gets detached from its peer if the
+ * connection is closed meanwhile */
+struct advop {
+  struct advop *prev;    /* operations in flight */
+  struct advop *next;
+  struct advpeer *peer;  /* NULL once detached */
+  int connect;           /* set for a connection attempt, else a write */
+  struct sockaddr_storage addr;
+  struct __kernel_timespec timeout;
+  struct msghdr mh;
+  struct iovec iov[MAXIOV];
+  struct rppmsg *msgs[MAXIOV];
+  int nmsgs;
+};
+
+/* the congestion window of the connection attempts to a controller - the
+ * controllers that hash to the same slot evict each other */
+struct advctl {
+  struct sockaddr_storage addr;
+  int used;              /* set once the slot holds a controller */
+  struct rppwindow win;
+};
+
+/* the controller of a list that won the last race */
+struct advpref {
+  unsigned long hash;    /* hash of the list */
+  struct sockaddr_storage addr;
+};
+
+struct rppmsg {
+  int refs;              /* the message is freed once no one refers to it, updated atomically */
+  int len;
+  char *data;            /* stored right after the structure */
+  struct rppmsg *text;   /* the text message a binary one encodes, NULL for text messages */
+};
+
+struct rppadv {
+  int epfd;
+  int maxconns;
+  int maxpeers;
+  int active;
+  long timeout;              /* in us */
+  long keepalive;            /* in us, 0 if connections are not pooled */
+  struct advreq *reqs;
+  struct advreq *freereqs;   /* linked through the 'next' field */
+  struct advreq *head;       /* advertisements in progress, oldest first */
+  struct advreq *tail;
+  struct advreq *done;       /* completed advertisements, see req_flush() */
+  struct advpeer *peers;
+  struct advpeer *freepeers; /* linked through the 'next' field */
+  struct advpeer *idle;      /* idle peers, least recently used first */
+  struct advpeer *idletail;
+  struct advpeer *backoff;   /* peers waiting to reconnect, soonest first */
+  struct advpeer **hash;     /* peers by address, maxconns buckets */
+  struct advreq *racing;     /* advertisements racing controllers, soonest attempt first */
+  struct advreq *racetail;
+  struct advpref *prefs;     /* fastest controllers, PREFSLOTS of them */
+  struct advctl *ctls;       /* windows of the controllers, CTLSLOTS of them */
+  struct rpprate rate;       /* cap of the connection attempts */
+  struct rppstats *stats;    /* what connections go through, if accounted */
+  struct rppdelta *delta;    /* what controllers know already, if advertising incrementally */
+  struct rppuring *ring;     /* connections and writes go through io_uring, if not NULL */
+  struct advop *ops;         /* operations in flight through io_uring */
+  struct rpparena *arena;    /* memory of the operations, recycled through opslab */
+  struct rppslab opslab;
+};
+
+
+/* returns a monotonic time in us */
+static long ustime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+}
+
+/* encodes a SETINPREF message out of lists that are not nul-terminated */
+static struct rppmsg *msg_new(int ttl, const char *locpreflist, size_t loclen, const char *preflist, size_t preflen) {
+  struct rppmsg *msg;
+  char hdr[32];
+  size_t hdrlen;
+
+  hdrlen = sprintf(hdr, "SETINPREF %d\t", ttl);
+  msg = malloc(sizeof(*msg) + hdrlen + loclen + preflen + 3);
+  if (msg == NULL) return(NULL);
+  msg->refs = 1;
+  msg->len = hdrlen + loclen + preflen + 3;
+  msg->data = (char *)(msg + 1);
+  msg->text = NULL;
+
+  /* SETINPREF ttl<TAB>locpreflist<TAB>preflist<CR><LF> */
+  memcpy(msg->data, hdr, hdrlen);
+  memcpy(msg->data + hdrlen, locpreflist, loclen);
+  msg->data[hdrlen + loclen] = '\t';
+  memcpy(msg->data + hdrlen + loclen + 1, preflist, preflen);
+  memcpy(msg->data + msg->len - 2, "\r\n", 2);
+  return(msg);
+}
+
+
+/* finds the TTL and the lists a SETINPREF message was encoded from
+ * @return 0 on success, non-zero if msg is not a SETINPREF message */
+static int msg_fields(const struct rppmsg *msg, long *ttl, const char **loc, size_t *loclen, const char **pref, size_t *preflen) {
+  const char *end;
+  char *num;
+  if (msg->text != NULL) msg = msg->text;
+  end = msg->data + msg->len - 2;
+  if ((msg->len < 14) || (memcmp(msg->data, "SETINPREF ", 10) != 0)) return(-1);
+  *ttl = strtol(msg->data + 10, &num, 10);
+  if (*num != '\t') return(-1);
+  *loc = num + 1;
+  *pref = memchr(*loc, '\t', end - *loc);
+  if (*pref == NULL) return(-1);
+  *loclen = *pref - *loc;
+  (*pref)++;
+  *preflen = end - *pref;
+  return(0);
+}
+
+
+struct rppmsg *rppmsg_setinpref(int ttl, const char *locpreflist, const char *preflist) {
+  return(msg_new(ttl, locpreflist, strlen(locpreflist), preflist, strlen(preflist)));
+}
+
+
+struct rppmsg *rppmsg_setinpref_lists(int ttl, struct rpplist *loc, struct rpplist *pref) {
+  struct rppmsg *msg;
+  char hdr[32];
+  size_t hdrlen;
+  long loclen, preflen;
+
+  if ((loc->len > INT_MAX / 2) || (pref->len > INT_MAX / 2)) {
+    errno = EFBIG;
+    return(NULL);
+  }
+  hdrlen = sprintf(hdr, "SETINPREF %d\t", ttl);
+  msg = malloc(sizeof(*msg) + hdrlen + loc->len + pref->len + 3);
+  if (msg == NULL) return(NULL);
+  msg->refs = 1;
+  msg->data = (char *)(msg + 1);
+  msg->text = NULL;
+
+  /* the lists are validated while they get copied, they never shrink */
+  memcpy(msg->data, hdr, hdrlen);
+  loclen = rpplist_copy(msg->data + hdrlen, loc, RPPLIST_PREFIXES);
+  preflen = (loclen < 0) ? -1 : rpplist_copy(msg->data + hdrlen + loclen + 1, pref, RPPLIST_PREFS);
+  if (preflen < 0) {
+    free(msg);
+    errno = EINVAL;
+    return(NULL);
+  }
+  msg->data[hdrlen + loclen] = '\t';
+  msg->len = hdrlen + loclen + preflen + 3;
+  memcpy(msg->data + msg->len - 2, "\r\n", 2);
+  return(msg);
+}
+
+
+/* returns the next blank-separated entry of a list, or NULL at its end -
+ * *s is moved past it */
+static const char *nextentry(const char **s, const char *end, size_t *len) {
+  const char *entry;
+  while ((*s < end) && ((**s == ' ') || (**s == '\t'))) (*s)++;
+  if (*s == end) return(NULL);
+  entry = *s;
+  while ((*s < end) && (**s != ' ') && (**s != '\t')) (*s)++;
+  *len = *s - entry;
+  return(entry);
+}
+
+
+/* writes the 32-bit value v to p, in network byte order */
+static void put32(unsigned char *p, unsigned long v) {
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+
+/* encodes a list of local prefixes in binary, see rppmsg_binary() - or only
+ * measures it if out is NULL
+ * @return the length of the encoding, or -1 if an entry cannot be encoded */
+static long bin_prefixes(const char *s, size_t len, unsigned char *out) {
+  const char *end = s + len, *entry;
+  unsigned long count = 0;
+  long pos = 4;
+  while ((entry = nextentry(&s, end, &len)) != NULL) {
+    struct rppprefix pfx;
+    int addrlen;
+    if (rppproto_prefix(&pfx, entry, len) != 0) return(-1);
+    addrlen = (pfx.len + 7) >> 3;
+    if (out != NULL) {
+      out[pos] = (pfx.family == AF_INET6) ? 6 : 4;
+      out[pos + 1] = pfx.len;
+      memcpy(out + pos + 2, pfx.addr, addrlen);
+    }
+    pos += 2 + addrlen;
+    count++;
+  }
+  if (out != NULL) put32(out, count);
+  return(pos);
+}
+
+
+/* encodes a preflist in binary, see rppmsg_binary() - or only measures it
+ * if out is NULL
+ * @return the length of the encoding, or -1 if an entry cannot be encoded */
+static long bin_prefs(const char *s, size_t len, unsigned char *out) {
+  const char *end = s + len, *entry;
+  unsigned long count = 0;
+  long pos = 4;
+  while ((entry = nextentry(&s, end, &len)) != NULL) {
+    unsigned long asn;
+    int weight;
+    if (rppproto_pref(&asn, &weight, entry, len) != 0) return(-1);
+    if (out != NULL) {
+      put32(out + pos, asn);
+      out[pos + 4] = weight;
+    }
+    pos += 5;
+    count++;
+  }
+  if (out != NULL) put32(out, count);
+  return(pos);
+}
+
+
+struct rppmsg *rppmsg_binary(struct rppmsg *msg) {
+  const char *loc, *pref;
+  size_t loclen, preflen;
+  long ttl, locsz, prefsz;
+  struct rppmsg *bin;
+  unsigned char *p;
+
+  if (msg->text != NULL) return(rppmsg_ref(msg));
+  if (msg_fields(msg, &ttl, &loc, &loclen, &pref, &preflen) != 0) return(NULL);
+  locsz = bin_prefixes(loc, loclen, NULL);
+  prefsz = bin_prefs(pref, preflen, NULL);
+  if ((ttl < 0) || (locsz < 0) || (prefsz < 0) || (locsz + prefsz > INT_MAX / 2)) return(NULL);
+  bin = malloc(sizeof(*bin) + RPP_BINHDRSZ + 4 + locsz + prefsz);
+  if (bin == NULL) return(NULL);
+  bin->refs = 1;
+  bin->len = RPP_BINHDRSZ + 4 + locsz + prefsz;
+  bin->data = (char *)(bin + 1);
+  bin->text = rppmsg_ref(msg);
+
+  /* NUL, version, command, reserved, payload length, then the payload */
+  p = (unsigned char *)(bin->data);
+  p[0] = 0;
+  p[1] = RPP_BINVERSION;
+  p[2] = RPP_BINSETINPREF;
+  p[3] = 0;
+  put32(p + 4, bin->len - RPP_BINHDRSZ);
+  put32(p + RPP_BINHDRSZ, ttl);
+  bin_prefixes(loc, loclen, p + RPP_BINHDRSZ + 4);
+  bin_prefs(pref, preflen, p + RPP_BINHDRSZ + 4 + locsz);
+  return(bin);
+}
+
+
+struct rppmsg *rppmsg_ref(struct rppmsg *msg) {
+  __atomic_add_fetch(&(msg->refs), 1, __ATOMIC_RELAXED);
+  return(msg);
+}
+
+
+void rppmsg_free(struct rppmsg *msg) {
+  if (msg == NULL) return;
+  if (__atomic_sub_fetch(&(msg->refs), 1, __ATOMIC_ACQ_REL) != 0) return;
+  rppmsg_free(msg->text);
+  free(msg);
+}
+
+
+
+struct rppadv *rppadv_new(int maxconns, int timeout, int keepalive, struct rppdelta *delta) {
+  struct rppadv *ctx;
+  int i;
+
+  if ((maxconns < 1) || (timeout < 1) || (keepalive < 0)) return(NULL);
+  ctx = calloc(1, sizeof(*ctx));
+  if (ctx == NULL) return(NULL);
+  ctx->maxconns = maxconns;
+  ctx->maxpeers = maxconns * RACEMAX; /* races take a few connections each */
+  ctx->timeout = timeout * 1000l;
+  ctx->keepalive = keepalive * 1000l;
+  ctx->delta = delta;
+  ctx->reqs = calloc(maxconns, sizeof(*(ctx->reqs)));
+  ctx->peers = calloc(ctx->maxpeers, sizeof(*(ctx->peers)));
+  ctx->hash = calloc(maxconns, sizeof(*(ctx->hash)));
+  ctx->prefs = calloc(PREFSLOTS, sizeof(*(ctx->prefs)));
+  ctx->ctls = calloc(CTLSLOTS, sizeof(*(ctx->ctls)));
+  rpprate_init(&(ctx->rate), 0, 1000000, ustime());
+  ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if ((ctx->reqs == NULL) || (ctx->peers == NULL) || (ctx->hash == NULL) || (ctx->prefs == NULL) || (ctx->ctls == NULL) || (ctx->epfd < 0)) {
+    rppadv_free(ctx);
+    return(NULL);
+  }
+  for (i = 0; i < maxconns; i++) {
+    ctx->reqs[i].next = ctx->freereqs;
+    ctx->freereqs = &(ctx->reqs[i]);
+  }
+  for (i = 0; i < ctx->maxpeers; i++) {
+    ctx->peers[i].sock = -1;
+    ctx->peers[i].next = ctx->freepeers;
+    ctx->freepeers = &(ctx->peers[i]);
+  }
+  return(ctx);
+}
+
+
+/* unlinks advertisement a from the list of advertisements in progress */
+static void req_unlink(struct rppadv *ctx, struct advreq *a) {
+  if (a->prev != NULL) {
+    a->prev->next = a->next;
+  } else {
+    ctx->head = a->next;
+  }
+  if (a->next != NULL) {
+    a->next->prev = a->prev;
+  } else {
+    ctx->tail = a->prev;
+  }
+  a->prev = NULL;
+  a->next = NULL;
+}
+
+
+/* (re)arms the deadline of advertisement a, moving it to the end of the list */
+static void req_arm(struct rppadv *ctx, struct advreq *a, long now) {
+  a->deadline = now + ctx->timeout;
+  a->prev = ctx->tail;
+  a->next = NULL;
+  if (ctx->tail != NULL) {
+    ctx->tail->next = a;
+  } else {
+    ctx->head = a;
+  }
+  ctx->tail = a;
+}
+
+
+/* completes advertisement a, which must not be queued on a peer anymore: it
+ * is queued for its callback to be called by req_flush() - callbacks are
+ * deferred so that slots are never recycled while events are still being
+ * processed */
+static void req_done(struct rppadv *ctx, struct advreq *a, int status, int err, long now) {
+  const char *loc, *pref;
+  size_t loclen, preflen;
+  long ttl;
+
+  /* the advertisements merged into this one share its fate */
+  while (a->riders != NULL) {
+    struct advreq *r = a->riders;
+    a->riders = r->qnext;
+    r->qnext = NULL;
+    req_done(ctx, r, status, err, now);
+  }
+  /* the controller now knows what it was sent */
+  if ((status == 0) && (ctx->delta != NULL) && (a->msg != NULL) && (msg_fields(a->msg, &ttl, &loc, &loclen, &pref, &preflen) == 0)) {
+    rppdelta_commit(ctx->delta, (struct sockaddr *)&(a->peer->addr), loc, loclen, pref, preflen, time(NULL), ttl);
+  }
+  if ((a->prev != NULL) || (ctx->head == a)) req_unlink(ctx, a);
+  rppmsg_free(a->msg);
+  a->msg = NULL;
+  a->peer = NULL;
+  a->status = status;
+  a->err = err;
+  a->start = now - a->start; /* latency */
+  a->next = ctx->done;
+  ctx->done = a;
+}
+
+
+/* releases completed advertisements and calls their callbacks */
+static void req_flush(struct rppadv *ctx) {
+  while (ctx->done != NULL) {
+    struct advreq *a = ctx->done;
+    ctx->done = a->next;
+    a->next = ctx->freereqs;
+    ctx->freereqs = a;
+    ctx->active--;
+    a->cb(a->priv, a->status, a->err, a->start);
+  }
+}
+
+
+/* makes advertisement a fail as soon as rppadv_run() gets called, by moving
+ * it to the head of the list with an expired deadline */
+static void req_fail(struct rppadv *ctx, struct advreq *a, int status, int err) {
+  req_unlink(ctx, a);
+  a->status = status;
+  a->err = err;
+  a->deadline = 0;
+  a->next = ctx->head;
+  if (ctx->head != NULL) {
+    ctx->head->prev = a;
+  } else {
+    ctx->tail = a;
+  }
+  ctx->head = a;
+}
+
+
+static void race_drop(struct rppadv *ctx, struct advpeer *p);
+
+
+/* returns the length of a controller address */
+static socklen_t addr_len(const struct sockaddr_storage *addr) {
+  return((addr->ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+}
+
+
+/* returns 0 if both controller addresses are the same */
+static int addrcmp(const struct sockaddr_storage *a, const struct sockaddr_storage *b) {
+  if (a->ss_family != b->ss_family) return(-1);
+  if (a->ss_family == AF_INET) {
+    const struct sockaddr_in *a4 = (const struct sockaddr_in *)a, *b4 = (const struct sockaddr_in *)b;
+    if (a4->sin_port != b4->sin_port) return(-1);
+    return(memcmp(&(a4->sin_addr), &(b4->sin_addr), sizeof(a4->sin_addr)));
+  } else {
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a, *b6 = (const struct sockaddr_in6 *)b;
+    if ((a6->sin6_port != b6->sin6_port) || (a6->sin6_scope_id != b6->sin6_scope_id)) return(-1);
+    return(memcmp(&(a6->sin6_addr), &(b6->sin6_addr), sizeof(a6->sin6_addr)));
+  }
+}
+
+
+/* parses a numeric IPv4 or IPv6 address (possibly scoped, as in
+ * 'fe80::1%eth0') into the address of a controller
+ * @return 0 on success, non-zero otherwise */
+static int addr_parse(struct sockaddr_storage *addr, const char *s) {
+  struct addrinfo hints, *res;
+  char port[8];
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  sprintf(port, "%d", RPP_PORT);
+  if (getaddrinfo(s, port, &hints, &res) != 0) return(-1);
+  memset(addr, 0, sizeof(*addr));
+  memcpy(addr, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  return(0);
+}
+
+
+static unsigned long addr_hash(const struct sockaddr_storage *addr) {
+  unsigned long h;
+  if (addr->ss_family == AF_INET6) {
+    const unsigned char *a6 = ((const struct sockaddr_in6 *)addr)->sin6_addr.s6_addr;
+    int i;
+    /* the interface identifier varies the most */
+    for (h = 0, i = 8; i < 16; i++) h = (h << 8) ^ (h >> 24) ^ a6[i];
+  } else {
+    h = ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr);
+  }
+  return((h & 0xfffffffful) * 2654435761ul);
+}
+
+
+static unsigned int peer_hash(const struct rppadv *ctx, const struct sockaddr_storage *addr) {
+  return((unsigned int)(addr_hash(addr) % ctx->maxconns));
+}
+
+
+/* returns the window of the controller at addr, or NULL if its slot is
+ * used by another controller with connection attempts in progress */
+static struct advctl *ctl_get(struct rppadv *ctx, const struct sockaddr_storage *addr) {
+  struct advctl *c = &(ctx->ctls[addr_hash(addr) % CTLSLOTS]);
+  if (c->used && (addrcmp(&(c->addr), addr) == 0)) return(c);
+  if (c->used && (c->win.inflight > 0)) return(NULL);
+  c->used = 1;
+  c->addr = *addr;
+  rppwindow_init(&(c->win), CTLWINDOW, ctx->maxconns);
+  return(c);
+}
+
+
+/* takes the connection attempt of peer p out of the window of its
+ * controller */
+static void ctl_release(struct advpeer *p) {
+  if (p->ctl == NULL) return;
+  p->ctl->win.inflight--;
+  p->ctl = NULL;
+}
+
+
+/* removes peer p from the idle or backoff list it is on, if any */
+static void peer_unlist(struct rppadv *ctx, struct advpeer *p) {
+  if (p->list == NOLIST) return;
+  if (p->prev != NULL) {
+    p->prev->next = p->next;
+  } else if (p->list == IDLELIST) {
+    ctx->idle = p->next;
+  } else {
+    ctx->backoff = p->next;
+  }
+  if (p->next != NULL) {
+    p->next->prev = p->prev;
+  } else if (p->list == IDLELIST) {
+    ctx->idletail = p->prev;
+  }
+  p->prev = NULL;
+  p->next = NULL;
+  p->list = NOLIST;
+}
+
+
+/* closes the connection to peer p, if any - an operation in flight holds
+ * the socket until it is cancelled, the socket is then removed from the
+ * epoll set explicitly */
+static void peer_close(struct rppadv *ctx, struct advpeer *p) {
+  ctl_release(p);
+  if (p->op != NULL) {
+    struct io_uring_sqe *sqe = rppuring_sqe(ctx->ring, IORING_OP_ASYNC_CANCEL, -1, NULL);
+    if (sqe != NULL) sqe->addr = (unsigned long)p->op;
+    p->op->peer = NULL;
+    p->op = NULL;
+  }
+  if ((ctx->ring != NULL) && (p->sock >= 0) && (p->events != 0)) epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, p->sock, NULL);
+  if (p->sock >= 0) close(p->sock); /* also removes the socket from the epoll set */
+  p->sock = -1;
+  p->state = DOWN;
+  p->events = 0;
+  p->sent = 0;
+}
+
+
+/* closes and frees peer p, which must have nothing queued */
+static void peer_release(struct rppadv *ctx, struct advpeer *p) {
+  struct advpeer **pp = &(ctx->hash[peer_hash(ctx, &(p->addr))]);
+  race_drop(ctx, p);
+  peer_unlist(ctx, p);
+  peer_close(ctx, p);
+  while (*pp != p) pp = &((*pp)->hnext);
+  *pp = p->hnext;
+  p->hnext = NULL;
+  p->next = ctx->freepeers;
+  ctx->freepeers = p;
+}
+
+
+/* returns the peer to send to addr through: the pooled connection to this
+ * controller if there is one, or else a new peer - the least recently used
+ * idle connection is evicted if needed */
+static struct advpeer *peer_get(struct rppadv *ctx, const struct sockaddr_storage *addr) {
+  struct advpeer *p;
+  unsigned int h = peer_hash(ctx, addr);
+
+  if (ctx->keepalive > 0) {
+    for (p = ctx->hash[h]; p != NULL; p = p->hnext) {
+      if (addrcmp(&(p->addr), addr) == 0) return(p);
+    }
+    if ((ctx->freepeers == NULL) && (ctx->idle != NULL)) peer_release(ctx, ctx->idle);
+  }
+
+  p = ctx->freepeers;
+  if (p == NULL) return(NULL);
+  ctx->freepeers = p->next;
+  memset(p, 0, sizeof(*p));
+  p->addr = *addr;
+  p->sock = -1;
+  p->hnext = ctx->hash[h];
+  ctx->hash[h] = p;
+  return(p);
+}
+
+
+/* watches the connection to peer p for the controller closing it, and for
+ * the socket being writable as long as there is something to send */
+static void peer_watch(struct rppadv *ctx, struct advpeer *p) {
+  struct epoll_event ev;
+  unsigned int events = EPOLLIN | EPOLLRDHUP;
+  /* through io_uring, sockets are only watched once connected, and writes
+   * need no readiness */
+  if ((p->qhead != NULL) && (ctx->ring == NULL)) events |= EPOLLOUT;
+  if (events == p->events) return;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = p;
+  if (epoll_ctl(ctx->epfd, (p->events == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, p->sock, &ev) == 0) p->events = events;
+}
+
+
+/* creates an operation of peer p, in flight through io_uring */
+static struct advop *op_new(struct rppadv *ctx, struct advpeer *p) {
+  struct advop *op = rppslab_get(&(ctx->opslab));
+  if (op == NULL) return(NULL);
+  memset(op, 0, sizeof(*op));
+  op->peer = p;
+  op->next = ctx->ops;
+  if (ctx->ops != NULL) ctx->ops->prev = op;
+  ctx->ops = op;
+  p->op = op;
+  return(op);
+}
+
+
+/* frees an operation the kernel is done with */
+static void op_free(struct rppadv *ctx, struct advop *op) {
+  int i;
+  if (op->prev != NULL) {
+    op->prev->next = op->next;
+  } else {
+    ctx->ops = op->next;
+  }
+  if (op->next != NULL) op->next->prev = op->prev;
+  for (i = 0; i < op->nmsgs; i++) rppmsg_free(op->msgs[i]);
+  rppslab_put(&(ctx->opslab), op);
+}
+
+
+/* returns non-zero if operation op writes message msg */
+static int op_holds(const struct advop *op, const struct rppmsg *msg) {
+  int i;
+  for (i = 0; (op != NULL) && (i < op->nmsgs); i++) {
+    if (op->msgs[i] == msg) return(1);
+  }
+  return(0);
+}
+
+
+/* prepares the connection of peer p through io_uring, given up by the
+ * kernel itself if it takes longer than the advertisement timeout
+ * @return 0 on success, non-zero otherwise */
+static int ring_connect(struct rppadv *ctx, struct advpeer *p) {
+  struct io_uring_sqe *sqe;
+  struct advop *op;
+
+  if (rppuring_reserve(ctx->ring, 2) != 0) return(-1);
+  op = op_new(ctx, p);
+  if (op == NULL) return(-1);
+  op->connect = 1;
+  op->addr = p->addr;
+  op->timeout.tv_sec = ctx->timeout / 1000000;
+  op->timeout.tv_nsec = (ctx->timeout % 1000000) * 1000;
+  sqe = rppuring_sqe(ctx->ring, IORING_OP_CONNECT, p->sock, op);
+  sqe->addr = (unsigned long)&(op->addr);
+  sqe->off = addr_len(&(op->addr));
+  sqe->flags = IOSQE_IO_LINK;
+  sqe = rppuring_sqe(ctx->ring, IORING_OP_LINK_TIMEOUT, -1, NULL);
+  sqe->addr = (unsigned long)&(op->timeout);
+  sqe->len = 1;
+  return(0);
+}
+
+
+/* prepares the write of the messages queued on peer p through io_uring,
+ * the same way peer_send() writes them
+ * @return 0 on success, non-zero otherwise */
+static int ring_send(struct rppadv *ctx, struct advpeer *p) {
+  struct io_uring_sqe *sqe;
+  struct advreq *a;
+  struct advop *op;
+
+  if (rppuring_reserve(ctx->ring, 1) != 0) return(-1);
+  op = op_new(ctx, p);
+  if (op == NULL) return(-1);
+  for (a = p->qhead; (a != NULL) && (op->nmsgs < MAXIOV); a = a->qnext) {
+    op->msgs[op->nmsgs] = rppmsg_ref(a->msg);
+    op->iov[op->nmsgs].iov_base = a->msg->data;
+    op->iov[op->nmsgs++].iov_len = a->msg->len;
+  }
+  op->iov[0].iov_base = (char *)op->iov[0].iov_base + p->sent;
+  op->iov[0].iov_len -= p->sent;
+  op->mh.msg_iov = op->iov;
+  op->mh.msg_iovlen = op->nmsgs;
+  sqe = rppuring_sqe(ctx->ring, IORING_OP_SENDMSG, p->sock, op);
+  sqe->addr = (unsigned long)&(op->mh);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  return(0);
+}
+
+
+static void peer_fail(struct rppadv *ctx, struct advpeer *p, int status, int err, long now);
+
+
+/* inserts (unlisted) peer p in the backoff list, sorted by time of retry */
+static void backoff_insert(struct rppadv *ctx, struct advpeer *p) {
+  struct advpeer **pp, *prev = NULL;
+  for (pp = &(ctx->backoff); (*pp != NULL) && ((*pp)->retry <= p->retry); pp = &((*pp)->next)) prev = *pp;
+  p->list = BACKOFFLIST;
+  p->prev = prev;
+  p->next = *pp;
+  if (*pp != NULL) (*pp)->prev = p;
+  *pp = p;
+}
+
+
+/* paces the connection attempts: at most a window of them at once to every
+ * controller, and no more than the rate cap overall. a peer that has to
+ * wait is filed in the backoff list, until it may try again.
+ * @return non-zero if (unlisted) peer p has to wait */
+static int peer_pace(struct rppadv *ctx, struct advpeer *p, long now) {
+  struct advctl *c = ctl_get(ctx, &(p->addr));
+  long wait = rpprate_wait(&(ctx->rate), now);
+  if ((c != NULL) && rppwindow_full(&(c->win)) && (wait < PACEDELAY)) wait = PACEDELAY;
+  if (wait > 0) {
+    p->retry = now + wait;
+    p->paced = 1;
+    backoff_insert(ctx, p);
+    return(1);
+  }
+  rpprate_take(&(ctx->rate), now);
+  p->paced = 0;
+  p->connstart = now;
+  p->ctl = c;
+  if (c != NULL) c->win.inflight++;
+  return(0);
+}
+
+
+/* starts connecting to (unlisted) peer p, once its pace allows -
+ * completion is signaled by the socket being writable, or by io_uring */
+static void peer_connect(struct rppadv *ctx, struct advpeer *p, long now) {
+  struct epoll_event ev;
+
+  if (peer_pace(ctx, p, now) != 0) return;
+  p->sock = socket(p->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+  if (p->sock < 0) {
+    peer_fail(ctx, p, -1, errno, now);
+    return;
+  }
+  p->state = CONNECTING;
+  if (ctx->ring != NULL) {
+    if (ring_connect(ctx, p) != 0) peer_fail(ctx, p, -1, ENOBUFS, now);
+    return;
+  }
+  p->events = EPOLLOUT;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLOUT;
+  ev.data.ptr = p;
+  if ((connect(p->sock, (struct sockaddr *)&(p->addr), addr_len(&(p->addr))) != 0) && (errno != EINPROGRESS)) {
+    peer_fail(ctx, p, -2, errno, now);
+  } else if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, p->sock, &ev) != 0) {
+    peer_fail(ctx, p, -1, errno, now);
+  }
+}
+
+
+/* files peer p according to its state: peers with nothing to send become
+ * idle (or are released right away if connections are not pooled), and
+ * disconnected peers with something to send are connected, unless they are
+ * being backed off */
+static void peer_settle(struct rppadv *ctx, struct advpeer *p, long now) {
+  peer_unlist(ctx, p);
+  if (p->qhead == NULL) {
+    if (ctx->keepalive == 0) {
+      peer_release(ctx, p);
+      return;
+    }
+    p->idle = now;
+    p->list = IDLELIST;
+    p->prev = ctx->idletail;
+    if (ctx->idletail != NULL) {
+      ctx->idletail->next = p;
+    } else {
+      ctx->idle = p;
+    }
+    ctx->idletail = p;
+  } else if (p->state == DOWN) {
+    if (p->retry <= now) {
+      peer_connect(ctx, p, now);
+      return;
+    }
+    backoff_insert(ctx, p);
+  }
+}
+
+
+/* handles the failure of the connection to peer p: without pooling, the
+ * advertisements queued on it fail right away. otherwise they stay queued
+ * (the one being sent is sent again from its start) until the controller is
+ * reconnected, after a delay that doubles with every consecutive failure */
+static void peer_fail(struct rppadv *ctx, struct advpeer *p, int status, int err, long now) {
+  /* a connection attempt that times out is a sign of congestion */
+  if ((p->ctl != NULL) && (p->state == CONNECTING) && (err == ETIMEDOUT)) rppwindow_cut(&(p->ctl->win), p->connstart, now);
+  if ((ctx->stats != NULL) && (p->state == CONNECTING)) ctx->stats->connfails++;
+  peer_close(ctx, p);
+  p->paced = 0;
+  p->status = status;
+  p->err = err;
+  race_drop(ctx, p);
+  if (ctx->keepalive == 0) {
+    while (p->qhead != NULL) {
+      struct advreq *a = p->qhead;
+      p->qhead = a->qnext;
+      req_done(ctx, a, status, err, now);
+    }
+    p->qtail = NULL;
+  } else {
+    p->backoff = (p->backoff == 0) ? BACKOFF_MIN : p->backoff * 2;
+    if (p->backoff > BACKOFF_MAX) p->backoff = BACKOFF_MAX;
+    p->retry = now + p->backoff;
+  }
+  peer_settle(ctx, p, now);
+}
+
+
+/* accounts for len bytes written to peer p: the advertisements whose
+ * message is entirely written complete, what is left is the part of the
+ * next message that got written */
+static void peer_written(struct rppadv *ctx, struct advpeer *p, long len, long now) {
+  struct advreq *a;
+  len += p->sent;
+  while ((p->qhead != NULL) && (len >= p->qhead->msg->len)) {
+    a = p->qhead;
+    len -= a->msg->len;
+    p->qhead = a->qnext;
+    req_done(ctx, a, 0, 0, now);
+    if (p->qhead != NULL) {
+      /* the send deadline of the next message starts now */
+      req_unlink(ctx, p->qhead);
+      req_arm(ctx, p->qhead, now);
+    }
+  }
+  p->sent = len;
+}
+
+
+/* writes as many queued messages as the socket accepts, several at once -
+ * an advertisement completes as soon as its message is written. through
+ * io_uring, a single write is in flight at a time and gets whatever was
+ * queued meanwhile once it completes. */
+static void peer_send(struct rppadv *ctx, struct advpeer *p, long now) {
+  struct iovec iov[MAXIOV];
+  struct msghdr mh;
+  struct advreq *a;
+  ssize_t len;
+  int n;
+
+  if ((ctx->ring != NULL) && (p->op == NULL) && (p->qhead != NULL) && (ring_send(ctx, p) != 0)) {
+    peer_fail(ctx, p, -3, ENOBUFS, now);
+    return;
+  }
+  while ((ctx->ring == NULL) && (p->qhead != NULL)) {
+    for (n = 0, a = p->qhead; (a != NULL) && (n < MAXIOV); n++, a = a->qnext) {
+      iov[n].iov_base = a->msg->data;
+      iov[n].iov_len = a->msg->len;
+    }
+    iov[0].iov_base = p->qhead->msg->data + p->sent;
+    iov[0].iov_len -= p->sent;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = n;
+    len = sendmsg(p->sock, &mh, MSG_NOSIGNAL);
+    if (len < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+      if (errno == EINTR) continue;
+      peer_fail(ctx, p, -3, errno, now);
+      return;
+    }
+
+    peer_written(ctx, p, len, now);
+  }
+
+  if (p->qhead == NULL) p->qtail = NULL;
+  if ((p->qhead != NULL) || (ctx->keepalive > 0)) peer_watch(ctx, p);
+  if (p->qhead == NULL) peer_settle(ctx, p, now);
+}
+
+
+/* drains whatever the controller sends, and handles it closing the
+ * connection: a message being sent is then considered failed, while the
+ * messages still queued are sent over a new connection */
+static void peer_read(struct rppadv *ctx, struct advpeer *p, long now) {
+  char buf[512];
+  ssize_t len;
+  int err = ECONNRESET;
+
+  for (;;) {
+    len = recv(p->sock, buf, sizeof(buf), 0);
+    if (len > 0) continue;
+    if (len == 0) break;
+    if (errno == EINTR) continue;
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+    err = errno;
+    break;
+  }
+  if ((len < 0) || (p->sent > 0)) {
+    peer_fail(ctx, p, -3, err, now);
+    return;
+  }
+  peer_close(ctx, p);
+  if (p->qhead != NULL) peer_connect(ctx, p, now);
+}
+
+
+/* removes advertisement a from the queue of peer p
+ * @return non-zero if its message was partially sent already */
+static int peer_dequeue(struct advpeer *p, struct advreq *a) {
+  struct advreq **pa, *prev = NULL;
+  int partial = 0;
+
+  if (a == p->qhead) {
+    partial = (p->sent > 0);
+    p->sent = 0;
+  }
+  for (pa = &(p->qhead); *pa != a; pa = &((*pa)->qnext)) prev = *pa;
+  *pa = a->qnext;
+  if (p->qtail == a) p->qtail = prev;
+  a->qnext = NULL;
+  return(partial);
+}
+
+
+/* trims the message of advertisement a down to the local prefixes the
+ * controller of its peer does not know about, when advertising incrementally
+ * @return non-zero if the controller knows about all of them already */
+static int req_delta(struct rppadv *ctx, struct advreq *a) {
+  const char *loc, *pref;
+  size_t loclen, preflen, len;
+  struct rppmsg *msg;
+  char *buf;
+  long ttl;
+  int skipped;
+
+  if ((ctx->delta == NULL) || (msg_fields(a->msg, &ttl, &loc, &loclen, &pref, &preflen) != 0)) return(0);
+  buf = malloc(loclen + 1);
+  if (buf == NULL) return(0);
+  skipped = rppdelta_filter(ctx->delta, (struct sockaddr *)&(a->peer->addr), loc, loclen, pref, preflen, time(NULL), buf, &len);
+  if ((skipped > 0) && (len > 0)) {
+    msg = msg_new(ttl, buf, len, pref, preflen);
+    /* the trimmed message keeps the encoding of the original one */
+    if ((msg != NULL) && (a->msg->text != NULL)) {
+      struct rppmsg *bin = rppmsg_binary(msg);
+      rppmsg_free(msg);
+      msg = bin;
+    }
+    if (msg != NULL) {
+      rppmsg_free(a->msg);
+      a->msg = msg;
+    }
+  }
+  free(buf);
+  return((skipped > 0) && (len == 0));
+}
+
+
+/* queues advertisement a on peer p - it is actually sent from within
+ * rppadv_run(), along with whatever else gets queued on the same connection
+ * meanwhile */
+static void peer_enqueue(struct rppadv *ctx, struct advpeer *p, struct advreq *a, long now) {
+  a->peer = p;
+  if (req_delta(ctx, a) != 0) {
+    /* nothing to send, a disconnected peer may be of no use anymore */
+    req_done(ctx, a, 1, 0, now);
+    if ((p->qhead == NULL) && (p->state == DOWN)) peer_settle(ctx, p, now);
+    return;
+  }
+  if (p->qtail != NULL) {
+    p->qtail->qnext = a;
+  } else {
+    p->qhead = a;
+  }
+  p->qtail = a;
+  if (p->state == DOWN) {
+    peer_settle(ctx, p, now);
+  } else {
+    peer_unlist(ctx, p);
+    if ((p->state == UP) && (ctx->ring != NULL)) {
+      peer_send(ctx, p, now);
+    } else if (p->state == UP) {
+      peer_watch(ctx, p);
+    }
+  }
+}
+
+
+/* without pooling, merges advertisement a into the one queued on a
+ * connection to its controller that is not up yet, if both have the same
+ * TTL, preferences and encoding: a single SETINPREF then carries the local
+ * prefixes of both over a single connection, and a shares the fate (and
+ * the deadline) of the advertisement it is merged into. other local
+ * prefixes are only merged when advertising incrementally, the controllers
+ * then applying SETINPREF to the prefixes it lists only
+ * @return 0 if a got merged, or completed because the controller knows
+ * about all of it already */
+static int req_join(struct rppadv *ctx, struct advreq *a, long now) {
+  const char *loc, *pref, *aloc, *apref;
+  size_t loclen, preflen, aloclen, apreflen, len;
+  long ttl, attl;
+  struct advpeer *p;
+  struct advreq *lead;
+  struct rppmsg *msg;
+  char *buf;
+
+  for (p = ctx->hash[peer_hash(ctx, &(a->cand[0]))]; p != NULL; p = p->hnext) {
+    if ((p->state != UP) && (p->qhead != NULL) && (p->racers == 0) && (addrcmp(&(p->addr), &(a->cand[0])) == 0)) break;
+  }
+  if (p == NULL) return(-1);
+  lead = p->qhead;
+  if ((lead->status != 0) || ((lead->msg->text != NULL) != (a->msg->text != NULL))) return(-1);
+  if ((msg_fields(lead->msg, &ttl, &loc, &loclen, &pref, &preflen) != 0) || (msg_fields(a->msg, &attl, &aloc, &aloclen, &apref, &apreflen) != 0)) return(-1);
+  if ((ttl != attl) || (preflen != apreflen) || (memcmp(pref, apref, preflen) != 0)) return(-1);
+  if ((ctx->delta == NULL) && ((aloclen != loclen) || (memcmp(aloc, loc, loclen) != 0))) return(-1);
+
+  a->peer = p;
+  if (req_delta(ctx, a) != 0) {
+    req_done(ctx, a, 1, 0, now);
+    return(0);
+  }
+  (void)msg_fields(a->msg, &attl, &aloc, &aloclen, &apref, &apreflen);
+  if ((aloclen == loclen) && (memcmp(aloc, loc, loclen) == 0)) {
+    /* the very same message, as when advertising the same local prefixes
+     * for several remote ones: it is sent once */
+    msg = rppmsg_ref(lead->msg);
+  } else if (lead->msg->len + a->msg->len > JOINMAX) {
+    a->peer = NULL;
+    return(-1);
+  } else if ((buf = malloc(loclen + aloclen + 1)) == NULL) {
+    msg = NULL;
+  } else {
+    memcpy(buf, loc, loclen);
+    len = loclen;
+    if ((loclen > 0) && (aloclen > 0)) buf[len++] = ' ';
+    memcpy(buf + len, aloc, aloclen);
+    msg = msg_new(ttl, buf, len + aloclen, pref, preflen);
+    free(buf);
+  }
+  if ((msg != NULL) && (msg != lead->msg) && (lead->msg->text != NULL)) {
+    struct rppmsg *bin = rppmsg_binary(msg);
+    rppmsg_free(msg);
+    msg = bin;
+  }
+  if (msg == NULL) {
+    a->peer = NULL;
+    return(-1);
+  }
+  rppmsg_free(lead->msg);
+  lead->msg = msg;
+  rppmsg_free(a->msg);
+  a->msg = NULL;
+  req_unlink(ctx, a);
+  a->qnext = lead->riders;
+  lead->riders = a;
+  return(0);
+}
+
+
+/* removes advertisement a from the list of racing advertisements, if it is
+ * on it */
+static void race_unlink(struct rppadv *ctx, struct advreq *a) {
+  if ((a->rprev == NULL) && (ctx->racing != a)) return;
+  if (a->rprev != NULL) {
+    a->rprev->rnext = a->rnext;
+  } else {
+    ctx->racing = a->rnext;
+  }
+  if (a->rnext != NULL) {
+    a->rnext->rprev = a->rprev;
+  } else {
+    ctx->racetail = a->rprev;
+  }
+  a->rprev = NULL;
+  a->rnext = NULL;
+}
+
+
+/* schedules the next connection attempt of racing advertisement a - all
+ * attempts being RACEDELAY apart, the list stays sorted */
+static void race_arm(struct rppadv *ctx, struct advreq *a, long now) {
+  race_unlink(ctx, a);
+  a->racenext = now + RACEDELAY;
+  a->rprev = ctx->racetail;
+  if (ctx->racetail != NULL) {
+    ctx->racetail->rnext = a;
+  } else {
+    ctx->racing = a;
+  }
+  ctx->racetail = a;
+}
+
+
+/* returns the attempt of racing advertisement a that goes through peer p,
+ * -1 if none does */
+static int race_find(const struct advreq *a, const struct advpeer *p) {
+  int i;
+  for (i = 0; i < a->nrace; i++) {
+    if (a->race[i] == p) return(i);
+  }
+  return(-1);
+}
+
+
+/* ends the race of advertisement a: the attempts that lost are given up,
+ * unless something else waits for their connection */
+static void race_end(struct rppadv *ctx, struct advreq *a, const struct advpeer *winner) {
+  int i;
+  race_unlink(ctx, a);
+  for (i = 0; i < a->nrace; i++) {
+    struct advpeer *p = a->race[i];
+    if (p == NULL) continue;
+    a->race[i] = NULL;
+    p->racers--;
+    if ((p != winner) && (p->racers == 0) && (p->qhead == NULL) && ((p->state == CONNECTING) || (p->paced != 0))) peer_release(ctx, p);
+  }
+}
+
+
+/* advertisement a won its race through peer p: remember the controller as
+ * the fastest of its list, and send the message through it */
+static void race_win(struct rppadv *ctx, struct advreq *a, struct advpeer *p, long now) {
+  struct advpref *pref = &(ctx->prefs[a->prefhash % PREFSLOTS]);
+  race_end(ctx, a, p);
+  pref->hash = a->prefhash;
+  pref->addr = p->addr;
+  peer_enqueue(ctx, p, a, now);
+}
+
+
+/* the connection to peer p is up: it wins the races waiting for it */
+static void race_connected(struct rppadv *ctx, struct advpeer *p, long now) {
+  while (p->racers > 0) {
+    struct advreq *a;
+    for (a = ctx->racing; (a != NULL) && (race_find(a, p) < 0); a = a->rnext);
+    if (a == NULL) break;
+    race_win(ctx, a, p, now);
+  }
+}
+
+
+/* the connection to peer p failed or is closed: the races waiting for it
+ * go on with their other attempts, or start the next one right away */
+static void race_drop(struct rppadv *ctx, struct advpeer *p) {
+  while (p->racers > 0) {
+    struct advreq *a;
+    int i;
+    for (a = ctx->racing; (a != NULL) && ((i = race_find(a, p)) < 0); a = a->rnext);
+    if (a == NULL) break;
+    a->race[i] = NULL;
+    p->racers--;
+    a->rstatus = (p->status != 0) ? p->status : -2;
+    a->rerr = (p->err != 0) ? p->err : ECONNABORTED;
+    for (i = 0; (i < a->nrace) && (a->race[i] == NULL); i++);
+    if (i < a->nrace) continue;
+    /* no attempt left in progress: move to the head of the list */
+    race_unlink(ctx, a);
+    a->racenext = 0;
+    a->rnext = ctx->racing;
+    if (ctx->racing != NULL) {
+      ctx->racing->rprev = a;
+    } else {
+      ctx->racetail = a;
+    }
+    ctx->racing = a;
+  }
+}
+
+
+/* starts the next connection attempt of racing advertisement a - pooled
+ * connections that are up win right away, and controllers being backed off
+ * are skipped. the advertisement fails once no attempt is left. */
+static void race_next(struct rppadv *ctx, struct advreq *a, long now) {
+  struct advpeer *p;
+  int i;
+
+  while (a->nrace < a->ncand) {
+    i = a->nrace++;
+    p = peer_get(ctx, &(a->cand[i]));
+    if (p == NULL) {
+      if (a->rstatus == 0) {
+        a->rstatus = -1;
+        a->rerr = ENOBUFS;
+      }
+      continue;
+    }
+    if (p->state == UP) {
+      race_win(ctx, a, p, now);
+      return;
+    }
+    if ((p->state == DOWN) && (p->retry > now) && (p->paced == 0)) {
+      a->rstatus = p->status;
+      a->rerr = p->err;
+      continue;
+    }
+    a->race[i] = p;
+    p->racers++;
+    race_arm(ctx, a, now);
+    if (p->state == DOWN) {
+      peer_unlist(ctx, p);
+      peer_connect(ctx, p, now);
+    }
+    return;
+  }
+
+  /* no controller left to try: wait for the attempts in progress, if any */
+  for (i = 0; (i < a->nrace) && (a->race[i] == NULL); i++);
+  if (i < a->nrace) {
+    race_arm(ctx, a, now);
+    return;
+  }
+  race_end(ctx, a, NULL);
+  req_fail(ctx, a, (a->rstatus != 0) ? a->rstatus : -2, (a->rerr != 0) ? a->rerr : EHOSTUNREACH);
+}
+
+
+/* fills the controllers of advertisement a out of a comma-separated list of
+ * addresses: the one that won the last race of the same list comes first,
+ * then the others in the order of the list
+ * @return the number of controllers */
+static int cand_parse(struct rppadv *ctx, struct advreq *a, const char *list) {
+  struct sockaddr_storage cand[MAXCAND];
+  const struct advpref *pref;
+  const char *s;
+  char buf[64];
+  size_t len;
+  int i, count = 0, first = 0;
+
+  a->prefhash = 2166136261ul; /* FNV-1a */
+  for (s = list; *s != 0; s++) a->prefhash = (a->prefhash ^ (unsigned char)*s) * 16777619ul;
+  pref = &(ctx->prefs[a->prefhash % PREFSLOTS]);
+
+  for (s = list; count < MAXCAND; s++) {
+    len = strcspn(s, ",");
+    if (len < sizeof(buf)) {
+      memcpy(buf, s, len);
+      buf[len] = 0;
+      if (addr_parse(&(cand[count]), buf) == 0) {
+        if ((pref->hash == a->prefhash) && (addrcmp(&(pref->addr), &(cand[count])) == 0)) first = count;
+        count++;
+      }
+    }
+    s += len;
+    if (*s == 0) break;
+  }
+
+  a->ncand = 0;
+  if (count > 0) a->cand[a->ncand++] = cand[first];
+  for (i = 0; (i < count) && (a->ncand < RACEMAX); i++) {
+    if (i != first) a->cand[a->ncand++] = cand[i];
+  }
+  return(a->ncand);
+}
+
+
+int rppadv_submit(struct rppadv *ctx, const char *rdeaddr, struct rppmsg *msg, rppadv_cb cb, void *priv) {
+  struct advreq *a;
+  struct advpeer *p;
+  long now = ustime();
+
+  a = ctx->freereqs;
+  if (a == NULL) return(-1);
+  ctx->freereqs = a->next;
+  ctx->active++;
+  a->msg = rppmsg_ref(msg);
+  a->cb = cb;
+  a->priv = priv;
+  a->start = now;
+  a->status = 0;
+  a->err = 0;
+  a->peer = NULL;
+  a->qnext = NULL;
+  a->riders = NULL;
+  a->nrace = 0;
+  a->rstatus = 0;
+  a->rerr = 0;
+  req_arm(ctx, a, now);
+
+  if (cand_parse(ctx, a, rdeaddr) == 0) {
+    req_fail(ctx, a, -2, EINVAL);
+    return(0);
+  }
+
+  /* several controllers are raced, a single one is simply queued on */
+  if (a->ncand > 1) {
+    race_next(ctx, a, now);
+    return(0);
+  }
+  if ((ctx->keepalive == 0) && (req_join(ctx, a, now) == 0)) return(0);
+  p = peer_get(ctx, &(a->cand[0]));
+  if (p == NULL) {
+    req_fail(ctx, a, -1, ENOBUFS);
+    return(0);
+  }
+  peer_enqueue(ctx, p, a, now);
+  return(0);
+}
+
+
+/* completes all advertisements that failed or passed their deadline, closes
+ * connections idle for too long and reconnects peers done backing off */
+static void adv_expire(struct rppadv *ctx, long now) {
+  while ((ctx->racing != NULL) && (ctx->racing->racenext <= now)) {
+    race_next(ctx, ctx->racing, now);
+  }
+
+  while ((ctx->head != NULL) && (ctx->head->deadline <= now)) {
+    struct advreq *a = ctx->head;
+    struct advpeer *p = a->peer;
+    int status, err, partial;
+
+    if (a->status != 0) {
+      req_done(ctx, a, a->status, a->err, now);
+      continue;
+    }
+    if (p == NULL) { /* still racing */
+      race_end(ctx, a, NULL);
+      req_done(ctx, a, (a->rstatus != 0) ? a->rstatus : -2, (a->rerr != 0) ? a->rerr : ETIMEDOUT, now);
+      continue;
+    }
+    if (p->state == UP) {
+      status = -3;
+    } else {
+      status = (p->status != 0) ? p->status : -2;
+    }
+    if ((p->ctl != NULL) && (p->state == CONNECTING)) rppwindow_cut(&(p->ctl->win), p->connstart, now);
+    err = (p->err != 0) ? p->err : ETIMEDOUT;
+    /* a write in flight may be in the middle of the message, too */
+    partial = op_holds(p->op, a->msg);
+    partial |= peer_dequeue(p, a);
+    req_done(ctx, a, status, err, now);
+    if (partial) {
+      /* the connection is left in the middle of a message */
+      peer_fail(ctx, p, -3, ETIMEDOUT, now);
+    } else if (p->qhead == NULL) {
+      /* a connection attempt nothing waits for anymore is given up */
+      if ((ctx->stats != NULL) && (p->state == CONNECTING)) ctx->stats->connfails++;
+      peer_settle(ctx, p, now);
+    }
+  }
+
+  while ((ctx->idle != NULL) && (ctx->idle->idle + ctx->keepalive <= now)) {
+    peer_release(ctx, ctx->idle);
+  }
+
+  while ((ctx->backoff != NULL) && (ctx->backoff->retry <= now)) {
+    struct advpeer *p = ctx->backoff;
+    peer_unlist(ctx, p);
+    peer_connect(ctx, p, now);
+  }
+}
+
+
+/* the connection to peer p is up: the send deadline starts now */
+static void peer_connected(struct rppadv *ctx, struct advpeer *p, long now) {
+  if (p->ctl != NULL) rppwindow_grow(&(p->ctl->win));
+  if (ctx->stats != NULL) rpphist_add(&(ctx->stats->connect), now - p->connstart);
+  ctl_release(p);
+  p->state = UP;
+  p->backoff = 0;
+  p->status = 0;
+  p->err = 0;
+  race_connected(ctx, p, now);
+  if (p->qhead != NULL) {
+    req_unlink(ctx, p->qhead);
+    req_arm(ctx, p->qhead, now);
+  }
+  peer_send(ctx, p, now);
+}
+
+
+/* processes the completions of the io_uring instance */
+static void ring_reap(struct rppadv *ctx, long now) {
+  struct epoll_event ev;
+  struct advpeer *p;
+  struct advop *op;
+  void *data;
+  int res;
+
+  while (rppuring_cqe(ctx->ring, &data, &res) != 0) {
+    op = data;
+    if (op == NULL) continue; /* linked timeouts and cancellations */
+    p = op->peer;
+    if (p == NULL) { /* the connection got closed meanwhile */
+      op_free(ctx, op);
+      continue;
+    }
+    p->op = NULL;
+    if ((op->connect) && (res == 0)) {
+      peer_connected(ctx, p, now);
+    } else if ((op->connect) && ((res == -EINPROGRESS) || (res == -EALREADY))) {
+      /* the kernel left the connection in progress: wait for it as epoll does */
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLOUT;
+      ev.data.ptr = p;
+      if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, p->sock, &ev) == 0) {
+        p->events = EPOLLOUT;
+      } else {
+        peer_fail(ctx, p, -1, errno, now);
+      }
+    } else if (op->connect) {
+      peer_fail(ctx, p, -2, (res == -ECANCELED) ? ETIMEDOUT : -res, now);
+    } else if (res < 0) {
+      peer_fail(ctx, p, -3, -res, now);
+    } else {
+      peer_written(ctx, p, res, now);
+      peer_send(ctx, p, now);
+    }
+    op_free(ctx, op);
+  }
+}
+
+
+void rppadv_ratelimit(struct rppadv *ctx, int persec) {
+  rpprate_init(&(ctx->rate), persec, 1000000, ustime());
+}
+
+
+void rppadv_stats(struct rppadv *ctx, struct rppstats *stats) {
+  ctx->stats = stats;
+}
+
+
+int rppadv_uring(struct rppadv *ctx) {
+  struct epoll_event ev;
+  if (ctx->ring != NULL) return(0);
+  ctx->arena = rpparena_new(64 * sizeof(struct advop));
+  if (ctx->arena == NULL) return(-1);
+  rppslab_init(&(ctx->opslab), ctx->arena, sizeof(struct advop));
+  ctx->ring = rppuring_new(RINGENTRIES);
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if ((ctx->ring == NULL) || (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, rppuring_fd(ctx->ring), &ev) != 0)) {
+    rppuring_free(ctx->ring);
+    ctx->ring = NULL;
+    rpparena_free(ctx->arena);
+    ctx->arena = NULL;
+    return(-1);
+  }
+  return(0);
+}
+
+
+void rppadv_flush(struct rppadv *ctx) {
+  if (ctx->ring != NULL) rppuring_submit(ctx->ring);
+}
+
+
+int rppadv_run(struct rppadv *ctx, int maxwait) {
+  struct epoll_event ev[64];
+  long now;
+  int i, n, wait;
+
+  adv_expire(ctx, ustime());
+  req_flush(ctx);
+  rppadv_flush(ctx);
+  if ((ctx->active == 0) && ((maxwait < 0) || (ctx->idle == NULL))) return(0);
+
+  /* wait no longer than until the next deadline */
+  wait = rppadv_waittime(ctx);
+  if ((maxwait >= 0) && ((wait < 0) || (maxwait < wait))) wait = maxwait;
+
+  n = epoll_wait(ctx->epfd, ev, sizeof(ev) / sizeof(ev[0]), wait);
+  now = ustime();
+  for (i = 0; i < n; i++) {
+    struct advpeer *p = ev[i].data.ptr;
+    if (p == NULL) {
+      ring_reap(ctx, now);
+      continue;
+    }
+    if (p->state == CONNECTING) {
+      int err = 0;
+      socklen_t errlen = sizeof(err);
+      if ((getsockopt(p->sock, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0) || (err != 0)) {
+        peer_fail(ctx, p, -2, err, now);
+        continue;
+      }
+      peer_connected(ctx, p, now);
+      continue;
+    }
+    if (p->state != UP) continue;
+    if (ev[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+      peer_read(ctx, p, now);
+      if (p->state != UP) continue;
+    }
+    if (ev[i].events & EPOLLOUT) peer_send(ctx, p, now);
+  }
+
+  adv_expire(ctx, now);
+  req_flush(ctx);
+  rppadv_flush(ctx);
+  return(ctx->active);
+}
+
+
+int rppadv_fd(const struct rppadv *ctx) {
+  return(ctx->epfd);
+}
+
+
+int rppadv_waittime(const struct rppadv *ctx) {
+  long next = -1, wait;
+  if (ctx->done != NULL) return(0); /* callbacks to call */
+  if (ctx->head != NULL) next = ctx->head->deadline;
+  if ((ctx->idle != NULL) && ((next < 0) || (ctx->idle->idle + ctx->keepalive < next))) {
+    next = ctx->idle->idle + ctx->keepalive;
+  }
+  if ((ctx->backoff != NULL) && ((next < 0) || (ctx->backoff->retry < next))) {
+    next = ctx->backoff->retry;
+  }
+  if ((ctx->racing != NULL) && ((next < 0) || (ctx->racing->racenext < next))) {
+    next = ctx->racing->racenext;
+  }
+  if (next < 0) return(-1);
+  wait = next - ustime();
+  if (wait <= 0) return(0);
+  return((wait + 999) / 1000);
+}
+
+
+void rppadv_free(struct rppadv *ctx) {
+  int i;
+  if (ctx == NULL) return;
+  rppuring_free(ctx->ring);
+  while (ctx->ops != NULL) op_free(ctx, ctx->ops);
+  rpparena_free(ctx->arena);
+  for (i = 0; (ctx->reqs != NULL) && (i < ctx->maxconns); i++) {
+    rppmsg_free(ctx->reqs[i].msg);
+  }
+  for (i = 0; (ctx->peers != NULL) && (i < ctx->maxpeers); i++) {
+    if (ctx->peers[i].sock >= 0) close(ctx->peers[i].sock);
+  }
+  if (ctx->epfd >= 0) close(ctx->epfd);
+  free(ctx->reqs);
+  free(ctx->peers);
+  free(ctx->hash);
+  free(ctx->prefs);
+  free(ctx->ctls);
+  free(ctx);
+}
+
+/* callback of advertise_msg_to_remote_dst(), the status and errno are
+ * stored in an array of two ints */
+static void advertise_done(void *priv, int status, int err, long latency) {
+  int *res = priv;
+  res[0] = status;
+  res[1] = err;
+  (void)latency;
+}
+
+
+int advertise_msg_to_remote_dst(struct rppmsg *msg, const char *servstringaddr, int timeout) {
+  struct rppadv *ctx;
+  int res[2] = {1, 0};
+
+  ctx = rppadv_new(1, timeout, 0, NULL);
+  if ((ctx == NULL) || (rppadv_submit(ctx, servstringaddr, msg, advertise_done, res) != 0)) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    rppadv_free(ctx);
+    return(-1);
+  }
+  while (rppadv_run(ctx, -1) > 0);
+  rppadv_free(ctx);
+
+  switch (res[0]) {
+    case 0:
+      break;
+    case -1:
+      fprintf(stderr, "ERROR: socket() call failed (%s)\n", strerror(res[1]));
+      break;
+    case -2:
+      fprintf(stderr, "ERROR: connection to the remote controller failed (%s)\n", strerror(res[1]));
+      break;
+    default:
+      fprintf(stderr, "ERROR: failed to send routing prefs to %s (%s)\n", servstringaddr, strerror(res[1]));
+      break;
+  }
+  return(res[0]);
+}
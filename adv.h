@@ -0,0 +1,152 @@
+/**
+  * @brief advertisement of inbound preferences to RDE controllers
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_ADV_H
+#define RPP_ADV_H
+
+#include "delta.h"
+#include "lists.h"
+#include "proto.h"
+#include "stats.h"
+
+/* TCP port RDE controllers listen on */
+#define RPP_PORT 4343
+
+/** @brief callback called by the fan-out engine for every advertisement
+  * that reaches completion
+  * @param *priv the private pointer that was given to rppadv_submit()
+  * @param status 0 on success, 1 if the controller knew all the preferences already (nothing was sent), -1 if no socket could be created, -2 if the connection failed or timed out, -3 if sending failed or timed out
+  * @param err the errno value that caused the failure, if any (for pooled connections, that of the last connection attempt)
+  * @param latency the time (in us) the advertisement took, from its submission to its completion
+  */
+typedef void (*rppadv_cb)(void *priv, int status, int err, long latency);
+
+/** @brief fan-out engine context (opaque) */
+struct rppadv;
+
+/** @brief an encoded message, ready to be sent to any number of controllers
+  * (opaque) */
+struct rppmsg;
+
+/** @brief encodes a SETINPREF message, once for all the controllers it is
+  * to be sent to
+  * @return a new message, or NULL on error */
+struct rppmsg *rppmsg_setinpref(int ttl, const char *locpreflist, const char *preflist);
+
+/** @brief same as rppmsg_setinpref(), for lists that may come from files:
+  * these are validated as they get copied into the message, see
+  * rpplist_copy()
+  * @return a new message, or NULL on error (errno is EINVAL if an entry of
+  * a list is invalid) */
+struct rppmsg *rppmsg_setinpref_lists(int ttl, struct rpplist *loc, struct rpplist *pref);
+
+/** @brief encodes a SETINPREF message as a binary frame (see proto.h), for
+  * controllers that accept them - about 4 times smaller than the text for long lists
+  * @return a new message (which still advertises incrementally as msg would),
+  * or NULL if an entry of msg cannot be encoded in binary or on error: msg
+  * should then be sent as it is */
+struct rppmsg *rppmsg_binary(struct rppmsg *msg);
+
+/** @brief takes a new reference to a message - messages may be shared
+  * between threads
+  * @return msg */
+struct rppmsg *rppmsg_ref(struct rppmsg *msg);
+
+/** @brief releases a message - it is actually freed once all the
+  * advertisements it has been submitted to are complete */
+void rppmsg_free(struct rppmsg *msg);
+
+/** @brief creates a fan-out engine
+  * @param maxconns the maximum number of simultaneous advertisements - racing controllers, these may open up to 3 connections each
+  * @param timeout the time (in ms) allowed to connect to a controller, and then to send it the preferences
+  * @param keepalive if non-zero, connections are pooled: they are kept open for up to keepalive ms of inactivity, messages to the same controller are pipelined over them, and failed connections are reestablished with an exponential backoff. if zero, every advertisement goes through a connection of its own - except that advertisements to a single controller with the same TTL, preferences and local prefixes (any local prefixes with delta) are merged into the one waiting for a connection to it, if any, and sent as a single message.
+  * @param *delta if not NULL, messages are trimmed down to the local prefixes whose preferences the controller does not know already (or that are to be refreshed), and what gets sent is recorded there - it may be shared by several engines
+  * @return a new engine, or NULL on error
+  */
+struct rppadv *rppadv_new(int maxconns, int timeout, int keepalive, struct rppdelta *delta);
+
+/** @brief starts sending a message to a controller - the callback is called
+  * later from within rppadv_run(). the message is referenced, not copied.
+  * @param *rdeaddr the address of the controller, or a comma-separated list of candidate controllers: connections to up to 3 of them are then raced, starting one every 250 ms (or as soon as the previous one fails), and the message goes to the first one connected. the winner is remembered, and tried first by the next advertisement to the same list.
+  * @return 0 on success, non-zero if the advertisement cannot be submitted (typically because maxconns connections are open already)
+  */
+int rppadv_submit(struct rppadv *ctx, const char *rdeaddr, struct rppmsg *msg, rppadv_cb cb, void *priv);
+
+/** @brief caps the connection attempts to persec per second (0 removes the
+  * cap). attempts past the cap wait for their turn, as do attempts to a
+  * controller that has a window of them in progress already: that window
+  * starts small, grows with every connection established, and is halved
+  * when an attempt times out. */
+void rppadv_ratelimit(struct rppadv *ctx, int persec);
+
+/** @brief accounts for the time taken to connect to controllers, and for
+  * the connection attempts that fail, into stats from now on (NULL stops
+  * accounting) */
+void rppadv_stats(struct rppadv *ctx, struct rppstats *stats);
+
+/** @brief connects to controllers and writes to them through io_uring from
+  * now on: connection attempts carry a linked timeout, and the connections
+  * and writes prepared in between two calls to rppadv_run() or
+  * rppadv_flush() are all submitted in a single system call. epoll is still
+  * used to notice controllers closing connections. to be called before
+  * anything is submitted.
+  * @return 0 on success, non-zero if io_uring is not available (the engine
+  * then keeps working through epoll alone) */
+int rppadv_uring(struct rppadv *ctx);
+
+/** @brief submits the connections and writes prepared and not submitted
+  * yet, when going through io_uring - to be called before waiting on
+  * rppadv_fd() */
+void rppadv_flush(struct rppadv *ctx);
+
+/** @brief drives connections, waiting up to maxwait ms for something to
+  * happen (-1 waits until at least one advertisement progresses, and does
+  * not wait at all if none is in progress)
+  * @return the number of advertisements still in progress
+  */
+int rppadv_run(struct rppadv *ctx, int maxwait);
+
+/** @brief returns a file descriptor that becomes readable when
+  * rppadv_run() has something to do */
+int rppadv_fd(const struct rppadv *ctx);
+
+/** @brief returns the time (in ms) rppadv_run() may be delayed at most,
+  * or -1 if no advertisement is in progress and no connection is pooled */
+int rppadv_waittime(const struct rppadv *ctx);
+
+/** @brief frees an engine - advertisements in progress are aborted
+  * without their callbacks being called */
+void rppadv_free(struct rppadv *ctx);
+
+/** @brief advertises our inbound preferences to a remote prefix, that is
+  * sends msg to the controller at servstringaddr, waiting for it to complete
+  * @return returns 0 on success, non-zero otherwise */
+int advertise_msg_to_remote_dst(struct rppmsg *msg, const char *servstringaddr, int timeout);
+
+#endif
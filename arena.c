@@ -0,0 +1,145 @@
+/**
+  * @brief bump allocator with fixed-size slabs
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <stdlib.h>
+
+#include "arena.h"
+
+/* alignment of the allocations, enough for any type */
+#define ALIGN 16
+
+struct arenachunk {
+  struct arenachunk *next;  /* chunk allocated before this one */
+  size_t size;              /* bytes available after the header */
+  size_t used;
+  /* the memory follows, aligned to ALIGN */
+};
+
+struct rpparena {
+  struct arenachunk *chunks;  /* current chunk first */
+  size_t chunksz;
+  size_t total;               /* bytes held, chunks included */
+};
+
+/* size of the header of a chunk, keeping its memory aligned */
+#define CHUNKHDR ((sizeof(struct arenachunk) + ALIGN - 1) & ~(size_t)(ALIGN - 1))
+
+
+struct rpparena *rpparena_new(size_t chunksz) {
+  struct rpparena *a = malloc(sizeof(*a));
+  if (a == NULL) return(NULL);
+  a->chunks = NULL;
+  a->chunksz = (chunksz < 1024) ? 1024 : chunksz;
+  a->total = 0;
+  return(a);
+}
+
+
+void *rpparena_alloc(struct rpparena *a, size_t size) {
+  struct arenachunk *c = a->chunks;
+  size = (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+  if ((c == NULL) || (c->size - c->used < size)) {
+    size_t csize = (size > a->chunksz / 4) ? size : a->chunksz - CHUNKHDR;
+    c = malloc(CHUNKHDR + csize);
+    if (c == NULL) return(NULL);
+    c->size = csize;
+    c->used = 0;
+    a->total += CHUNKHDR + csize;
+    if ((csize == size) && (a->chunks != NULL)) {
+      /* a dedicated chunk goes behind the current one, which keeps
+       * serving small allocations */
+      c->next = a->chunks->next;
+      a->chunks->next = c;
+    } else {
+      c->next = a->chunks;
+      a->chunks = c;
+    }
+  }
+  c->used += size;
+  return((char *)c + CHUNKHDR + c->used - size);
+}
+
+
+void rpparena_reset(struct rpparena *a) {
+  struct arenachunk *c = a->chunks, *keep = NULL;
+  /* the oldest chunk is kept, unless it is a dedicated one */
+  while (c != NULL) {
+    struct arenachunk *next = c->next;
+    if ((next == NULL) && (c->size == a->chunksz - CHUNKHDR)) {
+      keep = c;
+    } else {
+      a->total -= CHUNKHDR + c->size;
+      free(c);
+    }
+    c = next;
+  }
+  if (keep != NULL) {
+    keep->next = NULL;
+    keep->used = 0;
+  }
+  a->chunks = keep;
+}
+
+
+size_t rpparena_size(const struct rpparena *a) {
+  return(a->total);
+}
+
+
+void rpparena_free(struct rpparena *a) {
+  if (a == NULL) return;
+  while (a->chunks != NULL) {
+    struct arenachunk *c = a->chunks;
+    a->chunks = c->next;
+    free(c);
+  }
+  free(a);
+}
+
+
+void rppslab_init(struct rppslab *s, struct rpparena *arena, size_t size) {
+  s->arena = arena;
+  s->size = (size < sizeof(void *)) ? sizeof(void *) : size;
+  s->free = NULL;
+}
+
+
+void *rppslab_get(struct rppslab *s) {
+  void *obj = s->free;
+  if (obj == NULL) return(rpparena_alloc(s->arena, s->size));
+  s->free = *(void **)obj;
+  return(obj);
+}
+
+
+void rppslab_put(struct rppslab *s, void *obj) {
+  if (obj == NULL) return;
+  *(void **)obj = s->free;
+  s->free = obj;
+}
@@ -0,0 +1,78 @@
+/**
+  * @brief bump allocator with fixed-size slabs
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_ARENA_H
+#define RPP_ARENA_H
+
+#include <stddef.h>
+
+/** @brief a bump allocator: memory is carved out of large chunks and only
+  * given back all at once. an arena is not thread-safe, each thread (or
+  * engine) is meant to own its own (opaque) */
+struct rpparena;
+
+/** @brief creates an empty arena
+  * @param chunksz the size of the chunks memory is carved out of -
+  * allocations larger than a quarter of that get a chunk of their own
+  * @return a new arena, or NULL on error */
+struct rpparena *rpparena_new(size_t chunksz);
+
+/** @brief allocates size bytes, aligned for any type, and not initialized
+  * @return the memory, or NULL on error */
+void *rpparena_alloc(struct rpparena *a, size_t size);
+
+/** @brief gives all the memory allocated back at once - the first chunk is
+  * kept for reuse, the others are freed */
+void rpparena_reset(struct rpparena *a);
+
+/** @brief returns the number of bytes the arena holds, chunks included */
+size_t rpparena_size(const struct rpparena *a);
+
+/** @brief frees an arena and all the memory allocated from it */
+void rpparena_free(struct rpparena *a);
+
+/** @brief a pool of objects of the same size, carved out of an arena and
+  * recycled through a free list */
+struct rppslab {
+  struct rpparena *arena;
+  size_t size;   /**< size of the objects, at least that of a pointer */
+  void *free;    /**< objects given back, linked through their first bytes */
+};
+
+/** @brief prepares a slab of objects of a given size, allocated from arena */
+void rppslab_init(struct rppslab *s, struct rpparena *arena, size_t size);
+
+/** @brief takes an object out of the slab, not initialized
+  * @return the object, or NULL on error */
+void *rppslab_get(struct rppslab *s);
+
+/** @brief gives an object back to the slab */
+void rppslab_put(struct rppslab *s, void *obj);
+
+#endif
@@ -0,0 +1,1043 @@
+/**
+  * @brief resolution and advertisement of many requests at once
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "adv.h"
+#include "arena.h"
+#include "batch.h"
+#include "cache.h"
+#include "dns.h"
+#include "revdns.h"
+#include "sched.h"
+
+/* size of the chunks of the arenas of the engines and of the queues */
+#define ARENACHUNK 65536
+
+/* results leave a queue in the order of its requests, so its window holds
+ * WINDOWFACTOR times the requests the engine has in progress: complete ones
+ * wait there behind a query that times out, without stopping the others.
+ * it holds at least MINWINDOW and at most MAXWINDOW of them, unless the
+ * engine takes more at once */
+#define WINDOWFACTOR 32
+#define MINWINDOW 256
+#define MAXWINDOW 65536
+
+struct rppbatch {
+  struct rppdns *dns;
+  struct rppadv *adv;
+  struct rppcache *cache;
+  int maxbusy;              /* max number of requests in progress */
+  int busy;
+  struct rppmsg *lastmsg;   /* the last message encoded for a request... */
+  char *lastloc;            /* ...and the lists it has been encoded from */
+  char *lastpref;
+  struct rppqueue *orphans; /* queues freed while requests were in progress */
+  int advttl;               /* TTL of the preferences advertised, in s */
+  int refresh;              /* part of the TTL left at most when refreshing, in % */
+  long refreshfor;          /* time requests are re-advertised for, in ms */
+  long until;               /* time (ms) the request being re-advertised is re-advertised until, 0 for a new request */
+  int binary;               /* set if messages are encoded in binary */
+  int json;                 /* set if results are formatted in JSON */
+  unsigned int seed;        /* random jitter of refreshes */
+  struct rppsched *sched;   /* refreshes to come, if refreshing */
+  struct rppqueue *refreshq;  /* requests being re-advertised */
+  struct batchprefetch *prefetches; /* cache entries being refreshed */
+  struct rpparena *arena;   /* memory of the engine, never given back before it is freed */
+  struct rppslab prefetchslab;
+  struct rpparena *spare;   /* memory of the last queue freed, for the next one */
+  char *job;                /* refresh job being scheduled */
+  size_t jobsz;
+  char revdns[128];         /* name being queried, copied by the resolver right away */
+  struct rppstats stats;    /* what the engine went through */
+};
+
+/* a cache entry refreshed ahead of its expiry */
+struct batchprefetch {
+  struct rppbatch *batch;
+  struct batchprefetch *prev;
+  struct batchprefetch *next;
+  struct rppprefix zone;
+};
+
+/* a single request */
+struct batchreq {
+  struct rppqueue *queue;
+  char *line;         /* the request line, split in place into the fields below */
+  size_t linesz;
+  char *prefixorg;
+  struct rppmsg *msg;  /* the preferences to advertise, if any */
+  struct rppprefix pfx;
+  struct rppprefix zone; /* the zone currently looked at... */
+  int walklen;        /* ...and its length */
+  long start;         /* time (us) the request got started */
+  int pending;        /* set while the DNS query or the advertisement is in progress */
+  int resstatus;      /* resolution status, as returned by rppdns_resolve() */
+  int advstatus;      /* advertisement status, see rppadv_cb */
+  long advlatency;    /* advertisement latency, in us */
+  char rdeaddr[128];
+  char errline[64];   /* the remoteprefix (cut) of a request whose line did not fit in memory */
+};
+
+/* a queue lives in an arena of its own, along with its window and the
+ * lines of its requests - all of it is given back at once with the queue */
+struct rppqueue {
+  struct rppbatch *batch;
+  struct rpparena *arena;
+  struct rppmsg *defmsg;  /* preferences of requests that carry none, if any */
+  struct batchreq *win;   /* requests are kept in a ring, oldest first */
+  int size;
+  int head;
+  int count;
+  int busy;               /* number of requests of the queue in progress */
+  int orphan;             /* set if the queue got freed while busy */
+  struct rppqueue *next;  /* list of orphaned queues */
+};
+
+
+void rppopts_default(struct rppopts *opts) {
+  opts->inflight = 64;
+  opts->timeout = 1000;
+  opts->retries = 2;
+  opts->advtimeout = 5000;
+  opts->keepalive = 0;
+  opts->cachefile = NULL;
+  opts->resolvers = NULL;
+  opts->direct = NULL;
+  opts->incremental = 0;
+  opts->advttl = 3600;
+  opts->refresh = 0;
+  opts->refreshfor = 86400;
+  opts->binary = 0;
+  opts->iouring = 0;
+  opts->qps = 0;
+  opts->advrate = 0;
+  opts->json = 0;
+}
+
+
+/* parses a numeric option value, returns -1 if it is not within min..max */
+static int optval(const char *s, int min, int max) {
+  char *end;
+  long v;
+  if (s == NULL) return(-1);
+  v = strtol(s, &end, 10);
+  if ((*s == 0) || (*end != 0) || (v < min) || (v > max)) return(-1);
+  return(v);
+}
+
+
+int rppopts_set(struct rppopts *opts, const char *name, const char *val) {
+  int *opt = NULL, min = 0, max = 0;
+  if (strcmp(name, "--cache") == 0) {
+    if (val == NULL) return(-1);
+    opts->cachefile = (char *)val;
+    return(0);
+  } else if (strcmp(name, "--resolvers") == 0) {
+    if ((val == NULL) || (strcmp(val, "arpa") == 0) || (rppdns_checkservers(val) != 0)) return(-1);
+    opts->resolvers = (char *)val;
+    return(0);
+  } else if (strcmp(name, "--direct") == 0) {
+    if ((val == NULL) || (rppdns_checkservers(val) != 0)) return(-1);
+    opts->direct = (char *)val;
+    return(0);
+  } else if (strcmp(name, "--encoding") == 0) {
+    if (val == NULL) return(-1);
+    if (strcmp(val, "text") == 0) {
+      opts->binary = 0;
+    } else if (strcmp(val, "binary") == 0) {
+      opts->binary = 1;
+    } else {
+      return(-1);
+    }
+    return(0);
+  } else if (strcmp(name, "--format") == 0) {
+    if (val == NULL) return(-1);
+    if (strcmp(val, "tsv") == 0) {
+      opts->json = 0;
+    } else if (strcmp(val, "json") == 0) {
+      opts->json = 1;
+    } else {
+      return(-1);
+    }
+    return(0);
+  } else if (strcmp(name, "--io") == 0) {
+    if (val == NULL) return(-1);
+    if (strcmp(val, "epoll") == 0) {
+      opts->iouring = 0;
+    } else if (strcmp(val, "uring") == 0) {
+      opts->iouring = 1;
+    } else {
+      return(-1);
+    }
+    return(0);
+  } else if (strcmp(name, "--inflight") == 0) {
+    opt = &(opts->inflight);
+    min = 1;
+    max = 65536;
+  } else if (strcmp(name, "--timeout") == 0) {
+    opt = &(opts->timeout);
+    min = 1;
+    max = 60000;
+  } else if (strcmp(name, "--advtimeout") == 0) {
+    opt = &(opts->advtimeout);
+    min = 1;
+    max = 600000;
+  } else if (strcmp(name, "--keepalive") == 0) {
+    opt = &(opts->keepalive);
+    min = 0;
+    max = 3600000;
+  } else if (strcmp(name, "--retries") == 0) {
+    opt = &(opts->retries);
+    min = 0;
+    max = 100;
+  } else if (strcmp(name, "--incremental") == 0) {
+    opt = &(opts->incremental);
+    min = 0;
+    max = 99;
+  } else if (strcmp(name, "--advttl") == 0) {
+    opt = &(opts->advttl);
+    min = 1;
+    max = 604800;
+  } else if (strcmp(name, "--refresh") == 0) {
+    opt = &(opts->refresh);
+    min = 0;
+    max = 90;
+  } else if (strcmp(name, "--refreshfor") == 0) {
+    opt = &(opts->refreshfor);
+    min = 1;
+    max = 31536000;
+  } else if (strcmp(name, "--qps") == 0) {
+    opt = &(opts->qps);
+    min = 0;
+    max = 10000000;
+  } else if (strcmp(name, "--advrate") == 0) {
+    opt = &(opts->advrate);
+    min = 0;
+    max = 10000000;
+  }
+  if (opt == NULL) return(-1);
+  min = optval(val, min, max);
+  if (min < 0) return(-1);
+  *opt = min;
+  return(0);
+}
+
+
+void rppopts_printhelp(const struct rppopts *def) {
+  printf("  --cache file     keep resolved controllers in a file, shared between runs\n"
+         "  --inflight n     max number of requests processed concurrently, that is DNS\n"
+         "                   queries and controller connections (default: %d)\n", def->inflight);
+  printf("  --timeout ms     time to wait for a DNS answer before retrying (default: %d)\n", def->timeout);
+  printf("  --retries n      number of DNS retransmissions before giving up (default: %d)\n", def->retries);
+  printf("  --advtimeout ms  time allowed to connect to a controller, and then to send\n"
+         "                   it the preferences (default: %d)\n", def->advtimeout);
+  printf("  --keepalive ms   keep connections to controllers open for up to ms of\n"
+         "                   inactivity and pipeline advertisements over them - the\n"
+         "                   controllers must accept several SETINPREF per connection.\n");
+  printf("                   0 opens a connection per advertisement, the ones to a\n"
+         "                   controller not connected yet being merged into it when\n"
+         "                   they carry the same preferences and localprefixes - or,\n"
+         "                   with --incremental, the same preferences (default: %d)\n", def->keepalive);
+  printf("  --qps n          max DNS queries sent per second, retransmissions included.\n"
+         "                   queries past it, or past the congestion window of their\n"
+         "                   resolver, wait for their turn. windows adapt to the loss\n"
+         "                   and latency of every resolver. 0 for no cap (default: %d)\n", def->qps);
+  printf("  --advrate n      max connection attempts to controllers per second, and\n"
+         "                   to each controller at most a window of them at once,\n"
+         "                   halved when they time out. 0 for no cap (default: %d)\n", def->advrate);
+  printf("  --resolvers list DNS resolvers to use instead of the ones of the system, as\n"
+         "                   a comma-separated list of addresses (addr or addr#port).\n"
+         "                   queries go to the fastest one, and fail over to the next\n");
+  printf("  --direct list    query the authoritative servers of the reverse zones,\n"
+         "                   starting from the root servers in 'list', or from the\n"
+         "                   servers of in-addr.arpa and ip6.arpa if 'list' is 'arpa'.\n"
+         "                   delegations are remembered, aliases and failures are left\n"
+         "                   to the resolvers\n");
+  printf("  --incremental n  rppd only: remember what each controller was advertised,\n"
+         "                   and only send it the local prefixes whose preferences\n"
+         "                   changed, or whose advertisement has less than n %% of its\n"
+         "                   TTL left - the controllers must apply SETINPREF to the\n"
+         "                   prefixes it lists only. up to date controllers get an\n"
+         "                   advertisestatus of 1. 0 always advertises everything\n"
+         "                   (default: %d)\n", def->incremental);
+  printf("  --advttl s       TTL of the preferences advertised, in seconds (default: %d)\n", def->advttl);
+  printf("  --encoding e     'text' SETINPREF lines, or 'binary' frames about 4 times\n"
+         "                   smaller, for controllers that accept them - preferences\n"
+         "                   that cannot be encoded in binary are still sent as text\n"
+         "                   (default: %s)\n", def->binary ? "binary" : "text");
+  printf("  --io backend     'epoll', or 'uring' to batch DNS queries, connections and\n"
+         "                   writes into io_uring submissions, a system call each -\n"
+         "                   epoll is still used where io_uring is not available\n"
+         "                   (default: %s)\n", def->iouring ? "uring" : "epoll");
+  printf("  --format f       'tsv' result lines, or 'json' to output every result as a\n"
+         "                   JSON object on a line of its own, with the same fields:\n"
+         "                   prefix, status, controller, advertise, latency, revdns\n"
+         "                   (default: %s)\n", def->json ? "json" : "tsv");
+  printf("  --refresh n      rppd only: re-advertise the requests that carry preferences,\n"
+         "                   and refresh the cache entries that got looked up, once less\n"
+         "                   than n %% of their TTL is left - at random between n/2 and\n"
+         "                   n %%, so that refreshes spread over time. with --incremental,\n"
+         "                   refreshes also stay within its n %%. 0 lets everything\n"
+         "                   expire (default: %d)\n", def->refresh);
+  printf("  --refreshfor s   rppd only: stop re-advertising a request s seconds after\n"
+         "                   it was last received, so that requests clients do not\n"
+         "                   send anymore expire. a request replaces the one of the\n"
+         "                   same remoteprefix and localprefixes (default: %d)\n", def->refreshfor);
+}
+
+
+struct rppbatch *rppbatch_new(const struct rppopts *opts, struct rppcache *cache, struct rppdelta *delta) {
+  struct rppbatch *b;
+
+  b = calloc(1, sizeof(*b));
+  if (b == NULL) return(NULL);
+  b->arena = rpparena_new(ARENACHUNK);
+  if (b->arena == NULL) {
+    free(b);
+    return(NULL);
+  }
+  rppslab_init(&(b->prefetchslab), b->arena, sizeof(struct batchprefetch));
+  b->cache = cache;
+  b->maxbusy = opts->inflight;
+  b->advttl = opts->advttl;
+  b->binary = opts->binary;
+  b->json = opts->json;
+  /* re-advertisements must not be found up to date by the delta */
+  b->refresh = opts->refresh;
+  b->refreshfor = opts->refreshfor * 1000L;
+  if ((opts->incremental > 0) && (opts->incremental < b->refresh)) b->refresh = opts->incremental;
+  b->dns = rppdns_new(opts->inflight, opts->timeout, opts->retries, opts->resolvers, opts->direct);
+  b->adv = rppadv_new(opts->inflight, opts->advtimeout, opts->keepalive, (opts->incremental > 0) ? delta : NULL);
+  if ((b->dns == NULL) || (b->adv == NULL)) {
+    rppbatch_free(b);
+    return(NULL);
+  }
+  /* without io_uring, the engines simply stay on epoll */
+  if (opts->iouring != 0) {
+    rppdns_uring(b->dns);
+    rppadv_uring(b->adv);
+  }
+  rppdns_ratelimit(b->dns, opts->qps);
+  rppadv_ratelimit(b->adv, opts->advrate);
+  rppdns_stats(b->dns, &(b->stats));
+  rppadv_stats(b->adv, &(b->stats));
+  if (b->refresh > 0) {
+    b->seed = (unsigned int)time(NULL) ^ (unsigned int)(size_t)b;
+    b->sched = rppsched_new();
+    b->refreshq = (b->sched != NULL) ? rppqueue_new(b, NULL) : NULL;
+    if (b->refreshq == NULL) {
+      rppbatch_free(b);
+      return(NULL);
+    }
+  }
+  return(b);
+}
+
+
+int rppbatch_pollfds(struct rppbatch *b, struct pollfd *pfd) {
+  rppdns_flush(b->dns);
+  rppadv_flush(b->adv);
+  pfd[0].fd = rppdns_fd(b->dns);
+  pfd[0].events = POLLIN;
+  pfd[1].fd = rppadv_fd(b->adv);
+  pfd[1].events = POLLIN;
+  return(RPPBATCH_NFDS);
+}
+
+
+/* returns the current time on a monotonic clock, in ms */
+static long mstime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+
+/* returns the current time on a monotonic clock, in us */
+static long ustime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+}
+
+
+int rppbatch_waittime(const struct rppbatch *b) {
+  int wait, advwait;
+  wait = rppdns_waittime(b->dns);
+  advwait = rppadv_waittime(b->adv);
+  if ((wait < 0) || ((advwait >= 0) && (advwait < wait))) wait = advwait;
+  if (b->sched != NULL) {
+    advwait = rppsched_waittime(b->sched, mstime());
+    if ((wait < 0) || ((advwait >= 0) && (advwait < wait))) wait = advwait;
+  }
+  return(wait);
+}
+
+
+/* schedules the refresh of something that expires in ttl seconds, somewhere
+ * between refresh/2 and refresh % of its TTL before it does. a job is
+ * made of its kind ('A' for a request line to re-advertise, 'Z' for a cache
+ * entry to refresh) followed by what it is about, keylen bytes of which
+ * identify it - a request line is followed by the time (ms, a long) it is
+ * re-advertised until. failing to schedule it is not an error, it just
+ * expires */
+static void batch_schedule(struct rppbatch *b, const char *job, size_t keylen, size_t joblen, unsigned long ttl) {
+  double ttlms = ttl * 1000.0, lead;
+  lead = ttlms * b->refresh / 100.0 * (0.5 + 0.5 * rand_r(&(b->seed)) / RAND_MAX);
+  rppsched_add(b->sched, mstime() + (long)(ttlms - lead), job, keylen, job, joblen);
+}
+
+
+/* returns the length of the key of a job, see batch_schedule() - the
+ * remoteprefix and localprefixes of a request line, so that a request
+ * replaces the one advertising other preferences for the same prefixes */
+static size_t job_keylen(const char *job, size_t joblen) {
+  const char *tab;
+  if (job[0] != 'A') return(joblen);
+  joblen -= sizeof(long);
+  tab = memchr(job, '\t', joblen);
+  if (tab != NULL) tab = memchr(tab + 1, '\t', joblen - (tab + 1 - job));
+  return((tab != NULL) ? (size_t)(tab - job) : joblen);
+}
+
+
+/* schedules the refresh of the cache entry of zone, stored for ttl seconds */
+static void batch_cached(struct rppbatch *b, const struct rppprefix *zone, unsigned long ttl) {
+  char job[1 + sizeof(*zone)];
+  if (b->sched == NULL) return;
+  job[0] = 'Z';
+  memcpy(job + 1, zone, sizeof(*zone));
+  batch_schedule(b, job, sizeof(job), sizeof(job), ttl);
+}
+
+
+/* called by the asynchronous resolver when a cache entry got refreshed -
+ * failures leave the entry to expire */
+static void batch_prefetched(void *priv, int status, const char *rdeaddr, unsigned long ttl) {
+  struct batchprefetch *pf = priv;
+  struct rppbatch *b = pf->batch;
+  if (pf->prev != NULL) {
+    pf->prev->next = pf->next;
+  } else {
+    b->prefetches = pf->next;
+  }
+  if (pf->next != NULL) pf->next->prev = pf->prev;
+  b->busy--;
+  if ((ttl > 0) && (rppcache_put(b->cache, &(pf->zone), status, rdeaddr, time(NULL) + ttl) == 0)) {
+    batch_cached(b, &(pf->zone), ttl);
+  }
+  rppslab_put(&(b->prefetchslab), pf);
+}
+
+
+/* queries the zone of a cache entry again, if it got looked up since it
+ * was stored - cold entries are left to expire
+ * @return 0 if the job is done, non-zero if it is to be retried later */
+static int batch_prefetch(struct rppbatch *b, const char *job) {
+  struct batchprefetch *pf;
+  struct rppprefix zone;
+  memcpy(&zone, job + 1, sizeof(zone));
+  if (b->busy >= b->maxbusy) return(-1);
+  if (rppcache_hot(b->cache, &zone) == 0) return(0);
+  if (ip2revdns(b->revdns, sizeof(b->revdns), &zone, zone.len) != 0) return(0);
+  pf = rppslab_get(&(b->prefetchslab));
+  if (pf == NULL) return(-1);
+  pf->batch = b;
+  pf->zone = zone;
+  if (rppdns_submit(b->dns, b->revdns, batch_prefetched, pf) != 0) {
+    rppslab_put(&(b->prefetchslab), pf);
+    return(-1);
+  }
+  /* refreshes take their share of the requests in progress */
+  b->busy++;
+  pf->prev = NULL;
+  pf->next = b->prefetches;
+  if (pf->next != NULL) pf->next->prev = pf;
+  b->prefetches = pf;
+  return(0);
+}
+
+
+/* starts the refreshes that are due, for as long as the engine has room */
+static void batch_refresh(struct rppbatch *b) {
+  char res[1024];
+  char *job;
+  size_t joblen;
+  long now = mstime();
+
+  /* nobody waits for the results of re-advertisements */
+  while (rppqueue_pop(b->refreshq, res, sizeof(res)) > 0);
+
+  while ((job = rppsched_pop(b->sched, now, &joblen)) != NULL) {
+    int retry;
+    if (job[0] == 'A') { /* re-submitting the request schedules it again */
+      memcpy(&(b->until), job + joblen - sizeof(long), sizeof(long));
+      if (b->until <= now) { /* not submitted for too long, let it expire */
+        b->until = 0;
+        free(job);
+        continue;
+      }
+      retry = (rppqueue_submit(b->refreshq, job + 1, joblen - 1 - sizeof(long)) < 0);
+      b->until = 0;
+    } else {
+      retry = batch_prefetch(b, job);
+    }
+    if (retry != 0) { /* the engine is full, try again in a while */
+      rppsched_add(b->sched, now + 1000, job, job_keylen(job, joblen), job, joblen);
+      free(job);
+      break;
+    }
+    free(job);
+  }
+}
+
+
+void rppbatch_run(struct rppbatch *b) {
+  rppdns_run(b->dns, 0);
+  rppadv_run(b->adv, 0);
+  if (b->sched != NULL) batch_refresh(b);
+}
+
+
+void rppbatch_wait(struct rppbatch *b) {
+  struct pollfd pfd[RPPBATCH_NFDS];
+  poll(pfd, rppbatch_pollfds(b, pfd), rppbatch_waittime(b));
+  rppbatch_run(b);
+}
+
+
+/* frees a queue and the requests it holds - the arena of the last queue
+ * freed is kept for the next queue */
+static void queue_release(struct rppqueue *q) {
+  struct rppbatch *b = q->batch;
+  struct rpparena *arena = q->arena;
+  int i;
+  for (i = 0; i < q->size; i++) rppmsg_free(q->win[i].msg);
+  if (b->spare == NULL) {
+    rpparena_reset(arena);
+    b->spare = arena;
+  } else {
+    rpparena_free(arena);
+  }
+}
+
+
+const struct rppstats *rppbatch_stats(const struct rppbatch *b) {
+  return(&(b->stats));
+}
+
+
+void rppbatch_free(struct rppbatch *b) {
+  if (b == NULL) return;
+  rppqueue_free(b->refreshq);
+  /* pending requests are aborted along with the engines */
+  rppdns_free(b->dns);
+  rppadv_free(b->adv);
+  rppsched_free(b->sched);
+  while (b->orphans != NULL) {
+    struct rppqueue *q = b->orphans;
+    b->orphans = q->next;
+    queue_release(q);
+  }
+  rppmsg_free(b->lastmsg);
+  free(b->lastloc);
+  free(b->lastpref);
+  free(b->job);
+  rpparena_free(b->spare);
+  rpparena_free(b->arena); /* prefetches in progress included */
+  free(b);
+}
+
+
+/* accounts for the completion of a request, which is the last thing done
+ * with it: its queue is freed if it is orphaned and has nothing left to do */
+static void batch_complete(struct batchreq *req) {
+  struct rppqueue *q = req->queue;
+  struct rppqueue **pq;
+  q->batch->busy--;
+  q->busy--;
+  if ((q->orphan == 0) || (q->busy > 0)) return;
+  for (pq = &(q->batch->orphans); *pq != q; pq = &((*pq)->next));
+  *pq = q->next;
+  queue_release(q);
+}
+
+
+static void batch_resolved(void *priv, int status, const char *rdeaddr, unsigned long ttl);
+
+
+/* called by the fan-out engine when a request got advertised */
+static void batch_advertised(void *priv, int status, int err, long latency) {
+  struct batchreq *req = priv;
+  req->pending = 0;
+  req->advstatus = status;
+  req->advlatency = latency;
+  (void)err;
+  batch_complete(req);
+}
+
+
+/* starts advertising a request to its controller, if it has preferences
+ * to advertise and its controller is known */
+static void batch_advertise(struct batchreq *req) {
+  if ((req->resstatus != 0) || (req->msg == NULL)) return;
+  if (rppadv_submit(req->queue->batch->adv, req->rdeaddr, req->msg, batch_advertised, req) != 0) {
+    req->advstatus = -1;
+    return;
+  }
+  req->pending = 1;
+}
+
+
+/* returns the message advertising locpreflist and preflist - consecutive
+ * requests usually carry the same preferences, so the message of the
+ * previous request is reused whenever possible */
+static struct rppmsg *batch_msg(struct rppbatch *b, const char *locpreflist, const char *preflist) {
+  struct rppmsg *msg;
+  char *loc, *pref;
+  if ((b->lastmsg != NULL) && (strcmp(b->lastloc, locpreflist) == 0) && (strcmp(b->lastpref, preflist) == 0)) {
+    return(rppmsg_ref(b->lastmsg));
+  }
+  msg = rppmsg_setinpref(b->advttl, locpreflist, preflist);
+  if ((msg != NULL) && (b->binary != 0)) {
+    struct rppmsg *bin = rppmsg_binary(msg);
+    if (bin != NULL) {
+      rppmsg_free(msg);
+      msg = bin;
+    }
+  }
+  loc = strdup(locpreflist);
+  pref = strdup(preflist);
+  if ((msg == NULL) || (loc == NULL) || (pref == NULL)) {
+    rppmsg_free(msg);
+    free(loc);
+    free(pref);
+    return(NULL);
+  }
+  rppmsg_free(b->lastmsg);
+  free(b->lastloc);
+  free(b->lastpref);
+  b->lastmsg = msg;
+  b->lastloc = loc;
+  b->lastpref = pref;
+  return(rppmsg_ref(msg));
+}
+
+
+/* looks up the controller of a request, walking up from its prefix towards
+ * shorter ones for as long as the cache knows these have no RDE record. a
+ * DNS query is submitted as soon as a zone is not in the cache. returns
+ * non-zero if a query is in flight, zero if resstatus is final. */
+static int batch_lookup(struct batchreq *req) {
+  struct rppbatch *b = req->queue->batch;
+  time_t now = time(NULL);
+  int len;
+
+  /* the controller of a covering prefix may be known already */
+  if (rppcache_lpm(b->cache, &(req->pfx), req->rdeaddr, sizeof(req->rdeaddr), now, &len) == 0) {
+    rppprefix_trunc(&(req->zone), &(req->pfx), len);
+    b->stats.cachehits++;
+    req->resstatus = 0;
+    return(0);
+  }
+
+  for (; req->walklen >= 0; req->walklen = rppprefix_walk(&(req->pfx), req->walklen)) {
+    rppprefix_trunc(&(req->zone), &(req->pfx), req->walklen);
+    req->resstatus = rppcache_get(b->cache, &(req->zone), req->rdeaddr, sizeof(req->rdeaddr), now);
+    if ((req->resstatus == 0) || (req->resstatus == 1)) b->stats.cachehits++;
+    if (req->resstatus == 0) return(0);
+    if (req->resstatus == 1) continue;
+    b->stats.cachemisses++;
+    /* the name of the zone is only needed to query it */
+    if (ip2revdns(b->revdns, sizeof(b->revdns), &(req->pfx), req->walklen) != 0) {
+      req->resstatus = -1;
+      return(0);
+    }
+    if (rppdns_submit(b->dns, b->revdns, batch_resolved, req) != 0) {
+      req->resstatus = -2;
+      return(0);
+    }
+    req->resstatus = 0;
+    req->pending = 1;
+    return(1);
+  }
+  req->resstatus = 1; /* no zone has any RDE record */
+  return(0);
+}
+
+
+/* called by the asynchronous resolver when a request got resolved */
+static void batch_resolved(void *priv, int status, const char *rdeaddr, unsigned long ttl) {
+  struct batchreq *req = priv;
+  req->pending = 0;
+  req->resstatus = status;
+  if ((ttl > 0) && (rppcache_put(req->queue->batch->cache, &(req->zone), status, rdeaddr, time(NULL) + ttl) == 0)) {
+    batch_cached(req->queue->batch, &(req->zone), ttl);
+  }
+  if (status == 0) {
+    snprintf(req->rdeaddr, sizeof(req->rdeaddr), "%s", rdeaddr);
+  } else if (status == 1) { /* no RDE record here, try the next shorter zone */
+    req->walklen = rppprefix_walk(&(req->pfx), req->walklen);
+    if ((req->walklen >= 0) && (batch_lookup(req) != 0)) return;
+  }
+  rpphist_add(&(req->queue->batch->stats.resolve), ustime() - req->start);
+  batch_advertise(req);
+  if (req->pending == 0) batch_complete(req);
+}
+
+
+/* resets the state of a request about to start, whose prefix is its line */
+static void batch_reset(struct batchreq *req) {
+  req->prefixorg = req->line;
+  req->msg = NULL;
+  req->pending = 0;
+  req->resstatus = 0;
+  req->advstatus = 0;
+  req->advlatency = 0;
+}
+
+
+/* looks up the controller of a request whose prefix is known */
+static void batch_begin(struct batchreq *req) {
+  req->walklen = rppprefix_walk(&(req->pfx), -1);
+  req->start = ustime();
+  if (batch_lookup(req) == 0) {
+    rpphist_add(&(req->queue->batch->stats.resolve), ustime() - req->start);
+    batch_advertise(req);
+  }
+}
+
+
+/* splits the line of a request and looks up its controller */
+static void batch_start(struct batchreq *req) {
+  struct rppqueue *q = req->queue;
+  char *line = req->line;
+  char *locpreflist, *preflist;
+
+  /* split the line into its remoteprefix, localprefixes and preflist fields */
+  batch_reset(req);
+  locpreflist = strchr(line, '\t');
+  if (locpreflist != NULL) {
+    *locpreflist++ = 0;
+    preflist = strchr(locpreflist, '\t');
+    if ((preflist == NULL) || (strchr(preflist + 1, '\t') != NULL)) {
+      req->resstatus = -1; /* malformed request */
+      return;
+    }
+    *preflist++ = 0;
+    req->msg = batch_msg(q->batch, locpreflist, preflist);
+    if (req->msg == NULL) {
+      req->resstatus = -1;
+      return;
+    }
+  } else if (q->defmsg != NULL) {
+    req->msg = rppmsg_ref(q->defmsg);
+  }
+
+  /* resolve RDE controller's address for the given prefix */
+  if (rppprefix_parse(&(req->pfx), req->prefixorg) != 0) {
+    req->resstatus = -1;
+    return;
+  }
+  batch_begin(req);
+}
+
+
+struct rppqueue *rppqueue_new(struct rppbatch *b, struct rppmsg *defmsg) {
+  struct rpparena *arena = b->spare;
+  struct rppqueue *q;
+  struct batchreq *win;
+  int i, size;
+
+  size = (b->maxbusy > MAXWINDOW / WINDOWFACTOR) ? MAXWINDOW : b->maxbusy * WINDOWFACTOR;
+  if (size < MINWINDOW) size = MINWINDOW;
+  if (size < b->maxbusy) size = b->maxbusy;
+  if (arena == NULL) arena = rpparena_new(ARENACHUNK);
+  if (arena == NULL) return(NULL);
+  b->spare = NULL;
+  q = rpparena_alloc(arena, sizeof(*q));
+  win = rpparena_alloc(arena, size * sizeof(*win));
+  if ((q == NULL) || (win == NULL)) {
+    rpparena_free(arena);
+    return(NULL);
+  }
+  memset(q, 0, sizeof(*q));
+  memset(win, 0, size * sizeof(*win));
+  q->batch = b;
+  q->arena = arena;
+  q->size = size;
+  q->win = win;
+  for (i = 0; i < q->size; i++) q->win[i].queue = q;
+  if (defmsg != NULL) q->defmsg = rppmsg_ref(defmsg);
+  return(q);
+}
+
+
+int rppqueue_ready(const struct rppqueue *q) {
+  /* requests in progress are bounded by the engine, the window only fills
+   * up with complete ones if the oldest request takes that long */
+  return((q->count < q->size) && (q->batch->busy < q->batch->maxbusy));
+}
+
+
+/* makes room for a line of len bytes (its end of string excluded) in a request
+ * @return 0 on success, non-zero if out of memory */
+static int batch_reserve(struct batchreq *req, size_t len) {
+  size_t newsz;
+  char *newline;
+  if (req->linesz >= len + 1) return(0);
+  /* lines only grow, by powers of 2 so that the arena wastes little */
+  newsz = (req->linesz == 0) ? 128 : req->linesz * 2;
+  while (newsz < len + 1) newsz *= 2;
+  newline = rpparena_alloc(req->queue->arena, newsz);
+  if (newline == NULL) return(-1);
+  req->line = newline;
+  req->linesz = newsz;
+  return(0);
+}
+
+
+/* queues request req, whose line could not be copied for lack of memory, as
+ * failed: it still gets a result line, an error for its remoteprefix */
+static void batch_failed(struct batchreq *req, const char *line, size_t len) {
+  struct rppqueue *q = req->queue;
+  size_t n;
+  for (n = 0; (n < len) && (n < sizeof(req->errline) - 1) && (line[n] != '\t'); n++);
+  memcpy(req->errline, line, n);
+  req->errline[n] = 0;
+  q->count++;
+  q->busy++;
+  q->batch->busy++;
+  batch_reset(req);
+  req->prefixorg = req->errline;
+  req->resstatus = -1;
+  batch_complete(req);
+}
+
+
+int rppqueue_submit(struct rppqueue *q, const char *line, size_t len) {
+  struct batchreq *req;
+
+  /* strip the trailing end of line */
+  while ((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r'))) len--;
+  /* skip empty lines and comments */
+  if ((len == 0) || (line[0] == '#')) return(1);
+  if (rppqueue_ready(q) == 0) return(-1);
+
+  req = &(q->win[(q->head + q->count) % q->size]);
+  if (batch_reserve(req, len) != 0) {
+    batch_failed(req, line, len);
+    return(0);
+  }
+  memcpy(req->line, line, len);
+  req->line[len] = 0;
+
+  q->count++;
+  q->busy++;
+  q->batch->busy++;
+  batch_start(req);
+  /* well-formed requests carrying their preferences get advertised again
+   * before these expire, from the line as it was submitted */
+  if ((q->batch->sched != NULL) && (req->resstatus != -1) && (memchr(line, '\t', len) != NULL)) {
+    struct rppbatch *b = q->batch;
+    size_t joblen = 1 + len + sizeof(long);
+    long until = (b->until != 0) ? b->until : mstime() + b->refreshfor;
+    if (b->jobsz < joblen) {
+      char *job = realloc(b->job, joblen);
+      if (job != NULL) {
+        b->job = job;
+        b->jobsz = joblen;
+      }
+    }
+    if (b->jobsz >= joblen) {
+      b->job[0] = 'A';
+      memcpy(b->job + 1, line, len);
+      memcpy(b->job + 1 + len, &until, sizeof(long));
+      batch_schedule(b, b->job, job_keylen(b->job, joblen), joblen, b->advttl);
+    }
+  }
+  if (req->pending == 0) batch_complete(req);
+  return(0);
+}
+
+
+int rppqueue_submitprefix(struct rppqueue *q, const struct rppprefix *pfx) {
+  struct batchreq *req;
+  char addr[INET6_ADDRSTRLEN], line[INET6_ADDRSTRLEN + 4];
+
+  if (rppqueue_ready(q) == 0) return(-1);
+  req = &(q->win[(q->head + q->count) % q->size]);
+  /* the prefix is only formatted for its result */
+  if (inet_ntop(pfx->family, pfx->addr, addr, sizeof(addr)) == NULL) strcpy(addr, "-");
+  sprintf(line, "%s/%d", addr, pfx->len);
+  if (batch_reserve(req, strlen(line)) != 0) {
+    batch_failed(req, line, strlen(line));
+    return(0);
+  }
+  strcpy(req->line, line);
+
+  q->count++;
+  q->busy++;
+  q->batch->busy++;
+  batch_reset(req);
+  if (q->defmsg != NULL) req->msg = rppmsg_ref(q->defmsg);
+  req->pfx = *pfx;
+  batch_begin(req);
+  if (req->pending == 0) batch_complete(req);
+  return(0);
+}
+
+
+/* appends len bytes of s to a result being formatted in buf - returns the
+ * length of the result, which goes on counting past maxlen like snprintf() */
+static size_t out_append(char *buf, size_t maxlen, size_t pos, const char *s, size_t len) {
+  if (pos < maxlen) memcpy(buf + pos, s, (len < maxlen - pos) ? len : maxlen - pos);
+  return(pos + len);
+}
+
+
+/* appends s to a result being formatted in buf as a JSON string, or null if
+ * s is NULL, see out_append() */
+static size_t out_json(char *buf, size_t maxlen, size_t pos, const char *s) {
+  char esc[8];
+  if (s == NULL) return(out_append(buf, maxlen, pos, "null", 4));
+  pos = out_append(buf, maxlen, pos, "\"", 1);
+  for (;;) {
+    size_t n = 0;
+    while ((s[n] != 0) && (s[n] != '"') && (s[n] != '\\') && ((unsigned char)s[n] >= 0x20)) n++;
+    pos = out_append(buf, maxlen, pos, s, n);
+    s += n;
+    if (*s == 0) break;
+    if ((*s == '"') || (*s == '\\')) {
+      esc[0] = '\\';
+      esc[1] = *s;
+      pos = out_append(buf, maxlen, pos, esc, 2);
+    } else {
+      sprintf(esc, "\\u%04x", (unsigned char)*s);
+      pos = out_append(buf, maxlen, pos, esc, 6);
+    }
+    s++;
+  }
+  return(out_append(buf, maxlen, pos, "\"", 1));
+}
+
+
+/* formats the result of a request as a JSON object, with the given prefix
+ * and controller fields, see rppqueue_pop() */
+static size_t batch_json(const struct batchreq *req, const char *prefix, const char *rdeaddr, const char *revdns, char *buf, size_t maxlen) {
+  char tail[96];
+  size_t pos;
+  pos = out_append(buf, maxlen, 0, "{\"prefix\":", 10);
+  pos = out_json(buf, maxlen, pos, prefix);
+  sprintf(tail, ",\"status\":%d,\"controller\":", req->resstatus);
+  pos = out_append(buf, maxlen, pos, tail, strlen(tail));
+  pos = out_json(buf, maxlen, pos, rdeaddr);
+  if ((req->resstatus != 0) || (req->msg == NULL)) {
+    sprintf(tail, ",\"advertise\":null,\"latency\":null,\"revdns\":");
+  } else {
+    sprintf(tail, ",\"advertise\":%d,\"latency\":%ld.%03ld,\"revdns\":", req->advstatus, req->advlatency / 1000, req->advlatency % 1000);
+  }
+  pos = out_append(buf, maxlen, pos, tail, strlen(tail));
+  pos = out_json(buf, maxlen, pos, revdns);
+  pos = out_append(buf, maxlen, pos, "}\n", 2);
+  if (maxlen > 0) buf[(pos < maxlen) ? pos : maxlen - 1] = 0;
+  return(pos);
+}
+
+
+int rppqueue_pop(struct rppqueue *q, char *buf, size_t maxlen) {
+  struct batchreq *req = &(q->win[q->head]);
+  char zone[128], prefix[64];
+  const char *revdns = NULL;
+  int len;
+
+  if ((q->count == 0) || (req->pending != 0)) return(0);
+  rppstats_code(q->batch->stats.resstatus, req->resstatus);
+  if ((req->resstatus == 0) && (req->msg != NULL)) {
+    rppstats_code(q->batch->stats.advstatus, req->advstatus);
+    rpphist_add(&(q->batch->stats.advertise), req->advlatency);
+  }
+  if ((req->resstatus == 0) && (ip2revdns(zone, sizeof(zone), &(req->zone), req->zone.len) == 0)) revdns = zone;
+  /* the remoteprefix is echoed cut, as no prefix is that long anyway, so
+   * that results fit in a line */
+  snprintf(prefix, sizeof(prefix), "%s", req->prefixorg);
+  if (q->batch->json != 0) {
+    len = (int)batch_json(req, prefix, (req->resstatus == 0) ? req->rdeaddr : NULL, revdns, buf, maxlen);
+    /* escaped, a controller from an odd TXT record may still not fit: the
+     * record then goes without its strings rather than being cut */
+    if (len >= (int)maxlen) len = (int)batch_json(req, NULL, NULL, revdns, buf, maxlen);
+  } else if (req->resstatus != 0) {
+    len = snprintf(buf, maxlen, "%s\t%d\t-\t-\t-\t-\n", prefix, req->resstatus);
+  } else if (req->msg == NULL) {
+    len = snprintf(buf, maxlen, "%s\t0\t%s\t-\t-\t%s\n", prefix, req->rdeaddr, (revdns != NULL) ? revdns : "-");
+  } else {
+    len = snprintf(buf, maxlen, "%s\t0\t%s\t%d\t%ld.%03ld\t%s\n", prefix, req->rdeaddr, req->advstatus, req->advlatency / 1000, req->advlatency % 1000, (revdns != NULL) ? revdns : "-");
+  }
+  if (len >= (int)maxlen) { /* truncated, still end the line */
+    len = maxlen - 1;
+    buf[len - 1] = '\n';
+  }
+  rppmsg_free(req->msg);
+  req->msg = NULL;
+  q->head = (q->head + 1) % q->size;
+  q->count--;
+  return(len);
+}
+
+
+int rppqueue_count(const struct rppqueue *q) {
+  return(q->count);
+}
+
+
+int rppqueue_size(const struct rppqueue *q) {
+  return(q->size);
+}
+
+
+void rppqueue_free(struct rppqueue *q) {
+  if (q == NULL) return;
+  rppmsg_free(q->defmsg);
+  q->defmsg = NULL;
+  if (q->busy == 0) {
+    queue_release(q);
+    return;
+  }
+  q->orphan = 1;
+  q->next = q->batch->orphans;
+  q->batch->orphans = q;
+}
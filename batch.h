@@ -0,0 +1,160 @@
+/**
+  * @brief resolution and advertisement of many requests at once
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_BATCH_H
+#define RPP_BATCH_H
+
+#include <poll.h>
+#include <stddef.h>
+
+#include "adv.h"
+#include "cache.h"
+#include "stats.h"
+
+/** @brief options of the request processing engine */
+struct rppopts {
+  int inflight;     /* max number of requests in progress */
+  int timeout;      /* DNS retransmission timeout, in ms */
+  int retries;      /* number of DNS retransmissions before giving up */
+  int advtimeout;   /* time allowed to connect to, then to send to a controller, in ms */
+  int keepalive;    /* time idle controller connections are kept open, in ms */
+  char *cachefile;  /* cache file shared between invocations, if any */
+  char *resolvers;  /* resolvers to use instead of the system ones, if any */
+  char *direct;     /* servers to start asking authoritative servers from, if any */
+  int incremental;  /* part of the TTL (in %) left when refreshing advertisements, 0 to always advertise everything */
+  int advttl;       /* TTL of the preferences advertised, in seconds */
+  int refresh;      /* part of the TTL (in %) left at most when re-advertising requests and refreshing hot cache entries, 0 to never refresh */
+  int refreshfor;   /* time (s) requests keep being re-advertised after they were last submitted */
+  int binary;       /* set to advertise binary frames rather than text, see rppmsg_binary() */
+  int iouring;      /* set to go through io_uring where available, see rppdns_uring() and rppadv_uring() */
+  int qps;          /* max DNS queries sent per second, 0 for no cap, see rppdns_ratelimit() */
+  int advrate;      /* max connection attempts to controllers per second, 0 for no cap, see rppadv_ratelimit() */
+  int json;         /* set to format results as JSON records rather than tab-separated lines, see rppqueue_pop() */
+};
+
+/** @brief sets options to their default values */
+void rppopts_default(struct rppopts *opts);
+
+/** @brief sets option 'name' (such as "--inflight") to val
+  * @return 0 on success, non-zero if the option is unknown or its value invalid */
+int rppopts_set(struct rppopts *opts, const char *name, const char *val);
+
+/** @brief prints the help of all options
+  * @param *def the default values of the options */
+void rppopts_printhelp(const struct rppopts *def);
+
+/** @brief request processing engine (opaque) */
+struct rppbatch;
+
+/** @brief a stream of requests whose results are output in order (opaque) */
+struct rppqueue;
+
+/** @brief creates a request processing engine - the resolver is initialized
+  * once for the whole life of the engine. if opts->refresh is set, the
+  * engine keeps re-advertising the requests that carry preferences, and
+  * refreshing the cache entries that get looked up, shortly before they
+  * expire - requests for opts->refreshfor seconds after they were last
+  * submitted, cache entries for as long as they get looked up
+  * @param *cache cache of already resolved controllers, shared by all queues
+  * @param *delta what controllers were advertised already, if advertising incrementally (see opts->incremental) - it may be shared by several engines
+  * @return a new engine, or NULL on error */
+struct rppbatch *rppbatch_new(const struct rppopts *opts, struct rppcache *cache, struct rppdelta *delta);
+
+/** @brief fills pfd with the file descriptors the engine waits on - and,
+  * going through io_uring, submits the I/O prepared so far, so that it is to
+  * be called right before waiting
+  * @return the number of file descriptors (at most RPPBATCH_NFDS) */
+int rppbatch_pollfds(struct rppbatch *b, struct pollfd *pfd);
+#define RPPBATCH_NFDS 2
+
+/** @brief returns the time (in ms) rppbatch_run() may be delayed at most, or
+  * -1 if nothing is in progress */
+int rppbatch_waittime(const struct rppbatch *b);
+
+/** @brief lets the engine process whatever it has to, without waiting */
+void rppbatch_run(struct rppbatch *b);
+
+/** @brief waits until the engine has something to do, and lets it do it */
+void rppbatch_wait(struct rppbatch *b);
+
+/** @brief returns what the engine went through so far: the requests it
+  * output results for, by status, the time they took, its cache lookups,
+  * DNS queries and connections to controllers */
+const struct rppstats *rppbatch_stats(const struct rppbatch *b);
+
+/** @brief frees an engine, which must not have any queues left */
+void rppbatch_free(struct rppbatch *b);
+
+/** @brief creates a queue of requests
+  * @param *defmsg preferences advertised for requests that carry none, if any
+  * @return a new queue, or NULL on error */
+struct rppqueue *rppqueue_new(struct rppbatch *b, struct rppmsg *defmsg);
+
+/** @brief returns non-zero if a request can be submitted to the queue right
+  * now, that is if neither the queue nor the engine are full */
+int rppqueue_ready(const struct rppqueue *q);
+
+/** @brief submits a request line: a remoteprefix, optionally followed by a
+  * tab, localprefixes, a tab and a preflist. trailing end of lines are
+  * ignored, the line is copied - or, if it does not fit in memory, the
+  * request is queued as failed, with a resolve status of -1.
+  * @return 0 if the request is queued, 1 if the line holds no request (empty
+  * line or comment), -1 if the queue is not ready */
+int rppqueue_submit(struct rppqueue *q, const char *line, size_t len);
+
+/** @brief submits a request for a prefix given in binary form, advertised
+  * the preferences of the queue if any - its result is the same as the one
+  * of a line holding the prefix alone, including when out of memory
+  * @return 0 if the request is queued, -1 if the queue is not ready */
+int rppqueue_submitprefix(struct rppqueue *q, const struct rppprefix *pfx);
+
+/** @brief formats the result of the oldest request of the queue, if it is
+  * complete, and removes it from the queue. results are tab-separated lines:
+  * remoteprefix resolvestatus controller advertisestatus latency revdns -
+  * where advertisestatus is the status of rppadv_cb and revdns the zone the
+  * controller was found at. with opts->json, they are one-line JSON objects
+  * with the same fields instead, the ones that do not apply being null.
+  * remoteprefix is cut to 63 bytes. a JSON record that does not fit in buf
+  * goes with null remoteprefix and controller rather than being cut
+  * @return the length of the result written to buf (truncated to maxlen - 1
+  * bytes if needed), or 0 if the oldest request is not complete yet */
+int rppqueue_pop(struct rppqueue *q, char *buf, size_t maxlen);
+
+/** @brief returns the number of requests in the queue */
+int rppqueue_count(const struct rppqueue *q);
+
+/** @brief returns the number of requests the queue holds at most, complete
+  * or in progress */
+int rppqueue_size(const struct rppqueue *q);
+
+/** @brief frees a queue - if requests are still in progress, their results
+  * are discarded and the queue is actually freed once they complete */
+void rppqueue_free(struct rppqueue *q);
+
+#endif
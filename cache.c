@@ -0,0 +1,600 @@
+/**
+  * @brief cache of resolved RDE controllers, keyed by revDNS name
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "radix.h"
+
+/* initial number of hash buckets, must be a power of 2 */
+#define INITBUCKETS 1024
+
+/* the cache file is a snapshot meant to be used in place: a header, an
+ * open-addressing hash table of the zones (a power of 2 of slots, at most
+ * half of them used) and a pool of the nul-terminated controller addresses,
+ * each of them stored once. loading the file only maps it: its entries are
+ * looked up there, for as long as the cache itself has nothing about their
+ * zone. the layout is the native one, the header tells whether it fits. */
+#define SNAPMAGIC "RPPSNAP\n"
+#define SNAPVERSION 1
+
+struct snaphdr {
+  char magic[8];
+  unsigned int version;
+  unsigned int slotsz;      /* sizeof(struct snapslot) */
+  unsigned int nslots;
+  unsigned int count;
+  unsigned int poolsz;
+  unsigned int lens[2][5];  /* lengths of the positive entries, as bitmaps for IPv4 and IPv6 */
+};
+
+struct snapslot {
+  unsigned int hash;        /* low 32 bits of zonehash(), the same on any platform */
+  unsigned int expiry;
+  unsigned int addroff;     /* offset of the controller address in the pool */
+  unsigned char family;     /* 4 or 6, 0 if the slot is empty */
+  unsigned char len;
+  unsigned char status;
+  unsigned char pad;
+  unsigned char addr[16];
+};
+
+/* a snapshot being built, see rppcache_save() */
+struct snapbuild {
+  struct snaphdr hdr;
+  struct snapslot *slots;
+  unsigned int *addrs;      /* offsets of the addresses in the pool, hashed - 0 if the slot is empty */
+  char *pool;
+  size_t poolcap;
+};
+
+struct cacheentry {
+  struct cacheentry *next;  /* next entry in the same bucket */
+  unsigned long hash;
+  time_t expiry;
+  int status;
+  int hot;                  /* set when looked up, see rppcache_hot() */
+  struct rppprefix zone;    /* the prefix the reverse zone stands for */
+  char *rdeaddr;            /* stored right after the structure */
+};
+
+struct rppcache {
+  struct cacheentry **buckets;
+  unsigned long bucketcount;
+  unsigned long count;
+  struct rppradix *prefixes;  /* positive entries, by the prefix of their name */
+  pthread_rwlock_t lock;      /* lookups share it, updates take it exclusively */
+  const struct snaphdr *snap; /* the snapshot loaded, if any - it is read-only */
+  size_t snapsz;
+};
+
+
+/* FNV-1a hash of a zone: its family, length and significant bytes */
+static unsigned long zonehash(const struct rppprefix *zone) {
+  unsigned long h = 2166136261lu;
+  int i;
+  h = (h ^ (unsigned char)zone->family) * 16777619lu;
+  h = (h ^ (unsigned char)zone->len) * 16777619lu;
+  for (i = 0; i < ((zone->len + 7) >> 3); i++) h = (h ^ zone->addr[i]) * 16777619lu;
+  return(h);
+}
+
+
+/* returns non-zero if both zones are the same */
+static int zonecmp(const struct rppprefix *a, const struct rppprefix *b) {
+  if ((a->family != b->family) || (a->len != b->len)) return(1);
+  return(memcmp(a->addr, b->addr, (a->len + 7) >> 3));
+}
+
+
+struct rppcache *rppcache_new(void) {
+  struct rppcache *cache;
+  cache = calloc(1, sizeof(*cache));
+  if (cache == NULL) return(NULL);
+  if (pthread_rwlock_init(&(cache->lock), NULL) != 0) {
+    free(cache);
+    return(NULL);
+  }
+  cache->bucketcount = INITBUCKETS;
+  cache->buckets = calloc(cache->bucketcount, sizeof(*(cache->buckets)));
+  cache->prefixes = rppradix_new();
+  if ((cache->buckets == NULL) || (cache->prefixes == NULL)) {
+    rppcache_free(cache);
+    return(NULL);
+  }
+  return(cache);
+}
+
+
+/* returns the entry of a zone, or NULL if the zone is not in the cache */
+static struct cacheentry *cache_find(const struct rppcache *cache, const struct rppprefix *zone, unsigned long hash) {
+  struct cacheentry *e;
+  for (e = cache->buckets[hash & (cache->bucketcount - 1)]; e != NULL; e = e->next) {
+    if ((e->hash == hash) && (zonecmp(&(e->zone), zone) == 0)) return(e);
+  }
+  return(NULL);
+}
+
+
+/* doubles the number of buckets - failing to do so is not an error, the
+ * cache just gets slower */
+static void cache_grow(struct rppcache *cache) {
+  struct cacheentry **newbuckets;
+  unsigned long i, newcount = cache->bucketcount * 2;
+  newbuckets = calloc(newcount, sizeof(*newbuckets));
+  if (newbuckets == NULL) return;
+  for (i = 0; i < cache->bucketcount; i++) {
+    while (cache->buckets[i] != NULL) {
+      struct cacheentry *e = cache->buckets[i];
+      cache->buckets[i] = e->next;
+      e->next = newbuckets[e->hash & (newcount - 1)];
+      newbuckets[e->hash & (newcount - 1)] = e;
+    }
+  }
+  free(cache->buckets);
+  cache->buckets = newbuckets;
+  cache->bucketcount = newcount;
+}
+
+
+/* drops the entries that expired, along with their prefixes */
+static void cache_sweep(struct rppcache *cache, time_t now) {
+  unsigned long i;
+  for (i = 0; i < cache->bucketcount; i++) {
+    struct cacheentry **link = &(cache->buckets[i]), *e;
+    while ((e = *link) != NULL) {
+      if (e->expiry > now) {
+        link = &(e->next);
+        continue;
+      }
+      if (e->status == 0) (void)rppradix_remove(cache->prefixes, &(e->zone));
+      *link = e->next;
+      free(e);
+      cache->count--;
+    }
+  }
+}
+
+
+/* returns the slots of the snapshot */
+static const struct snapslot *snap_slots(const struct snaphdr *snap) {
+  return((const struct snapslot *)(snap + 1));
+}
+
+
+/* returns the pool of addresses of the snapshot */
+static const char *snap_pool(const struct snaphdr *snap) {
+  return((const char *)(snap_slots(snap) + snap->nslots));
+}
+
+
+/* returns the slot of a zone in the snapshot, or NULL if it is not there */
+static const struct snapslot *snap_find(const struct snaphdr *snap, const struct rppprefix *zone, unsigned long hash) {
+  const struct snapslot *slots = snap_slots(snap);
+  unsigned int h = (unsigned int)(hash & 0xfffffffful), mask = snap->nslots - 1, i, n;
+  int family = (zone->family == AF_INET6) ? 6 : 4;
+  for (i = h & mask, n = 0; (n <= mask) && (slots[i].family != 0); i = (i + 1) & mask, n++) {
+    const struct snapslot *sl = &(slots[i]);
+    if ((sl->hash == h) && (sl->family == family) && (sl->len == zone->len) && (memcmp(sl->addr, zone->addr, (zone->len + 7) >> 3) == 0)) return(sl);
+  }
+  return(NULL);
+}
+
+
+/* looks a zone up in the snapshot, like rppcache_get() does - the caller
+ * makes sure the cache itself has no entry for it, as these are newer */
+static int snap_get(const struct snaphdr *snap, const struct rppprefix *zone, unsigned long hash, char *rdeaddr, int maxlen, time_t now) {
+  const struct snapslot *sl = snap_find(snap, zone, hash);
+  if ((sl == NULL) || ((time_t)sl->expiry <= now) || (sl->status > 1) || (sl->addroff >= snap->poolsz)) return(-1);
+  if ((sl->status == 0) && (rdeaddr != NULL)) snprintf(rdeaddr, maxlen, "%s", snap_pool(snap) + sl->addroff);
+  return(sl->status);
+}
+
+
+/* looks up the controller of the longest prefix that covers pfx in the
+ * snapshot, among the ones longer than minlen - only the lengths the
+ * snapshot has controllers for are looked at
+ * @return the length of the prefix found, or -1 on a miss */
+static int snap_lpm(const struct rppcache *cache, const struct rppprefix *pfx, int minlen, char *rdeaddr, int maxlen, time_t now) {
+  const unsigned int *lens = cache->snap->lens[(pfx->family == AF_INET6) ? 1 : 0];
+  struct rppprefix zone;
+  int len;
+  for (len = (pfx->len < 128) ? pfx->len : 128; len > minlen; len--) {
+    unsigned long hash;
+    if ((lens[len >> 5] & (1u << (len & 31))) == 0) continue;
+    rppprefix_trunc(&zone, pfx, len);
+    hash = zonehash(&zone);
+    if (cache_find(cache, &zone, hash) != NULL) continue;
+    if (snap_get(cache->snap, &zone, hash, rdeaddr, maxlen, now) == 0) return(len);
+  }
+  return(-1);
+}
+
+
+/* looks a zone up, like rppcache_get() does - the caller holds the lock, and
+ * rdeaddr may be NULL if only the status matters */
+static int cache_get(struct rppcache *cache, const struct rppprefix *zone, char *rdeaddr, int maxlen, time_t now) {
+  struct cacheentry *e;
+  unsigned long hash = zonehash(zone);
+  e = cache_find(cache, zone, hash);
+  if ((e != NULL) && (e->expiry > now)) {
+    if ((e->status == 0) && (rdeaddr != NULL)) snprintf(rdeaddr, maxlen, "%s", e->rdeaddr);
+    /* lookups share the lock, the mark is only written when not set yet */
+    if (e->hot == 0) __sync_fetch_and_or(&(e->hot), 1);
+    return(e->status);
+  }
+  if ((e == NULL) && (cache->snap != NULL)) return(snap_get(cache->snap, zone, hash, rdeaddr, maxlen, now));
+  return(-1);
+}
+
+
+int rppcache_get(struct rppcache *cache, const struct rppprefix *zone, char *rdeaddr, int maxlen, time_t now) {
+  int res;
+  pthread_rwlock_rdlock(&(cache->lock));
+  res = cache_get(cache, zone, rdeaddr, maxlen, now);
+  pthread_rwlock_unlock(&(cache->lock));
+  return(res);
+}
+
+
+int rppcache_lpm(struct rppcache *cache, const struct rppprefix *pfx, char *rdeaddr, int maxlen, time_t now, int *len) {
+  struct rppprefix zone;
+  const char *addr;
+  int res = -1, plen = -1, slen, zlen;
+  pthread_rwlock_rdlock(&(cache->lock));
+  addr = rppradix_lookup(cache->prefixes, pfx, now, &plen);
+  if (addr != NULL) {
+    snprintf(rdeaddr, maxlen, "%s", addr);
+    res = 0;
+  } else {
+    plen = -1;
+  }
+  /* the snapshot may know of a longer prefix */
+  if ((cache->snap != NULL) && ((slen = snap_lpm(cache, pfx, plen, rdeaddr, maxlen, now)) >= 0)) {
+    plen = slen;
+    res = 0;
+  }
+  /* the walk asks the longer zones first, and any of them may publish a
+   * controller of its own: the prefix found only holds if they are all
+   * known to have no RDE record */
+  zlen = rppprefix_walk(pfx, -1);
+  if (zlen < 0) res = -1;
+  for (; (res == 0) && (zlen > plen); zlen = rppprefix_walk(pfx, zlen)) {
+    rppprefix_trunc(&zone, pfx, zlen);
+    if (cache_get(cache, &zone, NULL, 0, now) != 1) res = -1;
+  }
+  pthread_rwlock_unlock(&(cache->lock));
+  if ((res == 0) && (len != NULL)) *len = plen;
+  return(res);
+}
+
+
+/* inserts an entry, the caller holds the lock exclusively */
+static int cache_put(struct rppcache *cache, const struct rppprefix *zone, int status, const char *rdeaddr, time_t expiry) {
+  struct cacheentry *e, **bucket;
+  unsigned long hash;
+  size_t addrlen;
+
+  if ((status != 0) && (status != 1)) return(-1);
+  if (status != 0) rdeaddr = "";
+
+  /* controllers are also indexed by prefix, for longest-match lookups - and
+   * a zone that has none anymore must not be found there either */
+  if ((status == 0) && (rppradix_insert(cache->prefixes, zone, rdeaddr, expiry) != 0)) return(-1);
+  if (status == 1) (void)rppradix_remove(cache->prefixes, zone);
+
+  /* drop any previous entry of this zone */
+  hash = zonehash(zone);
+  bucket = &(cache->buckets[hash & (cache->bucketcount - 1)]);
+  for (; *bucket != NULL; bucket = &((*bucket)->next)) {
+    e = *bucket;
+    if ((e->hash != hash) || (zonecmp(&(e->zone), zone) != 0)) continue;
+    *bucket = e->next;
+    free(e);
+    cache->count--;
+    break;
+  }
+
+  addrlen = strlen(rdeaddr) + 1;
+  e = malloc(sizeof(*e) + addrlen);
+  if (e == NULL) return(-1);
+  e->hash = hash;
+  e->expiry = expiry;
+  e->status = status;
+  e->hot = 0;
+  e->zone = *zone;
+  e->rdeaddr = (char *)(e + 1);
+  memcpy(e->rdeaddr, rdeaddr, addrlen);
+
+  /* the buckets are full: expired entries make room first, and the buckets
+   * only grow if that leaves them more than half full - so that sweeps take
+   * no more than a constant time per entry inserted */
+  if (cache->count >= cache->bucketcount) {
+    cache_sweep(cache, time(NULL));
+    if (cache->count >= cache->bucketcount / 2) cache_grow(cache);
+  }
+  bucket = &(cache->buckets[hash & (cache->bucketcount - 1)]);
+  e->next = *bucket;
+  *bucket = e;
+  cache->count++;
+  return(0);
+}
+
+
+int rppcache_put(struct rppcache *cache, const struct rppprefix *zone, int status, const char *rdeaddr, time_t expiry) {
+  int res;
+  pthread_rwlock_wrlock(&(cache->lock));
+  res = cache_put(cache, zone, status, rdeaddr, expiry);
+  pthread_rwlock_unlock(&(cache->lock));
+  return(res);
+}
+
+
+int rppcache_hot(struct rppcache *cache, const struct rppprefix *zone) {
+  struct cacheentry *e;
+  int hot = 0;
+  pthread_rwlock_wrlock(&(cache->lock));
+  e = cache_find(cache, zone, zonehash(zone));
+  if (e != NULL) {
+    hot = e->hot;
+    e->hot = 0;
+    /* controllers are mostly found by prefix */
+    if ((e->status == 0) && (rppradix_hot(cache->prefixes, zone) != 0)) hot = 1;
+  }
+  pthread_rwlock_unlock(&(cache->lock));
+  return(hot);
+}
+
+
+/* checks that a snapshot of sz bytes is consistent, so that lookups can
+ * trust its layout - entries are still checked as they are used */
+static int snap_check(const struct snaphdr *snap, size_t sz) {
+  size_t need;
+  if ((sz < sizeof(*snap)) || (memcmp(snap->magic, SNAPMAGIC, sizeof(snap->magic)) != 0)) return(-1);
+  if ((snap->version != SNAPVERSION) || (snap->slotsz != sizeof(struct snapslot))) return(-1);
+  if ((snap->nslots == 0) || ((snap->nslots & (snap->nslots - 1)) != 0) || (snap->count >= snap->nslots)) return(-1);
+  if ((snap->poolsz == 0) || (snap->nslots > (sz - sizeof(*snap)) / sizeof(struct snapslot))) return(-1);
+  need = sizeof(*snap) + (size_t)snap->nslots * sizeof(struct snapslot) + snap->poolsz;
+  if ((need < sizeof(*snap)) || (need != sz)) return(-1);
+  if (snap_pool(snap)[snap->poolsz - 1] != 0) return(-1);
+  return(0);
+}
+
+
+/* copies the valid entries of a snapshot in the cache itself */
+static void snap_copy(struct rppcache *cache, const struct snaphdr *snap) {
+  const struct snapslot *slots = snap_slots(snap);
+  time_t now = time(NULL);
+  unsigned int i;
+  for (i = 0; i < snap->nslots; i++) {
+    struct rppprefix zone;
+    if ((slots[i].family == 0) || ((time_t)slots[i].expiry <= now) || (slots[i].addroff >= snap->poolsz)) continue;
+    if (slots[i].len > ((slots[i].family == 6) ? 128 : 32)) continue;
+    memset(&zone, 0, sizeof(zone));
+    zone.family = (slots[i].family == 6) ? AF_INET6 : AF_INET;
+    zone.len = slots[i].len;
+    memcpy(zone.addr, slots[i].addr, sizeof(zone.addr));
+    rppcache_put(cache, &zone, slots[i].status, snap_pool(snap) + slots[i].addroff, slots[i].expiry);
+  }
+}
+
+
+int rppcache_load(struct rppcache *cache, const char *fname) {
+  char magic[sizeof(((struct snaphdr *)NULL)->magic)];
+  struct stat st;
+  void *map;
+  int fdn;
+
+  fdn = open(fname, O_RDONLY);
+  if (fdn < 0) return((errno == ENOENT) ? 0 : -1);
+
+  /* only snapshots are read, they are mapped and used as they are */
+  if ((read(fdn, magic, sizeof(magic)) != (ssize_t)sizeof(magic)) || (memcmp(magic, SNAPMAGIC, sizeof(magic)) != 0)) {
+    close(fdn);
+    errno = EINVAL;
+    return(-1);
+  }
+  if (fstat(fdn, &st) != 0) {
+    close(fdn);
+    return(-1);
+  }
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fdn, 0);
+  close(fdn);
+  if (map == MAP_FAILED) return(-1);
+  if (snap_check(map, (size_t)st.st_size) != 0) {
+    munmap(map, (size_t)st.st_size);
+    errno = EINVAL;
+    return(-1);
+  }
+  pthread_rwlock_wrlock(&(cache->lock));
+  if (cache->snap == NULL) {
+    cache->snap = map;
+    cache->snapsz = (size_t)st.st_size;
+    map = NULL;
+  }
+  pthread_rwlock_unlock(&(cache->lock));
+  /* only one snapshot is used in place, the entries of others are copied */
+  if (map != NULL) {
+    snap_copy(cache, map);
+    munmap(map, (size_t)st.st_size);
+  }
+  return(0);
+}
+
+
+/* FNV-1a hash of a controller address */
+static unsigned long addrhash(const char *s) {
+  unsigned long h = 2166136261lu;
+  while (*s != 0) h = (h ^ (unsigned char)*s++) * 16777619lu;
+  return(h);
+}
+
+
+/* returns the offset of an address in the pool of a snapshot being built,
+ * adding it if it is not there yet - or 0 on error */
+static unsigned int snap_addr(struct snapbuild *sb, const char *rdeaddr) {
+  unsigned int mask = sb->hdr.nslots - 1, i;
+  size_t len = strlen(rdeaddr) + 1;
+  if (*rdeaddr == 0) return(0);
+  for (i = addrhash(rdeaddr) & mask; sb->addrs[i] != 0; i = (i + 1) & mask) {
+    if (strcmp(sb->pool + sb->addrs[i], rdeaddr) == 0) return(sb->addrs[i]);
+  }
+  if (sb->hdr.poolsz + len > sb->poolcap) {
+    size_t newcap = (sb->poolcap * 2 > sb->hdr.poolsz + len) ? sb->poolcap * 2 : sb->hdr.poolsz + len;
+    char *newpool;
+    if ((newcap > 0xfffffffful) || ((newpool = realloc(sb->pool, newcap)) == NULL)) return(0);
+    sb->pool = newpool;
+    sb->poolcap = newcap;
+  }
+  memcpy(sb->pool + sb->hdr.poolsz, rdeaddr, len);
+  sb->addrs[i] = sb->hdr.poolsz;
+  sb->hdr.poolsz += len;
+  return(sb->addrs[i]);
+}
+
+
+/* adds an entry to a snapshot being built
+ * @return 0 on success, non-zero otherwise */
+static int snap_add(struct snapbuild *sb, const struct rppprefix *zone, unsigned long hash, int status, const char *rdeaddr, time_t expiry) {
+  unsigned int mask = sb->hdr.nslots - 1, h = (unsigned int)(hash & 0xfffffffful), i;
+  struct snapslot *sl;
+  int v6 = (zone->family == AF_INET6);
+  if ((zone->len < 0) || (zone->len > (v6 ? 128 : 32)) || (sb->hdr.count >= mask)) return(-1);
+  for (i = h & mask; sb->slots[i].family != 0; i = (i + 1) & mask);
+  sl = &(sb->slots[i]);
+  if ((status == 0) && ((sl->addroff = snap_addr(sb, rdeaddr)) == 0)) return(-1);
+  sl->hash = h;
+  sl->expiry = ((unsigned long)expiry > 0xfffffffful) ? 0xffffffffu : (unsigned int)expiry;
+  sl->family = v6 ? 6 : 4;
+  sl->len = (unsigned char)zone->len;
+  sl->status = (unsigned char)status;
+  memcpy(sl->addr, zone->addr, sizeof(sl->addr));
+  if (status == 0) sb->hdr.lens[v6][zone->len >> 5] |= 1u << (zone->len & 31);
+  sb->hdr.count++;
+  return(0);
+}
+
+
+int rppcache_save(const struct rppcache *cache, const char *fname) {
+  pthread_rwlock_t *lock = (pthread_rwlock_t *)&(cache->lock);
+  struct snapbuild sb;
+  FILE *fd;
+  char *tmpname;
+  time_t now = time(NULL);
+  unsigned long i, total;
+  int res = 0;
+
+  /* write to a temporary file first, then move it over the old cache */
+  tmpname = malloc(strlen(fname) + 16);
+  if (tmpname == NULL) return(-1);
+  sprintf(tmpname, "%s.%lu", fname, (unsigned long)getpid());
+  fd = fopen(tmpname, "w");
+  if (fd == NULL) {
+    free(tmpname);
+    return(-1);
+  }
+
+  pthread_rwlock_rdlock(lock);
+  /* the snapshot gets the entries of the cache, and those of the snapshot
+   * in use that the cache does not override */
+  memset(&sb, 0, sizeof(sb));
+  memcpy(sb.hdr.magic, SNAPMAGIC, sizeof(sb.hdr.magic));
+  sb.hdr.version = SNAPVERSION;
+  sb.hdr.slotsz = sizeof(struct snapslot);
+  total = cache->count + ((cache->snap != NULL) ? cache->snap->count : 0);
+  for (sb.hdr.nslots = 16; (sb.hdr.nslots < 0x80000000u) && (sb.hdr.nslots < total * 2); sb.hdr.nslots *= 2);
+  sb.hdr.poolsz = 1;
+  sb.poolcap = 4096;
+  sb.slots = calloc(sb.hdr.nslots, sizeof(*(sb.slots)));
+  sb.addrs = calloc(sb.hdr.nslots, sizeof(*(sb.addrs)));
+  sb.pool = calloc(1, sb.poolcap);
+  if ((sb.slots == NULL) || (sb.addrs == NULL) || (sb.pool == NULL)) res = -1;
+  for (i = 0; (res == 0) && (i < cache->bucketcount); i++) {
+    const struct cacheentry *e;
+    for (e = cache->buckets[i]; (res == 0) && (e != NULL); e = e->next) {
+      if (e->expiry <= now) continue;
+      res = snap_add(&sb, &(e->zone), e->hash, e->status, e->rdeaddr, e->expiry);
+    }
+  }
+  for (i = 0; (res == 0) && (cache->snap != NULL) && (i < cache->snap->nslots); i++) {
+    const struct snapslot *sl = &(snap_slots(cache->snap)[i]);
+    struct rppprefix zone;
+    unsigned long hash;
+    if ((sl->family == 0) || ((time_t)sl->expiry <= now) || (sl->addroff >= cache->snap->poolsz)) continue;
+    memset(&zone, 0, sizeof(zone));
+    zone.family = (sl->family == 6) ? AF_INET6 : AF_INET;
+    zone.len = sl->len;
+    memcpy(zone.addr, sl->addr, sizeof(zone.addr));
+    hash = zonehash(&zone);
+    if (cache_find(cache, &zone, hash) != NULL) continue;
+    res = snap_add(&sb, &zone, hash, sl->status, snap_pool(cache->snap) + sl->addroff, sl->expiry);
+  }
+  pthread_rwlock_unlock(lock);
+
+  if ((res == 0) && ((fwrite(&(sb.hdr), sizeof(sb.hdr), 1, fd) != 1) ||
+                     (fwrite(sb.slots, sizeof(*(sb.slots)), sb.hdr.nslots, fd) != sb.hdr.nslots) ||
+                     (fwrite(sb.pool, 1, sb.hdr.poolsz, fd) != sb.hdr.poolsz))) res = -1;
+  free(sb.slots);
+  free(sb.addrs);
+  free(sb.pool);
+
+  if (fclose(fd) != 0) res = -1;
+  if ((res == 0) && (rename(tmpname, fname) != 0)) res = -1;
+  if (res != 0) remove(tmpname);
+  free(tmpname);
+  return(res);
+}
+
+
+void rppcache_free(struct rppcache *cache) {
+  unsigned long i;
+  if (cache == NULL) return;
+  rppradix_free(cache->prefixes);
+  for (i = 0; (cache->buckets != NULL) && (i < cache->bucketcount); i++) {
+    while (cache->buckets[i] != NULL) {
+      struct cacheentry *e = cache->buckets[i];
+      cache->buckets[i] = e->next;
+      free(e);
+    }
+  }
+  free(cache->buckets);
+  if (cache->snap != NULL) munmap((void *)cache->snap, cache->snapsz);
+  pthread_rwlock_destroy(&(cache->lock));
+  free(cache);
+}
@@ -0,0 +1,96 @@
+/**
+  * @brief cache of resolved RDE controllers, keyed by revDNS name
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_CACHE_H
+#define RPP_CACHE_H
+
+#include <time.h>
+
+#include "revdns.h"
+
+/** @brief controller cache (opaque) - it may be shared between threads,
+  * lookups run concurrently while updates are serialized */
+struct rppcache;
+
+/** @brief creates an empty cache
+  * @return a new cache, or NULL on error */
+struct rppcache *rppcache_new(void);
+
+/** @brief looks up a reverse zone in the cache
+  * @param *zone the prefix the zone stands for, see rppprefix_trunc()
+  * @param *rdeaddr filled with the controller address on positive hits
+  * @param maxlen the amount of space available in *rdeaddr
+  * @param now the current time, entries that expired by then are ignored
+  * @return 0 on a positive hit, 1 on a negative hit (the zone is known to have no RDE record), -1 on a miss
+  */
+int rppcache_get(struct rppcache *cache, const struct rppprefix *zone, char *rdeaddr, int maxlen, time_t now);
+
+/** @brief looks up the controller of the longest cached prefix that covers
+  * pfx - controllers found at reverse zones are known for the whole prefix
+  * their zone stands for. a hit is the result the zone walk of
+  * rppprefix_walk() would have: every longer zone it goes through must be
+  * cached as having no RDE record, or the lookup misses
+  * @param *rdeaddr filled with the controller address on hits
+  * @param maxlen the amount of space available in *rdeaddr
+  * @param now the current time, entries that expired by then are ignored
+  * @param *len filled with the length of the prefix found on hits, if not NULL
+  * @return 0 on hit, -1 on a miss
+  */
+int rppcache_lpm(struct rppcache *cache, const struct rppprefix *pfx, char *rdeaddr, int maxlen, time_t now, int *len);
+
+/** @brief inserts (or replaces) the result of a resolution in the cache
+  * @param *zone the prefix the resolved reverse zone stands for
+  * @param status the resolution status: 0 for a controller, 1 for the absence of RDE record - other statuses are not cached
+  * @param *rdeaddr the controller address (used only if status is 0)
+  * @param expiry the time at which the entry expires
+  * @return 0 on success, non-zero otherwise */
+int rppcache_put(struct rppcache *cache, const struct rppprefix *zone, int status, const char *rdeaddr, time_t expiry);
+
+/** @brief tells whether the entry of a zone has been looked up since it was
+  * stored or since the last call, and clears that mark - hot entries are
+  * worth refreshing before they expire
+  * @return non-zero if the entry is hot, zero if it is cold or not cached */
+int rppcache_hot(struct rppcache *cache, const struct rppprefix *zone);
+
+/** @brief loads a cache file - snapshots written by rppcache_save() are
+  * mapped and looked up in place rather than parsed, their entries giving
+  * way to the ones the cache gets later on
+  * @return 0 on success (including if the file does not exist), non-zero otherwise - including if the file is not a snapshot */
+int rppcache_load(struct rppcache *cache, const char *fname);
+
+/** @brief saves all valid entries, including those of the snapshot in use,
+  * to a cache file in the snapshot format - the file is replaced
+  * atomically, so other processes always see a complete cache
+  * @return 0 on success, non-zero otherwise */
+int rppcache_save(const struct rppcache *cache, const char *fname);
+
+/** @brief frees a cache and all its entries */
+void rppcache_free(struct rppcache *cache);
+
+#endif
@@ -0,0 +1,261 @@
+/**
+  * @brief what RDE controllers were advertised, for incremental advertisements
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <ctype.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+
+/* initial number of hash buckets, must be a power of 2 */
+#define INITBUCKETS 1024
+
+/* max length of the key of a controller, see ctrlkey() */
+#define MAXCTRLKEY 24
+
+/* local prefixes longer than this are not tracked, and always advertised */
+#define MAXPFXLEN 128
+
+#define FNVINIT 2166136261lu
+
+struct deltaentry {
+  struct deltaentry *next;  /* next entry in the same bucket */
+  unsigned long hash;       /* hash of the key */
+  unsigned long prefhash;   /* hash of the preflist advertised */
+  time_t refresh;           /* time after which the advertisement is refreshed */
+  time_t expiry;            /* time the controller forgets it */
+  int keylen;
+  unsigned char *key;       /* key of the controller, then the local prefix -
+                               stored right after the structure */
+};
+
+struct rppdelta {
+  struct deltaentry **buckets;
+  unsigned long bucketcount;
+  unsigned long count;
+  int refresh;              /* part of the TTL left when refreshing, in % */
+  pthread_mutex_t lock;
+};
+
+
+/* FNV-1a hash of len bytes, continuing hash h */
+static unsigned long fnv(unsigned long h, const void *data, size_t len) {
+  const unsigned char *p = data;
+  while (len-- > 0) h = (h ^ *p++) * 16777619lu;
+  return(h);
+}
+
+
+/* writes the key of a controller to key: its family, port and address
+ * @return the length of the key */
+static int ctrlkey(const struct sockaddr *addr, unsigned char *key) {
+  memcpy(key, &(addr->sa_family), sizeof(addr->sa_family));
+  if (addr->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)addr;
+    memcpy(key + 2, &(a6->sin6_port), 2);
+    memcpy(key + 4, &(a6->sin6_addr), 16);
+    memcpy(key + 20, &(a6->sin6_scope_id), 4);
+    return(24);
+  } else {
+    const struct sockaddr_in *a4 = (const struct sockaddr_in *)addr;
+    memcpy(key + 2, &(a4->sin_port), 2);
+    memcpy(key + 4, &(a4->sin_addr), 4);
+    return(8);
+  }
+}
+
+
+/* returns the next prefix of a blank-separated list, or NULL at the end of
+ * the list - *s is moved past it */
+static const char *nextpfx(const char **s, const char *end, size_t *len) {
+  const char *pfx;
+  while ((*s < end) && (isspace((unsigned char)**s))) (*s)++;
+  if (*s == end) return(NULL);
+  pfx = *s;
+  while ((*s < end) && (!isspace((unsigned char)**s))) (*s)++;
+  *len = *s - pfx;
+  return(pfx);
+}
+
+
+struct rppdelta *rppdelta_new(int refresh) {
+  struct rppdelta *d;
+  if ((refresh < 0) || (refresh > 100)) return(NULL);
+  d = calloc(1, sizeof(*d));
+  if (d == NULL) return(NULL);
+  if (pthread_mutex_init(&(d->lock), NULL) != 0) {
+    free(d);
+    return(NULL);
+  }
+  d->refresh = refresh;
+  d->bucketcount = INITBUCKETS;
+  d->buckets = calloc(d->bucketcount, sizeof(*(d->buckets)));
+  if (d->buckets == NULL) {
+    rppdelta_free(d);
+    return(NULL);
+  }
+  return(d);
+}
+
+
+/* returns the entry of a local prefix for the controller of key, or NULL */
+static struct deltaentry *delta_find(const struct rppdelta *d, const unsigned char *key, int keylen, const char *pfx, size_t len, unsigned long hash) {
+  struct deltaentry *e;
+  for (e = d->buckets[hash & (d->bucketcount - 1)]; e != NULL; e = e->next) {
+    if ((e->hash != hash) || (e->keylen != keylen + (int)len)) continue;
+    if ((memcmp(e->key, key, keylen) == 0) && (memcmp(e->key + keylen, pfx, len) == 0)) return(e);
+  }
+  return(NULL);
+}
+
+
+/* makes room for more entries: entries that expired are dropped, then the
+ * number of buckets is doubled if that was not enough - failing to do so is
+ * not an error, the state just gets slower */
+static void delta_grow(struct rppdelta *d, time_t now) {
+  struct deltaentry **newbuckets, **pe;
+  unsigned long i, newcount = d->bucketcount * 2;
+
+  for (i = 0; i < d->bucketcount; i++) {
+    for (pe = &(d->buckets[i]); *pe != NULL;) {
+      struct deltaentry *e = *pe;
+      if (e->expiry > now) {
+        pe = &(e->next);
+        continue;
+      }
+      *pe = e->next;
+      free(e);
+      d->count--;
+    }
+  }
+  if (d->count < d->bucketcount / 2) return;
+
+  newbuckets = calloc(newcount, sizeof(*newbuckets));
+  if (newbuckets == NULL) return;
+  for (i = 0; i < d->bucketcount; i++) {
+    while (d->buckets[i] != NULL) {
+      struct deltaentry *e = d->buckets[i];
+      d->buckets[i] = e->next;
+      e->next = newbuckets[e->hash & (newcount - 1)];
+      newbuckets[e->hash & (newcount - 1)] = e;
+    }
+  }
+  free(d->buckets);
+  d->buckets = newbuckets;
+  d->bucketcount = newcount;
+}
+
+
+int rppdelta_filter(struct rppdelta *d, const struct sockaddr *addr, const char *loc, size_t loclen, const char *pref, size_t preflen, time_t now, char *out, size_t *outlen) {
+  unsigned char key[MAXCTRLKEY];
+  unsigned long ctrlhash, prefhash;
+  const char *end = loc + loclen, *pfx;
+  size_t len;
+  int keylen, skipped = 0;
+
+  keylen = ctrlkey(addr, key);
+  ctrlhash = fnv(FNVINIT, key, keylen);
+  prefhash = fnv(FNVINIT, pref, preflen);
+  *outlen = 0;
+
+  pthread_mutex_lock(&(d->lock));
+  while ((pfx = nextpfx(&loc, end, &len)) != NULL) {
+    struct deltaentry *e = NULL;
+    if (len <= MAXPFXLEN) e = delta_find(d, key, keylen, pfx, len, fnv(ctrlhash, pfx, len));
+    if ((e != NULL) && (e->prefhash == prefhash) && (e->refresh > now)) {
+      skipped++;
+      continue;
+    }
+    if (*outlen > 0) out[(*outlen)++] = ' ';
+    memcpy(out + *outlen, pfx, len);
+    *outlen += len;
+  }
+  pthread_mutex_unlock(&(d->lock));
+  return(skipped);
+}
+
+
+int rppdelta_commit(struct rppdelta *d, const struct sockaddr *addr, const char *loc, size_t loclen, const char *pref, size_t preflen, time_t now, long ttl) {
+  unsigned char key[MAXCTRLKEY];
+  unsigned long ctrlhash, prefhash, hash;
+  const char *end = loc + loclen, *pfx;
+  size_t len;
+  int keylen, res = 0;
+
+  keylen = ctrlkey(addr, key);
+  ctrlhash = fnv(FNVINIT, key, keylen);
+  prefhash = fnv(FNVINIT, pref, preflen);
+
+  pthread_mutex_lock(&(d->lock));
+  while ((pfx = nextpfx(&loc, end, &len)) != NULL) {
+    struct deltaentry *e;
+    if (len > MAXPFXLEN) continue;
+    hash = fnv(ctrlhash, pfx, len);
+    e = delta_find(d, key, keylen, pfx, len, hash);
+    if (e == NULL) {
+      if (d->count >= d->bucketcount) delta_grow(d, now);
+      e = malloc(sizeof(*e) + keylen + len);
+      if (e == NULL) {
+        res = -1;
+        continue;
+      }
+      e->hash = hash;
+      e->keylen = keylen + len;
+      e->key = (unsigned char *)(e + 1);
+      memcpy(e->key, key, keylen);
+      memcpy(e->key + keylen, pfx, len);
+      e->next = d->buckets[hash & (d->bucketcount - 1)];
+      d->buckets[hash & (d->bucketcount - 1)] = e;
+      d->count++;
+    }
+    e->prefhash = prefhash;
+    e->expiry = now + ttl;
+    e->refresh = now + ttl - (ttl * d->refresh) / 100;
+  }
+  pthread_mutex_unlock(&(d->lock));
+  return(res);
+}
+
+
+void rppdelta_free(struct rppdelta *d) {
+  unsigned long i;
+  if (d == NULL) return;
+  for (i = 0; (d->buckets != NULL) && (i < d->bucketcount); i++) {
+    while (d->buckets[i] != NULL) {
+      struct deltaentry *e = d->buckets[i];
+      d->buckets[i] = e->next;
+      free(e);
+    }
+  }
+  free(d->buckets);
+  pthread_mutex_destroy(&(d->lock));
+  free(d);
+}
@@ -0,0 +1,64 @@
+/**
+  * @brief what RDE controllers were advertised, for incremental advertisements
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_DELTA_H
+#define RPP_DELTA_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/** @brief the preferences each controller was advertised for each local
+  * prefix (opaque) - it may be shared between threads */
+struct rppdelta;
+
+/** @brief creates an empty state
+  * @param refresh the part of the TTL (in percents) left when advertisements get refreshed
+  * @return a new state, or NULL on error */
+struct rppdelta *rppdelta_new(int refresh);
+
+/** @brief keeps the local prefixes the controller at addr must be told
+  * about: the ones it was never advertised preflist for, and the ones whose
+  * advertisement is about to expire
+  * @param *loc the local prefixes, separated by blanks
+  * @param *pref the preflist advertised for them
+  * @param *out filled with the prefixes kept, separated by spaces - it must hold at least loclen bytes
+  * @param *outlen filled with the length of out
+  * @return the number of prefixes that were left out */
+int rppdelta_filter(struct rppdelta *d, const struct sockaddr *addr, const char *loc, size_t loclen, const char *pref, size_t preflen, time_t now, char *out, size_t *outlen);
+
+/** @brief records that the controller at addr got advertised preflist for
+  * the local prefixes of loc, for ttl seconds starting from now
+  * @return 0 on success, non-zero if the state could not be recorded entirely */
+int rppdelta_commit(struct rppdelta *d, const struct sockaddr *addr, const char *loc, size_t loclen, const char *pref, size_t preflen, time_t now, long ttl);
+
+/** @brief frees a state */
+void rppdelta_free(struct rppdelta *d);
+
+#endif
@@ -0,0 +1,1695 @@
+/**
+  * @brief DNS resolution of RDE controllers, blocking and asynchronous
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <resolv.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dns.h"
+#include "pace.h"
+#include "rnd.h"
+#include "uring.h"
+
+/* negative caching TTL used when the answer does not provide any SOA */
+#define DEFAULT_NEGTTL 60
+
+/* max size of a query - a single question with a name of at most 255 bytes,
+ * and an EDNS0 OPT record */
+#define QUERYMAXLEN 320
+
+/* UDP payload size advertised with EDNS0, small enough to avoid IP
+ * fragmentation. larger answers come truncated, and are asked again over TCP. */
+#define EDNSSIZE 1232
+
+/* size of the buffers answers are read into */
+#define ANSWERSZ 4096
+
+/* epoll tag of TCP connections, the index of their query is added to it */
+#define TCPTAG 0x10000
+
+/* epoll tag of the io_uring instance, if any */
+#define RINGTAG MAXSERVERS
+
+/* epoll tag of the sockets authoritative servers are asked from, twice the
+ * index of their struct dsock is added to it, plus one for the old socket */
+#define DSOCKTAG (MAXSERVERS + 1)
+
+/* authoritative servers are asked from DSOCKS sockets per address family,
+ * picked at random. a socket gets replaced by a new one, on another port, once
+ * it sent DSOCKUSES queries: a forged answer has to guess the source port
+ * along with the id and the case of the name */
+#define DSOCKS 8
+#define DSOCKUSES 32
+
+/* io_uring backend: size of the submission queue, number of receives posted
+ * on each resolver socket, and number of queries that may be sent at once */
+#define RINGENTRIES 256
+#define RECVDEPTH 8
+#define TXBUFS 128
+
+/* kinds of io_uring buffers */
+#define RXBUF 0
+#define TXBUF 1
+
+/* max number of resolvers, and of servers kept for a delegation */
+#define MAXSERVERS 8
+
+/* initial congestion window of the resolvers, in queries */
+#define INITWINDOW 8
+
+/* max number of referrals a query follows before asking the resolvers */
+#define MAXHOPS 12
+
+/* number of buckets of the delegation cache, must be a power of 2 */
+#define DELEGBUCKETS 1024
+
+/* smoothed RTTs are kept in 1/8 ms, and never grow beyond this */
+#define MAXSRTT (60000l * 8)
+
+/* servers of in-addr.arpa and ip6.arpa (a to f.in-addr-servers.arpa, that
+ * also serve ip6.arpa), where the descent starts from with "--direct arpa" */
+#define ARPASERVERS "199.180.182.53,199.253.183.183,196.216.169.10,200.10.60.53,203.119.86.101,193.0.9.1"
+
+/* a nameserver, either a resolver or an authoritative server */
+struct nserver {
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  long srtt;         /* smoothed round-trip time, in 1/8 ms */
+};
+
+/* the authoritative servers of a zone. delegations are never freed before
+ * the resolver context, they are updated in place once they expire */
+struct deleg {
+  struct deleg *next;  /* next delegation in the same bucket */
+  unsigned long hash;
+  long expiry;         /* time (ms) after which the delegation is to be learnt again */
+  int count;           /* number of servers, 0 while their addresses are being looked up */
+  struct nserver srv[MAXSERVERS];
+  char *zone;          /* lower case, without trailing dot, stored right after the structure */
+};
+
+/* a lookup of a name that was being looked up already: it gets completed
+ * out of the answer of the query in flight */
+struct dnswaiter {
+  struct dnswaiter *next;
+  rppdns_cb cb;
+  void *priv;
+};
+
+struct rppdns_query {
+  struct rppdns_query *prev;  /* in-flight queries are kept in a list, */
+  struct rppdns_query *next;  /* sorted by deadline (oldest first)     */
+  rppdns_cb cb;
+  void *priv;
+  struct dnswaiter *waiters;  /* other lookups of the same name */
+  struct rppdns_query *hnext; /* next lookup in flight in the same bucket */
+  unsigned long hash;         /* hash of the name looked up */
+  long deadline;     /* time (ms) after which the query is considered lost */
+  long sent;         /* time (ms) the query has been sent last */
+  int ns;            /* server the query has been sent to last */
+  int tries;         /* how many times the query has been sent to its current servers */
+  unsigned int tried;  /* bitmask of the servers tried already */
+  int hops;          /* number of referrals followed */
+  struct deleg *deleg;  /* delegation asked directly, NULL when asking the resolvers */
+  struct sockaddr_storage to;  /* authoritative server the query has been sent to last */
+  int dfd;           /* socket it got sent to that server from, -1 if none */
+  struct rppdns_query *parent; /* for nameserver address lookups: the query waiting for it, */
+  struct deleg *pending;       /* the delegation the nameserver is for, */
+  long expiry;                 /* and the time the delegation expires */
+  int window;        /* resolver whose window the query is in flight in, -1 if none */
+  int waiting;       /* set while the query waits for a window or for a token */
+  int tcp;           /* TCP connection the query is sent over, -1 if none */
+  int usetcp;        /* set once an answer came truncated, the query goes over TCP from then on */
+  unsigned char *tcpbuf; /* the length-prefixed query being sent, then the answer being received */
+  int tcplen;        /* bytes of tcpbuf sent, then received, so far */
+  int tcpreading;    /* set once the query is sent */
+  int qlen;          /* length of the query up to the end of its question */
+  int querylen;
+  unsigned char query[QUERYMAXLEN];
+};
+
+/* a buffer an answer is received into from a resolver, through io_uring */
+struct dnsrx {
+  int kind;          /* RXBUF */
+  int ns;            /* the resolver */
+  int posted;        /* set while the receive is in flight */
+  unsigned char data[ANSWERSZ];
+};
+
+/* a copy of a query sent to a resolver through io_uring, the query itself
+ * may be retransmitted or completed before the kernel is done sending it */
+struct dnstx {
+  int kind;          /* TXBUF */
+  struct dnstx *next; /* free buffers */
+  unsigned char data[QUERYMAXLEN];
+};
+
+/* a socket authoritative servers are asked from. the socket it replaced is
+ * still read for late answers, until the next replacement */
+struct dsock {
+  int fd;            /* -1 if the address family is not used */
+  int old;           /* the socket replaced last, -1 if none */
+  int uses;          /* queries sent from fd */
+  long retired;      /* time (ms) old got replaced */
+};
+
+struct rppdns {
+  int epfd;
+  int nscount;
+  struct nserver ns[MAXSERVERS];  /* the resolvers */
+  int sock[MAXSERVERS];  /* one connected UDP socket per resolver */
+  struct rppwindow win[MAXSERVERS]; /* congestion window of each resolver */
+  struct dsock dsock[2][DSOCKS]; /* IPv4 and IPv6 sockets for authoritative servers */
+  int nextns;        /* next nameserver to use when rotating */
+  int rotate;        /* set if queries are spread over all nameservers */
+  int maxinflight;
+  int inflight;
+  int timeout;
+  int retries;
+  int resinit;       /* set once res is initialized and must be closed */
+  struct __res_state res; /* private resolver state, so engines may live in different threads */
+  struct rppdns_query *slots;
+  int nslots;
+  struct rppdns_query *freeslots; /* linked through the 'next' field */
+  struct rppdns_query *head;      /* in-flight queries, oldest first */
+  struct rppdns_query *tail;
+  struct rppdns_query *waithead;  /* queries waiting to be sent, oldest first */
+  struct rppdns_query *waittail;
+  struct rpprate rate;            /* cap of the queries sent */
+  struct rpprnd rnd;              /* query ids, source sockets and case of names, that off-path hosts must not guess */
+  struct rppstats *stats;         /* what queries go through, if accounted */
+  struct rppdns_query **idmap;    /* maps a DNS id to its in-flight query */
+  struct rppdns_query **names;    /* lookups in flight by name, namemask + 1 buckets */
+  unsigned long namemask;
+  struct dnswaiter *waiters;      /* maxinflight of them, never more are needed */
+  struct dnswaiter *freewaiters;  /* linked through the 'next' field */
+  struct deleg **delegs;          /* delegation cache, NULL if not querying authoritative servers */
+  struct rppuring *ring;          /* resolvers are talked to through io_uring, if not NULL */
+  struct dnsrx *rx;               /* RECVDEPTH receive buffers per resolver */
+  struct dnstx *tx;
+  struct dnstx *freetx;
+};
+
+
+/* returns a monotonic time in ms */
+static long mstime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+
+/* returns the negative caching TTL (RFC 2308) of a response without any
+ * usable answer, as announced by the SOA of its authority section */
+static unsigned long negttl(ns_msg *msg) {
+  int i;
+  for (i = 0; i < ns_msg_count(*msg, ns_s_ns); i++) {
+    ns_rr rr;
+    unsigned long minimum;
+    if (ns_parserr(msg, ns_s_ns, i, &rr) != 0) break;
+    if ((ns_rr_type(rr) != ns_t_soa) || (ns_rr_rdlen(rr) < 20)) continue;
+    /* the SOA 'minimum' field is the last 32 bits of its rdata */
+    minimum = ns_get32(ns_rr_rdata(rr) + ns_rr_rdlen(rr) - 4);
+    if (ns_rr_ttl(rr) < minimum) minimum = ns_rr_ttl(rr);
+    return(minimum);
+  }
+  return(DEFAULT_NEGTTL);
+}
+
+
+/* records a controller candidate, unless it is empty or known already */
+static int rde_add(struct rpprde *rde, int count, int maxrde, const unsigned char *addr, int len, unsigned long ttl) {
+  int i;
+  if (len == 0) return(count);
+  for (i = 0; i < count; i++) {
+    if ((rde[i].len != len) || (memcmp(rde[i].addr, addr, len) != 0)) continue;
+    if (ttl < rde[i].ttl) rde[i].ttl = ttl;
+    return(count);
+  }
+  if (count == maxrde) return(count);
+  rde[count].addr = (const char *)addr;
+  rde[count].len = len;
+  rde[count].ttl = ttl;
+  return(count + 1);
+}
+
+
+/* scans the character-strings of a TXT rdata for 'RDE:' tags, found at the
+ * start of a string or after a blank. the controller address follows the tag
+ * up to the next blank, or is the first word of the next string if the tag
+ * ends its own one. returns the updated amount of candidates. */
+static int txt_scan(struct rpprde *rde, int count, int maxrde, const unsigned char *rdata, int rdlen, unsigned long ttl) {
+  const unsigned char *end = rdata + rdlen;
+  const unsigned char *str, *strend, *p, *v, *w, *wend;
+
+  for (str = rdata; str < end; str = strend) {
+    strend = str + 1 + *str;
+    if (strend > end) break; /* malformed rdata */
+    str++;
+    for (p = str; (p = memchr(p, 'R', strend - p)) != NULL; p = v) {
+      v = p + 1;
+      if ((strend - p < 4) || (memcmp(p, "RDE:", 4) != 0)) continue;
+      if ((p > str) && (!isspace(p[-1]))) continue;
+      v = p + 4;
+      if (v < strend) {
+        w = v;
+        wend = strend;
+      } else if ((strend < end) && (strend + 1 + *strend <= end)) {
+        w = strend + 1;
+        wend = w + *strend;
+        while ((w < wend) && (isspace(*w))) w++;
+      } else {
+        break;
+      }
+      for (v = w; (v < wend) && (!isspace(*v)); v++);
+      count = rde_add(rde, count, maxrde, w, v - w, ttl);
+      if (v > strend) v = strend;
+    }
+  }
+  return(count);
+}
+
+
+int rpp_scananswer(struct rpprde *rde, int maxrde, unsigned long *ttl, const unsigned char *answer, int anslen) {
+  const unsigned char *p, *end = answer + anslen;
+  int i, n, ancount, count = 0;
+
+  *ttl = 0;
+  if (anslen < HFIXEDSZ) return(-3);
+  ancount = ns_get16(answer + 6);
+
+  /* no answer at all: let the SOA tell for how long that lasts */
+  if (ancount == 0) {
+    ns_msg msg;
+    if (ns_initparse(answer, anslen, &msg) != 0) return(-3);
+    *ttl = negttl(&msg);
+    return(0);
+  }
+
+  /* skip the question section */
+  p = answer + HFIXEDSZ;
+  for (i = ns_get16(answer + 4); i > 0; i--) {
+    n = dn_skipname(p, end);
+    if ((n < 0) || (p + n + QFIXEDSZ > end)) return(-3);
+    p += n + QFIXEDSZ;
+  }
+
+  /* walk the answer records in place, scanning every TXT of them */
+  for (i = 0; i < ancount; i++) {
+    unsigned long rrttl;
+    int type, class, rdlen;
+    n = dn_skipname(p, end);
+    if ((n < 0) || (p + n + RRFIXEDSZ > end)) return(-4);
+    p += n;
+    type = ns_get16(p);
+    class = ns_get16(p + 2);
+    rrttl = ns_get32(p + 4);
+    rdlen = ns_get16(p + 8);
+    p += RRFIXEDSZ;
+    if (p + rdlen > end) return(-4);
+    /* the absence of RDE record lasts as long as the records we got */
+    if ((i == 0) || (rrttl < *ttl)) *ttl = rrttl;
+    if ((type == ns_t_txt) && (class == ns_c_in)) count = txt_scan(rde, count, maxrde, p, rdlen, rrttl);
+    p += rdlen;
+  }
+
+  /* candidates are valid for as long as the shortest-lived of them */
+  for (i = 0; i < count; i++) {
+    if ((i == 0) || (rde[i].ttl < *ttl)) *ttl = rde[i].ttl;
+  }
+  return(count);
+}
+
+
+int rpp_parseanswer(char *result, int maxres, unsigned long *ttl, const unsigned char *answer, int anslen) {
+  struct rpprde rde[RPP_MAXRDE];
+  int i, count, len = 0;
+
+  count = rpp_scananswer(rde, RPP_MAXRDE, ttl, answer, anslen);
+  if (count < 0) return(count);
+
+  /* join the candidates with commas, as many of them as fit */
+  for (i = 0; (i < count) && (len + rde[i].len + 1 < maxres); i++) {
+    if (i > 0) result[len++] = ',';
+    memcpy(result + len, rde[i].addr, rde[i].len);
+    len += rde[i].len;
+  }
+  if (len == 0) return(1);
+  result[len] = 0;
+  return(0);
+}
+
+
+/* opens a non-blocking UDP socket connected to the nameserver at *addr */
+static int nsconnect(int epfd, const struct sockaddr *addr, socklen_t addrlen, int nsid) {
+  struct epoll_event ev;
+  int sock;
+  sock = socket(addr->sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock < 0) return(-1);
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = nsid;
+  if ((connect(sock, addr, addrlen) != 0) || (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) != 0)) {
+    close(sock);
+    return(-1);
+  }
+  return(sock);
+}
+
+
+/* parses a list of nameserver addresses separated by commas or spaces, each
+ * optionally followed by '#port' - returns the number of servers, or -1 if
+ * the list is invalid. rnd is the generator of their initial RTT jitter, NULL
+ * if the list is only checked */
+static int servers_parse(struct nserver *srv, int maxsrv, const char *list, struct rpprnd *rnd) {
+  char buf[64], *port;
+  int count = 0;
+  long portnum;
+
+  while (*list != 0) {
+    size_t len = strcspn(list, ", ");
+    if (len == 0) {
+      list++;
+      continue;
+    }
+    if ((len >= sizeof(buf)) || (count == maxsrv)) return(-1);
+    memcpy(buf, list, len);
+    buf[len] = 0;
+    list += len;
+    portnum = NS_DEFAULTPORT;
+    if ((port = strchr(buf, '#')) != NULL) {
+      char *end;
+      *port++ = 0;
+      portnum = strtol(port, &end, 10);
+      if ((*port == 0) || (*end != 0) || (portnum < 1) || (portnum > 65535)) return(-1);
+    }
+    memset(&(srv[count]), 0, sizeof(srv[count]));
+    if (inet_pton(AF_INET, buf, &(((struct sockaddr_in *)&(srv[count].addr))->sin_addr)) == 1) {
+      ((struct sockaddr_in *)&(srv[count].addr))->sin_port = htons(portnum);
+      srv[count].addr.ss_family = AF_INET;
+      srv[count].addrlen = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, buf, &(((struct sockaddr_in6 *)&(srv[count].addr))->sin6_addr)) == 1) {
+      ((struct sockaddr_in6 *)&(srv[count].addr))->sin6_port = htons(portnum);
+      srv[count].addr.ss_family = AF_INET6;
+      srv[count].addrlen = sizeof(struct sockaddr_in6);
+    } else {
+      return(-1);
+    }
+    /* a small random RTT makes the first queries probe all servers */
+    if (rnd != NULL) srv[count].srtt = 1 + (rpprnd_u32(rnd) % 8);
+    count++;
+  }
+  return((count > 0) ? count : -1);
+}
+
+
+int rppdns_checkservers(const char *list) {
+  struct nserver srv[MAXSERVERS];
+  if (strcmp(list, "arpa") == 0) return(0);
+  return((servers_parse(srv, MAXSERVERS, list, NULL) > 0) ? 0 : -1);
+}
+
+
+/* returns 0 if both addresses are the same */
+static int addrcmp(const struct sockaddr_storage *a, const struct sockaddr_storage *b) {
+  if (a->ss_family != b->ss_family) return(-1);
+  if (a->ss_family == AF_INET) {
+    const struct sockaddr_in *a4 = (const struct sockaddr_in *)a, *b4 = (const struct sockaddr_in *)b;
+    if (a4->sin_port != b4->sin_port) return(-1);
+    return(memcmp(&(a4->sin_addr), &(b4->sin_addr), sizeof(a4->sin_addr)));
+  } else {
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a, *b6 = (const struct sockaddr_in6 *)b;
+    if (a6->sin6_port != b6->sin6_port) return(-1);
+    return(memcmp(&(a6->sin6_addr), &(b6->sin6_addr), sizeof(a6->sin6_addr)));
+  }
+}
+
+
+/* picks the fastest server not tried yet (or the fastest of all, if all of
+ * them have been tried), and lets the RTT of the others decay, so slow
+ * servers get probed again from time to time */
+static int server_pick(struct nserver *srv, int count, unsigned int tried) {
+  int i, best = -1;
+  for (i = 0; i < count; i++) {
+    if ((tried & (1u << i)) != 0) continue;
+    if ((best < 0) || (srv[i].srtt < srv[best].srtt)) best = i;
+  }
+  if (best < 0) {
+    for (best = 0, i = 1; i < count; i++) {
+      if (srv[i].srtt < srv[best].srtt) best = i;
+    }
+  }
+  for (i = 0; i < count; i++) {
+    if (i != best) srv[i].srtt -= srv[i].srtt >> 5;
+  }
+  return(best);
+}
+
+
+/* accounts for an answer received from srv after rtt ms */
+static void server_answered(struct nserver *srv, long rtt) {
+  srv->srtt += rtt - (srv->srtt >> 3);
+}
+
+
+/* accounts for a query srv did not answer in time, or failed */
+static void server_failed(struct nserver *srv, int timeout) {
+  if (srv->srtt < (long)timeout * 8) {
+    srv->srtt = (long)timeout * 8;
+  } else if ((srv->srtt *= 2) > MAXSRTT) {
+    srv->srtt = MAXSRTT;
+  }
+}
+
+
+/* FNV-1a hash of a domain name, case-insensitive */
+static unsigned long namehash(const char *name) {
+  unsigned long h = 2166136261lu;
+  for (; *name != 0; name++) h = (h ^ (unsigned char)tolower(*name)) * 16777619lu;
+  return(h);
+}
+
+
+/* returns non-zero if name is zone, or is below it */
+static int name_under(const char *name, const char *zone) {
+  size_t nlen = strlen(name), zlen = strlen(zone);
+  if (zlen == 0) return(1);
+  if (nlen < zlen) return(0);
+  if (strcasecmp(name + nlen - zlen, zone) != 0) return(0);
+  return((nlen == zlen) || (name[nlen - zlen - 1] == '.'));
+}
+
+
+/* returns the delegation of a zone, creating an empty one if there is none
+ * yet, or NULL on error */
+static struct deleg *deleg_get(struct rppdns *ctx, const char *zone) {
+  struct deleg *d;
+  unsigned long hash = namehash(zone);
+  size_t i, len = strlen(zone);
+
+  for (d = ctx->delegs[hash & (DELEGBUCKETS - 1)]; d != NULL; d = d->next) {
+    if ((d->hash == hash) && (strcasecmp(d->zone, zone) == 0)) return(d);
+  }
+  d = calloc(1, sizeof(*d) + len + 1);
+  if (d == NULL) return(NULL);
+  d->hash = hash;
+  d->zone = (char *)(d + 1);
+  for (i = 0; i < len; i++) d->zone[i] = tolower(zone[i]);
+  d->next = ctx->delegs[hash & (DELEGBUCKETS - 1)];
+  ctx->delegs[hash & (DELEGBUCKETS - 1)] = d;
+  return(d);
+}
+
+
+/* sets the servers of a delegation, skipping the ones of an address family
+ * there is no socket for. if none is left, the delegation is left as is.
+ * @return the number of servers set */
+static int deleg_set(struct rppdns *ctx, struct deleg *d, const struct nserver *srv, int count, long expiry) {
+  int i, n = 0;
+  for (i = 0; i < count; i++) {
+    if (ctx->dsock[srv[i].addr.ss_family == AF_INET6][0].fd >= 0) n++;
+  }
+  if (n == 0) return(0);
+  for (n = 0, i = 0; i < count; i++) {
+    if (ctx->dsock[srv[i].addr.ss_family == AF_INET6][0].fd >= 0) d->srv[n++] = srv[i];
+  }
+  d->count = n;
+  d->expiry = expiry;
+  return(n);
+}
+
+
+/* returns the deepest known delegation that name is under, or NULL */
+static struct deleg *deleg_lookup(struct rppdns *ctx, const char *name, long now) {
+  struct deleg *d;
+  unsigned long hash;
+  for (;;) {
+    hash = namehash(name);
+    for (d = ctx->delegs[hash & (DELEGBUCKETS - 1)]; d != NULL; d = d->next) {
+      if ((d->hash == hash) && (strcasecmp(d->zone, name) == 0)) break;
+    }
+    if ((d != NULL) && (d->count > 0) && (d->expiry > now)) return(d);
+    if (*name == 0) return(NULL);
+    name = strchr(name, '.');
+    name = (name == NULL) ? "" : name + 1;
+  }
+}
+
+
+/* opens a socket to ask authoritative servers from, of either IPv4 (0) or
+ * IPv6 (1), and has epoll watch it under the given tag. the kernel binds it
+ * to a random port once it sends its first query.
+ * @return the socket, or -1 on error */
+static int dsock_open(struct rppdns *ctx, int family, unsigned int tag) {
+  struct epoll_event ev;
+  int fd;
+  fd = socket(family ? AF_INET6 : AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return(-1);
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = tag;
+  if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    close(fd);
+    return(-1);
+  }
+  return(fd);
+}
+
+
+/* picks a random socket of the given family to send a query to an
+ * authoritative server from. a socket that sent DSOCKUSES queries already is
+ * replaced first, unless the one it replaced last may still get answers. */
+static int dsock_pick(struct rppdns *ctx, int family, long now) {
+  int slot = rpprnd_u32(&(ctx->rnd)) % DSOCKS;
+  struct dsock *s = &(ctx->dsock[family][slot]);
+  unsigned int tag = DSOCKTAG + 2 * (family * DSOCKS + slot);
+  if ((s->uses >= DSOCKUSES) && ((s->old < 0) || (now - s->retired >= ctx->timeout))) {
+    int fd = dsock_open(ctx, family, tag);
+    if (fd >= 0) {
+      struct epoll_event ev;
+      if (s->old >= 0) close(s->old);
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.u32 = tag + 1;
+      (void)epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+      s->old = s->fd;
+      s->fd = fd;
+      s->uses = 0;
+      s->retired = now;
+    }
+  }
+  s->uses++;
+  return(s->fd);
+}
+
+
+/* randomizes the case of the letters of the name query q asks for (the
+ * "0x20" bits): authoritative servers copy the question of a query to
+ * their answer as is, so a forged answer has to guess the case as well */
+static void query_mixcase(struct rppdns *ctx, struct rppdns_query *q) {
+  unsigned long bits = 0;
+  int i, n = 0;
+  /* label lengths are below 64, so never taken for letters */
+  for (i = HFIXEDSZ; i < q->qlen - 4; i++) {
+    unsigned char c = q->query[i] | 0x20;
+    if ((c < 'a') || (c > 'z')) continue;
+    if (n == 0) {
+      bits = rpprnd_u32(&(ctx->rnd));
+      n = 32;
+    }
+    q->query[i] = (bits & 1) ? (c & ~0x20) : c;
+    bits >>= 1;
+    n--;
+  }
+}
+
+
+struct rppdns *rppdns_new(int maxinflight, int timeout, int retries, const char *resolvers, const char *direct) {
+  struct rppdns *ctx;
+  int i;
+
+  if ((maxinflight < 1) || (maxinflight > 65536) || (timeout < 1) || (retries < 0)) return(NULL);
+
+  ctx = calloc(1, sizeof(*ctx));
+  if (ctx == NULL) return(NULL);
+  ctx->maxinflight = maxinflight;
+  ctx->timeout = timeout;
+  ctx->retries = retries;
+  for (i = 0; i < 2 * DSOCKS; i++) {
+    ctx->dsock[i / DSOCKS][i % DSOCKS].fd = -1;
+    ctx->dsock[i / DSOCKS][i % DSOCKS].old = -1;
+  }
+  if (rpprnd_init(&(ctx->rnd)) != 0) {
+    free(ctx);
+    return(NULL);
+  }
+  if (res_ninit(&(ctx->res)) != 0) {
+    rpprnd_free(&(ctx->rnd));
+    free(ctx);
+    return(NULL);
+  }
+  ctx->resinit = 1;
+  ctx->rotate = ((ctx->res.options & RES_ROTATE) != 0);
+  /* queries asking authoritative servers may need another query each, to
+   * look up the address of a nameserver */
+  if (direct != NULL) maxinflight = (maxinflight > 32768) ? 65536 : maxinflight * 2;
+  ctx->slots = calloc(maxinflight, sizeof(*(ctx->slots)));
+  ctx->idmap = calloc(65536, sizeof(*(ctx->idmap)));
+  for (ctx->namemask = 1; ctx->namemask < (unsigned long)ctx->maxinflight; ctx->namemask <<= 1);
+  ctx->names = calloc(ctx->namemask, sizeof(*(ctx->names)));
+  ctx->namemask--;
+  ctx->waiters = calloc(ctx->maxinflight, sizeof(*(ctx->waiters)));
+  ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if ((ctx->slots == NULL) || (ctx->idmap == NULL) || (ctx->names == NULL) || (ctx->waiters == NULL) || (ctx->epfd < 0)) {
+    rppdns_free(ctx);
+    return(NULL);
+  }
+  ctx->nslots = maxinflight;
+  for (i = 0; i < maxinflight; i++) {
+    ctx->slots[i].tcp = -1;
+    ctx->slots[i].next = ctx->freeslots;
+    ctx->freeslots = &(ctx->slots[i]);
+  }
+  for (i = 0; i < ctx->maxinflight; i++) {
+    ctx->waiters[i].next = ctx->freewaiters;
+    ctx->freewaiters = &(ctx->waiters[i]);
+  }
+
+  /* the resolvers are either given, or the ones of the system resolver */
+  if (resolvers != NULL) {
+    struct nserver srv[MAXSERVERS];
+    int count = servers_parse(srv, MAXSERVERS, resolvers, &(ctx->rnd));
+    if (count < 0) {
+      rppdns_free(ctx);
+      return(NULL);
+    }
+    for (i = 0; i < count; i++) {
+      int sock = nsconnect(ctx->epfd, (struct sockaddr *)&(srv[i].addr), srv[i].addrlen, ctx->nscount);
+      if (sock < 0) continue;
+      ctx->ns[ctx->nscount] = srv[i];
+      ctx->sock[ctx->nscount++] = sock;
+    }
+  } else {
+    for (i = 0; (i < ctx->res.nscount) && (i < MAXSERVERS); i++) {
+      struct nserver *srv = &(ctx->ns[ctx->nscount]);
+      memset(srv, 0, sizeof(*srv));
+      if (ctx->res.nsaddr_list[i].sin_family == AF_INET) {
+        memcpy(&(srv->addr), &(ctx->res.nsaddr_list[i]), sizeof(ctx->res.nsaddr_list[i]));
+        srv->addrlen = sizeof(ctx->res.nsaddr_list[i]);
+#ifdef __GLIBC__
+      } else if (ctx->res._u._ext.nsaddrs[i] != NULL) { /* glibc keeps IPv6 nameservers aside */
+        memcpy(&(srv->addr), ctx->res._u._ext.nsaddrs[i], sizeof(struct sockaddr_in6));
+        srv->addrlen = sizeof(struct sockaddr_in6);
+#endif
+      } else {
+        continue;
+      }
+      srv->srtt = 1 + (rpprnd_u32(&(ctx->rnd)) % 8);
+      ctx->sock[ctx->nscount] = nsconnect(ctx->epfd, (struct sockaddr *)&(srv->addr), srv->addrlen, ctx->nscount);
+      if (ctx->sock[ctx->nscount] >= 0) ctx->nscount++;
+    }
+  }
+
+  /* no usable nameserver: fall back to localhost, as libresolv does */
+  if (ctx->nscount == 0) {
+    struct sockaddr_in *sin = (struct sockaddr_in *)&(ctx->ns[0].addr);
+    memset(&(ctx->ns[0]), 0, sizeof(ctx->ns[0]));
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(NS_DEFAULTPORT);
+    sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ctx->ns[0].addrlen = sizeof(*sin);
+    ctx->sock[0] = nsconnect(ctx->epfd, (struct sockaddr *)sin, sizeof(*sin), 0);
+    if (ctx->sock[0] < 0) {
+      rppdns_free(ctx);
+      return(NULL);
+    }
+    ctx->nscount = 1;
+  }
+  for (i = 0; i < ctx->nscount; i++) rppwindow_init(&(ctx->win[i]), INITWINDOW, ctx->maxinflight);
+  rpprate_init(&(ctx->rate), 0, 1000, mstime());
+
+  /* authoritative servers are asked from unconnected sockets, starting with
+   * the servers of either the root or the arpa reverse trees */
+  if (direct != NULL) {
+    struct nserver srv[MAXSERVERS];
+    int count, f, arpa = (strcmp(direct, "arpa") == 0);
+    count = servers_parse(srv, MAXSERVERS, arpa ? ARPASERVERS : direct, &(ctx->rnd));
+    ctx->delegs = calloc(DELEGBUCKETS, sizeof(*(ctx->delegs)));
+    /* an address family is used only if all of its sockets could be opened */
+    for (f = 0; f < 2; f++) {
+      for (i = 0; i < DSOCKS; i++) {
+        ctx->dsock[f][i].fd = dsock_open(ctx, f, DSOCKTAG + 2 * (f * DSOCKS + i));
+        if (ctx->dsock[f][i].fd < 0) break;
+      }
+      if (i == DSOCKS) continue;
+      while (i-- > 0) {
+        close(ctx->dsock[f][i].fd);
+        ctx->dsock[f][i].fd = -1;
+      }
+    }
+    if ((count < 0) || (ctx->delegs == NULL) || ((ctx->dsock[0][0].fd < 0) && (ctx->dsock[1][0].fd < 0))) {
+      rppdns_free(ctx);
+      return(NULL);
+    }
+    for (i = 0; i < (arpa ? 2 : 1); i++) {
+      struct deleg *d = deleg_get(ctx, arpa ? ((i == 0) ? "in-addr.arpa" : "ip6.arpa") : "");
+      if (d == NULL) {
+        rppdns_free(ctx);
+        return(NULL);
+      }
+      deleg_set(ctx, d, srv, count, LONG_MAX);
+    }
+  }
+
+  return(ctx);
+}
+
+
+/* unlinks query q from the in-flight list, or from the list of queries
+ * waiting to be sent */
+static void query_unlink(struct rppdns *ctx, struct rppdns_query *q) {
+  struct rppdns_query **head = q->waiting ? &(ctx->waithead) : &(ctx->head);
+  struct rppdns_query **tail = q->waiting ? &(ctx->waittail) : &(ctx->tail);
+  if (q->prev != NULL) {
+    q->prev->next = q->next;
+  } else {
+    *head = q->next;
+  }
+  if (q->next != NULL) {
+    q->next->prev = q->prev;
+  } else {
+    *tail = q->prev;
+  }
+  q->prev = NULL;
+  q->next = NULL;
+  q->waiting = 0;
+  if (q->window >= 0) ctx->win[q->window].inflight--;
+  q->window = -1;
+}
+
+
+/* returns the server query q has been sent to last, or NULL if it is not
+ * known anymore (its delegation got updated meanwhile) */
+static struct nserver *query_server(struct rppdns *ctx, struct rppdns_query *q) {
+  if (q->deleg == NULL) return(&(ctx->ns[q->ns]));
+  if ((q->ns >= q->deleg->count) || (addrcmp(&(q->deleg->srv[q->ns].addr), &(q->to)) != 0)) return(NULL);
+  return(&(q->deleg->srv[q->ns]));
+}
+
+
+/* picks the server query q is to be sent to next */
+static void query_pick(struct rppdns *ctx, struct rppdns_query *q) {
+  if (q->deleg != NULL) {
+    q->ns = server_pick(q->deleg->srv, q->deleg->count, q->tried);
+  } else if (ctx->rotate == 0) {
+    q->ns = server_pick(ctx->ns, ctx->nscount, q->tried);
+  } else if (q->tries == 0) {
+    q->ns = ctx->nextns;
+    ctx->nextns = (ctx->nextns + 1) % ctx->nscount;
+  } else {
+    q->ns = (q->ns + 1) % ctx->nscount;
+  }
+}
+
+
+/* closes the TCP connection of query q, if any */
+static void tcp_close(struct rppdns_query *q) {
+  if (q->tcp < 0) return;
+  close(q->tcp); /* also removes it from the epoll set */
+  q->tcp = -1;
+  free(q->tcpbuf);
+  q->tcpbuf = NULL;
+}
+
+
+/* connects to srv over TCP, to send it query q once connected - returns 0
+ * on success */
+static int tcp_start(struct rppdns *ctx, struct rppdns_query *q, const struct nserver *srv) {
+  struct epoll_event ev;
+  q->tcpbuf = malloc(2 + 65535);
+  if (q->tcpbuf == NULL) return(-1);
+  q->tcp = socket(srv->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLOUT;
+  ev.data.u32 = TCPTAG + (q - ctx->slots);
+  if ((q->tcp < 0) || ((connect(q->tcp, (const struct sockaddr *)&(srv->addr), srv->addrlen) != 0) && (errno != EINPROGRESS)) || (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, q->tcp, &ev) != 0)) {
+    if (q->tcp >= 0) close(q->tcp);
+    q->tcp = -1;
+    free(q->tcpbuf);
+    q->tcpbuf = NULL;
+    return(-1);
+  }
+  ns_put16(q->querylen, q->tcpbuf);
+  memcpy(q->tcpbuf + 2, q->query, q->querylen);
+  q->tcplen = 0;
+  q->tcpreading = 0;
+  return(0);
+}
+
+
+/* prepares the send of query q to its resolver through io_uring - it is
+ * submitted by the next ring_flush(), along with the other ones
+ * @return 0 on success, non-zero if the query is to be sent directly */
+static int ring_send(struct rppdns *ctx, const struct rppdns_query *q) {
+  struct io_uring_sqe *sqe;
+  struct dnstx *tx = ctx->freetx;
+  if (tx == NULL) return(-1);
+  sqe = rppuring_sqe(ctx->ring, IORING_OP_SEND, ctx->sock[q->ns], tx);
+  if (sqe == NULL) return(-1);
+  ctx->freetx = tx->next;
+  memcpy(tx->data, q->query, q->querylen);
+  sqe->addr = (unsigned long)tx->data;
+  sqe->len = q->querylen;
+  return(0);
+}
+
+
+/* posts the receives not in flight, and submits everything prepared */
+static void ring_flush(struct rppdns *ctx) {
+  int i;
+  if (ctx->ring == NULL) return;
+  for (i = 0; i < ctx->nscount * RECVDEPTH; i++) {
+    struct dnsrx *rx = &(ctx->rx[i]);
+    struct io_uring_sqe *sqe;
+    if (rx->posted) continue;
+    sqe = rppuring_sqe(ctx->ring, IORING_OP_RECV, ctx->sock[rx->ns], rx);
+    if (sqe == NULL) break;
+    sqe->addr = (unsigned long)rx->data;
+    sqe->len = sizeof(rx->data);
+    rx->posted = 1;
+  }
+  rppuring_submit(ctx->ring);
+}
+
+
+/* returns non-zero if (unlinked) query q may not be sent right now: the
+ * window of its resolver is full, or the rate cap is reached */
+static int query_paced(const struct rppdns *ctx, const struct rppdns_query *q, long now) {
+  if ((q->deleg == NULL) && rppwindow_full(&(ctx->win[q->ns]))) return(1);
+  return(rpprate_wait(&(ctx->rate), now) != 0);
+}
+
+
+/* (re)sends query q to the server it picked, and appends it at the end of
+ * the in-flight list. a send failure is not fatal: the query will simply time
+ * out and be resent. */
+static void query_transmit(struct rppdns *ctx, struct rppdns_query *q, long now) {
+  struct nserver *srv = (q->deleg != NULL) ? &(q->deleg->srv[q->ns]) : &(ctx->ns[q->ns]);
+  rpprate_take(&(ctx->rate), now);
+  if (q->deleg == NULL) {
+    q->window = q->ns;
+    ctx->win[q->ns].inflight++;
+  }
+  if (q->deleg != NULL) {
+    memcpy(&(q->to), &(srv->addr), srv->addrlen);
+    q->to.ss_family = srv->addr.ss_family;
+  }
+  q->dfd = -1;
+  if (q->usetcp) {
+    (void)tcp_start(ctx, q, srv);
+  } else if (q->deleg != NULL) {
+    query_mixcase(ctx, q);
+    q->dfd = dsock_pick(ctx, srv->addr.ss_family == AF_INET6, now);
+    (void)sendto(q->dfd, q->query, q->querylen, 0, (struct sockaddr *)&(srv->addr), srv->addrlen);
+  } else if ((ctx->ring == NULL) || (ring_send(ctx, q) != 0)) {
+    (void)send(ctx->sock[q->ns], q->query, q->querylen, 0);
+  }
+  q->tried |= 1u << q->ns;
+  q->tries++;
+  q->sent = now;
+  if (ctx->stats != NULL) ctx->stats->queries++;
+  q->deadline = now + ctx->timeout;
+  q->prev = ctx->tail;
+  q->next = NULL;
+  if (ctx->tail != NULL) {
+    ctx->tail->next = q;
+  } else {
+    ctx->head = q;
+  }
+  ctx->tail = q;
+}
+
+
+/* sends (unlinked) query q to the server it picked, unless it has to wait
+ * for its turn - queries are then sent in the order they came by
+ * query_drain() */
+static void query_send(struct rppdns *ctx, struct rppdns_query *q, long now) {
+  tcp_close(q);
+  if ((ctx->waithead == NULL) && (query_paced(ctx, q, now) == 0)) {
+    query_transmit(ctx, q, now);
+    return;
+  }
+  q->waiting = 1;
+  q->prev = ctx->waittail;
+  q->next = NULL;
+  if (ctx->waittail != NULL) {
+    ctx->waittail->next = q;
+  } else {
+    ctx->waithead = q;
+  }
+  ctx->waittail = q;
+}
+
+
+/* sends the queries waiting for their turn, for as long as they may be */
+static void query_drain(struct rppdns *ctx, long now) {
+  struct rppdns_query *q;
+  while (((q = ctx->waithead) != NULL) && (query_paced(ctx, q, now) == 0)) {
+    query_unlink(ctx, q);
+    query_transmit(ctx, q, now);
+  }
+}
+
+
+/* sends (unlinked) query q to the servers of a delegation, without asking
+ * for recursion */
+static void query_ask(struct rppdns *ctx, struct rppdns_query *q, struct deleg *d, long now) {
+  q->deleg = d;
+  q->tries = 0;
+  q->tried = 0;
+  q->query[2] &= ~0x01; /* RD */
+  query_pick(ctx, q);
+  query_send(ctx, q, now);
+}
+
+
+/* sends (unlinked) query q to the resolvers, asking for recursion */
+static void query_recurse(struct rppdns *ctx, struct rppdns_query *q, long now) {
+  q->deleg = NULL;
+  q->tries = 0;
+  q->tried = 0;
+  q->query[2] |= 0x01; /* RD */
+  query_pick(ctx, q);
+  query_send(ctx, q, now);
+}
+
+
+/* takes a free slot, and builds a query for name in it - returns NULL if
+ * there is no free slot or if the query cannot be built */
+static struct rppdns_query *query_new(struct rppdns *ctx, const char *name, int type) {
+  struct rppdns_query *q;
+  unsigned short id;
+
+  q = ctx->freeslots;
+  if (q == NULL) return(NULL);
+
+  q->querylen = res_nmkquery(&(ctx->res), QUERY, name, C_IN, type, NULL, 0, NULL, q->query, sizeof(q->query));
+  if ((q->querylen < HFIXEDSZ) || (q->querylen + 11 > QUERYMAXLEN)) return(NULL);
+
+  /* append an EDNS0 OPT record: root name, type, payload size, extended
+   * rcode and flags, and empty rdata */
+  q->qlen = q->querylen;
+  memset(q->query + q->querylen, 0, 11);
+  ns_put16(ns_t_opt, q->query + q->querylen + 1);
+  ns_put16(EDNSSIZE, q->query + q->querylen + 3);
+  q->querylen += 11;
+  ns_put16(1, q->query + 10); /* arcount */
+
+  /* pick a random id that is not used by any other in-flight query */
+  do {
+    id = rpprnd_u32(&(ctx->rnd)) & 0xffff;
+  } while (ctx->idmap[id] != NULL);
+  ns_put16(id, q->query);
+
+  ctx->freeslots = q->next;
+  ctx->idmap[id] = q;
+  q->prev = NULL;
+  q->next = NULL;
+  q->cb = NULL;
+  q->priv = NULL;
+  q->waiters = NULL;
+  q->hnext = NULL;
+  q->tries = 0;
+  q->tried = 0;
+  q->hops = 0;
+  q->ns = 0;
+  q->deleg = NULL;
+  q->parent = NULL;
+  q->pending = NULL;
+  q->window = -1;
+  q->waiting = 0;
+  q->usetcp = 0;
+  return(q);
+}
+
+
+/* releases the slot of (unlinked) query q */
+static void query_release(struct rppdns *ctx, struct rppdns_query *q) {
+  tcp_close(q);
+  ctx->idmap[ns_get16(q->query)] = NULL;
+  if (q->parent == NULL) ctx->inflight--;
+  q->next = ctx->freeslots;
+  ctx->freeslots = q;
+}
+
+
+/* returns the lookup of name (of the given hash) in flight, if any */
+static struct rppdns_query *name_find(struct rppdns *ctx, const char *name, unsigned long hash) {
+  char qname[NS_MAXDNAME];
+  struct rppdns_query *q;
+  for (q = ctx->names[hash & ctx->namemask]; q != NULL; q = q->hnext) {
+    if (q->hash != hash) continue;
+    if (ns_name_uncompress(q->query, q->query + q->qlen, q->query + HFIXEDSZ, qname, sizeof(qname)) < 0) continue;
+    if (strcasecmp(qname, name) == 0) return(q);
+  }
+  return(NULL);
+}
+
+
+/* removes lookup q from the lookups in flight by name */
+static void name_unlink(struct rppdns *ctx, struct rppdns_query *q) {
+  struct rppdns_query **pq = &(ctx->names[q->hash & ctx->namemask]);
+  while (*pq != q) pq = &((*pq)->hnext);
+  *pq = q->hnext;
+  q->hnext = NULL;
+}
+
+
+/* completes (unlinked) query q: releases its slot and calls its callback,
+ * then the ones of the lookups waiting for the same name */
+static void query_done(struct rppdns *ctx, struct rppdns_query *q, int status, const char *rdeaddr, unsigned long ttl) {
+  rppdns_cb cb = q->cb;
+  void *priv = q->priv;
+  struct dnswaiter *w = q->waiters;
+  name_unlink(ctx, q);
+  query_release(ctx, q);
+  cb(priv, status, rdeaddr, ttl);
+  while (w != NULL) {
+    struct dnswaiter *next = w->next;
+    cb = w->cb;
+    priv = w->priv;
+    w->next = ctx->freewaiters;
+    ctx->freewaiters = w;
+    ctx->inflight--;
+    cb(priv, status, rdeaddr, ttl);
+    w = next;
+  }
+}
+
+
+/* completes the (unlinked) lookup q of a nameserver address: the query
+ * waiting for it is sent to the servers found, or to the resolvers if none
+ * were */
+static void subquery_done(struct rppdns *ctx, struct rppdns_query *q, const struct nserver *srv, int count, unsigned long ttl, long now) {
+  struct rppdns_query *parent = q->parent;
+  struct deleg *d = q->pending;
+  long expiry = now + (long)ttl * 1000;
+  if (expiry > q->expiry) expiry = q->expiry;
+  query_release(ctx, q);
+  if (deleg_set(ctx, d, srv, count, expiry) > 0) {
+    query_ask(ctx, parent, d, now);
+  } else {
+    query_recurse(ctx, parent, now);
+  }
+}
+
+
+/* has the resolvers look up the address of nameserver nsname, for the
+ * (unlinked) query q that waits for it - returns 0 on success */
+static int subquery_start(struct rppdns *ctx, struct rppdns_query *q, struct deleg *d, long expiry, const char *nsname, long now) {
+  struct rppdns_query *sq;
+  sq = query_new(ctx, nsname, T_A);
+  if (sq == NULL) return(-1);
+  sq->parent = q;
+  sq->pending = d;
+  sq->expiry = expiry;
+  query_pick(ctx, sq);
+  query_send(ctx, sq, now);
+  return(0);
+}
+
+
+/* fails (unlinked) query q, that got no answer */
+static void query_fail(struct rppdns *ctx, struct rppdns_query *q, long now) {
+  if (q->parent != NULL) {
+    subquery_done(ctx, q, NULL, 0, 0, now);
+  } else {
+    query_done(ctx, q, -2, NULL, 0);
+  }
+}
+
+
+/* retransmits (unlinked) query q to the next server, or gives up on it if it
+ * has been tried too many times already. authoritative servers are given up
+ * for the resolvers once all of them have been tried. */
+static void query_retry(struct rppdns *ctx, struct rppdns_query *q, long now) {
+  struct nserver *srv = query_server(ctx, q);
+  if (srv != NULL) server_failed(srv, ctx->timeout);
+  if (q->deleg != NULL) {
+    if ((q->tries > ctx->retries) || (q->tried == (1u << q->deleg->count) - 1u)) {
+      query_recurse(ctx, q, now);
+      return;
+    }
+  } else if (q->tries > ctx->retries) {
+    query_fail(ctx, q, now);
+    return;
+  }
+  query_pick(ctx, q);
+  query_send(ctx, q, now);
+}
+
+
+int rppdns_submit(struct rppdns *ctx, const char *revname, rppdns_cb cb, void *priv) {
+  struct rppdns_query *q;
+  struct deleg *d = NULL;
+  unsigned long hash;
+  long now = mstime();
+
+  if (ctx->inflight >= ctx->maxinflight) return(-1);
+
+  /* a name being looked up already is not asked again: the lookup waits for
+   * the answer of the query in flight. there are at most maxinflight - 1
+   * waiters, so there always is one free. */
+  hash = namehash(revname);
+  q = name_find(ctx, revname, hash);
+  if ((q != NULL) && (ctx->freewaiters != NULL)) {
+    struct dnswaiter *w = ctx->freewaiters;
+    ctx->freewaiters = w->next;
+    w->cb = cb;
+    w->priv = priv;
+    w->next = q->waiters;
+    q->waiters = w;
+    ctx->inflight++;
+    return(0);
+  }
+
+  q = query_new(ctx, revname, T_TXT);
+  if (q == NULL) return(-1);
+  ctx->inflight++;
+  q->cb = cb;
+  q->priv = priv;
+  q->hash = hash;
+  q->hnext = ctx->names[hash & ctx->namemask];
+  ctx->names[hash & ctx->namemask] = q;
+
+  /* ask the deepest authoritative servers known, if asked to */
+  if (ctx->delegs != NULL) d = deleg_lookup(ctx, revname, now);
+  if (d != NULL) {
+    query_ask(ctx, q, d, now);
+  } else {
+    query_pick(ctx, q);
+    query_send(ctx, q, now);
+  }
+  return(0);
+}
+
+
+/* returns 0 if the question section of answer matches the one of query q */
+static int question_match(const struct rppdns_query *q, const unsigned char *answer, int anslen, int exact) {
+  int i;
+  if (anslen < q->qlen) return(-1);
+  if (ns_get16(answer + 4) != 1) return(-1); /* qdcount */
+  /* the case of the name got randomized for the authoritative servers, that
+   * must send it back as is. labels are compared case-insensitively
+   * otherwise, which is harmless for the length bytes */
+  if (exact) return((memcmp(answer + HFIXEDSZ, q->query + HFIXEDSZ, q->qlen - HFIXEDSZ) == 0) ? 0 : -1);
+  for (i = HFIXEDSZ; i < q->qlen; i++) {
+    if (tolower(answer[i]) != tolower(q->query[i])) return(-1);
+  }
+  return(0);
+}
+
+
+/* processes the answer to the (unlinked) lookup q of a nameserver address */
+static void subquery_answer(struct rppdns *ctx, struct rppdns_query *q, const unsigned char *answer, int anslen, long now) {
+  struct nserver srv[MAXSERVERS];
+  unsigned long ttl = 0;
+  int i, count = 0;
+  ns_msg msg;
+  ns_rr rr;
+
+  if (ns_initparse(answer, anslen, &msg) == 0) {
+    for (i = 0; (i < ns_msg_count(msg, ns_s_an)) && (count < MAXSERVERS); i++) {
+      struct sockaddr_in *sin = (struct sockaddr_in *)&(srv[count].addr);
+      if (ns_parserr(&msg, ns_s_an, i, &rr) != 0) break;
+      if ((ns_rr_type(rr) != ns_t_a) || (ns_rr_rdlen(rr) != 4)) continue;
+      memset(&(srv[count]), 0, sizeof(srv[count]));
+      sin->sin_family = AF_INET;
+      sin->sin_port = htons(NS_DEFAULTPORT);
+      memcpy(&(sin->sin_addr), ns_rr_rdata(rr), 4);
+      srv[count].addrlen = sizeof(*sin);
+      srv[count].srtt = 1 + (rpprnd_u32(&(ctx->rnd)) % 8);
+      if ((count == 0) || (ns_rr_ttl(rr) < ttl)) ttl = ns_rr_ttl(rr);
+      count++;
+    }
+  }
+  subquery_done(ctx, q, srv, count, ttl, now);
+}
+
+
+/* follows the referral an authoritative server answered (unlinked) query q
+ * with: q is sent to the servers of the zone it refers to, or waits for their
+ * addresses to be looked up if the referral has no glue.
+ * @return 0 on success, non-zero if the answer is not a usable referral */
+static int query_referral(struct rppdns *ctx, struct rppdns_query *q, const unsigned char *answer, int anslen, long now) {
+  char qname[NS_MAXDNAME], zone[NS_MAXDNAME], nsname[MAXSERVERS][NS_MAXDNAME];
+  struct nserver srv[MAXSERVERS];
+  struct deleg *d;
+  unsigned long ttl = 0;
+  int i, j, nscount = 0, count = 0;
+  ns_msg msg;
+  ns_rr rr;
+
+  if (++(q->hops) > MAXHOPS) return(-1);
+  if ((ns_initparse(answer, anslen, &msg) != 0) || (ns_parserr(&msg, ns_s_qd, 0, &rr) != 0)) return(-1);
+  snprintf(qname, sizeof(qname), "%s", ns_rr_name(rr));
+
+  /* the NS records of the zone referred to, which must be below the zone
+   * that got asked, and above the name looked up */
+  for (i = 0; i < ns_msg_count(msg, ns_s_ns); i++) {
+    if (ns_parserr(&msg, ns_s_ns, i, &rr) != 0) return(-1);
+    if (ns_rr_type(rr) != ns_t_ns) continue;
+    if (nscount == 0) {
+      if ((name_under(qname, ns_rr_name(rr)) == 0) || (name_under(ns_rr_name(rr), q->deleg->zone) == 0)) return(-1);
+      if (strlen(ns_rr_name(rr)) <= strlen(q->deleg->zone)) return(-1);
+      snprintf(zone, sizeof(zone), "%s", ns_rr_name(rr));
+      ttl = ns_rr_ttl(rr);
+    } else if ((strcasecmp(ns_rr_name(rr), zone) != 0) || (nscount == MAXSERVERS)) {
+      continue;
+    }
+    if (ns_name_uncompress(ns_msg_base(msg), ns_msg_end(msg), ns_rr_rdata(rr), nsname[nscount], NS_MAXDNAME) < 0) continue;
+    if (ns_rr_ttl(rr) < ttl) ttl = ns_rr_ttl(rr);
+    nscount++;
+  }
+  if (nscount == 0) return(-1);
+
+  /* addresses of the nameservers (glue) */
+  for (i = 0; (i < ns_msg_count(msg, ns_s_ar)) && (count < MAXSERVERS); i++) {
+    if (ns_parserr(&msg, ns_s_ar, i, &rr) != 0) break;
+    for (j = 0; (j < nscount) && (strcasecmp(ns_rr_name(rr), nsname[j]) != 0); j++);
+    if (j == nscount) continue;
+    memset(&(srv[count]), 0, sizeof(srv[count]));
+    if ((ns_rr_type(rr) == ns_t_a) && (ns_rr_rdlen(rr) == 4)) {
+      struct sockaddr_in *sin = (struct sockaddr_in *)&(srv[count].addr);
+      sin->sin_family = AF_INET;
+      sin->sin_port = htons(NS_DEFAULTPORT);
+      memcpy(&(sin->sin_addr), ns_rr_rdata(rr), 4);
+      srv[count].addrlen = sizeof(*sin);
+    } else if ((ns_rr_type(rr) == ns_t_aaaa) && (ns_rr_rdlen(rr) == 16)) {
+      struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&(srv[count].addr);
+      sin6->sin6_family = AF_INET6;
+      sin6->sin6_port = htons(NS_DEFAULTPORT);
+      memcpy(&(sin6->sin6_addr), ns_rr_rdata(rr), 16);
+      srv[count].addrlen = sizeof(*sin6);
+    } else {
+      continue;
+    }
+    srv[count].srtt = 1 + (rpprnd_u32(&(ctx->rnd)) % 8);
+    count++;
+  }
+
+  d = deleg_get(ctx, zone);
+  if (d == NULL) return(-1);
+  if ((deleg_set(ctx, d, srv, count, now + (long)ttl * 1000) > 0) || ((d->count > 0) && (d->expiry > now))) {
+    query_ask(ctx, q, d, now);
+    return(0);
+  }
+
+  /* no usable glue: have the resolvers look the first nameserver up */
+  return(subquery_start(ctx, q, d, now + (long)ttl * 1000, nsname[0], now));
+}
+
+
+/* handles the answer to (in-flight) query q, received over TCP if tcp is
+ * set. srv is the server to account the answer to, if known. */
+static void answer_handle(struct rppdns *ctx, struct rppdns_query *q, const unsigned char *answer, int anslen, struct nserver *srv, int tcp, long now) {
+  char rdeaddr[128];
+  unsigned long ttl;
+  int status;
+
+  if (srv != NULL) server_answered(srv, now - q->sent);
+  if (ctx->stats != NULL) rpphist_add(&(ctx->stats->dnsrtt), (now - q->sent) * 1000);
+  /* the window of the resolver grows as long as its latency does not */
+  if ((q->window >= 0) && ((now - q->sent) * 8 <= ctx->ns[q->window].srtt * 2)) rppwindow_grow(&(ctx->win[q->window]));
+  query_unlink(ctx, q);
+
+  /* truncated answers are asked again over TCP, to the same server */
+  if (((answer[2] & 0x02) != 0) && (tcp == 0)) {
+    q->usetcp = 1;
+    query_send(ctx, q, now);
+    return;
+  }
+
+  /* servers that do not support EDNS0 are asked again without it */
+  if (((answer[3] & 0x0f) == ns_r_formerr) && (q->querylen > q->qlen)) {
+    q->querylen = q->qlen;
+    ns_put16(0, q->query + 10); /* arcount */
+    query_send(ctx, q, now);
+    return;
+  }
+
+  /* a server failure is retried elsewhere, like libresolv does */
+  switch (answer[3] & 0x0f) {
+    case ns_r_noerror:
+    case ns_r_nxdomain:
+      break;
+    default:
+      query_retry(ctx, q, now);
+      return;
+  }
+
+  if (q->parent != NULL) {
+    subquery_answer(ctx, q, answer, anslen, now);
+    return;
+  }
+
+  if (q->deleg != NULL) {
+    /* a non-authoritative answer without records is a referral, or comes
+     * from a lame server */
+    if (((answer[2] & 0x04) == 0) && (ns_get16(answer + 6) == 0)) {
+      if (query_referral(ctx, q, answer, anslen, now) != 0) query_retry(ctx, q, now);
+      return;
+    }
+    /* aliases are left to the resolvers to follow */
+    if (ns_get16(answer + 6) > 0) {
+      ns_msg msg;
+      ns_rr rr;
+      if ((ns_initparse(answer, anslen, &msg) != 0) || (ns_parserr(&msg, ns_s_an, 0, &rr) != 0) || (ns_rr_type(rr) == ns_t_cname)) {
+        query_recurse(ctx, q, now);
+        return;
+      }
+    }
+  }
+
+  status = rpp_parseanswer(rdeaddr, sizeof(rdeaddr), &ttl, answer, anslen);
+  query_done(ctx, q, status, (status == 0) ? rdeaddr : NULL, ttl);
+}
+
+
+/* processes a datagram received from a nameserver, from the resolver sock
+ * (or from the authoritative server at *from, through the socket dfd, if
+ * sock is negative) */
+static void answer_process(struct rppdns *ctx, const unsigned char *answer, int anslen, int sock, int dfd, const struct sockaddr_storage *from, long now) {
+  struct rppdns_query *q;
+  struct nserver *srv;
+
+  if (anslen < HFIXEDSZ) return;
+  if ((answer[2] & 0x80) == 0) return; /* not a response */
+  q = ctx->idmap[ns_get16(answer)];
+  if ((q == NULL) || (question_match(q, answer, anslen, q->deleg != NULL) != 0)) return;
+  /* queries waiting for the address of a nameserver are not in flight */
+  if ((q->prev == NULL) && (ctx->head != q)) return;
+
+  /* answers of authoritative servers must come from the one that got asked
+   * last, to the socket it got asked from - resolvers may still answer after
+   * a retransmission */
+  if (q->deleg != NULL) {
+    if ((sock >= 0) || (dfd != q->dfd) || (addrcmp(from, &(q->to)) != 0)) return;
+  } else if (sock < 0) {
+    return;
+  }
+  srv = query_server(ctx, q);
+  if ((q->deleg == NULL) && (sock != q->ns)) srv = NULL;
+  answer_handle(ctx, q, answer, anslen, srv, 0, now);
+}
+
+
+/* makes the TCP exchange of query q progress: sends the query once
+ * connected, then reads the answer */
+static void tcp_event(struct rppdns *ctx, struct rppdns_query *q, long now) {
+  struct epoll_event ev;
+  unsigned char *answer;
+  ssize_t n;
+  int len;
+
+  if (q->tcpreading == 0) {
+    n = send(q->tcp, q->tcpbuf + q->tcplen, 2 + q->querylen - q->tcplen, MSG_NOSIGNAL);
+    if (n >= 0) {
+      q->tcplen += n;
+      if (q->tcplen < 2 + q->querylen) return;
+      q->tcpreading = 1;
+      q->tcplen = 0;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.u32 = TCPTAG + (q - ctx->slots);
+      if (epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, q->tcp, &ev) == 0) return;
+    }
+  } else {
+    len = (q->tcplen < 2) ? 2 : 2 + ns_get16(q->tcpbuf);
+    n = recv(q->tcp, q->tcpbuf + q->tcplen, len - q->tcplen, 0);
+    if (n > 0) {
+      q->tcplen += n;
+      if ((q->tcplen < 2) || (q->tcplen < 2 + (int)ns_get16(q->tcpbuf))) return;
+      /* the answer is complete: the connection is not needed anymore */
+      answer = q->tcpbuf;
+      len = ns_get16(answer);
+      q->tcpbuf = NULL;
+      tcp_close(q);
+      if ((len >= HFIXEDSZ) && (memcmp(answer + 2, q->query, 2) == 0) && ((answer[4] & 0x80) != 0) && (question_match(q, answer + 2, len, 0) == 0)) {
+        answer_handle(ctx, q, answer + 2, len, query_server(ctx, q), 1, now);
+      } else {
+        query_unlink(ctx, q);
+        query_retry(ctx, q, now);
+      }
+      free(answer);
+      return;
+    }
+  }
+  if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR))) return;
+
+  /* the connection failed, or got closed before the answer came */
+  query_unlink(ctx, q);
+  query_retry(ctx, q, now);
+}
+
+
+/* processes the completions of the io_uring instance: answers received, and
+ * query buffers the kernel is done with */
+static void ring_reap(struct rppdns *ctx, long now) {
+  void *data;
+  int res;
+  while (rppuring_cqe(ctx->ring, &data, &res) != 0) {
+    if (*(int *)data == TXBUF) {
+      struct dnstx *tx = data;
+      tx->next = ctx->freetx;
+      ctx->freetx = tx;
+    } else {
+      struct dnsrx *rx = data;
+      rx->posted = 0;
+      if (res > 0) answer_process(ctx, rx->data, res, rx->ns, -1, NULL, now);
+    }
+  }
+}
+
+
+void rppdns_ratelimit(struct rppdns *ctx, int qps) {
+  rpprate_init(&(ctx->rate), qps, 1000, mstime());
+}
+
+
+void rppdns_stats(struct rppdns *ctx, struct rppstats *stats) {
+  ctx->stats = stats;
+}
+
+
+int rppdns_uring(struct rppdns *ctx) {
+  struct epoll_event ev;
+  int i;
+
+  if (ctx->ring != NULL) return(0);
+  ctx->ring = rppuring_new(RINGENTRIES);
+  if (ctx->ring == NULL) return(-1);
+  ctx->rx = calloc(ctx->nscount * RECVDEPTH, sizeof(*(ctx->rx)));
+  ctx->tx = calloc(TXBUFS, sizeof(*(ctx->tx)));
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = RINGTAG;
+  if ((ctx->rx == NULL) || (ctx->tx == NULL) || (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, rppuring_fd(ctx->ring), &ev) != 0)) {
+    rppuring_free(ctx->ring);
+    ctx->ring = NULL;
+    free(ctx->rx);
+    ctx->rx = NULL;
+    free(ctx->tx);
+    ctx->tx = NULL;
+    return(-1);
+  }
+  for (i = 0; i < TXBUFS; i++) {
+    ctx->tx[i].kind = TXBUF;
+    ctx->tx[i].next = ctx->freetx;
+    ctx->freetx = &(ctx->tx[i]);
+  }
+  /* answers of the resolvers now come through the ring */
+  for (i = 0; i < ctx->nscount; i++) epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, ctx->sock[i], NULL);
+  for (i = 0; i < ctx->nscount * RECVDEPTH; i++) {
+    ctx->rx[i].kind = RXBUF;
+    ctx->rx[i].ns = i / RECVDEPTH;
+  }
+  ring_flush(ctx);
+  return(0);
+}
+
+
+void rppdns_flush(struct rppdns *ctx) {
+  ring_flush(ctx);
+}
+
+
+/* retransmits the queries that timed out - a query lost by a resolver is
+ * taken as a sign of congestion, and shrinks its window */
+static void query_expire(struct rppdns *ctx, long now) {
+  struct rppdns_query *q;
+  while (((q = ctx->head) != NULL) && (q->deadline <= now)) {
+    if (q->window >= 0) rppwindow_cut(&(ctx->win[q->window]), q->sent, now);
+    if (ctx->stats != NULL) ctx->stats->timeouts++;
+    query_unlink(ctx, q);
+    query_retry(ctx, q, now);
+  }
+}
+
+
+int rppdns_run(struct rppdns *ctx, int maxwait) {
+  struct epoll_event ev[64];
+  unsigned char answer[ANSWERSZ];
+  struct sockaddr_storage from;
+  socklen_t fromlen;
+  long now;
+  int i, n, len, wait;
+
+  /* handle queries that timed out */
+  now = mstime();
+  query_expire(ctx, now);
+  query_drain(ctx, now);
+  ring_flush(ctx);
+  if (ctx->inflight == 0) return(0);
+
+  /* wait no longer than until the next query times out */
+  wait = rppdns_waittime(ctx);
+  if ((maxwait >= 0) && (maxwait < wait)) wait = maxwait;
+
+  n = epoll_wait(ctx->epfd, ev, sizeof(ev) / sizeof(ev[0]), wait);
+  now = mstime();
+  for (i = 0; i < n; i++) {
+    if (ev[i].data.u32 == RINGTAG) {
+      ring_reap(ctx, now);
+    } else if (ev[i].data.u32 >= TCPTAG) {
+      int slot = ev[i].data.u32 - TCPTAG;
+      if ((slot < ctx->nslots) && (ctx->slots[slot].tcp >= 0)) tcp_event(ctx, &(ctx->slots[slot]), now);
+    } else if (ev[i].data.u32 >= DSOCKTAG) {
+      int slot = (ev[i].data.u32 - DSOCKTAG) / 2;
+      struct dsock *s = &(ctx->dsock[slot / DSOCKS][slot % DSOCKS]);
+      int sock = ((ev[i].data.u32 - DSOCKTAG) & 1) ? s->old : s->fd;
+      while (sock >= 0) {
+        fromlen = sizeof(from);
+        len = recvfrom(sock, answer, sizeof(answer), 0, (struct sockaddr *)&from, &fromlen);
+        if (len < 0) break;
+        answer_process(ctx, answer, len, -1, sock, &from, now);
+      }
+    } else {
+      int sock = ctx->sock[ev[i].data.u32];
+      while ((len = recv(sock, answer, sizeof(answer), 0)) >= 0) {
+        answer_process(ctx, answer, len, ev[i].data.u32, -1, NULL, now);
+      }
+    }
+  }
+
+  query_expire(ctx, now);
+  query_drain(ctx, now);
+  ring_flush(ctx);
+  return(ctx->inflight);
+}
+
+
+/* records the result of a query run by rppdns_resolve() */
+struct syncres {
+  int done;
+  int status;
+  unsigned long ttl;
+  char *result;
+  int maxres;
+};
+
+static void syncres_cb(void *priv, int status, const char *rdeaddr, unsigned long ttl) {
+  struct syncres *r = priv;
+  r->done = 1;
+  r->status = status;
+  r->ttl = ttl;
+  if (status == 0) snprintf(r->result, r->maxres, "%s", rdeaddr);
+}
+
+
+int rppdns_resolve(struct rppdns *ctx, char *result, int maxres, unsigned long *ttl, const char *revname) {
+  struct syncres r;
+  memset(&r, 0, sizeof(r));
+  r.result = result;
+  r.maxres = maxres;
+  *ttl = 0;
+  if (rppdns_submit(ctx, revname, syncres_cb, &r) != 0) return(-1);
+  while (r.done == 0) rppdns_run(ctx, -1);
+  *ttl = r.ttl;
+  return(r.status);
+}
+
+
+int rppdns_fd(const struct rppdns *ctx) {
+  return(ctx->epfd);
+}
+
+
+int rppdns_waittime(const struct rppdns *ctx) {
+  long now = mstime(), wait = -1;
+  if (ctx->head != NULL) {
+    wait = ctx->head->deadline - now;
+    if (wait < 0) wait = 0;
+  }
+  /* a query waiting for a window waits for a query in flight, and one
+   * waiting for a token until it is earned */
+  if ((ctx->waithead != NULL) && ((ctx->waithead->deleg != NULL) || (rppwindow_full(&(ctx->win[ctx->waithead->ns])) == 0))) {
+    long tokwait = rpprate_wait(&(ctx->rate), now);
+    if ((wait < 0) || (tokwait < wait)) wait = tokwait;
+  }
+  return(wait);
+}
+
+
+int rppdns_inflight(const struct rppdns *ctx) {
+  return(ctx->inflight);
+}
+
+
+void rppdns_free(struct rppdns *ctx) {
+  int i;
+  if (ctx == NULL) return;
+  rppuring_free(ctx->ring);
+  for (i = 0; i < ctx->nscount; i++) close(ctx->sock[i]);
+  for (i = 0; i < 2 * DSOCKS; i++) {
+    if (ctx->dsock[i / DSOCKS][i % DSOCKS].fd >= 0) close(ctx->dsock[i / DSOCKS][i % DSOCKS].fd);
+    if (ctx->dsock[i / DSOCKS][i % DSOCKS].old >= 0) close(ctx->dsock[i / DSOCKS][i % DSOCKS].old);
+  }
+  if (ctx->epfd >= 0) close(ctx->epfd);
+  for (i = 0; (ctx->slots != NULL) && (i < ctx->nslots); i++) tcp_close(&(ctx->slots[i]));
+  for (i = 0; (ctx->delegs != NULL) && (i < DELEGBUCKETS); i++) {
+    while (ctx->delegs[i] != NULL) {
+      struct deleg *d = ctx->delegs[i];
+      ctx->delegs[i] = d->next;
+      free(d);
+    }
+  }
+  free(ctx->delegs);
+  free(ctx->slots);
+  free(ctx->idmap);
+  free(ctx->names);
+  free(ctx->waiters);
+  free(ctx->rx);
+  free(ctx->tx);
+  if (ctx->resinit) res_nclose(&(ctx->res));
+  rpprnd_free(&(ctx->rnd));
+  free(ctx);
+}
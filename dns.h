@@ -0,0 +1,164 @@
+/**
+  * @brief DNS resolution of RDE controllers, blocking and asynchronous
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_DNS_H
+#define RPP_DNS_H
+
+#include "stats.h"
+
+/** @brief callback called by the asynchronous resolver for every query that
+  * reaches completion
+  * @param *priv the private pointer that was given to rppdns_submit()
+  * @param status the result of the query, with the same meaning as the return value of rppdns_resolve()
+  * @param *rdeaddr the addresses of the RDE controllers, separated by commas (meaningful only if status is 0)
+  * @param ttl for how long (in seconds) the result may be cached, 0 if it must not be cached
+  */
+typedef void (*rppdns_cb)(void *priv, int status, const char *rdeaddr, unsigned long ttl);
+
+/** @brief asynchronous resolver context (opaque) */
+struct rppdns;
+
+/** @brief maximum number of controller candidates kept out of an answer */
+#define RPP_MAXRDE 8
+
+/** @brief a controller candidate found in an answer - a view into the
+  * answer buffer itself, valid for as long as the answer is */
+struct rpprde {
+  const char *addr;   /**< the address, NOT nul-terminated */
+  int len;            /**< the length of addr */
+  unsigned long ttl;  /**< the TTL of the record it comes from */
+};
+
+/** @brief scans a TXT answer in place for RDE controllers - every
+  * character-string of every TXT record is looked at, and 'RDE:' tags are
+  * accepted at the start of a string or after a blank
+  * @param *rde filled with the distinct candidates found, in the order of the answer
+  * @param maxrde the amount of entries available in *rde
+  * @param *ttl filled with the time (in seconds) the result may be cached for - on negative answers this is the negative caching TTL of the zone
+  * @param *answer the DNS answer, in wire format
+  * @param anslen the length of the answer
+  * @return the number of candidates found (0 if none), negative value on parsing failure
+  */
+int rpp_scananswer(struct rpprde *rde, int maxrde, unsigned long *ttl, const unsigned char *answer, int anslen);
+
+/** @brief extracts the RDE controllers out of a TXT answer
+  * @param *result the IP addresses of the routing controllers are filled there, separated by commas
+  * @param maxres the amount of space available in *result
+  * @param *ttl filled with the time (in seconds) the result may be cached for - on negative answers this is the negative caching TTL of the zone
+  * @param *answer the DNS answer, in wire format
+  * @param anslen the length of the answer
+  * @return 0 on success, negative value on parsing failure, 1 if the answer does not contain any RDE record
+  */
+int rpp_parseanswer(char *result, int maxres, unsigned long *ttl, const unsigned char *answer, int anslen);
+
+/** @brief creates an asynchronous resolver context - every context reads
+  * the resolver configuration into its own state, so contexts may be used
+  * from different threads. queries are sent to the resolver that answered
+  * fastest so far, and retransmitted to the next fastest ones.
+  * @param maxinflight the maximum number of queries allowed in flight
+  * @param timeout the time (in ms) to wait for an answer before retransmitting
+  * @param retries how many times a query is retransmitted before giving up
+  * @param *resolvers the resolvers to use, in the format accepted by rppdns_checkservers(), or NULL for the ones of the system resolver
+  * @param *direct if not NULL, queries are sent to the authoritative servers of the reverse zones, starting with the servers given (that serve the root zone), or with the servers of in-addr.arpa and ip6.arpa if direct is "arpa". delegations are remembered for as long as their NS records allow, and queries that cannot be answered that way are left to the resolvers.
+  * @return a new resolver context, or NULL on error
+  */
+struct rppdns *rppdns_new(int maxinflight, int timeout, int retries, const char *resolvers, const char *direct);
+
+/** @brief checks a list of nameservers: addresses separated by commas or
+  * spaces, each optionally followed by '#port'. "arpa" is accepted as well.
+  * @return 0 if the list is valid, non-zero otherwise */
+int rppdns_checkservers(const char *list);
+
+/** @brief submits a TXT query for a revDNS name - the query is sent
+  * immediately, its callback is called later from within rppdns_run(). a
+  * name being looked up already is not asked again: the lookup shares the
+  * answer of the query in flight, and counts as in flight on its own.
+  * @return 0 on success, non-zero if the query cannot be submitted (typically because maxinflight queries are already in flight)
+  */
+int rppdns_submit(struct rppdns *ctx, const char *revname, rppdns_cb cb, void *priv);
+
+/** @brief resolves the routing controller for a given prefix' revDNS,
+  * waiting for the answer, through the servers of the resolver context
+  * @param *result the IP addresses of the routing controllers are filled there, separated by commas
+  * @param maxres the amount of space available in *result
+  * @param *ttl filled with the time (in seconds) the result may be cached for, 0 if it must not be cached
+  * @param *revname the revDNS string we want to look at
+  * @return 0 on success, negative value on resolution failure, 1 if resolution went fine but this prefix don't seem to have a RDE record
+  */
+int rppdns_resolve(struct rppdns *ctx, char *result, int maxres, unsigned long *ttl, const char *revname);
+
+/** @brief caps the queries sent, retransmissions included, to qps per
+  * second (0 removes the cap). queries past the cap wait for their turn, as
+  * do queries to a resolver whose congestion window is full: resolvers are
+  * sent at most a window of queries at once, that starts small, grows with
+  * every answer that does not come slower than usual, and is halved by every
+  * loss. */
+void rppdns_ratelimit(struct rppdns *ctx, int qps);
+
+/** @brief accounts for the queries sent, their round-trip times and their
+  * timeouts into stats from now on (NULL stops accounting) */
+void rppdns_stats(struct rppdns *ctx, struct rppstats *stats);
+
+/** @brief talks to the resolvers through io_uring from now on: queries are
+  * sent in batches, a single system call submitting all the queries
+  * prepared since the last one, and answers are received without any system
+  * call of their own. the authoritative servers of --direct, and queries
+  * over TCP, are still handled through epoll.
+  * @return 0 on success, non-zero if io_uring is not available (the context
+  * then keeps working through epoll alone) */
+int rppdns_uring(struct rppdns *ctx);
+
+/** @brief submits the queries prepared and not submitted yet, when talking
+  * to the resolvers through io_uring - to be called before waiting on
+  * rppdns_fd() */
+void rppdns_flush(struct rppdns *ctx);
+
+/** @brief processes answers and timeouts, waiting up to maxwait ms for
+  * something to happen (-1 waits until at least one query progresses)
+  * @return the number of queries still in flight
+  */
+int rppdns_run(struct rppdns *ctx, int maxwait);
+
+/** @brief returns a file descriptor that becomes readable when
+  * rppdns_run() has something to do */
+int rppdns_fd(const struct rppdns *ctx);
+
+/** @brief returns the time (in ms) rppdns_run() may be delayed at most,
+  * or -1 if no query is in flight */
+int rppdns_waittime(const struct rppdns *ctx);
+
+/** @brief returns the number of lookups currently in flight, the ones
+  * sharing a query included */
+int rppdns_inflight(const struct rppdns *ctx);
+
+/** @brief frees a resolver context - queries still in flight are dropped
+  * without their callbacks being called */
+void rppdns_free(struct rppdns *ctx);
+
+#endif
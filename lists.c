@@ -0,0 +1,170 @@
+/**
+  * @brief lists of local prefixes and preferences, given inline or as files
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lists.h"
+#include "proto.h"
+
+
+/* reads the whole of fd into a buffer of its own, for files that cannot be
+ * mapped (pipes and the like) */
+static int list_read(struct rpplist *l, int fd) {
+  char *buf = NULL;
+  size_t bufsz = 0;
+  l->len = 0;
+  for (;;) {
+    ssize_t len;
+    if (l->len == bufsz) {
+      char *newbuf;
+      bufsz = (bufsz == 0) ? 65536 : bufsz * 2;
+      newbuf = realloc(buf, bufsz);
+      if (newbuf == NULL) {
+        free(buf);
+        return(-1);
+      }
+      buf = newbuf;
+    }
+    len = read(fd, buf + l->len, bufsz - l->len);
+    if (len == 0) break;
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      free(buf);
+      return(-1);
+    }
+    l->len += len;
+  }
+  l->data = buf;
+  return(0);
+}
+
+
+int rpplist_open(struct rpplist *l, const char *arg) {
+  struct stat st;
+  int fd, res = 0;
+
+  memset(l, 0, sizeof(*l));
+  if (arg[0] != '@') {
+    l->data = arg;
+    l->len = strlen(arg);
+    return(0);
+  }
+  l->fromfile = 1;
+  if (strcmp(arg + 1, "-") == 0) {
+    fd = STDIN_FILENO;
+  } else if ((fd = open(arg + 1, O_RDONLY | O_CLOEXEC)) < 0) {
+    return(-1);
+  }
+
+  /* regular files are mapped, pages are then read once, in order */
+  if ((fstat(fd, &st) == 0) && (S_ISREG(st.st_mode)) && (st.st_size > 0)) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      l->data = map;
+      l->len = st.st_size;
+      l->mapped = 1;
+    }
+  }
+  if (l->mapped == 0) res = list_read(l, fd);
+
+  if (fd != STDIN_FILENO) {
+    int err = errno;
+    close(fd);
+    errno = err;
+  }
+  return(res);
+}
+
+
+/* returns 0 if the entry of len bytes at s is valid for a list of kind */
+static int entry_check(const char *s, size_t len, int kind) {
+  struct rppprefix pfx;
+  unsigned long asn;
+  int weight;
+  if (kind == RPPLIST_PREFIXES) return(rppproto_prefix(&pfx, s, len));
+  return(rppproto_pref(&asn, &weight, s, len));
+}
+
+
+long rpplist_copy(char *out, struct rpplist *l, int kind) {
+  const char *s = l->data, *end = l->data + l->len;
+  char *o = out;
+  int line = 1;
+
+  if (l->fromfile == 0) {
+    memcpy(out, l->data, l->len);
+    return(l->len);
+  }
+
+  /* entries are separated by at least one byte, which makes room for the
+   * single space that separates them in the output */
+  while (s < end) {
+    const char *entry;
+    if (*s == '\n') line++;
+    if (isspace((unsigned char)*s)) {
+      s++;
+      continue;
+    }
+    if (*s == '#') {
+      s = memchr(s, '\n', end - s);
+      if (s == NULL) break;
+      continue;
+    }
+    entry = s;
+    while ((s < end) && (!isspace((unsigned char)*s)) && (*s != '#')) s++;
+    if (entry_check(entry, s - entry, kind) != 0) {
+      l->errline = line;
+      errno = EINVAL;
+      return(-1);
+    }
+    if (o > out) *o++ = ' ';
+    memcpy(o, entry, s - entry);
+    o += s - entry;
+  }
+  return(o - out);
+}
+
+
+void rpplist_close(struct rpplist *l) {
+  if (l->mapped != 0) {
+    munmap((void *)l->data, l->len);
+  } else if (l->fromfile != 0) {
+    free((void *)l->data);
+  }
+  l->data = NULL;
+  l->len = 0;
+}
@@ -0,0 +1,69 @@
+/**
+  * @brief lists of local prefixes and preferences, given inline or as files
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_LISTS_H
+#define RPP_LISTS_H
+
+#include <stddef.h>
+
+/* kinds of lists */
+#define RPPLIST_PREFIXES 0  /* addr[/len] entries */
+#define RPPLIST_PREFS    1  /* asn:weight entries, weight being 0..255 */
+
+/** @brief a list of local prefixes or of preferences, as given on the
+  * command line - either inline, or read from a file */
+struct rpplist {
+  const char *data;   /* the list as given, not nul-terminated if read from a file */
+  size_t len;
+  int fromfile;       /* set if the list is read from a file, and must be validated */
+  int mapped;         /* set if data is a mapping of the file, rather than a copy */
+  int errline;        /* line of the invalid entry, see rpplist_copy() */
+};
+
+/** @brief opens a list given as a command line argument: "@file" reads it
+  * from file ("@-" from stdin), anything else is the list itself. files
+  * are mapped rather than read whenever possible, so that long lists are
+  * only ever copied once - by rpplist_copy()
+  * @return 0 on success, non-zero otherwise (errno is set) */
+int rpplist_open(struct rpplist *l, const char *arg);
+
+/** @brief copies a list to out, which must provide at least l->len bytes.
+  * lists read from files are validated and normalized in the same pass:
+  * entries may be separated by any blanks including ends of lines, and
+  * '#' starts a comment that runs to the end of the line - they are output
+  * separated by single spaces. inline lists are copied as they are.
+  * @param kind RPPLIST_PREFIXES or RPPLIST_PREFS
+  * @return the length of the list copied, or -1 if an entry is invalid
+  * (l->errline then tells where) */
+long rpplist_copy(char *out, struct rpplist *l, int kind);
+
+/** @brief releases what rpplist_open() mapped or read */
+void rpplist_close(struct rpplist *l);
+
+#endif
@@ -0,0 +1,545 @@
+/**
+  * @brief end-to-end load test of rpp and rppd against a mock DNS server and a mock controller
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adv.h"
+
+#define MAXREPLIES 16384  /* DNS replies the mock server delays at most at once */
+#define MAXCONNS 1024     /* connections the mock controller holds at most at once */
+#define MAXARGS 64        /* extra options given to rpp and rppd, at most */
+
+/* what the harness is told to do */
+struct benchopts {
+  int count;        /* requests per run */
+  int window;       /* requests in flight, at most */
+  int delay;        /* latency of the mock DNS server, in ms */
+  int loss;         /* share of DNS queries dropped, in % */
+  int ctldelay;     /* time the mock controller lets connections wait before reading them, in ms */
+  int ctlloss;      /* share of connections reset by the mock controller, in % */
+  int port;         /* UDP port of the mock DNS server */
+  const char *ctl;  /* address of the mock controller */
+  const char *mode; /* "batch", "daemon" or "both" */
+  char *args[MAXARGS]; /* extra options of rpp and rppd */
+  int nargs;
+};
+
+/* a DNS reply waiting for its delay to pass */
+struct reply {
+  double due;
+  struct sockaddr_in to;
+  int len;
+  unsigned char buf[256];
+};
+
+/* a connection to the mock controller */
+struct ctlconn {
+  int sock;
+  double readable; /* time it may be read from */
+};
+
+static struct benchopts opts;
+static volatile int stop = 0;
+static unsigned long dnsqueries = 0, dnsdropped = 0;
+static unsigned long ctlconns = 0, ctlresets = 0, ctlbytes = 0;
+
+
+/* returns a monotonic time in ms */
+static double mstime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((ts.tv_sec * 1e3) + (ts.tv_nsec / 1e6));
+}
+
+
+/* returns the time to wait (in ms) for the poll timeout of something due at
+ * 'due', -1 for no due time */
+static int waitfor(double due, double now) {
+  if (due < 0) return(100);
+  if (due <= now) return(0);
+  return((int)(due - now) + 1);
+}
+
+
+/* builds the answer to query q: any TXT query under in-addr.arpa or
+ * ip6.arpa gets the mock controller, anything else gets no record
+ * @return the length of the answer, or -1 to drop the query */
+static int dns_answer(unsigned char *ans, const unsigned char *q, int qlen) {
+  char txt[64];
+  int o = 12, len, txtlen, type;
+
+  if ((qlen < 17) || ((q[2] & 0x80) != 0) || (q[4] != 0) || (q[5] != 1)) return(-1);
+  while ((o < qlen) && (q[o] != 0)) {
+    if ((q[o] & 0xc0) != 0) return(-1);
+    o += q[o] + 1;
+  }
+  if (o + 5 > qlen) return(-1);
+  o += 5; /* end of the question */
+  if (o + 16 + 64 > (int)sizeof(((struct reply *)0)->buf)) return(-1);
+  type = (q[o - 4] << 8) | q[o - 3];
+  memcpy(ans, q, o);
+  ans[2] = 0x84 | (q[2] & 0x01); /* response, authoritative */
+  ans[3] = 0x80;
+  memset(ans + 6, 0, 6);
+  len = o;
+  if (type != 16) return(len);
+  txtlen = sprintf(txt, "RDE:%s", opts.ctl);
+  ans[7] = 1;
+  memcpy(ans + len, "\xc0\x0c\0\x10\0\x01\0\0\x0e\x10", 10);
+  ans[len + 10] = 0;
+  ans[len + 11] = txtlen + 1;
+  ans[len + 12] = txtlen;
+  memcpy(ans + len + 13, txt, txtlen);
+  return(len + 13 + txtlen);
+}
+
+
+/* the mock DNS server: answers come back after opts.delay ms, and a share
+ * opts.loss of the queries is dropped */
+static void *dns_main(void *arg) {
+  static struct reply replies[MAXREPLIES];
+  struct sockaddr_in from;
+  socklen_t fromlen;
+  unsigned char query[512];
+  unsigned int seed = 53;
+  int sock = *(int *)arg, head = 0, count = 0;
+
+  while (stop == 0) {
+    struct pollfd pfd;
+    double now = mstime();
+    ssize_t len;
+
+    /* replies are due in the order of the queries */
+    while ((count > 0) && (replies[head].due <= now)) {
+      struct reply *r = &(replies[head]);
+      sendto(sock, r->buf, r->len, 0, (struct sockaddr *)&(r->to), sizeof(r->to));
+      head = (head + 1) % MAXREPLIES;
+      count--;
+    }
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, waitfor((count > 0) ? replies[head].due : -1, now)) <= 0) continue;
+    for (;;) {
+      struct reply *r;
+      fromlen = sizeof(from);
+      len = recvfrom(sock, query, sizeof(query), MSG_DONTWAIT, (struct sockaddr *)&from, &fromlen);
+      if (len < 0) break;
+      dnsqueries++;
+      if ((int)(rand_r(&seed) % 100) < opts.loss) {
+        dnsdropped++;
+        continue;
+      }
+      if (count == MAXREPLIES) continue;
+      r = &(replies[(head + count) % MAXREPLIES]);
+      r->len = dns_answer(r->buf, query, len);
+      if (r->len < 0) continue;
+      r->to = from;
+      r->due = mstime() + opts.delay;
+      count++;
+    }
+  }
+  return(NULL);
+}
+
+
+/* the mock controller: a share opts.ctlloss of the connections is reset as
+ * soon as accepted, the others are read from (and what is read discarded)
+ * once they waited for opts.ctldelay ms */
+static void *ctl_main(void *arg) {
+  static struct ctlconn conns[MAXCONNS];
+  static struct pollfd pfd[MAXCONNS + 1];
+  char buf[65536];
+  unsigned int seed = 4343;
+  int lsock = *(int *)arg, nconns = 0, i, n;
+
+  while (stop == 0) {
+    double now = mstime(), due = -1;
+    pfd[0].fd = lsock;
+    pfd[0].events = (nconns < MAXCONNS) ? POLLIN : 0;
+    for (i = 0; i < nconns; i++) {
+      pfd[i + 1].fd = conns[i].sock;
+      pfd[i + 1].events = (conns[i].readable <= now) ? POLLIN : 0;
+      if ((conns[i].readable > now) && ((due < 0) || (conns[i].readable < due))) due = conns[i].readable;
+    }
+    if (poll(pfd, nconns + 1, waitfor(due, now)) < 0) continue;
+
+    for (i = nconns - 1; i >= 0; i--) {
+      ssize_t len;
+      if ((pfd[i + 1].revents == 0) || (conns[i].readable > now)) continue;
+      len = recv(conns[i].sock, buf, sizeof(buf), MSG_DONTWAIT);
+      if (len > 0) {
+        ctlbytes += len;
+      } else if ((len == 0) || ((errno != EAGAIN) && (errno != EINTR))) {
+        close(conns[i].sock);
+        conns[i] = conns[--nconns];
+      }
+    }
+    if ((pfd[0].revents & POLLIN) == 0) continue;
+    while ((nconns < MAXCONNS) && ((n = accept(lsock, NULL, NULL)) >= 0)) {
+      ctlconns++;
+      if ((int)(rand_r(&seed) % 100) < opts.ctlloss) {
+        struct linger lin;
+        lin.l_onoff = 1;
+        lin.l_linger = 0;
+        setsockopt(n, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+        close(n);
+        ctlresets++;
+        continue;
+      }
+      conns[nconns].sock = n;
+      conns[nconns].readable = mstime() + opts.ctldelay;
+      nconns++;
+    }
+  }
+  for (i = 0; i < nconns; i++) close(conns[i].sock);
+  return(NULL);
+}
+
+
+/* creates a socket of type bound to addr:port, listening if it is a stream */
+static int mock_socket(int type, const char *addr, int port) {
+  struct sockaddr_in sin;
+  int sock, one = 1;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  if (inet_pton(AF_INET, addr, &(sin.sin_addr)) != 1) return(-1);
+  sock = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock < 0) return(-1);
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if ((bind(sock, (struct sockaddr *)&sin, sizeof(sin)) != 0) || ((type == SOCK_STREAM) && (listen(sock, 128) != 0))) {
+    close(sock);
+    return(-1);
+  }
+  return(sock);
+}
+
+
+static int cmpdouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return((x > y) - (x < y));
+}
+
+
+/* formats request i: every request gets a /24 of its own, that the cache
+ * knows nothing of, and advertises preferences
+ * @return the length of the request line */
+static int request(char *buf, int i) {
+  return(sprintf(buf, "%d.%d.%d.0/24\t192.0.2.0/24\t64552:0 64900:255\n", 1 + ((i >> 16) & 0x7f), (i >> 8) & 0xff, i & 0xff));
+}
+
+
+/* feeds opts.count requests to the socket sock, keeping up to opts.window of
+ * them in flight, and reads their results from it - or, if sock is -1,
+ * reads the results of requests fed already from rfd. then reports how
+ * fast it went, and the latency of the requests if they were fed here. */
+static int drive(const char *label, int sock, int rfd) {
+  static char in[65536];
+  char out[4096];
+  double *sent, *lat, t0;
+  size_t inlen = 0, outlen = 0, outpos = 0;
+  int next = 0, got = 0, errors = 0, shut = 0;
+
+  sent = malloc(opts.count * sizeof(*sent));
+  lat = malloc(opts.count * sizeof(*lat));
+  if ((sent == NULL) || (lat == NULL)) {
+    free(sent);
+    free(lat);
+    return(-1);
+  }
+  t0 = mstime();
+  if (sock >= 0) {
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    rfd = sock;
+  } else {
+    for (next = 0; next < opts.count; next++) sent[next] = t0;
+    shut = 1;
+  }
+  while (got < opts.count) {
+    struct pollfd pfd;
+    char *eol;
+
+    while ((outlen - outpos < sizeof(out) / 2) && (next < opts.count) && (next - got < opts.window)) {
+      if (outpos > 0) {
+        memmove(out, out + outpos, outlen - outpos);
+        outlen -= outpos;
+        outpos = 0;
+      }
+      outlen += request(out + outlen, next);
+      sent[next++] = mstime();
+    }
+    if (outpos < outlen) {
+      ssize_t len = send(sock, out + outpos, outlen - outpos, MSG_NOSIGNAL);
+      if (len > 0) outpos += len;
+    }
+    /* rppd answers until the client is done */
+    if ((outpos == outlen) && (next == opts.count) && (shut == 0)) {
+      shutdown(sock, SHUT_WR);
+      shut = 1;
+    }
+
+    pfd.fd = rfd;
+    pfd.events = (outpos < outlen) ? (POLLIN | POLLOUT) : POLLIN;
+    if (poll(&pfd, 1, 1000) < 0) continue;
+    if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+      ssize_t len = read(rfd, in + inlen, sizeof(in) - inlen);
+      if (len <= 0) break;
+      inlen += len;
+    }
+    /* results come in the order of the requests */
+    while ((eol = memchr(in, '\n', inlen)) != NULL) {
+      char *f2 = strchr(in, '\t'), *f4 = NULL;
+      *eol = 0;
+      if ((f2 != NULL) && ((f4 = strchr(f2 + 1, '\t')) != NULL)) f4 = strchr(f4 + 1, '\t');
+      if ((f2 == NULL) || (f4 == NULL) || (strncmp(f2, "\t0\t", 3) != 0) || (strncmp(f4, "\t0\t", 3) != 0)) errors++;
+      if (got < opts.count) {
+        lat[got] = mstime() - sent[got];
+        got++;
+      }
+      inlen -= eol + 1 - in;
+      memmove(in, eol + 1, inlen);
+    }
+  }
+  t0 = mstime() - t0;
+
+  if (got < opts.count) {
+    printf("%-7s FAILED after %d results of %d\n", label, got, opts.count);
+  } else {
+    printf("%-7s %d prefixes in %.3f s: %.0f prefixes/s, ", label, got, t0 / 1000, got * 1000.0 / t0);
+    qsort(lat, got, sizeof(*lat), cmpdouble);
+    if (sock >= 0) printf("latency p50 %.3f ms, p99 %.3f ms, ", lat[got / 2], lat[(int)(got * 0.99)]);
+    printf("%d errors\n", errors);
+  }
+  if (shut == 0) shutdown(sock, SHUT_WR);
+  free(sent);
+  free(lat);
+  return((got < opts.count) ? -1 : 0);
+}
+
+
+/* runs prog (./rpp or ./rppd) with the extra options, pointed at the mock
+ * DNS server, followed by the arguments in tail */
+static pid_t spawn(const char *prog, char **tail, int stdoutfd) {
+  char *argv[MAXARGS + 8];
+  char resolvers[64];
+  pid_t pid;
+  int i, n = 0;
+
+  sprintf(resolvers, "127.0.0.1#%d", opts.port);
+  argv[n++] = (char *)prog;
+  for (i = 0; i < opts.nargs; i++) argv[n++] = opts.args[i];
+  argv[n++] = "--resolvers";
+  argv[n++] = resolvers;
+  while (*tail != NULL) argv[n++] = *tail++;
+  argv[n] = NULL;
+  fflush(stdout); /* or the child would output it again */
+  pid = fork();
+  if (pid != 0) return(pid);
+  if (stdoutfd >= 0) dup2(stdoutfd, 1);
+  execv(prog, argv);
+  fprintf(stderr, "ERROR: failed to run %s (%s)\n", prog, strerror(errno));
+  _exit(127);
+}
+
+
+/* runs the requests through 'rpp batch', from a file - the latencies of
+ * its requests are the ones of its --stats, as its output is buffered */
+static int run_batch(void) {
+  char path[64], line[128];
+  char *tail[4];
+  FILE *fd;
+  int out[2], res = -1, i;
+  pid_t pid;
+
+  sprintf(path, "/tmp/loadbench.%d.in", (int)getpid());
+  fd = fopen(path, "w");
+  if (fd == NULL) return(-1);
+  for (i = 0; i < opts.count; i++) fwrite(line, 1, request(line, i), fd);
+  if ((fclose(fd) != 0) || (pipe(out) != 0)) {
+    unlink(path);
+    return(-1);
+  }
+  fcntl(out[0], F_SETFD, FD_CLOEXEC);
+  fcntl(out[1], F_SETFD, FD_CLOEXEC);
+  tail[0] = "--stats";
+  tail[1] = "batch";
+  tail[2] = path;
+  tail[3] = NULL;
+  pid = spawn("./rpp", tail, out[1]);
+  close(out[1]);
+  if (pid > 0) {
+    res = drive("batch", -1, out[0]);
+    waitpid(pid, NULL, 0);
+  }
+  close(out[0]);
+  unlink(path);
+  return(res);
+}
+
+
+/* runs the requests through rppd, over a single connection */
+static int run_daemon(void) {
+  struct sockaddr_un addr;
+  char *tail[2];
+  int sock = -1, i, res = -1;
+  pid_t pid;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  sprintf(addr.sun_path, "/tmp/loadbench.%d.sock", (int)getpid());
+  tail[0] = addr.sun_path;
+  tail[1] = NULL;
+  pid = spawn("./rppd", tail, -1);
+  if (pid < 0) return(-1);
+  /* give the daemon time to start listening */
+  for (i = 0; (sock < 0) && (i < 200); i++) {
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ((sock >= 0) && (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+      close(sock);
+      sock = -1;
+      usleep(10000);
+    }
+  }
+  if (sock >= 0) {
+    res = drive("daemon", sock, -1);
+    close(sock);
+  } else {
+    printf("daemon  FAILED to connect to rppd\n");
+  }
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  return(res);
+}
+
+
+static void printhelp(void) {
+  printf("usage: loadbench [options] [-- rpp/rppd options]\n"
+         "\n"
+         "runs requests through 'rpp batch' and rppd, against a mock DNS server that\n"
+         "gives every reverse zone the mock controller, and reports throughput and\n"
+         "latency. every request gets a /24 of its own, and advertises preferences.\n"
+         "\n");
+  printf("options:\n"
+         "  --count n      requests per run (default: 20000)\n"
+         "  --window n     requests kept in flight by the client of rppd (default: 512)\n"
+         "  --delay ms     latency of the mock DNS server (default: 1)\n"
+         "  --loss n       share of the DNS queries dropped, in %% (default: 0)\n"
+         "  --ctldelay ms  time connections wait before the controller reads them\n"
+         "  --ctlloss n    share of the connections reset by the controller, in %%\n");
+  printf("  --ctl addr     address of the mock controller, listening on port %d\n"
+         "                 (default: 127.43.43.43)\n"
+         "  --port n       UDP port of the mock DNS server (default: 10053)\n"
+         "  --mode m       'batch', 'daemon' or 'both' (default: both)\n", RPP_PORT);
+}
+
+
+int main(int argc, char **argv) {
+  pthread_t dnsthread, ctlthread;
+  struct sigaction sa;
+  int dnssock, ctlsock, res = 0;
+
+  opts.count = 20000;
+  opts.window = 512;
+  opts.delay = 1;
+  opts.port = 10053;
+  opts.ctl = "127.43.43.43";
+  opts.mode = "both";
+  while ((argc > 2) && (strncmp(argv[1], "--", 2) == 0) && (argv[1][2] != 0)) {
+    int val = atoi(argv[2]);
+    if (strcmp(argv[1], "--count") == 0) {
+      opts.count = val;
+    } else if (strcmp(argv[1], "--window") == 0) {
+      opts.window = val;
+    } else if (strcmp(argv[1], "--delay") == 0) {
+      opts.delay = val;
+    } else if (strcmp(argv[1], "--loss") == 0) {
+      opts.loss = val;
+    } else if (strcmp(argv[1], "--ctldelay") == 0) {
+      opts.ctldelay = val;
+    } else if (strcmp(argv[1], "--ctlloss") == 0) {
+      opts.ctlloss = val;
+    } else if (strcmp(argv[1], "--port") == 0) {
+      opts.port = val;
+    } else if (strcmp(argv[1], "--ctl") == 0) {
+      opts.ctl = argv[2];
+    } else if (strcmp(argv[1], "--mode") == 0) {
+      opts.mode = argv[2];
+    } else {
+      break;
+    }
+    argc -= 2;
+    argv += 2;
+  }
+  if ((argc > 1) && (strcmp(argv[1], "--") == 0)) {
+    for (argc--, argv++; (argc > 1) && (opts.nargs < MAXARGS); argc--) opts.args[opts.nargs++] = *++argv;
+  }
+  if ((argc > 1) || (opts.count < 1) || (opts.window < 1) || (opts.port < 1) || (opts.port > 65535) || (opts.delay < 0) || (opts.ctldelay < 0)) {
+    printhelp();
+    return(1);
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &sa, NULL);
+  dnssock = mock_socket(SOCK_DGRAM, "127.0.0.1", opts.port);
+  ctlsock = mock_socket(SOCK_STREAM, opts.ctl, RPP_PORT);
+  if ((dnssock < 0) || (ctlsock < 0)) {
+    fprintf(stderr, "ERROR: failed to set up the mock servers (%s)\n", strerror(errno));
+    return(1);
+  }
+  if ((pthread_create(&dnsthread, NULL, dns_main, &dnssock) != 0) || (pthread_create(&ctlthread, NULL, ctl_main, &ctlsock) != 0)) {
+    fprintf(stderr, "ERROR: failed to start the mock servers\n");
+    return(1);
+  }
+
+  printf("mock DNS: %d ms, %d %% loss - controller %s: %d ms, %d %% reset\n", opts.delay, opts.loss, opts.ctl, opts.ctldelay, opts.ctlloss);
+  if (strcmp(opts.mode, "daemon") != 0) res |= run_batch();
+  if (strcmp(opts.mode, "batch") != 0) res |= run_daemon();
+  stop = 1;
+  pthread_join(dnsthread, NULL);
+  pthread_join(ctlthread, NULL);
+  printf("mock DNS got %lu queries (%lu dropped), controller %lu connections (%lu reset), %lu bytes\n", dnsqueries, dnsdropped, ctlconns, ctlresets, ctlbytes);
+  close(dnssock);
+  close(ctlsock);
+  return((res != 0) ? 1 : 0);
+}
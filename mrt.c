@@ -0,0 +1,262 @@
+/**
+  * @brief MRT routing table dumps import
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mrt.h"
+#include "revdns.h"
+
+/* MRT record types and subtypes (RFC 6396, RFC 8050) */
+#define MRT_TABLE_DUMP 12
+#define MRT_TABLE_DUMP_V2 13
+#define TD_AFI_IPV4 1
+#define TD_AFI_IPV6 2
+#define TD2_RIB_IPV4_UNICAST 2
+#define TD2_RIB_IPV6_UNICAST 4
+#define TD2_RIB_IPV4_UNICAST_ADDPATH 8
+#define TD2_RIB_IPV6_UNICAST_ADDPATH 10
+
+/* timestamp, type, subtype and length of the record */
+#define MRT_HDRLEN 12
+
+/* records of a dump parsed by one thread */
+struct mrtchunk {
+  const unsigned char *start;
+  const unsigned char *end;
+  struct rppprefix *pfxs;   /* the prefixes found, sorted and deduplicated */
+  unsigned long count;
+  unsigned long size;
+  int err;                  /* errno if the chunk could not be parsed */
+  pthread_t tid;
+};
+
+
+static unsigned long get32(const unsigned char *p) {
+  return(((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | p[3]);
+}
+
+
+/* extracts the prefix of a record, returns 1 if it got one, 0 if the
+ * record carries none, -1 if it is malformed */
+static int mrt_prefix(struct rppprefix *pfx, const unsigned char *rec) {
+  const unsigned char *body = rec + MRT_HDRLEN, *addr;
+  unsigned int type = (rec[4] << 8) | rec[5], subtype = (rec[6] << 8) | rec[7];
+  unsigned long len = get32(rec + 8);
+  struct rppprefix p;
+  int plen;
+
+  memset(&p, 0, sizeof(p));
+  if (type == MRT_TABLE_DUMP_V2) {
+    /* sequence number, prefix length, prefix bytes - then the entries */
+    if ((subtype == TD2_RIB_IPV4_UNICAST) || (subtype == TD2_RIB_IPV4_UNICAST_ADDPATH)) {
+      p.family = AF_INET;
+    } else if ((subtype == TD2_RIB_IPV6_UNICAST) || (subtype == TD2_RIB_IPV6_UNICAST_ADDPATH)) {
+      p.family = AF_INET6;
+    } else {
+      return(0);
+    }
+    if (len < 5) return(-1);
+    plen = body[4];
+    addr = body + 5;
+    if ((plen > ((p.family == AF_INET6) ? 128 : 32)) || (len < 5 + (unsigned long)((plen + 7) >> 3))) return(-1);
+  } else if (type == MRT_TABLE_DUMP) {
+    /* view number, sequence number, the whole address, prefix length */
+    unsigned long addrlen;
+    if (subtype == TD_AFI_IPV4) {
+      p.family = AF_INET;
+      addrlen = 4;
+    } else if (subtype == TD_AFI_IPV6) {
+      p.family = AF_INET6;
+      addrlen = 16;
+    } else {
+      return(0);
+    }
+    if (len < 4 + addrlen + 1) return(-1);
+    addr = body + 4;
+    plen = body[4 + addrlen];
+    if (plen > (int)(addrlen * 8)) return(-1);
+  } else {
+    return(0);
+  }
+  memcpy(p.addr, addr, (plen + 7) >> 3);
+  p.len = plen;
+  rppprefix_trunc(pfx, &p, plen);
+  return(1);
+}
+
+
+/* orders prefixes by family, then address, then length */
+static int pfxcmp(const void *a, const void *b) {
+  const struct rppprefix *pa = a, *pb = b;
+  int res;
+  if (pa->family != pb->family) return((pa->family == AF_INET) ? -1 : 1);
+  res = memcmp(pa->addr, pb->addr, sizeof(pa->addr));
+  if (res != 0) return(res);
+  return(pa->len - pb->len);
+}
+
+
+/* parses the records of a chunk, then sorts and deduplicates its prefixes */
+static void *chunk_main(void *arg) {
+  struct mrtchunk *c = arg;
+  const unsigned char *rec;
+  unsigned long i, n;
+
+  for (rec = c->start; rec < c->end; rec += MRT_HDRLEN + get32(rec + 8)) {
+    int res;
+    if (c->count == c->size) {
+      unsigned long newsize = (c->size == 0) ? 4096 : c->size * 2;
+      struct rppprefix *newpfxs = realloc(c->pfxs, newsize * sizeof(*newpfxs));
+      if (newpfxs == NULL) {
+        c->err = ENOMEM;
+        return(NULL);
+      }
+      c->pfxs = newpfxs;
+      c->size = newsize;
+    }
+    res = mrt_prefix(&(c->pfxs[c->count]), rec);
+    if (res < 0) {
+      c->err = EINVAL;
+      return(NULL);
+    }
+    c->count += res;
+  }
+
+  qsort(c->pfxs, c->count, sizeof(*(c->pfxs)), pfxcmp);
+  for (i = 0, n = 0; i < c->count; i++) {
+    if ((n > 0) && (pfxcmp(&(c->pfxs[n - 1]), &(c->pfxs[i])) == 0)) continue;
+    c->pfxs[n++] = c->pfxs[i];
+  }
+  c->count = n;
+  return(NULL);
+}
+
+
+/* merges the sorted prefixes of the chunks, without duplicates
+ * @return the prefixes, or NULL if out of memory */
+static struct rppprefix *chunks_merge(struct mrtchunk *chunks, int nchunks, unsigned long *count) {
+  struct rppprefix *res;
+  unsigned long total = 0, pos[RPPMRT_MAXTHREADS], n = 0;
+  int i;
+
+  for (i = 0; i < nchunks; i++) {
+    total += chunks[i].count;
+    pos[i] = 0;
+  }
+  res = malloc((total > 0) ? total * sizeof(*res) : 1);
+  if (res == NULL) return(NULL);
+  for (;;) {
+    int best = -1;
+    /* there are few chunks, the smallest head is simply looked for */
+    for (i = 0; i < nchunks; i++) {
+      if (pos[i] == chunks[i].count) continue;
+      if ((best < 0) || (pfxcmp(&(chunks[i].pfxs[pos[i]]), &(chunks[best].pfxs[pos[best]])) < 0)) best = i;
+    }
+    if (best < 0) break;
+    if ((n == 0) || (pfxcmp(&(res[n - 1]), &(chunks[best].pfxs[pos[best]])) != 0)) res[n++] = chunks[best].pfxs[pos[best]];
+    pos[best]++;
+  }
+  *count = n;
+  return(res);
+}
+
+
+struct rppprefix *rppmrt_load(const char *fname, int threads, unsigned long *count) {
+  struct mrtchunk chunks[RPPMRT_MAXTHREADS];
+  struct rppprefix *res = NULL;
+  const unsigned char *map, *end, *rec;
+  struct stat st;
+  size_t sz;
+  int fd, i, nchunks = 0, started, err = 0;
+
+  if ((threads < 1) || (threads > RPPMRT_MAXTHREADS)) {
+    errno = EINVAL;
+    return(NULL);
+  }
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) return(NULL);
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return(NULL);
+  }
+  sz = (size_t)st.st_size;
+  if (sz == 0) { /* nothing to map */
+    close(fd);
+    *count = 0;
+    return(malloc(1));
+  }
+  map = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return(NULL);
+  end = map + sz;
+
+  /* records only tell where the next one starts: their headers are walked
+   * through to split the dump in chunks of about the same size */
+  memset(chunks, 0, sizeof(chunks));
+  chunks[0].start = map;
+  for (rec = map; rec < end; ) {
+    if (((size_t)(end - rec) < MRT_HDRLEN) || (get32(rec + 8) > (size_t)(end - rec) - MRT_HDRLEN)) {
+      err = EINVAL;
+      break;
+    }
+    rec += MRT_HDRLEN + get32(rec + 8);
+    if ((nchunks < threads - 1) && ((size_t)(rec - map) >= sz / threads * (nchunks + 1))) {
+      chunks[nchunks].end = rec;
+      chunks[++nchunks].start = rec;
+    }
+  }
+  chunks[nchunks++].end = end;
+
+  /* the first chunk is parsed by the calling thread */
+  for (started = 1; (err == 0) && (started < nchunks); started++) {
+    if (pthread_create(&(chunks[started].tid), NULL, chunk_main, &(chunks[started])) != 0) break;
+  }
+  if (err == 0) {
+    for (i = started; i < nchunks; i++) chunk_main(&(chunks[i]));
+    chunk_main(&(chunks[0]));
+  }
+  for (i = 1; (err == 0) && (i < started); i++) pthread_join(chunks[i].tid, NULL);
+  for (i = 0; (err == 0) && (i < nchunks); i++) {
+    if (chunks[i].err != 0) err = chunks[i].err;
+  }
+
+  if ((err == 0) && ((res = chunks_merge(chunks, nchunks, count)) == NULL)) err = ENOMEM;
+  for (i = 0; i < nchunks; i++) free(chunks[i].pfxs);
+  munmap((void *)map, sz);
+  errno = err;
+  return(res);
+}
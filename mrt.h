@@ -0,0 +1,50 @@
+/**
+  * @brief MRT routing table dumps import
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_MRT_H
+#define RPP_MRT_H
+
+#include "revdns.h"
+
+/** @brief maximum number of threads parsing a dump */
+#define RPPMRT_MAXTHREADS 64
+
+/** @brief reads the prefixes of the routes of an MRT dump (RFC 6396): the
+  * unicast RIB records of TABLE_DUMP_V2 (add-path ones included, RFC 8050)
+  * and of TABLE_DUMP, other records are ignored. the file is mapped, and
+  * split in chunks of records parsed by as many threads. prefixes come out
+  * sorted (so that the ones sharing reverse zones are next to each other)
+  * and deduplicated.
+  * @param threads the number of threads to parse with (1 to RPPMRT_MAXTHREADS)
+  * @param *count filled with the number of prefixes
+  * @return the prefixes, to be freed with free(), or NULL on error (errno is
+  * set, to EINVAL if the dump is malformed) */
+struct rppprefix *rppmrt_load(const char *fname, int threads, unsigned long *count);
+
+#endif
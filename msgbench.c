@@ -0,0 +1,176 @@
+/**
+  * @brief micro-benchmark of the parsing of answers and of the encoding of messages
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "adv.h"
+#include "dns.h"
+
+#define ROUNDS 200000
+
+/* keeps the compiler from optimizing the work away */
+static volatile int sink;
+
+
+/* returns a monotonic time in ns */
+static double nstime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((ts.tv_sec * 1e9) + ts.tv_nsec);
+}
+
+
+/* builds the answer to a TXT query for name, with a record for each of the
+ * count strings of txt - a string holds the character-strings of its record
+ * separated by '|'
+ * @return the length of the answer */
+static int answer_build(unsigned char *ans, const char *name, const char **txt, int count) {
+  unsigned char *p = ans + 12;
+  const char *s, *dot;
+  int i;
+
+  memset(ans, 0, 12);
+  ans[2] = 0x85; /* response, authoritative, recursion desired */
+  ans[3] = 0x80;
+  ans[5] = 1;
+  ans[6] = count >> 8;
+  ans[7] = count & 0xff;
+  for (s = name; *s != 0; s = (*dot == '.') ? dot + 1 : dot) {
+    dot = strchr(s, '.');
+    if (dot == NULL) dot = s + strlen(s);
+    *p++ = dot - s;
+    memcpy(p, s, dot - s);
+    p += dot - s;
+  }
+  *p++ = 0;
+  memcpy(p, "\0\x10\0\x01", 4);
+  p += 4;
+  for (i = 0; i < count; i++) {
+    unsigned char *rdlen;
+    memcpy(p, "\xc0\x0c\0\x10\0\x01\0\0\x0e\x10", 10); /* TTL of 3600 s */
+    rdlen = p + 10;
+    p += 12;
+    for (s = txt[i]; *s != 0; s = (*dot == '|') ? dot + 1 : dot) {
+      dot = strchr(s, '|');
+      if (dot == NULL) dot = s + strlen(s);
+      *p++ = dot - s;
+      memcpy(p, s, dot - s);
+      p += dot - s;
+    }
+    rdlen[0] = (p - rdlen - 2) >> 8;
+    rdlen[1] = (p - rdlen - 2) & 0xff;
+  }
+  return(p - ans);
+}
+
+
+/* times rpp_parseanswer() on an answer made of the count records of txt */
+static int bench_parse(const char *label, const char **txt, int count) {
+  unsigned char ans[4096];
+  char res[256];
+  unsigned long ttl;
+  double t0;
+  int len, r;
+
+  len = answer_build(ans, "2.0.192.in-addr.arpa", txt, count);
+  if (rpp_parseanswer(res, sizeof(res), &ttl, ans, len) != 0) {
+    printf("%s: FAILED to parse\n", label);
+    return(-1);
+  }
+  t0 = nstime();
+  for (r = 0; r < ROUNDS; r++) {
+    sink = rpp_parseanswer(res, sizeof(res), &ttl, ans, len);
+  }
+  printf("%-26s %5d bytes  %8.1f ns/answer   -> %s\n", label, len, (nstime() - t0) / ROUNDS, res);
+  return(0);
+}
+
+
+/* times the encoding of a SETINPREF message, in text and in binary */
+static int bench_encode(const char *label, const char *loc, const char *pref) {
+  struct rppmsg *msg, *bin;
+  double t0, t1, t2;
+  int r, rounds = ROUNDS / 10;
+
+  msg = rppmsg_setinpref(3600, loc, pref);
+  bin = (msg != NULL) ? rppmsg_binary(msg) : NULL;
+  if (bin == NULL) {
+    printf("%s: FAILED to encode\n", label);
+    rppmsg_free(msg);
+    return(-1);
+  }
+  rppmsg_free(bin);
+  t0 = nstime();
+  for (r = 0; r < rounds; r++) {
+    rppmsg_free(rppmsg_setinpref(3600, loc, pref));
+  }
+  t1 = nstime();
+  for (r = 0; r < rounds; r++) {
+    rppmsg_free(rppmsg_binary(msg));
+  }
+  t2 = nstime();
+  rppmsg_free(msg);
+  printf("%-26s text: %9.1f ns/msg   binary: %9.1f ns/msg\n", label, (t1 - t0) / rounds, (t2 - t1) / rounds);
+  return(0);
+}
+
+
+int main(void) {
+  static const char *one[] = {"RDE:192.0.2.1"};
+  static const char *multi[] = {"v=spf1 -all", "RDE:198.51.100.4 RDE:2001:db8::1|RDE:192.0.2.1"};
+  static const char *noisy[31];
+  static char junk[30][64];
+  char *loc, *pref;
+  size_t loclen = 0, preflen = 0;
+  int i, res = 0;
+
+  for (i = 0; i < 30; i++) {
+    sprintf(junk[i], "v=junk%02d-%040d", i, 0);
+    noisy[i] = junk[i];
+  }
+  noisy[30] = "RDE:|192.0.2.1";
+  res |= bench_parse("answer, 1 record", one, 1);
+  res |= bench_parse("answer, 2 records", multi, 2);
+  res |= bench_parse("answer, 31 records", noisy, 31);
+
+  /* a few entries, and the lists of a large network */
+  res |= bench_encode("setinpref, 2+3 entries", "192.0.2.0/24 2001:db8::/32", "64552:0 64900:255 65001:127");
+  loc = malloc(256 * 24);
+  pref = malloc(64 * 16);
+  if ((loc == NULL) || (pref == NULL)) return(1);
+  for (i = 0; i < 256; i++) loclen += sprintf(loc + loclen, "%s10.%d.%d.0/24", (i > 0) ? " " : "", i >> 4, i & 15);
+  for (i = 0; i < 64; i++) preflen += sprintf(pref + preflen, "%s%d:%d", (i > 0) ? " " : "", 64512 + i, (i * 37) & 255);
+  res |= bench_encode("setinpref, 256+64 entries", loc, pref);
+  free(loc);
+  free(pref);
+  return((res != 0) ? 1 : 0);
+}
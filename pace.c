@@ -0,0 +1,103 @@
+/**
+  * @brief congestion windows and token buckets, pacing requests to a peer
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include "pace.h"
+
+
+void rppwindow_init(struct rppwindow *w, int init, int max) {
+  if (max < 1) max = 1;
+  if (init > max) init = max;
+  if (init < 1) init = 1;
+  w->cwnd = (long)init * RPPWINDOW_UNIT;
+  w->ssthresh = (long)max * RPPWINDOW_UNIT;
+  w->max = (long)max * RPPWINDOW_UNIT;
+  w->cut = 0;
+  w->inflight = 0;
+}
+
+
+int rppwindow_full(const struct rppwindow *w) {
+  return((long)w->inflight * RPPWINDOW_UNIT >= w->cwnd);
+}
+
+
+void rppwindow_grow(struct rppwindow *w) {
+  if (w->cwnd < w->ssthresh) {
+    w->cwnd += RPPWINDOW_UNIT;
+  } else {
+    /* RPPWINDOW_UNIT per window, rounded up so that it ever grows */
+    w->cwnd += (RPPWINDOW_UNIT * RPPWINDOW_UNIT + w->cwnd - 1) / w->cwnd;
+  }
+  if (w->cwnd > w->max) w->cwnd = w->max;
+}
+
+
+void rppwindow_cut(struct rppwindow *w, long started, long now) {
+  if ((w->cut != 0) && (started <= w->cut)) return;
+  w->cut = now;
+  w->ssthresh = w->cwnd / 2;
+  if (w->ssthresh < RPPWINDOW_UNIT) w->ssthresh = RPPWINDOW_UNIT;
+  w->cwnd = w->ssthresh;
+}
+
+
+int rppwindow_size(const struct rppwindow *w) {
+  return((int)(w->cwnd / RPPWINDOW_UNIT));
+}
+
+
+void rpprate_init(struct rpprate *r, long persec, long hz, long now) {
+  r->rate = (persec > 0) ? (double)persec / hz : 0;
+  r->burst = (persec > 10) ? persec / 10.0 : 1.0;
+  r->tokens = r->burst;
+  r->last = now;
+}
+
+
+/* returns the tokens available at time now */
+static double rate_tokens(const struct rpprate *r, long now) {
+  double tokens = r->tokens + (now - r->last) * r->rate;
+  return((tokens > r->burst) ? r->burst : tokens);
+}
+
+
+long rpprate_wait(const struct rpprate *r, long now) {
+  double tokens;
+  if (r->rate <= 0) return(0);
+  tokens = rate_tokens(r, now);
+  if (tokens >= 1.0) return(0);
+  return((long)((1.0 - tokens) / r->rate) + 1);
+}
+
+
+void rpprate_take(struct rpprate *r, long now) {
+  if (r->rate <= 0) return;
+  r->tokens = rate_tokens(r, now) - 1.0;
+  r->last = now;
+}
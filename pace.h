@@ -0,0 +1,94 @@
+/**
+  * @brief congestion windows and token buckets, pacing requests to a peer
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_PACE_H
+#define RPP_PACE_H
+
+/** @brief unit of the congestion windows: they are kept in fractions of an
+  * operation, so they can grow by less than one at a time */
+#define RPPWINDOW_UNIT 16
+
+/** @brief an AIMD congestion window, bounding the operations in flight
+  * towards a peer. it grows by one operation per success until it reaches
+  * its slow start threshold, then by one per window of successes, and a loss
+  * halves it (both the window and the threshold). */
+struct rppwindow {
+  long cwnd;      /**< the window, in 1/RPPWINDOW_UNIT operations */
+  long ssthresh;  /**< the slow start threshold, in the same unit */
+  long max;       /**< the window never grows beyond this, in the same unit */
+  long cut;       /**< time of the last cut, 0 if none */
+  int inflight;   /**< operations in flight, maintained by the user of the window */
+};
+
+/** @brief initializes a window
+  * @param init the initial window, in operations
+  * @param max the largest window, in operations */
+void rppwindow_init(struct rppwindow *w, int init, int max);
+
+/** @brief returns non-zero if the window is full, that is if no more
+  * operation may be started before one completes */
+int rppwindow_full(const struct rppwindow *w);
+
+/** @brief accounts for an operation that succeeded */
+void rppwindow_grow(struct rppwindow *w);
+
+/** @brief accounts for an operation that got lost - the loss of an
+  * operation started before the last cut is part of the same congestion
+  * event, and is ignored
+  * @param started the time the operation was started
+  * @param now the current time, on the same clock */
+void rppwindow_cut(struct rppwindow *w, long started, long now);
+
+/** @brief returns the size of the window, in whole operations */
+int rppwindow_size(const struct rppwindow *w);
+
+/** @brief a token bucket, capping the rate of some operation */
+struct rpprate {
+  double rate;    /**< tokens earned per tick, 0 if the rate is not capped */
+  double burst;   /**< how many tokens may be saved at most */
+  double tokens;  /**< tokens available as of 'last' */
+  long last;      /**< time (in ticks) tokens got accounted last */
+};
+
+/** @brief initializes a token bucket - a tenth of a second worth of tokens
+  * may be spent at once, and the bucket starts full
+  * @param persec the operations allowed per second, 0 for no cap
+  * @param hz the number of ticks per second of the clock used
+  * @param now the current time, in ticks */
+void rpprate_init(struct rpprate *r, long persec, long hz, long now);
+
+/** @brief returns the time (in ticks) until an operation is allowed, 0 if
+  * it is allowed right now */
+long rpprate_wait(const struct rpprate *r, long now);
+
+/** @brief spends a token for an operation - to be called when rpprate_wait()
+  * allows it */
+void rpprate_take(struct rpprate *r, long now);
+
+#endif
@@ -0,0 +1,192 @@
+/**
+  * @brief parsing of the RDE controller protocol, shared by the client and server sides
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "proto.h"
+
+
+/* reads the 32-bit value at p, in network byte order */
+static unsigned long get32(const unsigned char *p) {
+  return(((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | p[3]);
+}
+
+
+/* parses the decimal number of len digits at s
+ * @return 0 on success, non-zero if it is not a number up to max */
+static int number(unsigned long *val, const char *s, size_t len, unsigned long max) {
+  *val = 0;
+  if (len == 0) return(-1);
+  for (; len > 0; s++, len--) {
+    if ((*s < '0') || (*s > '9')) return(-1);
+    if (*val > (max - (*s - '0')) / 10) return(-1);
+    *val = *val * 10 + (*s - '0');
+  }
+  return(0);
+}
+
+
+int rppproto_prefix(struct rppprefix *pfx, const char *s, size_t len) {
+  char buf[64];
+  if (len >= sizeof(buf)) return(-1);
+  memcpy(buf, s, len);
+  buf[len] = 0;
+  return(rppprefix_parse(pfx, buf));
+}
+
+
+int rppproto_pref(unsigned long *asn, int *weight, const char *s, size_t len) {
+  const char *colon = memchr(s, ':', len);
+  unsigned long w;
+  if (colon == NULL) return(-1);
+  if (number(asn, s, colon - s, 4294967295lu) != 0) return(-1);
+  if (number(&w, colon + 1, s + len - colon - 1, 255) != 0) return(-1);
+  *weight = w;
+  return(0);
+}
+
+
+/* parses a binary frame, whose header is complete */
+static long parse_binary(struct rppprotomsg *m, const unsigned char *buf, size_t len, size_t maxlen) {
+  const unsigned char *p, *end;
+  unsigned long i, count, paylen = get32(buf + 4);
+
+  if ((buf[1] != RPP_BINVERSION) || (buf[2] != RPP_BINSETINPREF) || (paylen < 12) || (paylen > maxlen - RPP_BINHDRSZ)) return(-1);
+  if (len < RPP_BINHDRSZ + paylen) return(0);
+  p = buf + RPP_BINHDRSZ;
+  end = p + paylen;
+  m->cmd = RPPPROTO_SETINPREF;
+  m->binary = 1;
+  m->ttl = get32(p);
+
+  /* local prefixes are of varying lengths, they are all checked here so
+   * that iterating over them cannot fail */
+  count = get32(p + 4);
+  p += 8;
+  m->loc = p;
+  for (i = 0; i < count; i++) {
+    if ((end - p < 2) || ((p[0] != 4) && (p[0] != 6)) || (p[1] > ((p[0] == 4) ? 32 : 128))) return(-1);
+    if (end - p < 2 + ((p[1] + 7) >> 3)) return(-1);
+    p += 2 + ((p[1] + 7) >> 3);
+  }
+  m->loclen = p - m->loc;
+  if (end - p < 4) return(-1);
+  count = get32(p);
+  m->pref = p + 4;
+  m->preflen = end - m->pref;
+  if (m->preflen != count * 5) return(-1);
+  return(RPP_BINHDRSZ + paylen);
+}
+
+
+long rppproto_parse(struct rppprotomsg *m, const unsigned char *buf, size_t len, size_t maxlen) {
+  const unsigned char *eol, *field, *end;
+  size_t linelen;
+
+  memset(m, 0, sizeof(*m));
+  if (len == 0) return(0);
+  if (buf[0] == 0) {
+    if (len < RPP_BINHDRSZ) return(0);
+    return(parse_binary(m, buf, len, maxlen));
+  }
+
+  eol = memchr(buf, '\n', (len < maxlen) ? len : maxlen);
+  if (eol == NULL) return((len >= maxlen) ? -1 : 0);
+  linelen = eol - buf + 1;
+  end = eol;
+  if ((end > buf) && (end[-1] == '\r')) end--;
+
+  if ((end - buf > 10) && (memcmp(buf, "GETINPREF ", 10) == 0)) {
+    m->cmd = RPPPROTO_GETINPREF;
+    m->loc = buf + 10;
+    m->loclen = end - m->loc;
+  } else if ((end - buf > 10) && (memcmp(buf, "SETINPREF ", 10) == 0)) {
+    /* SETINPREF ttl<TAB>locpreflist<TAB>preflist */
+    field = memchr(buf + 10, '\t', end - buf - 10);
+    if ((field == NULL) || (number(&(m->ttl), (const char *)buf + 10, field - buf - 10, 4294967295lu) != 0)) return(-1);
+    m->loc = field + 1;
+    field = memchr(m->loc, '\t', end - m->loc);
+    if (field == NULL) return(-1);
+    m->loclen = field - m->loc;
+    m->pref = field + 1;
+    m->preflen = end - m->pref;
+    m->cmd = RPPPROTO_SETINPREF;
+  }
+  /* unknown commands are left for the caller to skip (cmd is 0) */
+  return(linelen);
+}
+
+
+/* returns the next blank-separated entry of a text list starting at *pos,
+ * or NULL at its end - *pos is moved past it */
+static const char *nextentry(const unsigned char *list, size_t listlen, size_t *pos, size_t *len) {
+  size_t start;
+  while ((*pos < listlen) && ((list[*pos] == ' ') || (list[*pos] == '\t'))) (*pos)++;
+  if (*pos == listlen) return(NULL);
+  start = *pos;
+  while ((*pos < listlen) && (list[*pos] != ' ') && (list[*pos] != '\t')) (*pos)++;
+  *len = *pos - start;
+  return((const char *)list + start);
+}
+
+
+int rppproto_nextprefix(const struct rppprotomsg *m, size_t *pos, struct rppprefix *pfx) {
+  const char *entry;
+  size_t len;
+  if (m->binary != 0) {
+    const unsigned char *p = m->loc + *pos;
+    if (*pos >= m->loclen) return(0);
+    memset(pfx, 0, sizeof(*pfx));
+    pfx->family = (p[0] == 6) ? AF_INET6 : AF_INET;
+    pfx->len = p[1];
+    memcpy(pfx->addr, p + 2, (p[1] + 7) >> 3);
+    *pos += 2 + ((p[1] + 7) >> 3);
+    return(1);
+  }
+  entry = nextentry(m->loc, m->loclen, pos, &len);
+  if (entry == NULL) return(0);
+  return((rppproto_prefix(pfx, entry, len) == 0) ? 1 : -1);
+}
+
+
+int rppproto_nextpref(const struct rppprotomsg *m, size_t *pos, unsigned long *asn, int *weight) {
+  const char *entry;
+  size_t len;
+  if (m->binary != 0) {
+    if (*pos >= m->preflen) return(0);
+    *asn = get32(m->pref + *pos);
+    *weight = m->pref[*pos + 4];
+    *pos += 5;
+    return(1);
+  }
+  entry = nextentry(m->pref, m->preflen, pos, &len);
+  if (entry == NULL) return(0);
+  return((rppproto_pref(asn, weight, entry, len) == 0) ? 1 : -1);
+}
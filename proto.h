@@ -0,0 +1,95 @@
+/**
+  * @brief parsing of the RDE controller protocol, shared by the client and server sides
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_PROTO_H
+#define RPP_PROTO_H
+
+#include <stddef.h>
+
+#include "revdns.h"
+
+/* binary frames: a header of RPP_BINHDRSZ bytes - a NUL byte (text commands
+ * never start with one), the version, the command and a reserved byte, then
+ * the length of the payload. all numbers are in network byte order. the
+ * payload of RPP_BINSETINPREF is:
+ *   uint32 ttl
+ *   uint32 number of local prefixes, each of them made of
+ *     uint8 family (4 or 6), uint8 length, and as many address bytes as
+ *     the length spans
+ *   uint32 number of preferences, each of them made of
+ *     uint32 ASN, uint8 weight */
+#define RPP_BINHDRSZ 8
+#define RPP_BINVERSION 1
+#define RPP_BINSETINPREF 1
+
+/* commands, see rppproto_parse() */
+#define RPPPROTO_SETINPREF 1
+#define RPPPROTO_GETINPREF 2
+
+/** @brief a command received from a client - its lists point into the
+  * data it has been parsed from */
+struct rppprotomsg {
+  int cmd;                    /* RPPPROTO_SETINPREF or RPPPROTO_GETINPREF */
+  int binary;                 /* set if the command came as a binary frame */
+  unsigned long ttl;
+  const unsigned char *loc;   /* local prefixes (for GETINPREF, the prefix looked up) */
+  size_t loclen;
+  const unsigned char *pref;  /* preferences */
+  size_t preflen;
+};
+
+/** @brief parses an 'addr[/len]' entry of len bytes (not nul-terminated)
+  * @return 0 on success, non-zero otherwise */
+int rppproto_prefix(struct rppprefix *pfx, const char *s, size_t len);
+
+/** @brief parses an 'asn:weight' entry of len bytes (not nul-terminated),
+  * the ASN being 32-bit and the weight 0..255
+  * @return 0 on success, non-zero otherwise */
+int rppproto_pref(unsigned long *asn, int *weight, const char *s, size_t len);
+
+/** @brief parses the command at the start of a stream of len bytes: a text
+  * line, either 'SETINPREF ttl<TAB>localprefixes<TAB>preflist' or
+  * 'GETINPREF prefix', or a binary frame (see rppmsg_binary())
+  * @param maxlen the longest command accepted
+  * @return the length of the command, 0 if it is not complete yet, or -1
+  * if it is malformed - the stream then cannot be parsed any further */
+long rppproto_parse(struct rppprotomsg *m, const unsigned char *buf, size_t len, size_t maxlen);
+
+/** @brief iterates over the local prefixes of a command
+  * @param *pos where to start from, 0 for the first prefix - it is moved
+  * past the prefix returned
+  * @return 1 if a prefix is returned, 0 at the end of the list, or -1 if the
+  * entry at *pos is invalid (*pos is moved past it) */
+int rppproto_nextprefix(const struct rppprotomsg *m, size_t *pos, struct rppprefix *pfx);
+
+/** @brief iterates over the preferences of a command, see
+  * rppproto_nextprefix() */
+int rppproto_nextpref(const struct rppprotomsg *m, size_t *pos, unsigned long *asn, int *weight);
+
+#endif
@@ -0,0 +1,207 @@
+/**
+  * @brief longest-prefix-match radix tree of RDE controllers
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "radix.h"
+
+/* path-compressed binary trie: every node holds the full key of the prefix
+ * it stands for, nodes without rdeaddr are mere junctions */
+struct radixnode {
+  struct radixnode *child[2];
+  unsigned char key[16];
+  int len;
+  time_t expiry;
+  char *rdeaddr;
+  int hot;        /* set when looked up, see rppradix_hot() */
+};
+
+struct rppradix {
+  struct radixnode *root4;
+  struct radixnode *root6;
+};
+
+
+/* returns bit n of key (bit 0 being the most significant one) */
+static int getbit(const unsigned char *key, int n) {
+  return((key[n >> 3] >> (7 - (n & 7))) & 1);
+}
+
+
+/* returns the number of leading bits shared by two keys, up to maxlen */
+static int commonbits(const unsigned char *a, const unsigned char *b, int maxlen) {
+  int i;
+  for (i = 0; (i < maxlen) && (a[i >> 3] == b[i >> 3]); i += 8);
+  for (; (i < maxlen) && (getbit(a, i) == getbit(b, i)); i++);
+  if (i > maxlen) i = maxlen;
+  return(i);
+}
+
+
+/* allocates a node for the first len bits of key */
+static struct radixnode *node_new(const unsigned char *key, int len) {
+  struct radixnode *n;
+  int i;
+  n = calloc(1, sizeof(*n));
+  if (n == NULL) return(NULL);
+  memcpy(n->key, key, sizeof(n->key));
+  for (i = len; i < 128; i++) n->key[i >> 3] &= ~(0x80 >> (i & 7));
+  n->len = len;
+  return(n);
+}
+
+
+struct rppradix *rppradix_new(void) {
+  return(calloc(1, sizeof(struct rppradix)));
+}
+
+
+int rppradix_insert(struct rppradix *tree, const struct rppprefix *pfx, const char *rdeaddr, time_t expiry) {
+  struct radixnode **link, *n;
+  char *addrcopy;
+
+  addrcopy = malloc(strlen(rdeaddr) + 1);
+  if (addrcopy == NULL) return(-1);
+  strcpy(addrcopy, rdeaddr);
+
+  link = (pfx->family == AF_INET6) ? &(tree->root6) : &(tree->root4);
+  for (;;) {
+    int common;
+    n = *link;
+    if (n == NULL) { /* empty spot: the new prefix becomes a leaf */
+      n = node_new(pfx->addr, pfx->len);
+      if (n == NULL) break;
+      *link = n;
+      break;
+    }
+    common = commonbits(n->key, pfx->addr, (n->len < pfx->len) ? n->len : pfx->len);
+    if ((common == n->len) && (n->len == pfx->len)) break; /* exact match */
+    if (common == n->len) { /* n covers the prefix, go down */
+      link = &(n->child[getbit(pfx->addr, n->len)]);
+      continue;
+    }
+    /* the prefix covers n, or both diverge: a node must be inserted above n */
+    if ((n = node_new(pfx->addr, common)) == NULL) break;
+    n->child[getbit((*link)->key, common)] = *link;
+    *link = n;
+    if (common < pfx->len) { /* diverging: the prefix gets its own leaf */
+      link = &(n->child[getbit(pfx->addr, common)]);
+      if ((n = node_new(pfx->addr, pfx->len)) == NULL) break;
+      *link = n;
+    }
+    break;
+  }
+
+  if (n == NULL) {
+    free(addrcopy);
+    return(-1);
+  }
+  free(n->rdeaddr);
+  n->rdeaddr = addrcopy;
+  n->expiry = expiry;
+  n->hot = 0;
+  return(0);
+}
+
+
+const char *rppradix_lookup(struct rppradix *tree, const struct rppprefix *pfx, time_t now, int *len) {
+  struct radixnode *n, *best = NULL;
+
+  n = (pfx->family == AF_INET6) ? tree->root6 : tree->root4;
+  while ((n != NULL) && (n->len <= pfx->len)) {
+    if (commonbits(n->key, pfx->addr, n->len) < n->len) break;
+    if ((n->rdeaddr != NULL) && (n->expiry > now)) best = n;
+    if (n->len == pfx->len) break;
+    n = n->child[getbit(pfx->addr, n->len)];
+  }
+  if (best == NULL) return(NULL);
+  if (len != NULL) *len = best->len;
+  /* lookups may run concurrently, the mark is only written when not set yet */
+  if (best->hot == 0) __sync_fetch_and_or(&(best->hot), 1);
+  return(best->rdeaddr);
+}
+
+
+int rppradix_remove(struct rppradix *tree, const struct rppprefix *pfx) {
+  struct radixnode **link, **parent = NULL, *n, *p;
+
+  link = (pfx->family == AF_INET6) ? &(tree->root6) : &(tree->root4);
+  while (((n = *link) != NULL) && (n->len < pfx->len) && (commonbits(n->key, pfx->addr, n->len) == n->len)) {
+    parent = link;
+    link = &(n->child[getbit(pfx->addr, n->len)]);
+  }
+  if ((n == NULL) || (n->len != pfx->len) || (commonbits(n->key, pfx->addr, n->len) < n->len) || (n->rdeaddr == NULL)) return(-1);
+  free(n->rdeaddr);
+  n->rdeaddr = NULL;
+  n->hot = 0;
+  /* the node is a mere junction now, only needed if it has two children */
+  if ((n->child[0] != NULL) && (n->child[1] != NULL)) return(0);
+  *link = (n->child[0] != NULL) ? n->child[0] : n->child[1];
+  free(n);
+  /* its parent may be a junction that is left with a single child */
+  if ((parent != NULL) && ((p = *parent)->rdeaddr == NULL) && ((p->child[0] == NULL) || (p->child[1] == NULL))) {
+    *parent = (p->child[0] != NULL) ? p->child[0] : p->child[1];
+    free(p);
+  }
+  return(0);
+}
+
+
+int rppradix_hot(struct rppradix *tree, const struct rppprefix *pfx) {
+  struct radixnode *n;
+  int hot;
+
+  n = (pfx->family == AF_INET6) ? tree->root6 : tree->root4;
+  while ((n != NULL) && (n->len < pfx->len) && (commonbits(n->key, pfx->addr, n->len) == n->len)) {
+    n = n->child[getbit(pfx->addr, n->len)];
+  }
+  if ((n == NULL) || (n->len != pfx->len) || (commonbits(n->key, pfx->addr, n->len) < n->len)) return(0);
+  hot = n->hot;
+  n->hot = 0;
+  return(hot);
+}
+
+
+static void node_free(struct radixnode *n) {
+  if (n == NULL) return;
+  node_free(n->child[0]);
+  node_free(n->child[1]);
+  free(n->rdeaddr);
+  free(n);
+}
+
+
+void rppradix_free(struct rppradix *tree) {
+  if (tree == NULL) return;
+  node_free(tree->root4);
+  node_free(tree->root6);
+  free(tree);
+}
@@ -0,0 +1,71 @@
+/**
+  * @brief longest-prefix-match radix tree of RDE controllers
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_RADIX_H
+#define RPP_RADIX_H
+
+#include <time.h>
+
+#include "revdns.h"
+
+/** @brief radix tree (opaque) */
+struct rppradix;
+
+/** @brief creates an empty radix tree
+  * @return a new tree, or NULL on error */
+struct rppradix *rppradix_new(void);
+
+/** @brief records the controller of a prefix, replacing any previous one
+  * @return 0 on success, non-zero otherwise */
+int rppradix_insert(struct rppradix *tree, const struct rppprefix *pfx, const char *rdeaddr, time_t expiry);
+
+/** @brief forgets the controller of exactly pfx, if any - along with the
+  * junctions that are not needed anymore, so that the tree only holds the
+  * prefixes it has controllers for
+  * @return 0 if it got removed, -1 if pfx had no controller */
+int rppradix_remove(struct rppradix *tree, const struct rppprefix *pfx);
+
+/** @brief finds the controller of the longest prefix covering pfx, and
+  * marks that prefix as hot - see rppradix_hot()
+  * @param now the current time, entries that expired by then are ignored
+  * @param *len filled with the length of the prefix found, if not NULL
+  * @return the address of the controller, or NULL if no valid prefix covers pfx
+  */
+const char *rppradix_lookup(struct rppradix *tree, const struct rppprefix *pfx, time_t now, int *len);
+
+/** @brief tells whether the controller of exactly pfx has been looked up
+  * since it was recorded or since the last call, and clears that mark - it
+  * must not run concurrently with lookups
+  * @return non-zero if the prefix is hot */
+int rppradix_hot(struct rppradix *tree, const struct rppprefix *pfx);
+
+/** @brief frees a radix tree and all its entries */
+void rppradix_free(struct rppradix *tree);
+
+#endif
@@ -0,0 +1,309 @@
+/**
+  * @brief prefix parsing and reverse DNS names computation
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+#include "revdns.h"
+
+/* shortest zones a walk goes up to */
+#define WALKMIN4 8
+#define WALKMIN6 16
+
+
+/* returns the value of a hex digit, or -1 if c is not one */
+static int hexval(char c) {
+  if ((c >= '0') && (c <= '9')) return(c - '0');
+  if ((c >= 'a') && (c <= 'f')) return(c - 'a' + 10);
+  if ((c >= 'A') && (c <= 'F')) return(c - 'A' + 10);
+  return(-1);
+}
+
+
+/* parses a dotted-quad IPv4 address into addr[0..3], *end is set to the
+ * first character after it. leading zeroes are refused, as inet_pton() does */
+static int parse4(unsigned char *addr, const char *s, const char **end) {
+  int i, v;
+  for (i = 0; i < 4; i++) {
+    if ((i > 0) && (*s++ != '.')) return(-1);
+    if ((*s < '0') || (*s > '9')) return(-1);
+    if ((s[0] == '0') && (s[1] >= '0') && (s[1] <= '9')) return(-1);
+    for (v = 0; (*s >= '0') && (*s <= '9'); s++) {
+      v = (v * 10) + (*s - '0');
+      if (v > 255) return(-1);
+    }
+    addr[i] = v;
+  }
+  *end = s;
+  return(0);
+}
+
+
+/* parses an IPv6 address (RFC 4291 text form: '::' compression and trailing
+ * dotted quad included) into addr[0..15], *end is set to the first
+ * character after it */
+static int parse6(unsigned char *addr, const char *s, const char **end) {
+  int n = 0, gap = -1;
+
+  if (*s == ':') {
+    if (s[1] != ':') return(-1);
+    s++;
+  }
+  for (;;) {
+    const char *group = s;
+    int v = 0, digits, h;
+    if (*s == ':') { /* "::" */
+      if (gap >= 0) return(-1);
+      gap = n;
+      s++;
+      if (hexval(*s) < 0) break;
+      group = s;
+    }
+    for (digits = 0; (digits < 5) && ((h = hexval(*s)) >= 0); digits++, s++) v = (v << 4) | h;
+    if ((digits == 0) || (digits > 4)) return(-1);
+    if (*s == '.') { /* embedded IPv4 address, always last */
+      if ((n > 12) || (parse4(addr + n, group, &s) != 0)) return(-1);
+      n += 4;
+      break;
+    }
+    if (n == 16) return(-1);
+    addr[n++] = v >> 8;
+    addr[n++] = v & 0xff;
+    if (*s != ':') break;
+    s++;
+  }
+
+  /* expand the "::", if any */
+  if (gap >= 0) {
+    if (n == 16) return(-1);
+    memmove(addr + 16 - (n - gap), addr + gap, n - gap);
+    memset(addr + gap, 0, 16 - n);
+  } else if (n != 16) {
+    return(-1);
+  }
+  *end = s;
+  return(0);
+}
+
+
+int rppprefix_parse(struct rppprefix *pfx, const char *s) {
+  const char *p;
+  int maxlen, i;
+
+  /* the first delimiter tells the family: IPv6 addresses have a colon
+   * within their first 5 characters, IPv4 ones never have any */
+  memset(pfx, 0, sizeof(*pfx));
+  for (p = s; (p - s < 5) && (hexval(*p) >= 0); p++);
+  if (*p == ':') {
+    pfx->family = AF_INET6;
+    maxlen = 128;
+    if (parse6(pfx->addr, s, &p) != 0) return(-1);
+  } else {
+    pfx->family = AF_INET;
+    maxlen = 32;
+    if (parse4(pfx->addr, s, &p) != 0) return(-1);
+  }
+
+  pfx->len = maxlen;
+  if (*p == '/') {
+    p++;
+    if ((*p < '0') || (*p > '9')) return(-1);
+    for (pfx->len = 0; (*p >= '0') && (*p <= '9'); p++) {
+      pfx->len = (pfx->len * 10) + (*p - '0');
+      if (pfx->len > maxlen) return(-1);
+    }
+  }
+  if (*p != 0) return(-1);
+
+  /* zero out host bits */
+  for (i = pfx->len; i < maxlen; i++) pfx->addr[i >> 3] &= ~(0x80 >> (i & 7));
+  return(0);
+}
+
+
+void rppprefix_trunc(struct rppprefix *dst, const struct rppprefix *src, int len) {
+  memset(dst, 0, sizeof(*dst));
+  dst->family = src->family;
+  dst->len = (len < src->len) ? len : src->len;
+  memcpy(dst->addr, src->addr, (dst->len + 7) >> 3);
+  if (dst->len & 7) dst->addr[dst->len >> 3] &= 0xff << (8 - (dst->len & 7));
+}
+
+
+int rppprefix_walk(const struct rppprefix *pfx, int len) {
+  int step = 8, min = WALKMIN4;
+  if (pfx->family == AF_INET6) {
+    step = 4;
+    min = WALKMIN6;
+  }
+  /* start at the longest boundary, but never at the (meaningless) root zone:
+   * no zone stands for a prefix shorter than an octet or a nibble */
+  if (len < 0) {
+    len = pfx->len - (pfx->len % step);
+    if (len < step) return(-1);
+    return(len);
+  }
+  len -= step;
+  if (len < min) return(-1);
+  return(len);
+}
+
+
+/* writes the reverse names of the 32 nibbles of an IPv6 address, that is
+ * "n.n.n. ... n." for nibbles 31 to 0 - the name of the first n nibbles is
+ * then the last 2n bytes of out */
+static void ip6nibbles(char *out, const unsigned char *addr) {
+#ifdef __SSSE3__
+  /* reverse the bytes, split them into nibbles, turn these into hex digits
+   * and interleave everything with dots: a few shuffles for the whole name */
+  const __m128i rev = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  const __m128i hex = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  const __m128i dots = _mm_set1_epi8('.');
+  __m128i v, lo, hi, pairs;
+  v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)addr), rev);
+  lo = _mm_shuffle_epi8(hex, _mm_and_si128(v, mask));
+  hi = _mm_shuffle_epi8(hex, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+  pairs = _mm_unpacklo_epi8(lo, hi);
+  _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(pairs, dots));
+  _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi8(pairs, dots));
+  pairs = _mm_unpackhi_epi8(lo, hi);
+  _mm_storeu_si128((__m128i *)(out + 32), _mm_unpacklo_epi8(pairs, dots));
+  _mm_storeu_si128((__m128i *)(out + 48), _mm_unpackhi_epi8(pairs, dots));
+#else
+  static const char hexdigits[] = "0123456789abcdef";
+  int i;
+  for (i = 15; i >= 0; i--) {
+    out[0] = hexdigits[addr[i] & 0x0F];
+    out[1] = '.';
+    out[2] = hexdigits[addr[i] >> 4];
+    out[3] = '.';
+    out += 4;
+  }
+#endif
+}
+
+
+int ip2revdns(char *res, int reslen, const struct rppprefix *pfx, int len) {
+  char buf[64];
+  char *p;
+  int i, rlen;
+  if (res == NULL) return(-1);
+  *res = 0;
+  /* compute the reverse string */
+  if (pfx->family == AF_INET) {
+    if ((len < 0) || (len > 32)) return(-1);
+    p = buf;
+    for (i = (len >> 3) - 1; i >= 0; i--) {
+      unsigned int v = pfx->addr[i];
+      if (v >= 100) *p++ = '0' + v / 100;
+      if (v >= 10) *p++ = '0' + (v / 10) % 10;
+      *p++ = '0' + v % 10;
+      *p++ = '.';
+    }
+    rlen = p - buf;
+    if (rlen + 13 > reslen) return(-1); /* error - res too short! */
+    memcpy(res, buf, rlen);
+    memcpy(res + rlen, "in-addr.arpa", 13);
+  } else {
+    if ((len < 0) || (len > 128)) return(-1);
+    rlen = (len >> 2) * 2;
+    if (rlen + 9 > reslen) return(-1); /* error - res too short! */
+    ip6nibbles(buf, pfx->addr);
+    memcpy(res, buf + 64 - rlen, rlen);
+    memcpy(res + rlen, "ip6.arpa", 9);
+  }
+  /* all fine */
+  return(0);
+}
+
+
+int revdns2prefix(struct rppprefix *pfx, const char *revname) {
+  const char *labels[32];
+  int count = 0, i, namelen;
+
+  memset(pfx, 0, sizeof(*pfx));
+  namelen = strlen(revname);
+  if ((namelen > 0) && (revname[namelen - 1] == '.')) namelen--; /* FQDN */
+
+  /* look at the suffix first */
+  if ((namelen >= 12) && (strncasecmp(revname + namelen - 12, "in-addr.arpa", 12) == 0)) {
+    pfx->family = AF_INET;
+    namelen -= 12;
+  } else if ((namelen >= 8) && (strncasecmp(revname + namelen - 8, "ip6.arpa", 8) == 0)) {
+    pfx->family = AF_INET6;
+    namelen -= 8;
+  } else {
+    return(-1);
+  }
+
+  /* locate labels - each of them is followed by a dot */
+  for (i = 0; i < namelen; i++) {
+    if ((i == 0) || (revname[i - 1] == '.')) {
+      if (count == 32) return(-1);
+      labels[count++] = revname + i;
+    }
+  }
+  if ((namelen > 0) && (revname[namelen - 1] != '.')) return(-1);
+
+  /* labels come least significant first */
+  if (pfx->family == AF_INET) {
+    if (count > 4) return(-1);
+    for (i = 0; i < count; i++) {
+      char *end;
+      long v = strtol(labels[count - 1 - i], &end, 10);
+      if ((end == labels[count - 1 - i]) || (*end != '.') || (v < 0) || (v > 255)) return(-1);
+      pfx->addr[i] = v;
+    }
+    pfx->len = count * 8;
+  } else {
+    for (i = 0; i < count; i++) {
+      const char *l = labels[count - 1 - i];
+      int v;
+      if (l[1] != '.') return(-1);
+      if ((*l >= '0') && (*l <= '9')) {
+        v = *l - '0';
+      } else if ((*l >= 'a') && (*l <= 'f')) {
+        v = *l - 'a' + 10;
+      } else if ((*l >= 'A') && (*l <= 'F')) {
+        v = *l - 'A' + 10;
+      } else {
+        return(-1);
+      }
+      pfx->addr[i >> 1] |= (i & 1) ? v : (v << 4);
+    }
+    pfx->len = count * 4;
+  }
+  return(0);
+}
@@ -0,0 +1,76 @@
+/**
+  * @brief prefix parsing and reverse DNS names computation
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_REVDNS_H
+#define RPP_REVDNS_H
+
+/** @brief an IPv4 or IPv6 prefix, in binary form - bits beyond len are
+  * always zero. IPv4 addresses occupy the 4 first bytes of addr. */
+struct rppprefix {
+  int family;              /* AF_INET or AF_INET6 */
+  int len;                 /* prefix length, in bits */
+  unsigned char addr[16];  /* network order */
+};
+
+/** @brief parses an 'addr[/len]' string into a binary prefix (a missing
+  * length stands for a host prefix), in a single pass over the string
+  * @return 0 on success, non-zero otherwise
+  */
+int rppprefix_parse(struct rppprefix *pfx, const char *s);
+
+/** @brief copies the first len bits of a prefix (at most its own length) */
+void rppprefix_trunc(struct rppprefix *dst, const struct rppprefix *src, int len);
+
+/** @brief computes the length of the reverse zones to look at when walking
+  * up from a prefix towards shorter ones: the walk starts at the longest
+  * octet (IPv4) or nibble (IPv6) boundary that does not exceed the prefix
+  * length, and goes up to /8 (IPv4) or /16 (IPv6). prefixes shorter than
+  * /8 (IPv4) or /4 (IPv6) have no zone: the walk is over right away.
+  * @param len the last zone length tried, or -1 to start the walk
+  * @return the length of the next zone to try, or -1 when the walk is over
+  */
+int rppprefix_walk(const struct rppprefix *pfx, int len);
+
+/** @brief computes the revdns string of the zone that holds the first 'len'
+  * bits of a prefix - names are written straight from lookup tables, and
+  * with SSSE3 shuffles for IPv6 when available
+  * @param *res a pointer to the string where result should be written
+  * @param reslen the amount of space available in *res
+  * @param *pfx the prefix
+  * @param len a prefix length, rounded down to an octet (IPv4) or nibble (IPv6) boundary
+  * @return 0 on success, non-zero otherwise
+  */
+int ip2revdns(char *res, int reslen, const struct rppprefix *pfx, int len);
+
+/** @brief converts a revdns string back to the prefix it stands for
+  * @return 0 on success, non-zero if the name is not a valid reverse name
+  */
+int revdns2prefix(struct rppprefix *pfx, const char *revname);
+
+#endif
@@ -0,0 +1,132 @@
+/**
+  * @brief micro-benchmark of the reverse name builder
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "revdns.h"
+
+#define NADDR 4096
+#define ROUNDS 256
+
+/* keeps the compiler from optimizing the builders away */
+static volatile char sink;
+
+
+/* the original snprintf()-based builder, as the reference both for results
+ * and for speed */
+static int ip2revdns_ref(char *res, int reslen, const struct rppprefix *pfx, int len) {
+  int i, rlen = 0;
+  *res = 0;
+  if (pfx->family == AF_INET) {
+    for (i = (len >> 3) - 1; i >= 0; i--) {
+      rlen += snprintf(res + rlen, reslen - rlen, "%d.", pfx->addr[i]);
+      if (rlen >= reslen) return(-1);
+    }
+    rlen += snprintf(res + rlen, reslen - rlen, "in-addr.arpa");
+  } else {
+    for (i = (len >> 2) - 1; i >= 0; i--) {
+      rlen += snprintf(res + rlen, reslen - rlen, "%x.", (i & 1) ? (pfx->addr[i >> 1] & 0x0F) : (pfx->addr[i >> 1] >> 4));
+      if (rlen >= reslen) return(-1);
+    }
+    rlen += snprintf(res + rlen, reslen - rlen, "ip6.arpa");
+  }
+  return((rlen >= reslen) ? -1 : 0);
+}
+
+
+/* returns a monotonic time in ns */
+static double nstime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((ts.tv_sec * 1e9) + ts.tv_nsec);
+}
+
+
+/* times both builders for zones of length len, after checking they agree */
+static int bench(const struct rppprefix *pfx, int len, const char *label) {
+  char name[128], ref[128];
+  double t0, t1, t2;
+  int r, i;
+
+  for (i = 0; i < NADDR; i++) {
+    if ((ip2revdns(name, sizeof(name), &(pfx[i]), len) != 0) || (ip2revdns_ref(ref, sizeof(ref), &(pfx[i]), len) != 0) || (strcmp(name, ref) != 0)) {
+      printf("%s: MISMATCH '%s' vs '%s'\n", label, name, ref);
+      return(-1);
+    }
+  }
+
+  t0 = nstime();
+  for (r = 0; r < ROUNDS; r++) {
+    for (i = 0; i < NADDR; i++) {
+      ip2revdns_ref(name, sizeof(name), &(pfx[i]), len);
+      sink = name[0];
+    }
+  }
+  t1 = nstime();
+  for (r = 0; r < ROUNDS; r++) {
+    for (i = 0; i < NADDR; i++) {
+      ip2revdns(name, sizeof(name), &(pfx[i]), len);
+      sink = name[0];
+    }
+  }
+  t2 = nstime();
+
+  printf("%-10s snprintf: %7.1f ns/name   table: %7.1f ns/name   (x%.1f)\n", label,
+         (t1 - t0) / (ROUNDS * NADDR), (t2 - t1) / (ROUNDS * NADDR), (t1 - t0) / (t2 - t1));
+  return(0);
+}
+
+
+int main(void) {
+  static struct rppprefix pfx4[NADDR], pfx6[NADDR];
+  int i, j, res = 0;
+
+  srand(4343);
+  for (i = 0; i < NADDR; i++) {
+    pfx4[i].family = AF_INET;
+    pfx4[i].len = 32;
+    pfx6[i].family = AF_INET6;
+    pfx6[i].len = 128;
+    for (j = 0; j < 16; j++) {
+      if (j < 4) pfx4[i].addr[j] = rand() & 0xff;
+      pfx6[i].addr[j] = rand() & 0xff;
+    }
+  }
+
+  res |= bench(pfx4, 24, "IPv4 /24");
+  res |= bench(pfx4, 32, "IPv4 /32");
+  res |= bench(pfx6, 48, "IPv6 /48");
+  res |= bench(pfx6, 64, "IPv6 /64");
+  res |= bench(pfx6, 128, "IPv6 /128");
+  return((res != 0) ? 1 : 0);
+}
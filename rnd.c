@@ -0,0 +1,98 @@
+/**
+  * @brief unpredictable numbers, read from the system a pool at a time
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+#include "rnd.h"
+
+#define POOLWORDS (sizeof(((struct rpprnd *)NULL)->pool) / sizeof(uint32_t))
+
+
+/* refills the pool of a generator with system entropy
+ * @return 0 on success, -1 otherwise (errno is set) */
+static int rnd_fill(struct rpprnd *r) {
+  unsigned char *p = (unsigned char *)r->pool;
+  size_t got = 0;
+  ssize_t res;
+
+  while (got < sizeof(r->pool)) {
+    if (r->fd < 0) {
+      res = getrandom(p + got, sizeof(r->pool) - got, 0);
+    } else {
+      res = read(r->fd, p + got, sizeof(r->pool) - got);
+    }
+    if ((res < 0) && (errno == EINTR)) continue;
+    /* kernels older than 3.17 only have the device */
+    if ((res < 0) && (errno == ENOSYS) && (r->fd < 0)) {
+      r->fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+      if (r->fd >= 0) continue;
+    }
+    if (res <= 0) {
+      if (res == 0) errno = EIO;
+      return(-1);
+    }
+    got += res;
+  }
+  r->pos = 0;
+  return(0);
+}
+
+
+int rpprnd_init(struct rpprnd *r) {
+  memset(r, 0, sizeof(*r));
+  r->fd = -1;
+  if (rnd_fill(r) == 0) return(0);
+  rpprnd_free(r);
+  return(-1);
+}
+
+
+uint32_t rpprnd_u32(struct rpprnd *r) {
+  uint32_t res;
+  /* the system does not run out of entropy once it provided some: should
+   * it fail anyway, the pool is gone through again */
+  if ((r->pos >= (int)POOLWORDS) && (rnd_fill(r) != 0)) r->pos = 0;
+  res = r->pool[r->pos];
+  /* a word is never handed out twice */
+  r->pool[r->pos++] = 0;
+  return(res);
+}
+
+
+void rpprnd_free(struct rpprnd *r) {
+  volatile unsigned char *p = (volatile unsigned char *)r->pool;
+  size_t i;
+  for (i = 0; i < sizeof(r->pool); i++) p[i] = 0;
+  if (r->fd >= 0) close(r->fd);
+  r->fd = -1;
+}
@@ -0,0 +1,56 @@
+/**
+  * @brief unpredictable numbers, read from the system a pool at a time
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_RND_H
+#define RPP_RND_H
+
+#include <stdint.h>
+
+/** @brief state of a generator - words are read from the kernel's own
+  * generator (getrandom(), or /dev/urandom where it is missing) a pool at a
+  * time, so that they may not be guessed from earlier outputs. a generator
+  * is not shared between threads. */
+struct rpprnd {
+  uint32_t pool[64];    /**< words read from the system */
+  int pos;              /**< next unused word of 'pool' */
+  int fd;               /**< /dev/urandom, if getrandom() is not available, -1 otherwise */
+};
+
+/** @brief sets a generator up, reading its first pool
+  * @return 0 on success, -1 if no entropy could be read (errno is set) */
+int rpprnd_init(struct rpprnd *r);
+
+/** @brief returns 32 unpredictable bits */
+uint32_t rpprnd_u32(struct rpprnd *r);
+
+/** @brief wipes the words of a generator not handed out yet, and releases
+  * it, once it is not used any more */
+void rpprnd_free(struct rpprnd *r);
+
+#endif
@@ -30,202 +30,539 @@
 #include <arpa/inet.h>
 #include <arpa/nameser.h>
 #include <errno.h>
-#include <resolv.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "adv.h"
+#include "batch.h"
+#include "cache.h"
+#include "dns.h"
+#include "lists.h"
+#include "mrt.h"
+#include "revdns.h"
+#include "workers.h"
+
 #define PVER "20160504"
 #define PDATE "2016"
 
-
-/** @brief computes a revdns string for a given IPv4 or IPv6 address
-  * @param *res a pointer to the string where result should be written
-  * @param reslen the amount of space available in *res
-  * @param *orig a pointer to the original string representing the IP address
-  * @return 0 on success, non-zero otherwise
-  */
-static int ip2revdns(char *res, int reslen, char *orig) {
-  int ipfamily;
-  struct in6_addr ip6;
-  /* input cannot be less than 4 bytes long */
-  if (res == NULL) return(-1);
-  if ((orig == NULL) || (strlen(orig) < 4)) {
-    *res = 0;
-    return(-1);
-  }
-  /* is it ip4 or ip6? */
-  if ((orig[1] == '.') || (orig[2] == '.') || (orig[3] == '.')) {
-    ipfamily = AF_INET;
-  } else {
-    ipfamily = AF_INET6;
-  }
-  /* convert str to binary */
-  if (inet_pton(ipfamily, orig, &(ip6.s6_addr)) != 1) {
-    *res = 0;
-    return(-1);
-  }
-  /* compute the reverse string */
-  if (ipfamily == AF_INET) {
-    snprintf(res, reslen, "%d.%d.%d.%d.in-addr.arpa", ip6.s6_addr[3], ip6.s6_addr[2], ip6.s6_addr[1], ip6.s6_addr[0]);
-  } else {
-    int i, rlen = 0;
-    for (i = 15; i >= 0; i--) {
-      rlen += snprintf(res + rlen, reslen - rlen, "%x.%x.", ip6.s6_addr[i] & 0x0F, ip6.s6_addr[i] >> 4);
-      if (rlen >= reslen) { /* error - res too short! */
-        *res = 0;
-        return(-1);
-      }
-    }
-    rlen += snprintf(res + rlen, reslen - rlen, "ip6.arpa");
-    if (rlen >= reslen) { /* error - res too short! */
-      *res = 0;
-      return(-1);
-    }
-  }
-  /* all fine */
-  return(0);
-}
+/* size of the buffer batch results go through, it is flushed whenever rpp
+ * is about to wait */
+#define OUTBUFSZ 65536
 
 
 static void printhelp(void) {
+  struct rppopts def;
   printf("rpp version " PVER " Copyright (C) " PDATE " Border 6 S.A.S\n"
          "\n"
          "rpp is a simple tool that allows to resolve and interact with remote RDE\n"
          "controllers.\n"
          "\n"
-         "usage: rpp resolve|advertise remoteprefix [localprefixes preflist]\n"
-         "\n"
-         "where:\n"
+         "usage: rpp [options] resolve|advertise remoteprefix [localprefixes preflist]\n"
+         "       rpp [options] batch [file [localprefixes preflist]]\n"
+         "\n");
+  printf("where:\n"
          "'localprefixes' is the list of the prefixes advertised by the local AS.\n"
          "\n"
          "'preflist' is to be provided only for the 'advertise' action. it should\n"
          "be a single argument that contains the list of preffered ASes with weights to\n"
          "be advertised to the remote controller.\n"
          "\n");
+  printf("long lists may be given as '@file' instead, to be read from 'file' ('@-'\n"
+         "for stdin): their entries are then separated by blanks or ends of lines,\n"
+         "'#' starts a comment, and every entry is validated - prefixes as\n"
+         "addr[/len], preferences as asn:weight with a weight of 0 to 255.\n"
+         "\n");
+  printf("the RDE controller of a prefix is looked up in the reverse zone matching the\n"
+         "prefix length (rounded down to an octet or nibble boundary), then in ever\n"
+         "shorter zones, up to /8 for IPv4 and /16 for IPv6, until one is found.\n"
+         "prefixes shorter than /8 (IPv4) or /4 (IPv6) have no zone of their own, and\n"
+         "always resolve to 1.\n");
+  printf("a zone may publish several controllers, as several 'RDE:' TXT records or\n"
+         "strings: they are all reported, separated by commas. connections to up to\n"
+         "3 of them are then raced, 250 ms apart, and preferences are advertised to\n"
+         "the first controller that accepts - which is tried first next time.\n"
+         "\n");
+  printf("'batch' reads requests from 'file' (or from stdin if no file is given), one\n"
+         "per line: a remoteprefix, optionally followed by a tab, localprefixes, a tab\n"
+         "and a preflist. lines that carry preferences are advertised, the others are\n"
+         "advertised the localprefixes and preflist given to 'batch' if any, or only\n"
+         "resolved. each request produces one tab-separated line of output:\n"
+         "  remoteprefix resolvestatus controller advertisestatus latency revdns\n");
+  printf("where a status is 0 on success, 1 if no RDE record exists for the prefix,\n"
+         "negative on error, and '-' if the step did not take place. latency is the\n"
+         "time (in ms) the advertisement took, and revdns the zone the controller was\n"
+         "found at. --format json outputs the same fields as a JSON object per line.\n"
+         "requests are processed concurrently, but results are output in the order\n"
+         "of the requests.\n"
+         "\n");
+  rppopts_default(&def);
+  printf("options:\n");
+  rppopts_printhelp(&def);
+  printf("  --threads n      number of worker threads 'batch' spreads requests over,\n"
+         "                   each of them with up to --inflight requests (default: 1)\n");
+  printf("  --input fmt      what 'batch' reads: 'text' request lines, or 'mrt' to\n"
+         "                   process every prefix of an uncompressed MRT routing table\n"
+         "                   dump (TABLE_DUMP_V2 or TABLE_DUMP), once - the dump is\n"
+         "                   parsed in parallel, prefixes come sorted (default: text)\n");
+  printf("  --stats          print what 'batch' went through to stderr once done: DNS\n"
+         "                   queries, cache lookups, statuses and latencies\n"
+         "  --daemon socket  have requests processed by the rppd daemon listening at\n"
+         "                   'socket', whose own options then apply instead\n"
+         "\n");
   printf("examples:\n"
          "  rpp resolve 203.0.113.0/24\n"
          "  rpp advertise 203.0.113.0/24 '192.0.2.0/24 198.51.100.0/24' '64552:0 64900:255 65001:127'\n"
+         "  rpp batch prefixes.txt\n"
+         "  rpp batch - '192.0.2.0/24' '64552:0 64900:255' < prefixes.txt\n");
+  printf("  rpp --input mrt --threads 4 batch rib.mrt '192.0.2.0/24' '64552:0'\n"
+         "  rpp advertise 203.0.113.0/24 @localprefixes.txt @prefs.txt\n"
+         "  rpp --daemon /run/rppd.sock batch prefixes.txt\n"
          "\n");
 }
 
 
-/** @brief resolves the routing controller for a given prefix' revDNS
-  * @param *result the IP address of the routing controller is filled there
-  * @param *revname the revDNS string we want to look at
-  * @return 0 on success, negative value on resolution failure, 1 if resolution went fine but this prefix don't seem to have a RDE record
-  */
-static int rpp_getcontroller(char *result, int maxres, char *revname) {
-  int i;
-  unsigned char answer[512];
-  ns_msg msg;
-  int msg_count;
+/** @brief processes resolve/advertise requests read from a stream, one per
+  * line, and outputs one tab-separated result line for each of them. up to
+  * inflight requests are resolved and advertised concurrently, results are
+  * output in the order of the requests.
+  * @param *fd the stream to read requests from, if pfxs is NULL
+  * @param *pfxs the prefixes to process instead, if not NULL
+  * @param count the number of prefixes in pfxs
+  * @param *opts command line options
+  * @param *cache cache of already resolved controllers
+  * @param *defmsg preferences advertised for requests that carry none, if any
+  * @param *stats what the engine went through gets added to it, if not NULL
+  * @return 0 on success, non-zero if reading the input or queuing a request failed */
+static int batch(FILE *fd, const struct rppprefix *pfxs, unsigned long count, const struct rppopts *opts, struct rppcache *cache, struct rppmsg *defmsg, struct rppstats *stats) {
+  struct rppbatch *b;
+  struct rppqueue *q;
+  char *line = NULL;
+  size_t linesz = 0;
+  char out[1024];
+  unsigned long next = 0;
+  int len, eof = 0, res = 0;
+
+  b = rppbatch_new(opts, cache, NULL);
+  q = (b != NULL) ? rppqueue_new(b, defmsg) : NULL;
+  if (q == NULL) {
+    fprintf(stderr, "ERROR: failed to set up the asynchronous resolver\n");
+    rppbatch_free(b);
+    return(1);
+  }
 
-  i = res_query(revname, C_IN, T_TXT, answer, sizeof(answer));
-  if (i < 0) return(1); /* res_query "fails" if no TXT record is found */
+  /* requests are kept in a sliding window: new requests are read as long as
+   * there is room, and they leave the window in order once resolved */
+  for (;;) {
+    while ((eof == 0) && (rppqueue_ready(q) != 0)) {
+      ssize_t linelen;
+      int queued = 0;
+      if (pfxs != NULL) {
+        if (next < count) queued = rppqueue_submitprefix(q, &(pfxs[next++]));
+        eof = (next == count);
+      } else if ((linelen = getline(&line, &linesz, fd)) < 0) {
+        eof = 1;
+      } else {
+        queued = rppqueue_submit(q, line, linelen);
+      }
+      /* a request must never go without its result line: stop the batch */
+      if (queued < 0) {
+        fprintf(stderr, "ERROR: failed to queue a batch request\n");
+        eof = 1;
+        res = 1;
+      }
+    }
+    while ((len = rppqueue_pop(q, out, sizeof(out))) > 0) fwrite(out, 1, len, stdout);
+    if (rppqueue_count(q) > 0) {
+      fflush(stdout);
+      rppbatch_wait(b);
+    } else if (eof != 0) {
+      break;
+    }
+  }
 
-  /* parse the response */
-  if (ns_initparse(answer, i, &msg) != 0) return(-3);
+  if ((pfxs == NULL) && ferror(fd)) {
+    fprintf(stderr, "ERROR: failed to read batch input (%s)\n", strerror(errno));
+    res = 1;
+  }
+  free(line);
+  rppqueue_free(q);
+  if (stats != NULL) rppstats_merge(stats, rppbatch_stats(b));
+  rppbatch_free(b);
+  return(res);
+}
 
-  msg_count = ns_msg_count(msg, ns_s_an);
-  if (msg_count == 0) return(1); /* return 1 if all went fine but there is no RDE record */
 
-  /* look at all received answers, until one looks fine enough */
-  for (i = 0 ; i < msg_count ; i++ ) {
-    ns_rr rr;
-    if (ns_parserr(&msg, ns_s_an, i, &rr)) {
-      return(-4);
+/* connects to the rppd daemon listening on the unix socket at path */
+static int client_connect(const char *path) {
+  struct sockaddr_un addr;
+  int sock;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return(-1);
+  }
+  strcpy(addr.sun_path, path);
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) return(-1);
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    int err = errno;
+    close(sock);
+    errno = err;
+    return(-1);
+  }
+  return(sock);
+}
+
+
+/* sends len bytes of buf to the daemon */
+static int client_send(int sock, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(sock, buf, len, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) continue;
+      return(-1);
     }
-    /* if it doesn't start with 'RDE:', then ignore this entry */
-    if ((ns_rr_rdata(rr)[1] != 'R') || (ns_rr_rdata(rr)[2] != 'D') || (ns_rr_rdata(rr)[3] != 'E') || (ns_rr_rdata(rr)[4] != ':')) continue;
-    /* otherwise it's what we are looking for - copy it to result and quit */
-    if (ns_rr_rdata(rr)[0] < maxres) maxres = ns_rr_rdata(rr)[0];
-    maxres -= 4;
-    memcpy(result, ns_rr_rdata(rr) + 5, maxres);
-    result[maxres] = 0;
-    return(0);
+    buf += sent;
+    len -= sent;
   }
+  return(0);
+}
 
-  return(1);
+
+/* sends a request line to the daemon, with the default preferences appended
+ * if it carries none. empty lines and comments are sent as-is, the daemon
+ * ignores them. */
+static int client_sendreq(int sock, const char *line, size_t len, const char *locpreflist, const char *preflist) {
+  while ((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r'))) len--;
+  if (client_send(sock, line, len) != 0) return(-1);
+  if ((preflist != NULL) && (len > 0) && (line[0] != '#') && (memchr(line, '\t', len) == NULL)) {
+    if ((client_send(sock, "\t", 1) != 0) || (client_send(sock, locpreflist, strlen(locpreflist)) != 0)) return(-1);
+    if ((client_send(sock, "\t", 1) != 0) || (client_send(sock, preflist, strlen(preflist)) != 0)) return(-1);
+  }
+  return(client_send(sock, "\n", 1));
 }
 
 
-/** @brief advertises our inbound preferences to a remote prefix
-  * @return returns 0 on success, non-zero otherwise */
-static int advertise_inpref_to_remote_dst(char *locpreflist, int ttl, char *servstringaddr, char *preflist) {
-  char buff[64];
-  int bufflen;
-  int sock;
-  struct sockaddr_in servaddr;
+/** @brief same as batch(), but has the requests processed by a rppd daemon
+  * @param sock the connection to the daemon
+  * @return 0 on success, non-zero on error */
+static int client_batch(int sock, FILE *fd, const char *locpreflist, const char *preflist) {
+  struct pollfd pfd;
+  char *line = NULL;
+  size_t linesz = 0;
+  char buf[4096];
+  ssize_t len;
+  int n, eof = 0, res = 0;
+
+  /* requests are sent as long as the daemon accepts them, while results are
+   * copied to stdout as they come */
+  for (;;) {
+    pfd.fd = sock;
+    pfd.events = (eof == 0) ? (POLLIN | POLLOUT) : POLLIN;
+    /* results buffered so far go out before waiting */
+    n = poll(&pfd, 1, 0);
+    if (n == 0) {
+      fflush(stdout);
+      n = poll(&pfd, 1, -1);
+    }
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      res = 1;
+      break;
+    }
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+      len = recv(sock, buf, sizeof(buf), 0);
+      if ((len < 0) && (errno == EINTR)) continue;
+      if (len <= 0) {
+        if ((len < 0) || (eof == 0)) res = 1;
+        break;
+      }
+      fwrite(buf, 1, len, stdout);
+    } else if (pfd.revents & POLLOUT) {
+      len = getline(&line, &linesz, fd);
+      if (len < 0) {
+        eof = 1;
+        shutdown(sock, SHUT_WR);
+      } else if (client_sendreq(sock, line, len, locpreflist, preflist) != 0) {
+        res = 1;
+        break;
+      }
+    }
+  }
 
-  /* construct the server address structure */
-  memset(&servaddr, 0, sizeof(servaddr));  /* zero out structure */
-  servaddr.sin_family = AF_INET;  /* internet address family */
-  servaddr.sin_addr.s_addr = inet_addr(servstringaddr);  /* server IP address */
-  servaddr.sin_port = htons(4343);  /* server port */
+  if (ferror(fd)) {
+    fprintf(stderr, "ERROR: failed to read batch input (%s)\n", strerror(errno));
+  } else if (res != 0) {
+    fprintf(stderr, "ERROR: connection to rppd lost\n");
+  }
+  free(line);
+  return(res);
+}
 
-  sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-  if (sock < 0) {
-    printf("ERROR: socket() call failed (%s)\n", strerror(errno));
-    return(-1);
+
+/** @brief has a single request processed by a rppd daemon
+  * @param *result receives the tab-separated result line
+  * @param *field receives pointers to the 6 fields of the result
+  * @return 0 on success, -1 if the connection failed, -2 if the result is
+  * not a tab-separated line */
+static int client_request(int sock, const char *prefix, const char *locpreflist, const char *preflist, char *result, size_t maxlen, char **field) {
+  size_t len = 0;
+  ssize_t rlen;
+  int i;
+
+  if (client_sendreq(sock, prefix, strlen(prefix), locpreflist, preflist) != 0) return(-1);
+  shutdown(sock, SHUT_WR);
+  while (len < maxlen - 1) {
+    rlen = recv(sock, result + len, maxlen - 1 - len, 0);
+    if ((rlen < 0) && (errno == EINTR)) continue;
+    if (rlen < 0) return(-1);
+    if (rlen == 0) break;
+    len += rlen;
   }
+  if (len == 0) return(-1);
+  result[len] = 0;
+
+  /* split the result line into its fields */
+  for (i = 0; i < 6; i++) {
+    field[i] = result;
+    result = strpbrk(result, (i < 5) ? "\t" : "\n");
+    if (result == NULL) return(-2);
+    *result++ = 0;
+  }
+  return(0);
+}
+
 
-  /* establish the connection to the server */
-  if (connect(sock, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
-    printf("ERROR: connection to the remote controller failed (%s)\n", strerror(errno));
-    return(-2);
+/** @brief resolves the controller of a prefix with blocking queries, walking
+  * up from the prefix towards shorter ones until an RDE record is found. the
+  * cache is looked at first, and updated with the results.
+  * @return same as rppdns_resolve() */
+static int resolve(char *rdeaddr, int maxlen, struct rppcache *cache, const struct rppprefix *pfx, const struct rppopts *opts) {
+  struct rppdns *dns = NULL;
+  char revdns[128];
+  struct rppprefix zone;
+  unsigned long ttl;
+  time_t now = time(NULL);
+  int len, res = 1;
+
+  if (rppcache_lpm(cache, pfx, rdeaddr, maxlen, now, NULL) == 0) return(0);
+
+  for (len = rppprefix_walk(pfx, -1); (res == 1) && (len >= 0); len = rppprefix_walk(pfx, len)) {
+    rppprefix_trunc(&zone, pfx, len);
+    res = rppcache_get(cache, &zone, rdeaddr, maxlen, now);
+    if (res >= 0) continue;
+    /* the resolver is set up only once something has to be asked */
+    if (dns == NULL) dns = rppdns_new(1, opts->timeout, opts->retries, opts->resolvers, opts->direct);
+    if ((dns == NULL) || (ip2revdns(revdns, sizeof(revdns), pfx, len) != 0)) {
+      res = -1;
+      break;
+    }
+    res = rppdns_resolve(dns, rdeaddr, maxlen, &ttl, revdns);
+    if (ttl > 0) rppcache_put(cache, &zone, res, rdeaddr, now + ttl);
   }
+  rppdns_free(dns);
+  return(res);
+}
 
-  /* send our inbound routing preferences to the remote controller */
-  bufflen = sprintf(buff, "SETINPREF %d\t", ttl);
-  if (send(sock, buff, bufflen, MSG_MORE) != bufflen) {
-    printf("ERROR: failed to send routing prefs to %s (%s)\n", servstringaddr, strerror(errno));
-    close(sock);
-    return(-3);
+
+/* saves the cache to fname, if a cache file is in use */
+static void cache_save(const struct rppcache *cache, const char *fname) {
+  if (fname == NULL) return;
+  if (rppcache_save(cache, fname) != 0) {
+    fprintf(stderr, "WARNING: failed to save cache file '%s' (%s)\n", fname, strerror(errno));
   }
+}
 
-  /* send the list of our local prefixes */
-  if (send(sock, locpreflist, strlen(locpreflist), MSG_MORE) != (unsigned)strlen(locpreflist)) {
-    printf("ERROR: failed to send routing prefs to %s (%s)\n", servstringaddr, strerror(errno));
-    close(sock);
-    return(-4);
+
+#define RESOLVE 0
+#define ADVERTISE 1
+#define BATCH 2
+
+
+/* reports why a list given on the command line could not be used */
+static void list_error(const struct rpplist *l, const char *arg) {
+  if ((errno == EINVAL) && (l->errline > 0)) {
+    fprintf(stderr, "ERROR: invalid entry at line %d of '%s'\n", l->errline, arg + 1);
+  } else if (arg[0] == '@') {
+    fprintf(stderr, "ERROR: failed to read '%s' (%s)\n", arg + 1, strerror(errno));
+  } else {
+    fprintf(stderr, "ERROR: out of memory\n");
   }
-  if (send(sock, "\t", 1, MSG_MORE) != 1) {
-    printf("ERROR: failed to send routing prefs to %s (%s)\n", servstringaddr, strerror(errno));
-    close(sock);
-    return(-5);
+}
+
+
+/* encodes the preferences given on the command line, reading the lists
+ * that are given as files
+ * @return the message, or NULL on error (reported) */
+static struct rppmsg *cli_msg(int ttl, int binary, const char *locpreflist, const char *preflist) {
+  struct rpplist loc, pref;
+  struct rppmsg *msg;
+  if (rpplist_open(&loc, locpreflist) != 0) {
+    list_error(&loc, locpreflist);
+    return(NULL);
   }
+  if (rpplist_open(&pref, preflist) != 0) {
+    list_error(&pref, preflist);
+    rpplist_close(&loc);
+    return(NULL);
+  }
+  msg = rppmsg_setinpref_lists(ttl, &loc, &pref);
+  if (msg == NULL) {
+    if (pref.errline > 0) {
+      list_error(&pref, preflist);
+    } else {
+      list_error(&loc, locpreflist);
+    }
+  }
+  rpplist_close(&loc);
+  rpplist_close(&pref);
+  if ((msg != NULL) && (binary != 0)) {
+    struct rppmsg *bin = rppmsg_binary(msg);
+    if (bin != NULL) {
+      rppmsg_free(msg);
+      msg = bin;
+    }
+  }
+  return(msg);
+}
 
-  if (send(sock, preflist, strlen(preflist), MSG_MORE) != (unsigned)strlen(preflist)) {
-    printf("ERROR: failed to send routing prefs to %s (%s)\n", servstringaddr, strerror(errno));
-    close(sock);
-    return(-6);
+
+/* returns a list given on the command line as a string, read from its file
+ * if it is given as one - or NULL on error (reported) */
+static char *cli_list(const char *arg, int kind) {
+  struct rpplist l;
+  char *s;
+  long len = -1;
+  if (rpplist_open(&l, arg) != 0) {
+    list_error(&l, arg);
+    return(NULL);
+  }
+  s = malloc(l.len + 1);
+  if (s != NULL) len = rpplist_copy(s, &l, kind);
+  if (len < 0) {
+    list_error(&l, arg);
+    free(s);
+    s = NULL;
+  } else {
+    s[len] = 0;
+  }
+  rpplist_close(&l);
+  return(s);
+}
+
+
+/* performs an action through the rppd daemon listening at path */
+static int client(const char *path, int action, const char *prefixorg, const char *locpreflist, const char *preflist) {
+  char result[1024];
+  char *field[6];
+  int sock, i;
+
+  sock = client_connect(path);
+  if (sock < 0) {
+    fprintf(stderr, "ERROR: failed to connect to rppd at '%s' (%s)\n", path, strerror(errno));
+    return(1);
   }
 
-  /* terminate with a \r\n and close the connection */
-  if (send(sock, "\r\n", 2, 0) != 2) {
-    printf("ERROR: failed to send routing prefs to %s (%s)\n", servstringaddr, strerror(errno));
+  if (action == BATCH) {
+    FILE *fd = stdin;
+    if ((prefixorg != NULL) && (strcmp(prefixorg, "-") != 0)) {
+      fd = fopen(prefixorg, "r");
+      if (fd == NULL) {
+        fprintf(stderr, "ERROR: failed to open '%s' (%s)\n", prefixorg, strerror(errno));
+        close(sock);
+        return(1);
+      }
+    }
+    i = client_batch(sock, fd, locpreflist, preflist);
+    if (fd != stdin) fclose(fd);
     close(sock);
-    return(-7);
+    return(i);
   }
 
+  i = client_request(sock, prefixorg, locpreflist, preflist, result, sizeof(result), field);
   close(sock);
+  if (i == -2) {
+    fprintf(stderr, "ERROR: unexpected result from rppd, single requests need its '--format tsv'\n");
+    return(1);
+  } else if (i != 0) {
+    fprintf(stderr, "ERROR: connection to rppd lost\n");
+    return(1);
+  }
+  i = atoi(field[1]);
+  if (i == 0) {
+    printf("RDE controller for %s is %s\n", prefixorg, field[2]);
+  } else if (i > 0) {
+    printf("No RDE entry found for %s\n", prefixorg);
+  } else {
+    fprintf(stderr, "ERROR: DNS failure (%d)\n", i);
+  }
+  if ((action == RESOLVE) || (strcmp(field[3], "-") == 0)) return(0);
+
+  puts("Sending preferences...");
+  i = atoi(field[3]);
+  if (i == 0) {
+    puts("Done.");
+  } else {
+    fprintf(stderr, "ERROR: failed to send routing prefs to %s (%d)\n", field[2], i);
+  }
   return(0);
 }
 
 
-#define RESOLVE 0
-#define ADVERTISE 1
-
 int main(int argc, char **argv) {
   int action;
   int i;
-  unsigned x;
+  struct rppopts opts;
+  struct rppcache *cache;
+  struct rppprefix pfx;
+  struct rppmsg *msg;
   char *prefixorg;
-  char prefix[128];
-  char revdns[128];
   char rdeaddr[128];
   char *locpreflist = NULL, *preflist = NULL;
+  char *daemonpath = NULL;
+  struct rppstats stats;
+  int threads = 1, showstats = 0, mrt = 0;
+
+  rppopts_default(&opts);
+
+  /* parse options, they are all located before the action */
+  while ((argc > 1) && (strncmp(argv[1], "--", 2) == 0) && (strcmp(argv[1], "--help") != 0)) {
+    if (strcmp(argv[1], "--stats") == 0) { /* the only option without a value */
+      showstats = 1;
+      argc--;
+      argv++;
+      continue;
+    }
+    if ((strcmp(argv[1], "--daemon") == 0) && (argc > 2)) {
+      daemonpath = argv[2];
+    } else if (strcmp(argv[1], "--threads") == 0) {
+      threads = (argc > 2) ? atoi(argv[2]) : 0;
+      if ((threads < 1) || (threads > RPPWORKERS_MAX)) {
+        fprintf(stderr, "ERROR: invalid option '%s'\n", argv[1]);
+        return(1);
+      }
+    } else if ((strcmp(argv[1], "--incremental") == 0) || (strcmp(argv[1], "--refresh") == 0) || (strcmp(argv[1], "--refreshfor") == 0)) {
+      /* what controllers were advertised is only remembered by rppd, and
+       * refreshes would come long after rpp is done */
+      fprintf(stderr, "ERROR: '%s' only applies to rppd\n", argv[1]);
+      return(1);
+    } else if ((strcmp(argv[1], "--input") == 0) && (argc > 2) && ((strcmp(argv[2], "text") == 0) || (strcmp(argv[2], "mrt") == 0))) {
+      mrt = (strcmp(argv[2], "mrt") == 0);
+    } else if (rppopts_set(&opts, argv[1], argv[2]) != 0) {
+      fprintf(stderr, "ERROR: invalid option '%s'\n", argv[1]);
+      return(1);
+    }
+    argc -= 2;
+    argv += 2;
+  }
 
   /* validate command and number of CLI arguments */
   if ((argc == 3) && (strcmp(argv[1], "resolve") == 0)) {
@@ -234,6 +571,12 @@ int main(int argc, char **argv) {
     action = ADVERTISE;
     locpreflist = argv[3];
     preflist = argv[4];
+  } else if (((argc == 2) || (argc == 3) || (argc == 5)) && (strcmp(argv[1], "batch") == 0)) {
+    action = BATCH;
+    if (argc == 5) {
+      locpreflist = argv[3];
+      preflist = argv[4];
+    }
   } else if ((argc == 2) && (strcmp(argv[1], "--help") == 0)) {
     printhelp();
     return(0);
@@ -242,36 +585,137 @@ int main(int argc, char **argv) {
     return(1);
   }
   prefixorg = argv[2];
+  if (action == BATCH) setvbuf(stdout, NULL, _IOFBF, OUTBUFSZ);
 
-  /* look at the prefix - if a '/' is found, cut it out */
-  for (x = 0; (prefixorg[x] != 0) && (prefixorg[x] != '/') && (x < sizeof(prefix) - 1); x++) prefix[x] = prefixorg[x];
-  prefix[x] = 0;
+  /* dumps are mapped, and not sent over to daemons */
+  if ((mrt != 0) && ((action != BATCH) || (prefixorg == NULL) || (strcmp(prefixorg, "-") == 0) || (daemonpath != NULL))) {
+    fprintf(stderr, "ERROR: '--input mrt' needs a dump file given to 'batch', without --daemon\n");
+    return(1);
+  }
+
+  /* stdin can only be read once */
+  if ((locpreflist != NULL) && ((strcmp(locpreflist, "@-") == 0) || (strcmp(preflist, "@-") == 0))) {
+    if (((strcmp(locpreflist, "@-") == 0) && (strcmp(preflist, "@-") == 0)) || ((action == BATCH) && (strcmp(prefixorg, "-") == 0))) {
+      fprintf(stderr, "ERROR: only one list can be read from stdin\n");
+      return(1);
+    }
+  }
 
-  /* compute the revDNS representation of the given prefix */
-  if (ip2revdns(revdns, sizeof(revdns), prefix) != 0) {
-    printf("ERROR: failed to compute a reverse DNS for '%s'\n", prefixorg);
+  /* have the request processed by a daemon, if asked to - lists given as
+   * files are sent inline */
+  if (daemonpath != NULL) {
+    char *loc = NULL, *pref = NULL;
+    if (locpreflist != NULL) {
+      loc = cli_list(locpreflist, RPPLIST_PREFIXES);
+      pref = (loc != NULL) ? cli_list(preflist, RPPLIST_PREFS) : NULL;
+      if (pref == NULL) {
+        free(loc);
+        return(1);
+      }
+    }
+    i = client(daemonpath, action, prefixorg, loc, pref);
+    free(loc);
+    free(pref);
+    return(i);
+  }
+
+  /* encode the preferences once and for all */
+  msg = NULL;
+  if ((locpreflist != NULL) && ((msg = cli_msg(opts.advttl, opts.binary, locpreflist, preflist)) == NULL)) return(1);
+
+  /* load the cache of previous invocations, if any */
+  cache = rppcache_new();
+  if (cache == NULL) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    rppmsg_free(msg);
+    return(1);
+  }
+  if ((opts.cachefile != NULL) && (rppcache_load(cache, opts.cachefile) != 0)) {
+    fprintf(stderr, "WARNING: failed to load cache file '%s' (%s)\n", opts.cachefile, strerror(errno));
+  }
+
+  if (action == BATCH) {
+    FILE *fd = stdin;
+    struct rppprefix *pfxs = NULL;
+    unsigned long count = 0;
+    if (mrt != 0) {
+      /* the dump is parsed with every processor, whatever --threads is */
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      if (cpus < 1) cpus = 1;
+      if (cpus > RPPMRT_MAXTHREADS) cpus = RPPMRT_MAXTHREADS;
+      pfxs = rppmrt_load(prefixorg, (int)cpus, &count);
+      if (pfxs == NULL) {
+        fprintf(stderr, "ERROR: failed to read MRT dump '%s' (%s)\n", prefixorg, strerror(errno));
+        rppmsg_free(msg);
+        rppcache_free(cache);
+        return(1);
+      }
+      fd = NULL;
+    } else if ((prefixorg != NULL) && (strcmp(prefixorg, "-") != 0)) {
+      fd = fopen(prefixorg, "r");
+      if (fd == NULL) {
+        fprintf(stderr, "ERROR: failed to open '%s' (%s)\n", prefixorg, strerror(errno));
+        rppmsg_free(msg);
+        rppcache_free(cache);
+        return(1);
+      }
+    }
+    memset(&stats, 0, sizeof(stats));
+    if (threads > 1) {
+      i = rppworkers_batch(fd, pfxs, count, &opts, cache, msg, threads, &stats);
+      if (i == -1) {
+        fprintf(stderr, "ERROR: failed to set up the worker threads\n");
+      } else if (i != 0) {
+        fprintf(stderr, "ERROR: failed to read batch input (%s)\n", strerror(errno));
+      }
+      i = (i != 0);
+    } else {
+      i = batch(fd, pfxs, count, &opts, cache, msg, &stats);
+    }
+    if ((showstats != 0) && (mrt != 0)) fprintf(stderr, "mrt dump          %lu distinct prefixes\n", count);
+    if (showstats != 0) rppstats_print(&stats, stderr);
+    rppmsg_free(msg);
+    free(pfxs);
+    if ((fd != NULL) && (fd != stdin)) fclose(fd);
+    cache_save(cache, opts.cachefile);
+    rppcache_free(cache);
+    return(i);
+  }
+
+  /* parse the given prefix */
+  if (rppprefix_parse(&pfx, prefixorg) != 0) {
+    fprintf(stderr, "ERROR: failed to compute a reverse DNS for '%s'\n", prefixorg);
+    rppmsg_free(msg);
+    rppcache_free(cache);
     return(1);
   }
 
   /* resolve RDE controller's address for the given prefix */
-  i = rpp_getcontroller(rdeaddr, sizeof(rdeaddr), revdns);
+  i = resolve(rdeaddr, sizeof(rdeaddr), cache, &pfx, &opts);
+  cache_save(cache, opts.cachefile);
+  rppcache_free(cache);
   if (i == 0) {
     printf("RDE controller for %s is %s\n", prefixorg, rdeaddr);
   } else if (i > 0) {
     printf("No RDE entry found for %s\n", prefixorg);
   } else {
-    printf("ERROR: DNS failure (%d)\n", i);
+    fprintf(stderr, "ERROR: DNS failure (%d)\n", i);
   }
 
-  /* if action is 'resolve', then stop here */
-  if (action == RESOLVE) return(0);
+  /* if action is 'resolve', or there is no controller to advertise to, then
+   * stop here */
+  if ((action == RESOLVE) || (i != 0)) {
+    rppmsg_free(msg);
+    return(0);
+  }
 
   puts("Sending preferences...");
 
   /* send a SETINPREF query to the remote controller */
-  if (advertise_inpref_to_remote_dst(locpreflist, 3600, rdeaddr, preflist) == 0) {
+  if (advertise_msg_to_remote_dst(msg, rdeaddr, opts.advtimeout) == 0) {
     puts("Done.");
   }
+  rppmsg_free(msg);
 
   return(0);
 }
@@ -0,0 +1,635 @@
+/**
+  * @brief rppd, a daemon resolving and advertising requests of local clients
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "cache.h"
+
+#define PVER "20160504"
+#define PDATE "2016"
+
+#define MAXCLIENTS 256   /* max number of simultaneous clients */
+#define MAXLINE 16384    /* max length of a request line */
+#define MAXOUT 65536     /* results pending after which a client's requests are not read anymore */
+#define MAXSCRAPES 8     /* max number of simultaneous connections to the metrics endpoint */
+#define MAXMETRICS 65536 /* max size of the metrics served */
+
+
+/* a connected client */
+struct client {
+  int sock;              /* -1 if the slot is free */
+  int pfd;               /* index of the client in the poll set, if any */
+  int eof;               /* set once the client is done sending requests */
+  struct rppqueue *queue;
+  char *in;              /* requests received, not submitted yet */
+  size_t inlen;
+  char *out;             /* results not sent yet */
+  size_t outlen;
+  size_t outsz;
+};
+
+/* a connection to the metrics endpoint, that gets a single response */
+struct scrape {
+  int sock;              /* -1 if the slot is free */
+  int pfd;               /* index of the connection in the poll set, if any */
+  char req[1024];        /* the HTTP request, read until its empty line */
+  size_t reqlen;
+  char *out;             /* the response, once the request is read */
+  size_t outlen;
+  size_t outpos;
+};
+
+
+static volatile sig_atomic_t quit = 0;
+static volatile sig_atomic_t savecache = 0;
+
+
+static void onsignal(int sig) {
+  if (sig == SIGHUP) {
+    savecache = 1;
+  } else {
+    quit = 1;
+  }
+}
+
+
+static void printhelp(void) {
+  struct rppopts def;
+  printf("rppd version " PVER " Copyright (C) " PDATE " Border 6 S.A.S\n"
+         "\n"
+         "rppd resolves and advertises the requests of local clients, keeping its\n"
+         "cache, resolver and connections to RDE controllers warm between requests.\n"
+         "\n"
+         "usage: rppd [options] socket\n"
+         "\n");
+  printf("rppd listens on the unix socket 'socket'. clients send requests, one per\n"
+         "line, in the format of 'rpp batch': a remoteprefix, optionally followed by\n"
+         "a tab, localprefixes, a tab and a preflist. each request gets one result\n"
+         "line, in the order of the requests, also in the format of 'rpp batch'.\n"
+         "empty lines and lines starting with '#' are ignored. the connection is\n"
+         "closed once the client has shut down its side and got all its results.\n"
+         "\n");
+  printf("rppd runs in the foreground. SIGHUP saves the cache file, SIGINT and SIGTERM\n"
+         "save it and stop the daemon.\n"
+         "\n");
+  rppopts_default(&def);
+  def.keepalive = 60000;
+  def.refresh = 10;
+  printf("options:\n");
+  rppopts_printhelp(&def);
+  printf("  --metrics addr   serve the stats of the daemon over HTTP at 'addr', given\n"
+         "                   as [host:]port, in the Prometheus text format: DNS\n"
+         "                   queries, cache lookups, statuses and latencies\n"
+         "  --save secs      also save the cache file every 'secs' seconds, so that a\n"
+         "                   restart after a crash still starts warm\n"
+         "\n"
+         "example:\n"
+         "  rppd --cache /var/cache/rpp --metrics localhost:9100 /run/rppd.sock\n"
+         "  echo 203.0.113.0/24 | rpp --daemon /run/rppd.sock batch\n"
+         "\n");
+}
+
+
+/* saves the cache to fname, if a cache file is in use */
+static void cache_save(const struct rppcache *cache, const char *fname) {
+  if (fname == NULL) return;
+  if (rppcache_save(cache, fname) != 0) {
+    fprintf(stderr, "WARNING: failed to save cache file '%s' (%s)\n", fname, strerror(errno));
+  }
+}
+
+
+/* creates the listening unix socket at path - a stale socket left by a
+ * previous instance is replaced, but not the one of a running daemon */
+static int listen_unix(const char *path) {
+  struct sockaddr_un addr;
+  int sock;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return(-1);
+  }
+  strcpy(addr.sun_path, path);
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock < 0) return(-1);
+  if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) && (errno == EADDRINUSE)) {
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ((probe >= 0) && (connect(probe, (struct sockaddr *)&addr, sizeof(addr)) != 0) && (errno == ECONNREFUSED)) {
+      unlink(path);
+    }
+    if (probe >= 0) close(probe);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(sock);
+      errno = EADDRINUSE;
+      return(-1);
+    }
+  }
+  if (listen(sock, 64) != 0) {
+    int err = errno;
+    close(sock);
+    errno = err;
+    return(-1);
+  }
+  return(sock);
+}
+
+
+/* creates the listening TCP socket of the metrics endpoint at spec, given
+ * as [host:]port - an IPv6 host is to be enclosed in brackets */
+static int listen_tcp(const char *spec) {
+  struct addrinfo hints, *res;
+  char host[256];
+  const char *port = strrchr(spec, ':');
+  int sock, on = 1;
+
+  host[0] = 0;
+  if (port != NULL) {
+    size_t len = port - spec;
+    if ((len > 1) && (spec[0] == '[') && (spec[len - 1] == ']')) {
+      spec++;
+      len -= 2;
+    }
+    if (len >= sizeof(host)) {
+      errno = ENAMETOOLONG;
+      return(-1);
+    }
+    memcpy(host, spec, len);
+    host[len] = 0;
+    port++;
+  } else {
+    port = spec;
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo((host[0] != 0) ? host : NULL, port, &hints, &res) != 0) {
+    errno = EINVAL;
+    return(-1);
+  }
+  sock = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock >= 0) setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if ((sock >= 0) && ((bind(sock, res->ai_addr, res->ai_addrlen) != 0) || (listen(sock, 16) != 0))) {
+    int err = errno;
+    close(sock);
+    sock = -1;
+    errno = err;
+  }
+  freeaddrinfo(res);
+  return(sock);
+}
+
+
+/* accepts a new connection to the metrics endpoint into a free slot */
+static void scrape_accept(int lsock, struct scrape *scrapes) {
+  int i, sock;
+  sock = accept(lsock, NULL, NULL);
+  if (sock < 0) return;
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+  fcntl(sock, F_SETFD, FD_CLOEXEC);
+  for (i = 0; i < MAXSCRAPES; i++) {
+    if (scrapes[i].sock < 0) break;
+  }
+  if (i == MAXSCRAPES) {
+    close(sock);
+    return;
+  }
+  memset(&(scrapes[i]), 0, sizeof(scrapes[i]));
+  scrapes[i].sock = sock;
+  scrapes[i].pfd = -1;
+}
+
+
+static void scrape_close(struct scrape *sc) {
+  close(sc->sock);
+  sc->sock = -1;
+  free(sc->out);
+  sc->out = NULL;
+}
+
+
+/* reads the request of a connection to the metrics endpoint, and prepares
+ * its response once the request is complete - any GET gets the metrics
+ * @return 0 on success, non-zero if the connection is to be closed */
+static int scrape_read(struct scrape *sc, const struct rppbatch *b) {
+  static char body[MAXMETRICS];
+  size_t bodylen;
+  ssize_t len;
+  int hdrlen;
+
+  len = recv(sc->sock, sc->req + sc->reqlen, sizeof(sc->req) - 1 - sc->reqlen, 0);
+  if (len < 0) return(((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1);
+  if (len == 0) return(-1);
+  sc->reqlen += len;
+  sc->req[sc->reqlen] = 0;
+  if ((strstr(sc->req, "\r\n\r\n") == NULL) && (strstr(sc->req, "\n\n") == NULL)) {
+    return((sc->reqlen == sizeof(sc->req) - 1) ? -1 : 0);
+  }
+  if (strncmp(sc->req, "GET ", 4) != 0) return(-1);
+
+  bodylen = rppstats_prometheus(rppbatch_stats(b), body, sizeof(body));
+  sc->out = malloc(bodylen + 256);
+  if (sc->out == NULL) return(-1);
+  hdrlen = sprintf(sc->out, "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %lu\r\n"
+                            "Connection: close\r\n\r\n", (unsigned long)bodylen);
+  memcpy(sc->out + hdrlen, body, bodylen);
+  sc->outlen = hdrlen + bodylen;
+  return(0);
+}
+
+
+/* sends as much of the response as the socket accepts
+ * @return 0 as long as something is left to send, non-zero once the
+ * connection is to be closed */
+static int scrape_write(struct scrape *sc) {
+  while (sc->outpos < sc->outlen) {
+    ssize_t len = send(sc->sock, sc->out + sc->outpos, sc->outlen - sc->outpos, MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      return(((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1);
+    }
+    sc->outpos += len;
+  }
+  return(-1);
+}
+
+
+/* disconnects a client - its requests still in progress are discarded */
+static void client_close(struct client *c) {
+  close(c->sock);
+  c->sock = -1;
+  rppqueue_free(c->queue);
+  c->queue = NULL;
+  free(c->in);
+  c->in = NULL;
+  free(c->out);
+  c->out = NULL;
+}
+
+
+/* accepts a new client into a free slot */
+static void client_accept(int lsock, struct client *clients, struct rppbatch *b) {
+  struct client *c = NULL;
+  int i, sock;
+
+  sock = accept(lsock, NULL, NULL);
+  if (sock < 0) return;
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+  fcntl(sock, F_SETFD, FD_CLOEXEC);
+  for (i = 0; i < MAXCLIENTS; i++) {
+    if (clients[i].sock < 0) {
+      c = &(clients[i]);
+      break;
+    }
+  }
+  if (c == NULL) {
+    close(sock);
+    return;
+  }
+  memset(c, 0, sizeof(*c));
+  c->sock = sock;
+  c->pfd = -1;
+  c->queue = rppqueue_new(b, NULL);
+  c->in = malloc(MAXLINE);
+  if ((c->queue == NULL) || (c->in == NULL)) {
+    fprintf(stderr, "WARNING: out of memory, client dropped\n");
+    client_close(c);
+  }
+}
+
+
+/* reads whatever the client sent
+ * @return 0 on success, non-zero if the client is to be disconnected */
+static int client_read(struct client *c) {
+  ssize_t len;
+  for (;;) {
+    len = recv(c->sock, c->in + c->inlen, MAXLINE - c->inlen, 0);
+    if (len > 0) {
+      c->inlen += len;
+      return(0);
+    }
+    if (len == 0) {
+      c->eof = 1;
+      return(0);
+    }
+    if (errno == EINTR) continue;
+    return((errno == EAGAIN) || (errno == EWOULDBLOCK) ? 0 : -1);
+  }
+}
+
+
+/* collects the results of the requests of a client which are complete
+ * @return 0 on success, non-zero if the client is to be disconnected */
+static int client_collect(struct client *c) {
+  char res[1024];
+  int len;
+  while ((len = rppqueue_pop(c->queue, res, sizeof(res))) > 0) {
+    if (c->outlen + len > c->outsz) {
+      size_t newsz = (c->outsz == 0) ? 4096 : c->outsz * 2;
+      char *newout;
+      while (newsz < c->outlen + len) newsz *= 2;
+      newout = realloc(c->out, newsz);
+      if (newout == NULL) return(-1);
+      c->out = newout;
+      c->outsz = newsz;
+    }
+    memcpy(c->out + c->outlen, res, len);
+    c->outlen += len;
+  }
+  return(0);
+}
+
+
+/* submits the requests of a client for as long as it is allowed to, and
+ * collects the results of those which are complete */
+static int client_process(struct client *c) {
+  size_t pos = 0;
+
+  /* results leave room in the queue for the requests that wait for it -
+   * these are not polled for, so they are not to be left waiting */
+  if (client_collect(c) != 0) return(-1);
+
+  /* submit complete lines, as long as the queue accepts them and the client
+   * reads its results */
+  while ((c->outlen < MAXOUT) && (rppqueue_ready(c->queue) != 0)) {
+    char *eol = memchr(c->in + pos, '\n', c->inlen - pos);
+    size_t linelen;
+    if (eol != NULL) {
+      linelen = eol - (c->in + pos) + 1;
+    } else if ((c->eof != 0) && (c->inlen > pos)) {
+      linelen = c->inlen - pos; /* last line, without an end of line */
+    } else {
+      break;
+    }
+    /* a line that is not queued would never get its result */
+    if (rppqueue_submit(c->queue, c->in + pos, linelen) < 0) return(-1);
+    pos += linelen;
+  }
+  if (pos > 0) {
+    memmove(c->in, c->in + pos, c->inlen - pos);
+    c->inlen -= pos;
+  } else if ((c->inlen == MAXLINE) && (memchr(c->in, '\n', c->inlen) == NULL)) {
+    return(-1); /* line too long */
+  }
+
+  /* collect the results of the requests complete already */
+  return(client_collect(c));
+}
+
+
+/* sends as many results as the client's socket accepts
+ * @return 0 on success, non-zero if the client is to be disconnected */
+static int client_write(struct client *c) {
+  size_t pos = 0;
+  while (pos < c->outlen) {
+    ssize_t len = send(c->sock, c->out + pos, c->outlen - pos, MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+      return(-1);
+    }
+    pos += len;
+  }
+  if (pos > 0) {
+    memmove(c->out, c->out + pos, c->outlen - pos);
+    c->outlen -= pos;
+  }
+  return(0);
+}
+
+
+int main(int argc, char **argv) {
+  static struct client clients[MAXCLIENTS];
+  static struct scrape scrapes[MAXSCRAPES];
+  struct pollfd pfd[RPPBATCH_NFDS + 1 + MAXCLIENTS + 1 + MAXSCRAPES];
+  struct sigaction sa;
+  struct rppopts opts;
+  struct rppcache *cache;
+  struct rppdelta *delta = NULL;
+  struct rppbatch *b;
+  char *path, *metrics = NULL;
+  time_t nextsave = 0;
+  long saveevery = 0;
+  int lsock, msock = -1, mpfd = -1, i, n, nclients = 0;
+
+  rppopts_default(&opts);
+  opts.keepalive = 60000;
+  opts.refresh = 10;
+
+  /* parse options, they are all located before the socket path */
+  while ((argc > 1) && (strncmp(argv[1], "--", 2) == 0) && (strcmp(argv[1], "--help") != 0)) {
+    if ((strcmp(argv[1], "--metrics") == 0) && (argc > 2)) {
+      metrics = argv[2];
+    } else if ((strcmp(argv[1], "--save") == 0) && (argc > 2)) {
+      saveevery = atol(argv[2]);
+      if (saveevery <= 0) {
+        fprintf(stderr, "ERROR: invalid value for '--save'\n");
+        return(1);
+      }
+    } else if (rppopts_set(&opts, argv[1], argv[2]) != 0) {
+      fprintf(stderr, "ERROR: invalid option '%s'\n", argv[1]);
+      return(1);
+    }
+    argc -= 2;
+    argv += 2;
+  }
+  if ((argc != 2) || (strcmp(argv[1], "--help") == 0)) {
+    printhelp();
+    return((argc == 2) ? 0 : 1);
+  }
+  path = argv[1];
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onsignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  sa.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &sa, NULL);
+
+  /* load the cache of previous invocations, if any */
+  cache = rppcache_new();
+  if (cache == NULL) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return(1);
+  }
+  if ((opts.cachefile != NULL) && (rppcache_load(cache, opts.cachefile) != 0)) {
+    fprintf(stderr, "WARNING: failed to load cache file '%s' (%s)\n", opts.cachefile, strerror(errno));
+  }
+
+  /* controllers are told about changes only, for as long as the daemon runs */
+  if (opts.incremental > 0) delta = rppdelta_new(opts.incremental);
+  b = ((opts.incremental == 0) || (delta != NULL)) ? rppbatch_new(&opts, cache, delta) : NULL;
+  if (b == NULL) {
+    fprintf(stderr, "ERROR: failed to set up the asynchronous resolver\n");
+    rppdelta_free(delta);
+    rppcache_free(cache);
+    return(1);
+  }
+  lsock = listen_unix(path);
+  if (lsock < 0) {
+    fprintf(stderr, "ERROR: failed to listen on '%s' (%s)\n", path, strerror(errno));
+    rppbatch_free(b);
+    rppdelta_free(delta);
+    rppcache_free(cache);
+    return(1);
+  }
+  if ((metrics != NULL) && ((msock = listen_tcp(metrics)) < 0)) {
+    fprintf(stderr, "ERROR: failed to listen on '%s' (%s)\n", metrics, strerror(errno));
+    close(lsock);
+    unlink(path);
+    rppbatch_free(b);
+    rppdelta_free(delta);
+    rppcache_free(cache);
+    return(1);
+  }
+  for (i = 0; i < MAXCLIENTS; i++) clients[i].sock = -1;
+  for (i = 0; i < MAXSCRAPES; i++) scrapes[i].sock = -1;
+  if ((saveevery > 0) && (opts.cachefile != NULL)) nextsave = time(NULL) + saveevery;
+
+  while (quit == 0) {
+    int timeout;
+    /* wait for the engine, new clients, and clients that can make progress */
+    n = rppbatch_pollfds(b, pfd);
+    pfd[n].fd = lsock;
+    pfd[n].events = (nclients < MAXCLIENTS) ? POLLIN : 0;
+    n++;
+    for (i = 0; i < MAXCLIENTS; i++) {
+      struct client *c = &(clients[i]);
+      c->pfd = -1;
+      if (c->sock < 0) continue;
+      pfd[n].fd = c->sock;
+      pfd[n].events = 0;
+      if ((c->eof == 0) && (c->inlen < MAXLINE) && (memchr(c->in, '\n', c->inlen) == NULL)) pfd[n].events |= POLLIN;
+      if (c->outlen > 0) pfd[n].events |= POLLOUT;
+      c->pfd = n++;
+    }
+    if (msock >= 0) {
+      mpfd = n;
+      pfd[n].fd = msock;
+      pfd[n++].events = POLLIN;
+    }
+    for (i = 0; i < MAXSCRAPES; i++) {
+      struct scrape *sc = &(scrapes[i]);
+      sc->pfd = -1;
+      if (sc->sock < 0) continue;
+      pfd[n].fd = sc->sock;
+      pfd[n].events = (sc->out == NULL) ? POLLIN : POLLOUT;
+      sc->pfd = n++;
+    }
+    /* wake up in time for the next periodic save */
+    timeout = rppbatch_waittime(b);
+    if (nextsave > 0) {
+      time_t left = nextsave - time(NULL);
+      if (left < 0) left = 0;
+      if (left > 86400) left = 86400;
+      if ((timeout < 0) || ((time_t)timeout > left * 1000)) timeout = (int)(left * 1000);
+    }
+    if (poll(pfd, n, timeout) < 0) {
+      if (errno != EINTR) break;
+      n = 0;
+    }
+    if ((nextsave > 0) && (time(NULL) >= nextsave)) {
+      nextsave = time(NULL) + saveevery;
+      savecache = 1;
+    }
+    if (savecache != 0) {
+      savecache = 0;
+      cache_save(cache, opts.cachefile);
+    }
+
+    rppbatch_run(b);
+    if ((n > RPPBATCH_NFDS) && (pfd[RPPBATCH_NFDS].revents & POLLIN)) client_accept(lsock, clients, b);
+
+    nclients = 0;
+    for (i = 0; i < MAXCLIENTS; i++) {
+      struct client *c = &(clients[i]);
+      if (c->sock < 0) continue;
+      if ((c->pfd >= 0) && (c->pfd < n) && (pfd[c->pfd].revents & (POLLIN | POLLHUP | POLLERR)) && (client_read(c) != 0)) {
+        client_close(c);
+        continue;
+      }
+      if ((client_process(c) != 0) || (client_write(c) != 0)) {
+        client_close(c);
+        continue;
+      }
+      /* the client is done once it got the results of all its requests */
+      if ((c->eof != 0) && (c->inlen == 0) && (rppqueue_count(c->queue) == 0) && (c->outlen == 0)) {
+        client_close(c);
+        continue;
+      }
+      nclients++;
+    }
+
+    /* the metrics reflect whatever got processed so far */
+    for (i = 0; i < MAXSCRAPES; i++) {
+      struct scrape *sc = &(scrapes[i]);
+      int done;
+      if ((sc->sock < 0) || (sc->pfd < 0) || (sc->pfd >= n) || (pfd[sc->pfd].revents == 0)) continue;
+      if (sc->out == NULL) {
+        done = scrape_read(sc, b);
+        if ((done == 0) && (sc->out != NULL)) done = scrape_write(sc);
+      } else {
+        done = scrape_write(sc);
+      }
+      if (done != 0) scrape_close(sc);
+    }
+    if ((mpfd >= 0) && (mpfd < n) && (pfd[mpfd].revents & POLLIN)) scrape_accept(msock, scrapes);
+  }
+
+  for (i = 0; i < MAXCLIENTS; i++) {
+    if (clients[i].sock >= 0) client_close(&(clients[i]));
+  }
+  for (i = 0; i < MAXSCRAPES; i++) {
+    if (scrapes[i].sock >= 0) scrape_close(&(scrapes[i]));
+  }
+  if (msock >= 0) close(msock);
+  close(lsock);
+  unlink(path);
+  rppbatch_free(b);
+  rppdelta_free(delta);
+  cache_save(cache, opts.cachefile);
+  rppcache_free(cache);
+  return(0);
+}
@@ -0,0 +1,505 @@
+/**
+  * @brief reference RDE controller, receiving SETINPREF advertisements
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adv.h"
+#include "proto.h"
+#include "table.h"
+
+#define PVER "20160504"
+#define PDATE "2016"
+
+#define MAXTHREADS 256
+#define MAXCMD (16 * 1024 * 1024)  /* longest command accepted, in bytes */
+#define READSZ 65536               /* bytes read at once from a client */
+#define MAXEVENTS 64
+
+
+/* a connected client */
+struct conn {
+  struct conn *prev;     /* clients of the same thread */
+  struct conn *next;
+  int sock;
+  int eof;               /* set once the client is done sending */
+  unsigned char *in;     /* commands received, not processed yet */
+  size_t inlen;
+  size_t insz;
+  char *out;             /* replies not sent yet */
+  size_t outlen;
+  size_t outsz;
+};
+
+/* a thread, with a listening socket of its own */
+struct worker {
+  pthread_t tid;
+  int lsock;
+  int epfd;
+  struct rpptable *table;
+  struct conn *conns;    /* connected clients */
+  unsigned long cmds;    /* commands processed */
+  unsigned long errors;  /* malformed commands and invalid entries */
+};
+
+
+static volatile sig_atomic_t quit = 0;
+static volatile sig_atomic_t dump = 0;
+
+
+static void onsignal(int sig) {
+  if (sig == SIGHUP) {
+    dump = 1;
+  } else {
+    quit = 1;
+  }
+}
+
+
+static void printhelp(void) {
+  printf("rppsrv version " PVER " Copyright (C) " PDATE " Border 6 S.A.S\n"
+         "\n"
+         "rppsrv is a reference RDE controller: it receives the preferences that\n"
+         "'rpp advertise', 'rpp batch' and rppd send, and keeps them until their\n"
+         "TTL expires.\n"
+         "\n"
+         "usage: rppsrv [options]\n"
+         "\n");
+  printf("clients send commands over TCP, several per connection if they like:\n"
+         "  SETINPREF ttl<TAB>localprefixes<TAB>preflist\n"
+         "as text lines or binary frames (see 'rpp --encoding'). every local prefix\n"
+         "then gets the preferences of the preflist for ttl seconds - 0 withdraws\n"
+         "them. at most %d preferences are kept per prefix.\n"
+         "  GETINPREF prefix\n"
+         "is answered with 'INPREF ttl<TAB>preflist' or 'NOINPREF'.\n"
+         "\n", RPPTABLE_MAXPREFS);
+  printf("rppsrv runs in the foreground. SIGHUP dumps all preferences to stdout, one\n"
+         "prefix per line: prefix<TAB>ttl<TAB>preflist. SIGINT and SIGTERM stop it.\n"
+         "\n"
+         "options:\n"
+         "  --bind addr      address to listen on (default: all of them)\n"
+         "  --port n         TCP port to listen on (default: 4343)\n"
+         "  --threads n      number of threads, each of them accepting connections on\n"
+         "                   a socket of its own (default: one per CPU)\n"
+         "\n");
+}
+
+
+/* creates a listening socket, shared with the other threads through
+ * SO_REUSEPORT - addr NULL listens on all addresses, IPv6 and IPv4 */
+static int listen_tcp(const char *addr, int port) {
+  struct addrinfo hints, *ai;
+  char service[16];
+  int sock, one = 1, zero = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV | ((addr != NULL) ? AI_NUMERICHOST : 0);
+  hints.ai_family = (addr != NULL) ? AF_UNSPEC : AF_INET6;
+  sprintf(service, "%d", port);
+  if (getaddrinfo(addr, service, &hints, &ai) != 0) {
+    if (addr != NULL) {
+      errno = EINVAL;
+      return(-1);
+    }
+    /* no IPv6 on this host */
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(NULL, service, &hints, &ai) != 0) return(-1);
+  }
+  sock = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if ((sock < 0) && (addr == NULL) && (ai->ai_family == AF_INET6)) {
+    freeaddrinfo(ai);
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(NULL, service, &hints, &ai) != 0) return(-1);
+    sock = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  }
+  if (sock < 0) {
+    freeaddrinfo(ai);
+    return(-1);
+  }
+  if (ai->ai_family == AF_INET6) setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if ((setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) || (bind(sock, ai->ai_addr, ai->ai_addrlen) != 0) || (listen(sock, 1024) != 0)) {
+    int err = errno;
+    close(sock);
+    freeaddrinfo(ai);
+    errno = err;
+    return(-1);
+  }
+  freeaddrinfo(ai);
+  return(sock);
+}
+
+
+static void conn_close(struct worker *w, struct conn *c) {
+  if (c->prev != NULL) {
+    c->prev->next = c->next;
+  } else {
+    w->conns = c->next;
+  }
+  if (c->next != NULL) c->next->prev = c->prev;
+  epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->sock, NULL);
+  close(c->sock);
+  free(c->in);
+  free(c->out);
+  free(c);
+}
+
+
+static void conn_accept(struct worker *w) {
+  struct epoll_event ev;
+  for (;;) {
+    struct conn *c;
+    int sock = accept(w->lsock, NULL, NULL);
+    if (sock < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+      close(sock);
+      continue;
+    }
+    c->sock = sock;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, sock, &ev) != 0) {
+      close(sock);
+      free(c);
+      continue;
+    }
+    c->next = w->conns;
+    if (w->conns != NULL) w->conns->prev = c;
+    w->conns = c;
+  }
+}
+
+
+/* appends a reply to the output of a client
+ * @return 0 on success, non-zero otherwise */
+static int conn_reply(struct conn *c, const char *s, size_t len) {
+  if (c->outlen + len > c->outsz) {
+    size_t newsz = (c->outsz == 0) ? 4096 : c->outsz * 2;
+    char *newout;
+    while (newsz < c->outlen + len) newsz *= 2;
+    newout = realloc(c->out, newsz);
+    if (newout == NULL) return(-1);
+    c->out = newout;
+    c->outsz = newsz;
+  }
+  memcpy(c->out + c->outlen, s, len);
+  c->outlen += len;
+  return(0);
+}
+
+
+/* applies a SETINPREF command to the table - invalid entries are skipped */
+static void cmd_setinpref(struct worker *w, const struct rppprotomsg *m) {
+  struct rpptableprefs prefs;
+  struct rppprefix pfx;
+  unsigned long asn;
+  time_t expiry = time(NULL) + m->ttl;
+  size_t pos = 0;
+  int weight, res;
+
+  prefs.count = 0;
+  while ((res = rppproto_nextpref(m, &pos, &asn, &weight)) != 0) {
+    if (res < 0) {
+      w->errors++;
+      continue;
+    }
+    if (prefs.count == RPPTABLE_MAXPREFS) continue;
+    prefs.asn[prefs.count] = asn;
+    prefs.weight[prefs.count++] = weight;
+  }
+  pos = 0;
+  while ((res = rppproto_nextprefix(m, &pos, &pfx)) != 0) {
+    if (res < 0) {
+      w->errors++;
+    } else if (m->ttl == 0) {
+      rpptable_unset(w->table, &pfx);
+    } else if (rpptable_set(w->table, &pfx, &prefs, expiry) != 0) {
+      w->errors++;
+    }
+  }
+}
+
+
+/* answers a GETINPREF command
+ * @return 0 on success, non-zero if the reply could not be queued */
+static int cmd_getinpref(struct worker *w, struct conn *c, const struct rppprotomsg *m) {
+  struct rpptableprefs prefs;
+  struct rppprefix pfx;
+  char buf[64 + RPPTABLE_MAXPREFS * 16];
+  time_t expiry, now = time(NULL);
+  int i, len;
+
+  if ((rppproto_prefix(&pfx, (const char *)m->loc, m->loclen) != 0) || (rpptable_get(w->table, &pfx, now, &prefs, &expiry) != 0)) {
+    return(conn_reply(c, "NOINPREF\r\n", 10));
+  }
+  len = sprintf(buf, "INPREF %ld\t", (long)(expiry - now));
+  for (i = 0; i < prefs.count; i++) {
+    len += sprintf(buf + len, (i > 0) ? " %u:%u" : "%u:%u", prefs.asn[i], prefs.weight[i]);
+  }
+  len += sprintf(buf + len, "\r\n");
+  return(conn_reply(c, buf, len));
+}
+
+
+/* processes all complete commands received
+ * @return 0 on success, non-zero if the client is to be disconnected */
+static int conn_process(struct worker *w, struct conn *c) {
+  struct rppprotomsg m;
+  size_t pos = 0;
+  long len;
+  int res = 0;
+
+  while ((len = rppproto_parse(&m, c->in + pos, c->inlen - pos, MAXCMD)) > 0) {
+    pos += len;
+    w->cmds++;
+    if (m.cmd == RPPPROTO_SETINPREF) {
+      cmd_setinpref(w, &m);
+    } else if (m.cmd == RPPPROTO_GETINPREF) {
+      if (cmd_getinpref(w, c, &m) != 0) res = -1;
+    } else {
+      w->errors++;
+    }
+  }
+  if (len < 0) {
+    w->errors++;
+    res = -1;
+  }
+  if (pos > 0) {
+    memmove(c->in, c->in + pos, c->inlen - pos);
+    c->inlen -= pos;
+  }
+  return(res);
+}
+
+
+/* reads what the client sent, and processes it
+ * @return 0 on success, non-zero if the client is to be disconnected */
+static int conn_read(struct worker *w, struct conn *c) {
+  ssize_t len;
+  int i;
+  /* a busy client does not monopolize the thread */
+  for (i = 0; i < 16; i++) {
+    if (c->insz - c->inlen < READSZ) {
+      unsigned char *newin;
+      size_t newsz = (c->insz == 0) ? READSZ * 2 : c->insz * 2;
+      if (newsz > MAXCMD + READSZ * 2) return(-1);
+      newin = realloc(c->in, newsz);
+      if (newin == NULL) return(-1);
+      c->in = newin;
+      c->insz = newsz;
+    }
+    len = recv(c->sock, c->in + c->inlen, c->insz - c->inlen, 0);
+    if (len == 0) {
+      c->eof = 1;
+      break;
+    }
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+      return(-1);
+    }
+    c->inlen += len;
+    if (conn_process(w, c) != 0) return(-1);
+  }
+  return(0);
+}
+
+
+/* sends as many replies as the socket accepts, and watches the socket for
+ * what the client can do next: a client is not read from while it does not
+ * read its replies
+ * @return 0 on success, non-zero if the client is to be disconnected */
+static int conn_flush(struct worker *w, struct conn *c) {
+  struct epoll_event ev;
+  size_t pos = 0;
+  while (pos < c->outlen) {
+    ssize_t len = send(c->sock, c->out + pos, c->outlen - pos, MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+      return(-1);
+    }
+    pos += len;
+  }
+  if (pos > 0) {
+    memmove(c->out, c->out + pos, c->outlen - pos);
+    c->outlen -= pos;
+  }
+  if ((c->eof != 0) && (c->outlen == 0)) return(-1); /* done */
+  ev.events = (c->outlen > 0) ? EPOLLOUT : EPOLLIN;
+  ev.data.ptr = c;
+  epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->sock, &ev);
+  return(0);
+}
+
+
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  struct epoll_event ev[MAXEVENTS];
+  int i, n;
+
+  while (quit == 0) {
+    n = epoll_wait(w->epfd, ev, MAXEVENTS, 500);
+    for (i = 0; i < n; i++) {
+      struct conn *c = ev[i].data.ptr;
+      if (c == NULL) {
+        conn_accept(w);
+        continue;
+      }
+      if ((ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && (c->outlen == 0) && (conn_read(w, c) != 0)) {
+        conn_close(w, c);
+        continue;
+      }
+      if (conn_flush(w, c) != 0) conn_close(w, c);
+    }
+  }
+  /* clients still connected are dropped */
+  while (w->conns != NULL) conn_close(w, w->conns);
+  return(NULL);
+}
+
+
+int main(int argc, char **argv) {
+  static struct worker workers[MAXTHREADS];
+  struct sigaction sa;
+  struct epoll_event ev;
+  struct rpptable *table;
+  sigset_t sigs, oldsigs;
+  unsigned long cmds = 0, errors = 0;
+  char *bindaddr = NULL;
+  int port = RPP_PORT, threads, started, i;
+
+  threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if ((threads < 1) || (threads > MAXTHREADS)) threads = 1;
+  while ((argc > 2) && (strncmp(argv[1], "--", 2) == 0)) {
+    if (strcmp(argv[1], "--bind") == 0) {
+      bindaddr = argv[2];
+    } else if (strcmp(argv[1], "--port") == 0) {
+      port = atoi(argv[2]);
+      if ((port < 1) || (port > 65535)) port = -1;
+    } else if (strcmp(argv[1], "--threads") == 0) {
+      threads = atoi(argv[2]);
+      if ((threads < 1) || (threads > MAXTHREADS)) threads = -1;
+    } else {
+      break;
+    }
+    if ((port < 0) || (threads < 0)) {
+      fprintf(stderr, "ERROR: invalid option '%s'\n", argv[1]);
+      return(1);
+    }
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc != 1) {
+    printhelp();
+    return(((argc == 2) && (strcmp(argv[1], "--help") == 0)) ? 0 : 1);
+  }
+
+  table = rpptable_new();
+  if (table == NULL) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return(1);
+  }
+  for (i = 0; i < threads; i++) {
+    workers[i].table = table;
+    workers[i].lsock = listen_tcp(bindaddr, port);
+    workers[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+    if ((workers[i].lsock < 0) || (workers[i].epfd < 0)) {
+      fprintf(stderr, "ERROR: failed to listen on port %d (%s)\n", port, strerror(errno));
+      return(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(workers[i].epfd, EPOLL_CTL_ADD, workers[i].lsock, &ev);
+  }
+
+  /* signals are handled by the main thread only */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onsignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  sa.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &sa, NULL);
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+  for (started = 0; started < threads; started++) {
+    if (pthread_create(&(workers[started].tid), NULL, worker_main, &(workers[started])) != 0) break;
+  }
+  pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+  if (started < threads) {
+    fprintf(stderr, "ERROR: failed to start the threads\n");
+    quit = 1;
+  }
+
+  /* expired preferences are dropped in bulk, every second */
+  while (quit == 0) {
+    sleep(1);
+    rpptable_expire(table, time(NULL));
+    if (dump != 0) {
+      dump = 0;
+      rpptable_dump(table, stdout, time(NULL));
+      fflush(stdout);
+    }
+  }
+
+  for (i = 0; i < started; i++) {
+    pthread_join(workers[i].tid, NULL);
+    cmds += workers[i].cmds;
+    errors += workers[i].errors;
+  }
+  for (i = 0; i < threads; i++) {
+    close(workers[i].lsock);
+    close(workers[i].epfd);
+  }
+  fprintf(stderr, "%lu commands processed, %lu errors, %lu prefixes known\n", cmds, errors, rpptable_count(table));
+  rpptable_free(table);
+  return((started < threads) ? 1 : 0);
+}
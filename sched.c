@@ -0,0 +1,218 @@
+/**
+  * @brief min-heap scheduler of keyed jobs
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sched.h"
+
+/* initial number of hash buckets, must be a power of 2 */
+#define INITBUCKETS 1024
+
+struct schedjob {
+  struct schedjob *next;  /* next job in the same bucket */
+  unsigned long hash;     /* hash of the key */
+  long when;
+  size_t pos;             /* position of the job in the heap */
+  size_t keylen;
+  size_t datalen;
+  unsigned char *key;     /* the key, then the data - stored right after the structure */
+};
+
+struct rppsched {
+  struct schedjob **heap;   /* earliest job first */
+  size_t count;
+  size_t size;
+  struct schedjob **buckets;
+  unsigned long bucketcount;
+};
+
+
+/* FNV-1a hash of len bytes */
+static unsigned long fnv(const void *data, size_t len) {
+  const unsigned char *p = data;
+  unsigned long h = 2166136261lu;
+  while (len-- > 0) h = (h ^ *p++) * 16777619lu;
+  return(h);
+}
+
+
+/* puts job at position pos of the heap */
+static void heap_set(struct rppsched *s, size_t pos, struct schedjob *job) {
+  s->heap[pos] = job;
+  job->pos = pos;
+}
+
+
+/* moves the job at pos up or down the heap, to where its due time belongs */
+static void heap_fix(struct rppsched *s, size_t pos) {
+  struct schedjob *job = s->heap[pos];
+  while ((pos > 0) && (s->heap[(pos - 1) / 2]->when > job->when)) {
+    heap_set(s, pos, s->heap[(pos - 1) / 2]);
+    pos = (pos - 1) / 2;
+  }
+  for (;;) {
+    size_t child = pos * 2 + 1;
+    if (child >= s->count) break;
+    if ((child + 1 < s->count) && (s->heap[child + 1]->when < s->heap[child]->when)) child++;
+    if (s->heap[child]->when >= job->when) break;
+    heap_set(s, pos, s->heap[child]);
+    pos = child;
+  }
+  heap_set(s, pos, job);
+}
+
+
+/* removes a job from the heap and from its bucket, without freeing it */
+static void job_unlink(struct rppsched *s, struct schedjob *job) {
+  struct schedjob **bucket;
+  size_t pos = job->pos;
+  for (bucket = &(s->buckets[job->hash & (s->bucketcount - 1)]); *bucket != job; bucket = &((*bucket)->next));
+  *bucket = job->next;
+  s->count--;
+  if (pos == s->count) return;
+  heap_set(s, pos, s->heap[s->count]);
+  heap_fix(s, pos);
+}
+
+
+/* doubles the number of buckets - failing to do so is not an error, the
+ * schedule just gets slower */
+static void sched_grow(struct rppsched *s) {
+  struct schedjob **newbuckets;
+  unsigned long i, newcount = s->bucketcount * 2;
+  newbuckets = calloc(newcount, sizeof(*newbuckets));
+  if (newbuckets == NULL) return;
+  for (i = 0; i < s->bucketcount; i++) {
+    while (s->buckets[i] != NULL) {
+      struct schedjob *job = s->buckets[i];
+      s->buckets[i] = job->next;
+      job->next = newbuckets[job->hash & (newcount - 1)];
+      newbuckets[job->hash & (newcount - 1)] = job;
+    }
+  }
+  free(s->buckets);
+  s->buckets = newbuckets;
+  s->bucketcount = newcount;
+}
+
+
+struct rppsched *rppsched_new(void) {
+  struct rppsched *s;
+  s = calloc(1, sizeof(*s));
+  if (s == NULL) return(NULL);
+  s->bucketcount = INITBUCKETS;
+  s->buckets = calloc(s->bucketcount, sizeof(*(s->buckets)));
+  if (s->buckets == NULL) {
+    free(s);
+    return(NULL);
+  }
+  return(s);
+}
+
+
+int rppsched_add(struct rppsched *s, long when, const void *key, size_t keylen, const void *data, size_t datalen) {
+  struct schedjob *job, **bucket;
+  unsigned long hash = fnv(key, keylen);
+
+  /* the job replaces any previous one of the same key */
+  for (job = s->buckets[hash & (s->bucketcount - 1)]; job != NULL; job = job->next) {
+    if ((job->hash == hash) && (job->keylen == keylen) && (memcmp(job->key, key, keylen) == 0)) break;
+  }
+  if (job != NULL) {
+    job_unlink(s, job);
+    free(job);
+  }
+
+  if (s->count == s->size) {
+    size_t newsize = (s->size == 0) ? 1024 : s->size * 2;
+    struct schedjob **newheap = realloc(s->heap, newsize * sizeof(*newheap));
+    if (newheap == NULL) return(-1);
+    s->heap = newheap;
+    s->size = newsize;
+  }
+  job = malloc(sizeof(*job) + keylen + datalen);
+  if (job == NULL) return(-1);
+  job->hash = hash;
+  job->when = when;
+  job->keylen = keylen;
+  job->datalen = datalen;
+  job->key = (unsigned char *)(job + 1);
+  memcpy(job->key, key, keylen);
+  memcpy(job->key + keylen, data, datalen);
+
+  if (s->count >= s->bucketcount) sched_grow(s);
+  bucket = &(s->buckets[hash & (s->bucketcount - 1)]);
+  job->next = *bucket;
+  *bucket = job;
+  heap_set(s, s->count++, job);
+  heap_fix(s, job->pos);
+  return(0);
+}
+
+
+void *rppsched_pop(struct rppsched *s, long now, size_t *datalen) {
+  struct schedjob *job;
+  void *data;
+  if ((s->count == 0) || (s->heap[0]->when > now)) return(NULL);
+  job = s->heap[0];
+  data = malloc(job->datalen + 1);
+  if (data == NULL) return(NULL);
+  memcpy(data, job->key + job->keylen, job->datalen);
+  ((unsigned char *)data)[job->datalen] = 0;
+  *datalen = job->datalen;
+  job_unlink(s, job);
+  free(job);
+  return(data);
+}
+
+
+int rppsched_waittime(const struct rppsched *s, long now) {
+  long wait;
+  if (s->count == 0) return(-1);
+  wait = s->heap[0]->when - now;
+  if (wait < 0) return(0);
+  if (wait > 3600000) return(3600000);
+  return(wait);
+}
+
+
+size_t rppsched_count(const struct rppsched *s) {
+  return(s->count);
+}
+
+
+void rppsched_free(struct rppsched *s) {
+  size_t i;
+  if (s == NULL) return;
+  for (i = 0; i < s->count; i++) free(s->heap[i]);
+  free(s->heap);
+  free(s->buckets);
+  free(s);
+}
@@ -0,0 +1,66 @@
+/**
+  * @brief min-heap scheduler of keyed jobs
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_SCHED_H
+#define RPP_SCHED_H
+
+#include <stddef.h>
+
+/** @brief a schedule of jobs sorted by due time, each job identified by a
+  * key (opaque) */
+struct rppsched;
+
+/** @brief creates an empty schedule
+  * @return a new schedule, or NULL on error */
+struct rppsched *rppsched_new(void);
+
+/** @brief schedules a job - a job of the same key is replaced
+  * @param when the time the job is due, in ms on any monotonic clock
+  * @param *key the key of the job, copied
+  * @param *data what the job is about, copied
+  * @return 0 on success, non-zero otherwise */
+int rppsched_add(struct rppsched *s, long when, const void *key, size_t keylen, const void *data, size_t datalen);
+
+/** @brief removes the earliest job from the schedule if it is due by now
+  * @param *datalen filled with the length of its data
+  * @return the data of the job, followed by a nul byte and to be freed by
+  * the caller, or NULL if no job is due */
+void *rppsched_pop(struct rppsched *s, long now, size_t *datalen);
+
+/** @brief returns the time (in ms) until the earliest job is due, 0 if it
+  * is due already, or -1 if the schedule is empty */
+int rppsched_waittime(const struct rppsched *s, long now);
+
+/** @brief returns the number of jobs scheduled */
+size_t rppsched_count(const struct rppsched *s);
+
+/** @brief frees a schedule and all its jobs */
+void rppsched_free(struct rppsched *s);
+
+#endif
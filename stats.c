@@ -0,0 +1,225 @@
+/**
+  * @brief counters and latency histograms of the request processing engines
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+
+/* returns the bucket of value v */
+static int hist_bucket(unsigned long v) {
+  int e = 0;
+  if (v < RPPHIST_SUB) return((int)v);
+  while ((v >> e) >= 2 * RPPHIST_SUB) e++;
+  /* v is (RPPHIST_SUB + sub) << e, give or take what e drops */
+  return((e + 1) * RPPHIST_SUB + (int)((v >> e) - RPPHIST_SUB));
+}
+
+
+/* returns the largest value that falls into bucket i */
+static unsigned long hist_top(int i) {
+  int e = i / RPPHIST_SUB - 1;
+  if (i < RPPHIST_SUB) return((unsigned long)i);
+  return((((unsigned long)(RPPHIST_SUB + i % RPPHIST_SUB) + 1) << e) - 1);
+}
+
+
+void rpphist_add(struct rpphist *h, long v) {
+  unsigned long u;
+  if (v < 0) v = 0;
+  u = (unsigned long)v;
+  if (u > 0xfffffffful) u = 0xfffffffful;
+  h->bucket[hist_bucket(u)]++;
+  h->count++;
+  h->sum += u;
+  if (u > h->max) h->max = u;
+}
+
+
+unsigned long rpphist_quantile(const struct rpphist *h, double q) {
+  unsigned long rank, seen = 0;
+  int i;
+  if (h->count == 0) return(0);
+  rank = (unsigned long)(q * h->count + 0.999999);
+  if (rank < 1) rank = 1;
+  for (i = 0; i < RPPHIST_BUCKETS; i++) {
+    seen += h->bucket[i];
+    if (seen >= rank) break;
+  }
+  /* the top of the bucket, but never beyond what got recorded */
+  if ((i == RPPHIST_BUCKETS) || (hist_top(i) > h->max)) return(h->max);
+  return(hist_top(i));
+}
+
+
+void rppstats_code(unsigned long *counters, int code) {
+  if (code < RPPSTATS_MINCODE) code = RPPSTATS_MINCODE;
+  if (code > RPPSTATS_MINCODE + RPPSTATS_CODES - 1) code = RPPSTATS_MINCODE + RPPSTATS_CODES - 1;
+  counters[code - RPPSTATS_MINCODE]++;
+}
+
+
+static void hist_merge(struct rpphist *dst, const struct rpphist *src) {
+  int i;
+  for (i = 0; i < RPPHIST_BUCKETS; i++) dst->bucket[i] += src->bucket[i];
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->max > dst->max) dst->max = src->max;
+}
+
+
+void rppstats_merge(struct rppstats *dst, const struct rppstats *src) {
+  int i;
+  hist_merge(&(dst->dnsrtt), &(src->dnsrtt));
+  hist_merge(&(dst->resolve), &(src->resolve));
+  hist_merge(&(dst->connect), &(src->connect));
+  hist_merge(&(dst->advertise), &(src->advertise));
+  dst->queries += src->queries;
+  dst->timeouts += src->timeouts;
+  dst->cachehits += src->cachehits;
+  dst->cachemisses += src->cachemisses;
+  dst->connfails += src->connfails;
+  for (i = 0; i < RPPSTATS_CODES; i++) {
+    dst->resstatus[i] += src->resstatus[i];
+    dst->advstatus[i] += src->advstatus[i];
+  }
+}
+
+
+/* prints the non-zero counters of codes, as "code: count" pairs */
+static void print_codes(const char *title, const unsigned long *counters, FILE *fd) {
+  int i, n = 0;
+  fprintf(fd, "%-18s", title);
+  for (i = 0; i < RPPSTATS_CODES; i++) {
+    if (counters[i] == 0) continue;
+    fprintf(fd, "%s%d: %lu", (n++ > 0) ? ", " : "", i + RPPSTATS_MINCODE, counters[i]);
+  }
+  fprintf(fd, "%s\n", (n == 0) ? "none" : "");
+}
+
+
+/* prints a histogram as its count and a few quantiles, in ms */
+static void print_hist(const char *title, const struct rpphist *h, FILE *fd) {
+  static const double q[4] = {0.5, 0.9, 0.99, 1.0};
+  int i;
+  fprintf(fd, "  %-16s%8lu", title, h->count);
+  for (i = 0; i < 4; i++) {
+    unsigned long v = (q[i] < 1.0) ? rpphist_quantile(h, q[i]) : h->max;
+    fprintf(fd, " %6lu.%03lu", v / 1000, v % 1000);
+  }
+  fprintf(fd, "\n");
+}
+
+
+void rppstats_print(const struct rppstats *s, FILE *fd) {
+  fprintf(fd, "%-18s%lu sent, %lu timed out\n", "dns queries", s->queries, s->timeouts);
+  fprintf(fd, "%-18s%lu hits, %lu misses\n", "cache lookups", s->cachehits, s->cachemisses);
+  fprintf(fd, "%-18s%lu\n", "connect failures", s->connfails);
+  print_codes("resolve status", s->resstatus, fd);
+  print_codes("advertise status", s->advstatus, fd);
+  fprintf(fd, "latency (ms)         count        p50        p90        p99        max\n");
+  print_hist("dns rtt", &(s->dnsrtt), fd);
+  print_hist("resolve", &(s->resolve), fd);
+  print_hist("connect", &(s->connect), fd);
+  print_hist("advertise", &(s->advertise), fd);
+}
+
+
+/* an output buffer that silently truncates what does not fit */
+struct promout {
+  char *buf;
+  size_t maxlen;
+  size_t len;
+};
+
+
+static void prom_printf(struct promout *o, const char *fmt, ...) {
+  va_list ap;
+  int len;
+  if (o->len + 1 >= o->maxlen) return;
+  va_start(ap, fmt);
+  len = vsnprintf(o->buf + o->len, o->maxlen - o->len, fmt, ap);
+  va_end(ap);
+  if (len < 0) return;
+  o->len += len;
+  if (o->len >= o->maxlen) o->len = o->maxlen - 1;
+}
+
+
+/* writes a histogram, with a cumulative bucket per power of 2 from 16 us up
+ * to about 2 minutes - these fall on boundaries of the buckets of h */
+static void prom_hist(struct promout *o, const char *name, const char *help, const struct rpphist *h) {
+  unsigned long seen = 0;
+  int e, i = 0;
+  prom_printf(o, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  for (e = 4; e <= 27; e++) {
+    for (; i < hist_bucket(1ul << e); i++) seen += h->bucket[i];
+    prom_printf(o, "%s_bucket{le=\"%.6f\"} %lu\n", name, ((1ul << e) - 1) / 1000000.0, seen);
+  }
+  prom_printf(o, "%s_bucket{le=\"+Inf\"} %lu\n%s_sum %.6f\n%s_count %lu\n", name, h->count, name, h->sum / 1000000.0, name, h->count);
+}
+
+
+static void prom_counter(struct promout *o, const char *name, const char *help, unsigned long v) {
+  prom_printf(o, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", name, help, name, name, v);
+}
+
+
+static void prom_codes(struct promout *o, const char *name, const char *help, const unsigned long *counters) {
+  int i;
+  prom_printf(o, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+  for (i = 0; i < RPPSTATS_CODES; i++) {
+    if (counters[i] == 0) continue;
+    prom_printf(o, "%s{status=\"%d\"} %lu\n", name, i + RPPSTATS_MINCODE, counters[i]);
+  }
+}
+
+
+size_t rppstats_prometheus(const struct rppstats *s, char *buf, size_t maxlen) {
+  struct promout o;
+  o.buf = buf;
+  o.maxlen = maxlen;
+  o.len = 0;
+  if (maxlen == 0) return(0);
+  buf[0] = 0;
+  prom_counter(&o, "rpp_dns_queries_total", "DNS queries sent, retransmissions included.", s->queries);
+  prom_counter(&o, "rpp_dns_timeouts_total", "DNS queries that timed out.", s->timeouts);
+  prom_counter(&o, "rpp_cache_hits_total", "Zones found in the cache.", s->cachehits);
+  prom_counter(&o, "rpp_cache_misses_total", "Zones that had to be queried.", s->cachemisses);
+  prom_counter(&o, "rpp_connect_failures_total", "Connection attempts to controllers that failed.", s->connfails);
+  prom_codes(&o, "rpp_resolve_total", "Requests resolved, by status.", s->resstatus);
+  prom_codes(&o, "rpp_advertise_total", "Requests advertised, by status.", s->advstatus);
+  prom_hist(&o, "rpp_dns_rtt_seconds", "Round-trip time of the DNS queries answered.", &(s->dnsrtt));
+  prom_hist(&o, "rpp_resolve_seconds", "Time taken to resolve a request.", &(s->resolve));
+  prom_hist(&o, "rpp_connect_seconds", "Time taken to connect to a controller.", &(s->connect));
+  prom_hist(&o, "rpp_advertise_seconds", "Time taken to advertise a request.", &(s->advertise));
+  return(o.len);
+}
@@ -0,0 +1,96 @@
+/**
+  * @brief counters and latency histograms of the request processing engines
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_STATS_H
+#define RPP_STATS_H
+
+#include <stdio.h>
+
+/** @brief sub-buckets of every power of 2 of a histogram: values are
+  * recorded with a relative error of 1/RPPHIST_SUB at most */
+#define RPPHIST_SUB 8
+
+/** @brief number of buckets of a histogram, enough for any 32-bit value */
+#define RPPHIST_BUCKETS (30 * RPPHIST_SUB)
+
+/** @brief a log-linear (HDR-style) histogram of latencies, in us. values
+  * below RPPHIST_SUB get a bucket each, larger ones share RPPHIST_SUB
+  * buckets per power of 2 */
+struct rpphist {
+  unsigned long count;   /**< number of values recorded */
+  unsigned long max;     /**< largest value recorded */
+  double sum;            /**< sum of the values recorded */
+  unsigned long bucket[RPPHIST_BUCKETS];
+};
+
+/** @brief lowest status code counted on its own - the codes of results
+  * (see rppdns_resolve() and rppadv_cb) are counted from it up to
+  * RPPSTATS_MINCODE + RPPSTATS_CODES - 1, codes outside of that range are
+  * counted along with the closest one */
+#define RPPSTATS_MINCODE -8
+#define RPPSTATS_CODES 16
+
+/** @brief what the engine of a thread went through - nothing is shared, a
+  * process sums the stats of its engines with rppstats_merge() */
+struct rppstats {
+  struct rpphist dnsrtt;     /**< round-trip time of the DNS queries answered, to the ms */
+  struct rpphist resolve;    /**< time taken to resolve a request, cache lookups included */
+  struct rpphist connect;    /**< time taken to connect to controllers */
+  struct rpphist advertise;  /**< time taken to advertise a request (see rppadv_cb) */
+  unsigned long queries;     /**< DNS queries sent, retransmissions included */
+  unsigned long timeouts;    /**< DNS queries that timed out */
+  unsigned long cachehits;   /**< zones found in the cache */
+  unsigned long cachemisses; /**< zones that had to be queried */
+  unsigned long connfails;   /**< connection attempts to controllers that failed */
+  unsigned long resstatus[RPPSTATS_CODES]; /**< requests by resolution status */
+  unsigned long advstatus[RPPSTATS_CODES]; /**< requests by advertisement status */
+};
+
+/** @brief records value v (in us) into histogram h */
+void rpphist_add(struct rpphist *h, long v);
+
+/** @brief returns the value (in us) below which a fraction q (0 to 1) of
+  * the values recorded into h lie, 0 if nothing got recorded */
+unsigned long rpphist_quantile(const struct rpphist *h, double q);
+
+/** @brief counts the result code 'code' into counters */
+void rppstats_code(unsigned long *counters, int code);
+
+/** @brief adds up the stats of src into dst */
+void rppstats_merge(struct rppstats *dst, const struct rppstats *src);
+
+/** @brief prints a human-readable summary of the stats to fd */
+void rppstats_print(const struct rppstats *s, FILE *fd);
+
+/** @brief writes the stats in the Prometheus text exposition format
+  * @return the length of the text written to buf (truncated to maxlen - 1
+  * bytes if needed) */
+size_t rppstats_prometheus(const struct rppstats *s, char *buf, size_t maxlen);
+
+#endif
@@ -0,0 +1,345 @@
+/**
+  * @brief sharded table of the inbound preferences received by a controller
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+
+/* number of shards, must be a power of 2 */
+#define NSHARDS 256
+
+/* initial number of slots per shard, must be a power of 2 */
+#define INITSLOTS 64
+
+/* an open-addressing slot - the preferences are kept inline, so that a
+ * lookup touches a couple of cache lines */
+struct tableslot {
+  unsigned long hash;       /* 0 if the slot is free */
+  time_t expiry;
+  int family;
+  int len;
+  unsigned char addr[16];
+  struct rpptableprefs prefs;
+};
+
+/* the slots of a shard - arrays replaced by larger ones are kept until the
+ * table is freed, since lookups may still be reading them */
+struct slotarray {
+  struct slotarray *retired;  /* the array this one replaced */
+  unsigned long mask;         /* number of slots - 1 */
+  struct tableslot slot[1];
+};
+
+/* a shard: updates are serialized by its lock and bump its sequence around
+ * every change, lookups retry for as long as the sequence is odd or changed
+ * while they were reading */
+struct tableshard {
+  unsigned int seq;
+  pthread_mutex_t lock;
+  struct slotarray *slots;
+  unsigned long count;
+  char pad[64];             /* keeps shards on cache lines of their own */
+};
+
+struct rpptable {
+  struct tableshard shard[NSHARDS];
+};
+
+
+/* FNV-1a hash of a prefix (never 0), which must have been masked to its
+ * length */
+static unsigned long pfxhash(const struct rppprefix *pfx) {
+  unsigned long h = 2166136261lu;
+  int i;
+  h = (h ^ (unsigned char)pfx->family) * 16777619lu;
+  h = (h ^ (unsigned char)pfx->len) * 16777619lu;
+  for (i = 0; i < ((pfx->len + 7) >> 3); i++) h = (h ^ pfx->addr[i]) * 16777619lu;
+  return((h == 0) ? 1 : h);
+}
+
+
+/* returns the shard of a hash, picked from bits the slot index does not use */
+static unsigned long shardof(unsigned long hash) {
+  return((hash >> 24) & (NSHARDS - 1));
+}
+
+
+/* returns non-zero if slot s holds the prefix pfx of hash */
+static int slotcmp(const struct tableslot *s, const struct rppprefix *pfx, unsigned long hash) {
+  if ((s->hash != hash) || (s->family != pfx->family) || (s->len != pfx->len)) return(1);
+  return(memcmp(s->addr, pfx->addr, (pfx->len + 7) >> 3));
+}
+
+
+static struct slotarray *slots_new(unsigned long count) {
+  struct slotarray *a;
+  a = calloc(1, sizeof(*a) + (count - 1) * sizeof(a->slot[0]));
+  if (a == NULL) return(NULL);
+  a->mask = count - 1;
+  return(a);
+}
+
+
+struct rpptable *rpptable_new(void) {
+  struct rpptable *t;
+  int i;
+  t = calloc(1, sizeof(*t));
+  if (t == NULL) return(NULL);
+  for (i = 0; i < NSHARDS; i++) {
+    pthread_mutex_init(&(t->shard[i].lock), NULL);
+    t->shard[i].slots = slots_new(INITSLOTS);
+    if (t->shard[i].slots == NULL) {
+      rpptable_free(t);
+      return(NULL);
+    }
+  }
+  return(t);
+}
+
+
+/* marks the start and then the end of a change of a shard */
+static void shard_writing(struct tableshard *sh) {
+  __atomic_add_fetch(&(sh->seq), 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void shard_written(struct tableshard *sh) {
+  __atomic_add_fetch(&(sh->seq), 1, __ATOMIC_RELEASE);
+}
+
+
+/* replaces the slots of a shard by twice as many - the new array is
+ * complete before being published, lookups still reading the old one see
+ * it unchanged */
+static int shard_grow(struct tableshard *sh) {
+  struct slotarray *old = sh->slots, *a;
+  unsigned long i;
+  a = slots_new((old->mask + 1) * 2);
+  if (a == NULL) return(-1);
+  for (i = 0; i <= old->mask; i++) {
+    unsigned long j;
+    if (old->slot[i].hash == 0) continue;
+    for (j = old->slot[i].hash & a->mask; a->slot[j].hash != 0; j = (j + 1) & a->mask);
+    a->slot[j] = old->slot[i];
+  }
+  a->retired = old;
+  __atomic_store_n(&(sh->slots), a, __ATOMIC_RELEASE);
+  return(0);
+}
+
+
+int rpptable_set(struct rpptable *t, const struct rppprefix *pfx, const struct rpptableprefs *prefs, time_t expiry) {
+  struct rppprefix key;
+  struct tableshard *sh;
+  struct slotarray *a;
+  struct tableslot *s;
+  unsigned long hash, i;
+
+  rppprefix_trunc(&key, pfx, pfx->len);
+  hash = pfxhash(&key);
+  sh = &(t->shard[shardof(hash)]);
+  pthread_mutex_lock(&(sh->lock));
+  /* linear probing stays fast up to 3/4 of the slots used */
+  if (((sh->count + 1) * 4 > (sh->slots->mask + 1) * 3) && (shard_grow(sh) != 0)) {
+    pthread_mutex_unlock(&(sh->lock));
+    return(-1);
+  }
+  a = sh->slots;
+  for (i = hash & a->mask; (a->slot[i].hash != 0) && (slotcmp(&(a->slot[i]), &key, hash) != 0); i = (i + 1) & a->mask);
+  s = &(a->slot[i]);
+  shard_writing(sh);
+  if (s->hash == 0) {
+    sh->count++;
+    s->family = key.family;
+    s->len = key.len;
+    memcpy(s->addr, key.addr, sizeof(s->addr));
+    s->hash = hash;
+  }
+  s->expiry = expiry;
+  s->prefs = *prefs;
+  shard_written(sh);
+  pthread_mutex_unlock(&(sh->lock));
+  return(0);
+}
+
+
+/* removes the entry of slot i, the caller is writing the shard. entries
+ * that follow it are moved back, so that no probe sequence is broken */
+static void slot_remove(struct tableshard *sh, unsigned long i) {
+  struct slotarray *a = sh->slots;
+  unsigned long j = i;
+  for (;;) {
+    unsigned long home;
+    j = (j + 1) & a->mask;
+    if (a->slot[j].hash == 0) break;
+    home = a->slot[j].hash & a->mask;
+    /* an entry whose home lies within (i, j] stays where it is */
+    if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j))) continue;
+    a->slot[i] = a->slot[j];
+    i = j;
+  }
+  a->slot[i].hash = 0;
+  sh->count--;
+}
+
+
+void rpptable_unset(struct rpptable *t, const struct rppprefix *pfx) {
+  struct rppprefix key;
+  struct tableshard *sh;
+  struct slotarray *a;
+  unsigned long hash, i;
+
+  rppprefix_trunc(&key, pfx, pfx->len);
+  hash = pfxhash(&key);
+  sh = &(t->shard[shardof(hash)]);
+  pthread_mutex_lock(&(sh->lock));
+  a = sh->slots;
+  for (i = hash & a->mask; a->slot[i].hash != 0; i = (i + 1) & a->mask) {
+    if (slotcmp(&(a->slot[i]), &key, hash) != 0) continue;
+    shard_writing(sh);
+    slot_remove(sh, i);
+    shard_written(sh);
+    break;
+  }
+  pthread_mutex_unlock(&(sh->lock));
+}
+
+
+int rpptable_get(const struct rpptable *t, const struct rppprefix *pfx, time_t now, struct rpptableprefs *prefs, time_t *expiry) {
+  const struct tableshard *sh;
+  struct rppprefix key;
+  struct tableslot found;
+  unsigned long hash;
+  unsigned int seq;
+
+  rppprefix_trunc(&key, pfx, pfx->len);
+  hash = pfxhash(&key);
+  sh = &(t->shard[shardof(hash)]);
+  for (;;) {
+    const struct slotarray *a;
+    unsigned long i, n;
+    seq = __atomic_load_n(&(sh->seq), __ATOMIC_ACQUIRE);
+    if (seq & 1) continue; /* being written */
+    a = __atomic_load_n(&(sh->slots), __ATOMIC_ACQUIRE);
+    found.hash = 0;
+    /* what is read may be torn by a concurrent update, the probe is bounded
+     * and its result only used once the sequence is checked */
+    for (i = hash & a->mask, n = 0; (n <= a->mask) && (a->slot[i].hash != 0); i = (i + 1) & a->mask, n++) {
+      if (slotcmp(&(a->slot[i]), &key, hash) != 0) continue;
+      memcpy(&found, &(a->slot[i]), sizeof(found));
+      break;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&(sh->seq), __ATOMIC_RELAXED) == seq) break;
+  }
+  if ((found.hash == 0) || (found.expiry <= now)) return(-1);
+  *prefs = found.prefs;
+  *expiry = found.expiry;
+  return(0);
+}
+
+
+unsigned long rpptable_expire(struct rpptable *t, time_t now) {
+  unsigned long removed = 0;
+  int i;
+  for (i = 0; i < NSHARDS; i++) {
+    struct tableshard *sh = &(t->shard[i]);
+    struct slotarray *a;
+    unsigned long j;
+    pthread_mutex_lock(&(sh->lock));
+    a = sh->slots;
+    shard_writing(sh);
+    /* entries only ever move back into the slot being looked at, or into
+     * slots that were looked at and hold valid entries */
+    for (j = 0; j <= a->mask;) {
+      if ((a->slot[j].hash != 0) && (a->slot[j].expiry <= now)) {
+        slot_remove(sh, j);
+        removed++;
+        continue;
+      }
+      j++;
+    }
+    shard_written(sh);
+    pthread_mutex_unlock(&(sh->lock));
+  }
+  return(removed);
+}
+
+
+unsigned long rpptable_count(const struct rpptable *t) {
+  unsigned long count = 0;
+  int i;
+  for (i = 0; i < NSHARDS; i++) count += __atomic_load_n(&(t->shard[i].count), __ATOMIC_RELAXED);
+  return(count);
+}
+
+
+int rpptable_dump(const struct rpptable *t, FILE *fd, time_t now) {
+  int i, res = 0;
+  for (i = 0; i < NSHARDS; i++) {
+    struct tableshard *sh = (struct tableshard *)&(t->shard[i]);
+    struct slotarray *a;
+    unsigned long j;
+    /* a dump is no lookup, it holds one shard at a time */
+    pthread_mutex_lock(&(sh->lock));
+    a = sh->slots;
+    for (j = 0; j <= a->mask; j++) {
+      const struct tableslot *s = &(a->slot[j]);
+      char addr[INET6_ADDRSTRLEN];
+      int k;
+      if ((s->hash == 0) || (s->expiry <= now)) continue;
+      inet_ntop(s->family, s->addr, addr, sizeof(addr));
+      if (fprintf(fd, "%s/%d\t%ld\t", addr, s->len, (long)(s->expiry - now)) < 0) res = -1;
+      for (k = 0; k < s->prefs.count; k++) {
+        if (fprintf(fd, (k > 0) ? " %u:%u" : "%u:%u", s->prefs.asn[k], s->prefs.weight[k]) < 0) res = -1;
+      }
+      if (fputc('\n', fd) == EOF) res = -1;
+    }
+    pthread_mutex_unlock(&(sh->lock));
+  }
+  return(res);
+}
+
+
+void rpptable_free(struct rpptable *t) {
+  int i;
+  if (t == NULL) return;
+  for (i = 0; i < NSHARDS; i++) {
+    while (t->shard[i].slots != NULL) {
+      struct slotarray *a = t->shard[i].slots;
+      t->shard[i].slots = a->retired;
+      free(a);
+    }
+    pthread_mutex_destroy(&(t->shard[i].lock));
+  }
+  free(t);
+}
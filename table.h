@@ -0,0 +1,88 @@
+/**
+  * @brief sharded table of the inbound preferences received by a controller
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_TABLE_H
+#define RPP_TABLE_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include "revdns.h"
+
+/* preferences kept per prefix at most, longer preflists are truncated */
+#define RPPTABLE_MAXPREFS 16
+
+/** @brief the preferences of a prefix */
+struct rpptableprefs {
+  int count;
+  unsigned int asn[RPPTABLE_MAXPREFS];
+  unsigned char weight[RPPTABLE_MAXPREFS];
+};
+
+/** @brief table of preferences by prefix (opaque). it is split in shards
+  * that are updated independently, and lookups never take any lock: they
+  * run concurrently with updates, and retry if one got in their way */
+struct rpptable;
+
+/** @brief creates an empty table
+  * @return a new table, or NULL on error */
+struct rpptable *rpptable_new(void);
+
+/** @brief sets the preferences of a prefix, replacing any previous ones
+  * @param expiry the time at which the preferences expire
+  * @return 0 on success, non-zero otherwise */
+int rpptable_set(struct rpptable *t, const struct rppprefix *pfx, const struct rpptableprefs *prefs, time_t expiry);
+
+/** @brief removes the preferences of a prefix, if any */
+void rpptable_unset(struct rpptable *t, const struct rppprefix *pfx);
+
+/** @brief looks up the preferences of exactly pfx
+  * @param now the current time, preferences that expired by then are ignored
+  * @param *expiry filled with the time the preferences expire
+  * @return 0 on success, non-zero if pfx has no (valid) preferences */
+int rpptable_get(const struct rpptable *t, const struct rppprefix *pfx, time_t now, struct rpptableprefs *prefs, time_t *expiry);
+
+/** @brief removes all the preferences that expired by now, one shard at a
+  * time
+  * @return the number of prefixes removed */
+unsigned long rpptable_expire(struct rpptable *t, time_t now);
+
+/** @brief returns the number of prefixes in the table, including those that
+  * expired but were not removed yet */
+unsigned long rpptable_count(const struct rpptable *t);
+
+/** @brief writes all valid preferences to fd, one prefix per line:
+  * prefix<TAB>ttl<TAB>preflist
+  * @return 0 on success, non-zero otherwise */
+int rpptable_dump(const struct rpptable *t, FILE *fd, time_t now);
+
+/** @brief frees a table - no lookup may be in progress */
+void rpptable_free(struct rpptable *t);
+
+#endif
@@ -0,0 +1,461 @@
+/**
+  * @brief unit tests of the data structures and parsers, run by make check
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "mrt.h"
+#include "proto.h"
+#include "radix.h"
+#include "revdns.h"
+#include "sched.h"
+
+/* counts a failed check, and tells where it is */
+#define CHECK(c) check((c), #c, __LINE__)
+
+static int failures;
+
+
+static void check(int ok, const char *what, int line) {
+  if (ok) return;
+  printf("unittest.c:%d: FAILED: %s\n", line, what);
+  failures++;
+}
+
+
+/* parses a prefix, that the tests always give valid */
+static struct rppprefix pfx(const char *s) {
+  struct rppprefix p;
+  if (rppprefix_parse(&p, s) != 0) {
+    printf("invalid test prefix %s\n", s);
+    exit(1);
+  }
+  return(p);
+}
+
+
+static void test_radix(void) {
+  struct rppradix *t = rppradix_new();
+  struct rppprefix p;
+  const char *addr;
+  int len, i;
+  time_t now = time(NULL);
+
+  CHECK(t != NULL);
+  p = pfx("10.0.0.0/8");
+  CHECK(rppradix_insert(t, &p, "192.0.2.8", now + 60) == 0);
+  p = pfx("10.1.0.0/16");
+  CHECK(rppradix_insert(t, &p, "192.0.2.16", now + 60) == 0);
+  p = pfx("10.2.0.0/16");
+  CHECK(rppradix_insert(t, &p, "192.0.2.99", now - 1) == 0); /* expired */
+  p = pfx("2001:db8::/32");
+  CHECK(rppradix_insert(t, &p, "2001:db8::1", now + 60) == 0);
+
+  /* the longest valid prefix wins, within the family looked up */
+  p = pfx("10.1.2.0/24");
+  addr = rppradix_lookup(t, &p, now, &len);
+  CHECK((addr != NULL) && (strcmp(addr, "192.0.2.16") == 0) && (len == 16));
+  p = pfx("10.2.2.0/24");
+  addr = rppradix_lookup(t, &p, now, &len);
+  CHECK((addr != NULL) && (strcmp(addr, "192.0.2.8") == 0) && (len == 8));
+  p = pfx("11.0.0.0/24");
+  CHECK(rppradix_lookup(t, &p, now, NULL) == NULL);
+  p = pfx("2001:db8:1::/48");
+  addr = rppradix_lookup(t, &p, now, NULL);
+  CHECK((addr != NULL) && (strcmp(addr, "2001:db8::1") == 0));
+  p = pfx("10.0.0.0/4");
+  CHECK(rppradix_lookup(t, &p, now, NULL) == NULL);
+
+  /* lookups mark prefixes hot, once */
+  p = pfx("10.1.0.0/16");
+  CHECK(rppradix_hot(t, &p) != 0);
+  CHECK(rppradix_hot(t, &p) == 0);
+
+  /* replacing, then removing */
+  CHECK(rppradix_insert(t, &p, "192.0.2.17", now + 60) == 0);
+  p = pfx("10.1.2.0/24");
+  addr = rppradix_lookup(t, &p, now, NULL);
+  CHECK((addr != NULL) && (strcmp(addr, "192.0.2.17") == 0));
+  p = pfx("10.1.0.0/16");
+  CHECK(rppradix_remove(t, &p) == 0);
+  CHECK(rppradix_remove(t, &p) != 0);
+  p = pfx("10.1.2.0/24");
+  addr = rppradix_lookup(t, &p, now, &len);
+  CHECK((addr != NULL) && (len == 8));
+  p = pfx("10.0.0.0/8");
+  CHECK(rppradix_remove(t, &p) == 0);
+  p = pfx("10.1.2.0/24");
+  CHECK(rppradix_lookup(t, &p, now, NULL) == NULL);
+
+  /* prefixes that come and go, the remaining ones are still found */
+  for (i = 0; i < 256; i++) {
+    char s[32];
+    sprintf(s, "172.%d.%d.0/24", i & 15, i);
+    p = pfx(s);
+    CHECK(rppradix_insert(t, &p, s, now + 60) == 0);
+  }
+  for (i = 0; i < 256; i += 2) {
+    char s[32];
+    sprintf(s, "172.%d.%d.0/24", i & 15, i);
+    p = pfx(s);
+    CHECK(rppradix_remove(t, &p) == 0);
+  }
+  for (i = 0; i < 256; i++) {
+    char s[32];
+    sprintf(s, "172.%d.%d.0/24", i & 15, i);
+    p = pfx(s);
+    addr = rppradix_lookup(t, &p, now, NULL);
+    CHECK((i & 1) ? ((addr != NULL) && (strcmp(addr, s) == 0)) : (addr == NULL));
+  }
+  rppradix_free(t);
+}
+
+
+static void test_sched(void) {
+  struct rppsched *s = rppsched_new();
+  char *job;
+  size_t len;
+
+  CHECK(s != NULL);
+  CHECK(rppsched_waittime(s, 0) == -1);
+  CHECK(rppsched_pop(s, 1000, &len) == NULL);
+  CHECK(rppsched_add(s, 300, "c", 1, "job c", 5) == 0);
+  CHECK(rppsched_add(s, 100, "a", 1, "job a", 5) == 0);
+  CHECK(rppsched_add(s, 200, "b", 1, "job b", 5) == 0);
+  CHECK(rppsched_count(s) == 3);
+  CHECK(rppsched_waittime(s, 40) == 60);
+  CHECK(rppsched_waittime(s, 150) == 0);
+
+  /* a job of the same key replaces the previous one, due time included */
+  CHECK(rppsched_add(s, 400, "a", 1, "job a2", 6) == 0);
+  CHECK(rppsched_count(s) == 3);
+  CHECK(rppsched_pop(s, 150, &len) == NULL);
+
+  /* jobs come out in the order they are due, nul-terminated */
+  job = rppsched_pop(s, 1000, &len);
+  CHECK((job != NULL) && (len == 5) && (strcmp(job, "job b") == 0));
+  free(job);
+  job = rppsched_pop(s, 1000, &len);
+  CHECK((job != NULL) && (strcmp(job, "job c") == 0));
+  free(job);
+  job = rppsched_pop(s, 1000, &len);
+  CHECK((job != NULL) && (len == 6) && (strcmp(job, "job a2") == 0));
+  free(job);
+  CHECK(rppsched_count(s) == 0);
+  CHECK(rppsched_pop(s, 1000, &len) == NULL);
+
+  /* a job can be scheduled again once it got out */
+  CHECK(rppsched_add(s, 500, "a", 1, "job a3", 6) == 0);
+  CHECK(rppsched_count(s) == 1);
+  rppsched_free(s);
+}
+
+
+/* writes len bytes to a new file */
+static int writefile(const char *fname, const void *data, size_t len) {
+  FILE *fd = fopen(fname, "w");
+  int res = 0;
+  if (fd == NULL) return(-1);
+  if (fwrite(data, 1, len, fd) != len) res = -1;
+  if (fclose(fd) != 0) res = -1;
+  return(res);
+}
+
+
+static void test_cache(const char *dir) {
+  struct rppcache *c, *c2;
+  struct rppprefix z, p;
+  char fname[256], addr[64], *buf;
+  time_t now = time(NULL);
+  FILE *fd;
+  long sz;
+  int len;
+
+  sprintf(fname, "%s/cache", dir);
+  c = rppcache_new();
+  CHECK(c != NULL);
+  z = pfx("198.51.100.0/24");
+  CHECK(rppcache_put(c, &z, 0, "192.0.2.1", now + 60) == 0);
+  z = pfx("203.0.113.0/24");
+  CHECK(rppcache_put(c, &z, 1, "", now + 60) == 0);
+  z = pfx("192.0.2.0/24");
+  CHECK(rppcache_put(c, &z, 0, "192.0.2.2", now - 1) == 0); /* expired */
+  CHECK(rppcache_put(c, &z, 2, "", now + 60) != 0); /* not a status to cache */
+
+  /* a missing file is an empty cache */
+  CHECK(rppcache_load(c, fname) == 0);
+  CHECK(rppcache_save(c, fname) == 0);
+  rppcache_free(c);
+
+  /* the snapshot has the valid entries */
+  c2 = rppcache_new();
+  CHECK(rppcache_load(c2, fname) == 0);
+  z = pfx("198.51.100.0/24");
+  CHECK((rppcache_get(c2, &z, addr, sizeof(addr), now) == 0) && (strcmp(addr, "192.0.2.1") == 0));
+  z = pfx("203.0.113.0/24");
+  CHECK(rppcache_get(c2, &z, addr, sizeof(addr), now) == 1);
+  z = pfx("192.0.2.0/24");
+  CHECK(rppcache_get(c2, &z, addr, sizeof(addr), now) == -1);
+  p = pfx("198.51.100.128/25");
+  CHECK((rppcache_lpm(c2, &p, addr, sizeof(addr), now, &len) == 0) && (len == 24) && (strcmp(addr, "192.0.2.1") == 0));
+  /* entries of the cache override those of the snapshot */
+  z = pfx("198.51.100.0/24");
+  CHECK(rppcache_put(c2, &z, 1, "", now + 60) == 0);
+  CHECK(rppcache_get(c2, &z, addr, sizeof(addr), now) == 1);
+  rppcache_free(c2);
+
+  /* anything but a snapshot is rejected */
+  c = rppcache_new();
+  CHECK(writefile(fname, "9999999999\t0\t100.51.198.in-addr.arpa\t192.0.2.1\n", 46) == 0);
+  errno = 0;
+  CHECK((rppcache_load(c, fname) != 0) && (errno == EINVAL));
+  CHECK(writefile(fname, "", 0) == 0);
+  CHECK(rppcache_load(c, fname) != 0);
+
+  /* and so are snapshots cut short, or that do not fit their header */
+  c2 = rppcache_new();
+  z = pfx("198.51.100.0/24");
+  CHECK(rppcache_put(c2, &z, 0, "192.0.2.1", now + 60) == 0);
+  CHECK(rppcache_save(c2, fname) == 0);
+  rppcache_free(c2);
+  fd = fopen(fname, "r");
+  CHECK(fd != NULL);
+  if (fd == NULL) return;
+  fseek(fd, 0, SEEK_END);
+  sz = ftell(fd);
+  rewind(fd);
+  buf = malloc(sz);
+  CHECK((buf != NULL) && (fread(buf, 1, sz, fd) == (size_t)sz));
+  fclose(fd);
+  if (buf == NULL) return;
+  CHECK(writefile(fname, buf, sz - 1) == 0);
+  errno = 0;
+  CHECK((rppcache_load(c, fname) != 0) && (errno == EINVAL));
+  buf[8] ^= 0xff; /* version */
+  CHECK(writefile(fname, buf, sz) == 0);
+  CHECK(rppcache_load(c, fname) != 0);
+  z = pfx("198.51.100.0/24");
+  CHECK(rppcache_get(c, &z, addr, sizeof(addr), now) == -1);
+  free(buf);
+  unlink(fname);
+  rppcache_free(c);
+}
+
+
+/* appends an MRT record of the given type and subtype to buf */
+static size_t mrt_record(unsigned char *buf, int type, int subtype, const unsigned char *body, size_t bodylen) {
+  memset(buf, 0, 12);
+  buf[5] = type;
+  buf[7] = subtype;
+  buf[8] = (bodylen >> 24) & 0xff;
+  buf[9] = (bodylen >> 16) & 0xff;
+  buf[10] = (bodylen >> 8) & 0xff;
+  buf[11] = bodylen & 0xff;
+  memcpy(buf + 12, body, bodylen);
+  return(12 + bodylen);
+}
+
+
+/* appends a TABLE_DUMP_V2 RIB record of prefix p (without entries) */
+static size_t mrt_rib(unsigned char *buf, const char *p) {
+  struct rppprefix x = pfx(p);
+  unsigned char body[32];
+  memset(body, 0, sizeof(body));
+  body[4] = x.len;
+  memcpy(body + 5, x.addr, (x.len + 7) >> 3);
+  /* no entries: the entry count (2 bytes) is 0 */
+  return(mrt_record(buf, 13, (x.family == AF_INET6) ? 4 : 2, body, 5 + ((x.len + 7) >> 3) + 2));
+}
+
+
+static void test_mrt(const char *dir) {
+  static const char *order[] = {"10.0.0.0/8", "10.1.0.0/16", "192.0.2.0/24", "198.51.100.0/24", "2001:db8::/32", "2001:db8:1::/48"};
+  unsigned char dump[4096], body[32];
+  struct rppprefix *pfxs;
+  unsigned long count, i;
+  char fname[256];
+  size_t len = 0;
+  int threads;
+
+  sprintf(fname, "%s/dump.mrt", dir);
+  /* a peer index table, that carries no prefix */
+  memset(body, 0, sizeof(body));
+  len += mrt_record(dump + len, 13, 1, body, 8);
+  len += mrt_rib(dump + len, "198.51.100.0/24");
+  len += mrt_rib(dump + len, "2001:db8:1::/48");
+  len += mrt_rib(dump + len, "10.1.0.0/16");
+  len += mrt_rib(dump + len, "10.0.0.0/8");
+  len += mrt_rib(dump + len, "198.51.100.0/24");
+  len += mrt_rib(dump + len, "2001:db8::/32");
+  /* a TABLE_DUMP record: view, sequence, the whole address, length */
+  memset(body, 0, sizeof(body));
+  body[4] = 192;
+  body[6] = 2;
+  body[8] = 24;
+  len += mrt_record(dump + len, 12, 1, body, 22);
+  len += mrt_rib(dump + len, "10.1.0.0/16");
+  CHECK(writefile(fname, dump, len) == 0);
+
+  /* sorted and deduplicated, whatever the number of threads */
+  for (threads = 1; threads <= 4; threads++) {
+    pfxs = rppmrt_load(fname, threads, &count);
+    CHECK((pfxs != NULL) && (count == 6));
+    for (i = 0; (pfxs != NULL) && (i < count) && (i < 6); i++) {
+      struct rppprefix x = pfx(order[i]);
+      CHECK((pfxs[i].family == x.family) && (pfxs[i].len == x.len) && (memcmp(pfxs[i].addr, x.addr, sizeof(x.addr)) == 0));
+    }
+    free(pfxs);
+  }
+
+  /* a record cut short, or a prefix longer than its family allows */
+  CHECK(writefile(fname, dump, len - 3) == 0);
+  errno = 0;
+  CHECK((rppmrt_load(fname, 2, &count) == NULL) && (errno == EINVAL));
+  memset(body, 0, sizeof(body));
+  body[4] = 33;
+  len = mrt_record(dump, 13, 2, body, 5 + 5 + 2);
+  CHECK(writefile(fname, dump, len) == 0);
+  errno = 0;
+  CHECK((rppmrt_load(fname, 1, &count) == NULL) && (errno == EINVAL));
+
+  /* an empty dump has no prefix */
+  CHECK(writefile(fname, "", 0) == 0);
+  pfxs = rppmrt_load(fname, 1, &count);
+  CHECK((pfxs != NULL) && (count == 0));
+  free(pfxs);
+  unlink(fname);
+}
+
+
+/* stores a 32-bit number in network byte order */
+static void put32(unsigned char *p, unsigned long v) {
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+
+static void test_proto(void) {
+  static const char *text = "SETINPREF 3600\t192.0.2.0/24 2001:db8::/32\t64552:0 64900:255\r\nGETINPREF 192.0.2.0/24\nHELLO\n";
+  struct rppprotomsg m;
+  struct rppprefix p;
+  unsigned char frame[64];
+  unsigned long asn;
+  size_t pos, flen;
+  long len, off = 0;
+  int weight, n;
+
+  /* text commands, one line each */
+  len = rppproto_parse(&m, (const unsigned char *)text, strlen(text), 1024);
+  CHECK((len == (long)strlen("SETINPREF 3600\t192.0.2.0/24 2001:db8::/32\t64552:0 64900:255\r\n")) && (m.cmd == RPPPROTO_SETINPREF) && (m.ttl == 3600) && (m.binary == 0));
+  for (pos = 0, n = 0; rppproto_nextprefix(&m, &pos, &p) == 1; n++);
+  CHECK(n == 2);
+  pos = 0;
+  CHECK((rppproto_nextpref(&m, &pos, &asn, &weight) == 1) && (asn == 64552) && (weight == 0));
+  CHECK((rppproto_nextpref(&m, &pos, &asn, &weight) == 1) && (asn == 64900) && (weight == 255));
+  CHECK(rppproto_nextpref(&m, &pos, &asn, &weight) == 0);
+  off += len;
+  len = rppproto_parse(&m, (const unsigned char *)text + off, strlen(text) - off, 1024);
+  CHECK((len == 23) && (m.cmd == RPPPROTO_GETINPREF) && (m.loclen == 12));
+  off += len;
+  len = rppproto_parse(&m, (const unsigned char *)text + off, strlen(text) - off, 1024);
+  CHECK((len == 6) && (m.cmd == 0)); /* unknown, left to skip */
+
+  /* incomplete, too long and malformed lines */
+  CHECK(rppproto_parse(&m, (const unsigned char *)"SETINPREF 36", 12, 1024) == 0);
+  CHECK(rppproto_parse(&m, (const unsigned char *)"SETINPREF 36", 12, 8) == -1);
+  CHECK(rppproto_parse(&m, (const unsigned char *)"SETINPREF x\ta\tb\n", 16, 1024) == -1);
+  CHECK(rppproto_parse(&m, (const unsigned char *)"SETINPREF 60\tab\n", 16, 1024) == -1);
+
+  /* a binary frame: header, ttl, one IPv4 prefix, one preference */
+  memset(frame, 0, sizeof(frame));
+  frame[1] = RPP_BINVERSION;
+  frame[2] = RPP_BINSETINPREF;
+  flen = RPP_BINHDRSZ;
+  put32(frame + flen, 600);
+  put32(frame + flen + 4, 1);
+  flen += 8;
+  frame[flen++] = 4;
+  frame[flen++] = 24;
+  frame[flen++] = 192;
+  frame[flen++] = 0;
+  frame[flen++] = 2;
+  put32(frame + flen, 1);
+  put32(frame + flen + 4, 65001);
+  frame[flen + 8] = 127;
+  flen += 9;
+  put32(frame + 4, flen - RPP_BINHDRSZ);
+  len = rppproto_parse(&m, frame, flen, 1024);
+  CHECK((len == (long)flen) && (m.cmd == RPPPROTO_SETINPREF) && (m.binary != 0) && (m.ttl == 600));
+  pos = 0;
+  CHECK((rppproto_nextprefix(&m, &pos, &p) == 1) && (p.family == AF_INET) && (p.len == 24) && (p.addr[0] == 192) && (p.addr[2] == 2));
+  CHECK(rppproto_nextprefix(&m, &pos, &p) == 0);
+  pos = 0;
+  CHECK((rppproto_nextpref(&m, &pos, &asn, &weight) == 1) && (asn == 65001) && (weight == 127));
+  CHECK(rppproto_nextpref(&m, &pos, &asn, &weight) == 0);
+
+  /* frames come in pieces, and must hold what they announce */
+  CHECK(rppproto_parse(&m, frame, RPP_BINHDRSZ - 1, 1024) == 0);
+  CHECK(rppproto_parse(&m, frame, flen - 1, 1024) == 0);
+  CHECK(rppproto_parse(&m, frame, flen, flen - 1) == -1);
+  put32(frame + RPP_BINHDRSZ + 4, 2); /* two prefixes announced, one given */
+  CHECK(rppproto_parse(&m, frame, flen, 1024) == -1);
+  put32(frame + RPP_BINHDRSZ + 4, 1);
+  frame[1] = RPP_BINVERSION + 1;
+  CHECK(rppproto_parse(&m, frame, flen, 1024) == -1);
+}
+
+
+int main(void) {
+  char dir[] = "/tmp/rpptest.XXXXXX";
+
+  if (mkdtemp(dir) == NULL) {
+    printf("failed to create a temporary directory (%s)\n", strerror(errno));
+    return(1);
+  }
+  test_radix();
+  test_sched();
+  test_cache(dir);
+  test_mrt(dir);
+  test_proto();
+  rmdir(dir);
+  if (failures != 0) {
+    printf("%d checks FAILED\n", failures);
+    return(1);
+  }
+  printf("all checks passed\n");
+  return(0);
+}
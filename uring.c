@@ -0,0 +1,227 @@
+/**
+  * @brief minimal io_uring submission and completion rings
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+/* operations the engines submit, checked for with IORING_REGISTER_PROBE */
+static const int ops_needed[] = {IORING_OP_SEND, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_CONNECT, IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL};
+
+struct rppuring {
+  int fd;
+  unsigned int entries;
+  unsigned int *sqhead;    /* consumed by the kernel */
+  unsigned int *sqtail;    /* published to the kernel */
+  unsigned int sqmask;
+  unsigned int sqlocal;    /* tail of the entries prepared, published on submission */
+  struct io_uring_sqe *sqes;
+  unsigned int *cqhead;
+  unsigned int *cqtail;
+  unsigned int cqmask;
+  struct io_uring_cqe *cqes;
+  void *sqring;
+  size_t sqringsz;
+  void *cqring;            /* same as sqring if the kernel maps both at once */
+  size_t cqringsz;
+  size_t sqesz;
+};
+
+
+#ifdef __NR_io_uring_setup
+
+/* checks that the kernel supports all the operations needed */
+static int probe(int fd) {
+  struct io_uring_probe *p;
+  size_t i;
+  int res = 0;
+  p = calloc(1, sizeof(*p) + 256 * sizeof(p->ops[0]));
+  if (p == NULL) return(-1);
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, p, 256) < 0) res = -1;
+  for (i = 0; (res == 0) && (i < sizeof(ops_needed) / sizeof(ops_needed[0])); i++) {
+    if ((ops_needed[i] > p->last_op) || ((p->ops[ops_needed[i]].flags & IO_URING_OP_SUPPORTED) == 0)) res = -1;
+  }
+  free(p);
+  return(res);
+}
+
+
+struct rppuring *rppuring_new(unsigned int entries) {
+  struct io_uring_params params;
+  struct rppuring *u;
+  unsigned int i, *sqarray;
+
+  u = calloc(1, sizeof(*u));
+  if (u == NULL) return(NULL);
+  memset(&params, 0, sizeof(params));
+  u->fd = syscall(__NR_io_uring_setup, entries, &params);
+  /* completions must never be dropped, and entries are consumed by the
+   * kernel as soon as they are submitted */
+  if ((u->fd < 0) || ((params.features & (IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE)) != (IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE)) || (probe(u->fd) != 0)) {
+    if (u->fd >= 0) close(u->fd);
+    free(u);
+    return(NULL);
+  }
+  u->entries = params.sq_entries;
+  u->sqringsz = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  u->cqringsz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) && (u->cqringsz > u->sqringsz)) u->sqringsz = u->cqringsz;
+  u->sqring = mmap(NULL, u->sqringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sqring == MAP_FAILED) u->sqring = NULL;
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    u->cqring = u->sqring;
+  } else if (u->sqring != NULL) {
+    u->cqring = mmap(NULL, u->cqringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cqring == MAP_FAILED) u->cqring = NULL;
+  }
+  u->sqesz = params.sq_entries * sizeof(struct io_uring_sqe);
+  if (u->cqring != NULL) {
+    u->sqes = mmap(NULL, u->sqesz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) u->sqes = NULL;
+  }
+  if (u->sqes == NULL) {
+    rppuring_free(u);
+    return(NULL);
+  }
+
+  u->sqhead = (unsigned int *)((char *)u->sqring + params.sq_off.head);
+  u->sqtail = (unsigned int *)((char *)u->sqring + params.sq_off.tail);
+  u->sqmask = *(unsigned int *)((char *)u->sqring + params.sq_off.ring_mask);
+  u->sqlocal = *(u->sqtail);
+  u->cqhead = (unsigned int *)((char *)u->cqring + params.cq_off.head);
+  u->cqtail = (unsigned int *)((char *)u->cqring + params.cq_off.tail);
+  u->cqmask = *(unsigned int *)((char *)u->cqring + params.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)((char *)u->cqring + params.cq_off.cqes);
+  /* entries are always used in order, the indirection array maps each
+   * slot to itself once for all */
+  sqarray = (unsigned int *)((char *)u->sqring + params.sq_off.array);
+  for (i = 0; i < params.sq_entries; i++) sqarray[i] = i;
+  return(u);
+}
+
+
+int rppuring_reserve(struct rppuring *u, unsigned int n) {
+  if (u->sqlocal - __atomic_load_n(u->sqhead, __ATOMIC_ACQUIRE) + n <= u->entries) return(0);
+  rppuring_submit(u);
+  if (u->sqlocal - __atomic_load_n(u->sqhead, __ATOMIC_ACQUIRE) + n <= u->entries) return(0);
+  return(-1);
+}
+
+
+struct io_uring_sqe *rppuring_sqe(struct rppuring *u, int opcode, int fd, void *data) {
+  struct io_uring_sqe *sqe;
+  if (rppuring_reserve(u, 1) != 0) return(NULL);
+  sqe = &(u->sqes[u->sqlocal & u->sqmask]);
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = (unsigned long)data;
+  u->sqlocal++;
+  return(sqe);
+}
+
+
+int rppuring_submit(struct rppuring *u) {
+  /* entries left over by a submission that failed are submitted again */
+  unsigned int pending = u->sqlocal - __atomic_load_n(u->sqhead, __ATOMIC_ACQUIRE);
+  long res;
+  if (pending == 0) return(0);
+  __atomic_store_n(u->sqtail, u->sqlocal, __ATOMIC_RELEASE);
+  do {
+    res = syscall(__NR_io_uring_enter, u->fd, pending, 0, 0, NULL, 0);
+  } while ((res < 0) && (errno == EINTR));
+  return(res);
+}
+
+
+int rppuring_cqe(struct rppuring *u, void **data, int *res) {
+  unsigned int head = *(u->cqhead);
+  struct io_uring_cqe *cqe;
+  if (head == __atomic_load_n(u->cqtail, __ATOMIC_ACQUIRE)) return(0);
+  cqe = &(u->cqes[head & u->cqmask]);
+  *data = (void *)(unsigned long)cqe->user_data;
+  *res = cqe->res;
+  __atomic_store_n(u->cqhead, head + 1, __ATOMIC_RELEASE);
+  return(1);
+}
+
+#else /* no io_uring in the system headers */
+
+struct rppuring *rppuring_new(unsigned int entries) {
+  (void)entries;
+  return(NULL);
+}
+
+int rppuring_reserve(struct rppuring *u, unsigned int n) {
+  (void)u;
+  (void)n;
+  return(-1);
+}
+
+struct io_uring_sqe *rppuring_sqe(struct rppuring *u, int opcode, int fd, void *data) {
+  (void)u;
+  (void)opcode;
+  (void)fd;
+  (void)data;
+  return(NULL);
+}
+
+int rppuring_submit(struct rppuring *u) {
+  (void)u;
+  return(-1);
+}
+
+int rppuring_cqe(struct rppuring *u, void **data, int *res) {
+  (void)u;
+  (void)data;
+  (void)res;
+  return(0);
+}
+
+#endif
+
+
+int rppuring_fd(const struct rppuring *u) {
+  return(u->fd);
+}
+
+
+void rppuring_free(struct rppuring *u) {
+  if (u == NULL) return;
+  if (u->sqes != NULL) munmap(u->sqes, u->sqesz);
+  if ((u->cqring != NULL) && (u->cqring != u->sqring)) munmap(u->cqring, u->cqringsz);
+  if (u->sqring != NULL) munmap(u->sqring, u->sqringsz);
+  close(u->fd);
+  free(u);
+}
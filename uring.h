@@ -0,0 +1,77 @@
+/**
+  * @brief minimal io_uring submission and completion rings
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_URING_H
+#define RPP_URING_H
+
+#include <linux/io_uring.h>
+
+/** @brief an io_uring instance, driven through raw system calls (opaque) */
+struct rppuring;
+
+/** @brief sets up an io_uring instance - the kernel must support all the
+  * operations the engines use: SEND, RECV, SENDMSG, CONNECT, LINK_TIMEOUT
+  * and ASYNC_CANCEL
+  * @param entries the size of the submission queue, the completion queue
+  * being twice as large
+  * @return a new instance, or NULL if io_uring is not available */
+struct rppuring *rppuring_new(unsigned int entries);
+
+/** @brief makes sure n submission queue entries may be taken by
+  * rppuring_sqe() in a row (such as an operation and its linked timeout),
+  * submitting the entries prepared so far if needed
+  * @return 0 on success, non-zero if the queue stays full */
+int rppuring_reserve(struct rppuring *u, unsigned int n);
+
+/** @brief takes the next submission queue entry, zeroed - it is submitted
+  * with the next rppuring_submit()
+  * @param *data the user data of the entry, reported along with its completion
+  * @return the entry, or NULL if the queue is full */
+struct io_uring_sqe *rppuring_sqe(struct rppuring *u, int opcode, int fd, void *data);
+
+/** @brief submits all the entries prepared, in a single system call and
+  * without waiting for any completion
+  * @return the number of entries submitted, negative value on error */
+int rppuring_submit(struct rppuring *u);
+
+/** @brief takes the next completion, if any
+  * @param **data filled with the user data of the entry that completed
+  * @param *res filled with the result of the operation (-errno on failure)
+  * @return 1 if a completion was taken, 0 if none is pending */
+int rppuring_cqe(struct rppuring *u, void **data, int *res);
+
+/** @brief returns a file descriptor that becomes readable when completions
+  * are pending, to be watched by poll() or epoll */
+int rppuring_fd(const struct rppuring *u);
+
+/** @brief tears an instance down - the kernel cancels the operations still
+  * in flight */
+void rppuring_free(struct rppuring *u);
+
+#endif
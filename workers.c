@@ -0,0 +1,421 @@
+/**
+  * @brief batch processing spread over several worker threads
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "adv.h"
+#include "batch.h"
+#include "cache.h"
+#include "workers.h"
+
+/* largest window of requests between the reader and the writer */
+#define MAXWINDOW (1lu << 18)
+
+/* room for a formatted result line */
+#define MAXOUT 1024
+
+/* a request of the window, from the moment it is read until its result is
+ * written out */
+struct slot {
+  char *line;       /* the request line, as read from the input */
+  size_t linesz;
+  ssize_t linelen;
+  char *out;        /* its result, formatted by a worker */
+  int outlen;
+  int ready;        /* set once out is complete, under the lock */
+};
+
+/* bounded lock-free multi-producer multi-consumer queue of request numbers
+ * (D. Vyukov's design): every cell carries a sequence that tells whether it
+ * is free for the producer of a given position, or filled for its consumer */
+struct mpmccell {
+  unsigned long seq;
+  unsigned long val;
+};
+
+struct mpmcq {
+  struct mpmccell *cells;
+  unsigned long mask;
+  unsigned long head;   /* next position to consume */
+  char pad[64];         /* keeps producers and consumers on separate cache lines */
+  unsigned long tail;   /* next position to produce */
+};
+
+struct workers {
+  struct slot *slots;   /* the window, request n lives in slots[n & mask] */
+  unsigned long mask;
+  struct mpmcq queue;   /* requests read but not taken by any worker yet */
+  int itemsfd;          /* semaphore eventfd, one token per queued request */
+  int donefd;           /* eventfd, readable once the input is exhausted */
+  int eof;              /* set (atomically) once the input is exhausted */
+  sem_t room;           /* free slots in the window */
+  pthread_mutex_t lock; /* protects the fields below, and slot readiness */
+  pthread_cond_t cond;  /* signalled when the next result to write is ready */
+  unsigned long next;   /* next request whose result is to be written */
+  unsigned long total;  /* number of requests read, known once inputdone is set */
+  int inputdone;
+  int syncinit;         /* set once the semaphore, lock and condition are initialized */
+  const struct rppprefix *pfxs; /* the prefixes to process, if not read from the input */
+  unsigned long count;  /* number of prefixes, only looked at by the reader */
+};
+
+struct worker {
+  struct workers *w;
+  pthread_t tid;
+  struct rppbatch *b;
+  struct rppqueue *q;
+  unsigned long *fifo;  /* numbers of the requests in q, oldest first */
+  int fifosz;
+  int fifohead;
+  int fifocount;
+};
+
+
+static int mpmc_init(struct mpmcq *q, unsigned long size) {
+  unsigned long i;
+  memset(q, 0, sizeof(*q));
+  q->cells = malloc(size * sizeof(*(q->cells)));
+  if (q->cells == NULL) return(-1);
+  for (i = 0; i < size; i++) q->cells[i].seq = i;
+  q->mask = size - 1;
+  return(0);
+}
+
+
+/* returns 0 on success, -1 if the queue is full */
+static int mpmc_push(struct mpmcq *q, unsigned long val) {
+  struct mpmccell *cell;
+  unsigned long pos, seq;
+  long diff;
+  pos = __atomic_load_n(&(q->tail), __ATOMIC_RELAXED);
+  for (;;) {
+    cell = &(q->cells[pos & q->mask]);
+    seq = __atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE);
+    diff = (long)(seq - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&(q->tail), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if (diff < 0) {
+      return(-1);
+    } else {
+      pos = __atomic_load_n(&(q->tail), __ATOMIC_RELAXED);
+    }
+  }
+  cell->val = val;
+  __atomic_store_n(&(cell->seq), pos + 1, __ATOMIC_RELEASE);
+  return(0);
+}
+
+
+/* returns 0 on success, -1 if the queue is empty */
+static int mpmc_pop(struct mpmcq *q, unsigned long *val) {
+  struct mpmccell *cell;
+  unsigned long pos, seq;
+  long diff;
+  pos = __atomic_load_n(&(q->head), __ATOMIC_RELAXED);
+  for (;;) {
+    cell = &(q->cells[pos & q->mask]);
+    seq = __atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE);
+    diff = (long)(seq - (pos + 1));
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&(q->head), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if (diff < 0) {
+      return(-1);
+    } else {
+      pos = __atomic_load_n(&(q->head), __ATOMIC_RELAXED);
+    }
+  }
+  *val = cell->val;
+  __atomic_store_n(&(cell->seq), pos + q->mask + 1, __ATOMIC_RELEASE);
+  return(0);
+}
+
+
+/* takes the next queued request, if any - returns 0 on success */
+static int workers_take(struct workers *w, unsigned long *seq) {
+  uint64_t token;
+  if (read(w->itemsfd, &token, sizeof(token)) != sizeof(token)) return(-1);
+  /* holding a token guarantees that a request is there for us, but its
+   * producer may not have completed the push yet */
+  while (mpmc_pop(&(w->queue), seq) != 0) sched_yield();
+  return(0);
+}
+
+
+/* marks the result of a request as ready to be written */
+static void workers_publish(struct workers *w, unsigned long seq) {
+  pthread_mutex_lock(&(w->lock));
+  w->slots[seq & w->mask].ready = 1;
+  if (seq == w->next) pthread_cond_signal(&(w->cond));
+  pthread_mutex_unlock(&(w->lock));
+}
+
+
+static void *worker_main(void *arg) {
+  struct worker *wk = arg;
+  struct workers *w = wk->w;
+  struct pollfd pfd[RPPBATCH_NFDS + 2];
+  struct slot *s;
+  unsigned long seq;
+  int n, done, popped;
+
+  for (;;) {
+    /* must be read before taking requests: once the input is exhausted,
+     * failing to take one means that there are none left */
+    done = __atomic_load_n(&(w->eof), __ATOMIC_ACQUIRE);
+
+    /* take new requests as long as the engine and the fifo have room for
+     * them */
+    while ((wk->fifocount < wk->fifosz) && (rppqueue_ready(wk->q) != 0) && (workers_take(w, &seq) == 0)) {
+      s = &(w->slots[seq & w->mask]);
+      if (((w->pfxs != NULL) ? rppqueue_submitprefix(wk->q, &(w->pfxs[seq])) : rppqueue_submit(wk->q, s->line, s->linelen)) == 0) {
+        wk->fifo[(wk->fifohead + wk->fifocount) % wk->fifosz] = seq;
+        wk->fifocount++;
+      } else { /* empty line or comment, that produces no output */
+        s->outlen = 0;
+        workers_publish(w, seq);
+      }
+    }
+
+    /* hand completed results over to the writer */
+    popped = 0;
+    while (wk->fifocount > 0) {
+      s = &(w->slots[wk->fifo[wk->fifohead] & w->mask]);
+      s->outlen = rppqueue_pop(wk->q, s->out, MAXOUT);
+      if (s->outlen == 0) break;
+      workers_publish(w, wk->fifo[wk->fifohead]);
+      wk->fifohead = (wk->fifohead + 1) % wk->fifosz;
+      wk->fifocount--;
+      popped++;
+    }
+
+    /* requests that completed made room for new ones */
+    if (popped != 0) continue;
+
+    if ((wk->fifocount == 0) && (done != 0)) break;
+
+    /* wait for the engine, for new requests if there is room for them, and
+     * for the end of the input if there is nothing else to wait for */
+    n = rppbatch_pollfds(wk->b, pfd);
+    if ((wk->fifocount < wk->fifosz) && (rppqueue_ready(wk->q) != 0)) {
+      pfd[n].fd = w->itemsfd;
+      pfd[n++].events = POLLIN;
+    }
+    if (wk->fifocount == 0) {
+      pfd[n].fd = w->donefd;
+      pfd[n++].events = POLLIN;
+    }
+    poll(pfd, n, rppbatch_waittime(wk->b));
+    rppbatch_run(wk->b);
+  }
+
+  return(NULL);
+}
+
+
+/* writes results out in the order of the requests, and makes room in the
+ * window for new ones */
+static void *writer_main(void *arg) {
+  struct workers *w = arg;
+  struct slot *s;
+
+  pthread_mutex_lock(&(w->lock));
+  for (;;) {
+    s = &(w->slots[w->next & w->mask]);
+    /* results written so far go out before waiting for the next one */
+    if (s->ready == 0) {
+      pthread_mutex_unlock(&(w->lock));
+      fflush(stdout);
+      pthread_mutex_lock(&(w->lock));
+    }
+    while ((s->ready == 0) && ((w->inputdone == 0) || (w->next != w->total))) {
+      pthread_cond_wait(&(w->cond), &(w->lock));
+    }
+    if (s->ready == 0) break;
+    pthread_mutex_unlock(&(w->lock));
+    if (s->outlen > 0) fwrite(s->out, 1, s->outlen, stdout);
+    pthread_mutex_lock(&(w->lock));
+    s->ready = 0;
+    w->next++;
+    sem_post(&(w->room));
+  }
+  pthread_mutex_unlock(&(w->lock));
+  fflush(stdout);
+  return(NULL);
+}
+
+
+/* reads requests and queues them for the workers, until the input (or the
+ * array of prefixes) is exhausted - a NULL fd with no prefixes left reads
+ * nothing, and just stops everything. returns 0 on success, -2 on read
+ * failure */
+static int workers_read(struct workers *w, FILE *fd) {
+  unsigned long seq;
+  uint64_t token = 1;
+  struct slot *s;
+  int res = 0;
+
+  for (seq = 0; (fd != NULL) || ((w->pfxs != NULL) && (seq < w->count)); seq++) {
+    while (sem_wait(&(w->room)) != 0) {
+      if (errno != EINTR) break;
+    }
+    s = &(w->slots[seq & w->mask]);
+    if ((s->out == NULL) && ((s->out = malloc(MAXOUT)) == NULL)) {
+      res = -2;
+      break;
+    }
+    if (w->pfxs == NULL) s->linelen = getline(&(s->line), &(s->linesz), fd);
+    if ((w->pfxs == NULL) && (s->linelen < 0)) {
+      if (ferror(fd)) res = -2;
+      break;
+    }
+    /* the window is never larger than the queue, so there is always room */
+    mpmc_push(&(w->queue), seq);
+    if (write(w->itemsfd, &token, sizeof(token)) != sizeof(token)) {
+      res = -2;
+      break;
+    }
+  }
+
+  /* let the writer know when to stop, then the workers */
+  pthread_mutex_lock(&(w->lock));
+  w->total = seq;
+  w->inputdone = 1;
+  pthread_cond_signal(&(w->cond));
+  pthread_mutex_unlock(&(w->lock));
+  __atomic_store_n(&(w->eof), 1, __ATOMIC_RELEASE);
+  if (write(w->donefd, &token, sizeof(token)) != sizeof(token)) res = -1;
+  return(res);
+}
+
+
+/* frees whatever got allocated of the workers and their shared context */
+static void workers_free(struct workers *w, struct worker *wk, int threads) {
+  unsigned long i;
+  for (i = 0; i < (unsigned long)threads; i++) {
+    rppqueue_free(wk[i].q);
+    rppbatch_free(wk[i].b);
+    free(wk[i].fifo);
+  }
+  if (w->syncinit != 0) {
+    pthread_cond_destroy(&(w->cond));
+    pthread_mutex_destroy(&(w->lock));
+    sem_destroy(&(w->room));
+  }
+  for (i = 0; (w->slots != NULL) && (i <= w->mask); i++) {
+    free(w->slots[i].line);
+    free(w->slots[i].out);
+  }
+  free(w->slots);
+  free(w->queue.cells);
+  if (w->itemsfd >= 0) close(w->itemsfd);
+  if (w->donefd >= 0) close(w->donefd);
+}
+
+
+int rppworkers_batch(FILE *fd, const struct rppprefix *pfxs, unsigned long count, const struct rppopts *opts, struct rppcache *cache, struct rppmsg *defmsg, int threads, struct rppstats *stats) {
+  struct workers w;
+  struct worker wk[RPPWORKERS_MAX];
+  struct rppopts wopts;
+  pthread_t writer;
+  unsigned long window, size;
+  int i, started, ok = 0, err = 0, res = -1;
+
+  if ((threads < 1) || (threads > RPPWORKERS_MAX)) return(-1);
+
+  memset(&w, 0, sizeof(w));
+  memset(wk, 0, sizeof(wk));
+  w.pfxs = pfxs;
+  w.count = count;
+  w.itemsfd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+  w.donefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ok = ((w.itemsfd >= 0) && (w.donefd >= 0));
+
+  /* every worker gets its own engine, and its share of the rate caps */
+  wopts = *opts;
+  if (wopts.qps > 0) wopts.qps = (wopts.qps + threads - 1) / threads;
+  if (wopts.advrate > 0) wopts.advrate = (wopts.advrate + threads - 1) / threads;
+  window = 0;
+  for (i = 0; (ok != 0) && (i < threads); i++) {
+    wk[i].w = &w;
+    wk[i].b = rppbatch_new(&wopts, cache, NULL);
+    wk[i].q = (wk[i].b != NULL) ? rppqueue_new(wk[i].b, defmsg) : NULL;
+    /* the fifo follows every request of the queue, complete ones included */
+    wk[i].fifosz = (wk[i].q != NULL) ? rppqueue_size(wk[i].q) : 0;
+    wk[i].fifo = (wk[i].q != NULL) ? malloc(wk[i].fifosz * sizeof(*(wk[i].fifo))) : NULL;
+    if ((wk[i].fifo == NULL) || (wk[i].q == NULL)) ok = 0;
+    window += wk[i].fifosz;
+  }
+
+  /* the window is large enough to fill the queues of all the workers */
+  for (size = 64; (size < MAXWINDOW) && (size < window * 2); size *= 2);
+  window = size;
+  w.slots = calloc(window, sizeof(*(w.slots)));
+  w.mask = window - 1;
+  if ((ok != 0) && (w.slots != NULL) && (mpmc_init(&(w.queue), window) == 0) && (sem_init(&(w.room), 0, window) == 0)) {
+    pthread_mutex_init(&(w.lock), NULL);
+    pthread_cond_init(&(w.cond), NULL);
+    w.syncinit = 1;
+  } else {
+    ok = 0;
+  }
+
+  if ((ok != 0) && (pthread_create(&writer, NULL, writer_main, &w) == 0)) {
+    for (started = 0; started < threads; started++) {
+      if (pthread_create(&(wk[started].tid), NULL, worker_main, &(wk[started])) != 0) break;
+    }
+    /* if not all workers could be started, the input is not even read */
+    if (started == threads) {
+      res = workers_read(&w, fd);
+      err = errno;
+    } else {
+      w.count = 0;
+      workers_read(&w, NULL);
+    }
+    for (i = 0; i < started; i++) pthread_join(wk[i].tid, NULL);
+    pthread_join(writer, NULL);
+  }
+  for (i = 0; (stats != NULL) && (i < threads); i++) {
+    if (wk[i].b != NULL) rppstats_merge(stats, rppbatch_stats(wk[i].b));
+  }
+
+  workers_free(&w, wk, threads);
+  errno = err;
+  return(res);
+}
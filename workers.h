@@ -0,0 +1,58 @@
+/**
+  * @brief batch processing spread over several worker threads
+  *
+  * @author Mateusz Viste
+  * @copyright Copyright (C) 2016, Border 6 S.A.S, All rights reserved.
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions are met:
+  *
+  * - Redistributions of source code must retain the above copyright notice,
+  *   this list of conditions and the following disclaimer.
+  *
+  * - Redistributions in binary form must reproduce the above copyright notice,
+  *   this list of conditions and the following disclaimer in the documentation
+  *   and/or other materials provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  * POSSIBILITY OF SUCH DAMAGE.
+  */
+
+#ifndef RPP_WORKERS_H
+#define RPP_WORKERS_H
+
+#include <stdio.h>
+
+#include "adv.h"
+#include "batch.h"
+#include "cache.h"
+
+/** @brief maximum number of worker threads */
+#define RPPWORKERS_MAX 64
+
+/** @brief processes request lines read from a stream, like the 'batch'
+  * action does, with several worker threads. every worker runs its own
+  * engine (with its own resolver state and up to opts->inflight requests in
+  * progress), requests are dispatched to whichever worker has room, and a
+  * single writer outputs the results in the order of the requests.
+  * @param *fd the stream to read requests from, if pfxs is NULL
+  * @param *pfxs the prefixes to process instead, if not NULL
+  * @param count the number of prefixes in pfxs
+  * @param *opts engine options, that apply to every worker
+  * @param *cache cache of already resolved controllers, shared by all workers
+  * @param *defmsg preferences advertised for requests that carry none, if any
+  * @param threads the number of worker threads (1 to RPPWORKERS_MAX)
+  * @param *stats what the engines of the workers went through gets added to it, if not NULL
+  * @return 0 on success, -1 if the workers could not be set up, -2 if reading the input failed (errno is set) */
+int rppworkers_batch(FILE *fd, const struct rppprefix *pfxs, unsigned long count, const struct rppopts *opts, struct rppcache *cache, struct rppmsg *defmsg, int threads, struct rppstats *stats);
+
+#endif